@@ -2,36 +2,55 @@
 
 // Global variables for lighting calculations
 uniform vec3 viewPos;
-uniform vec3 lightPos;
-uniform vec3 lightColor;
-uniform vec3 ks;
-uniform vec3 kd;
-uniform float shininess;
+
+// The lights shaded in this pass, see LightBlock in main.cpp. The single pass
+// path fills it with up to MAX_LIGHTS lights, the multi pass path with one.
+#define MAX_LIGHTS 256
+layout(std140) uniform lightBuffer {
+    int lightCount;
+    vec4 lightPositions[MAX_LIGHTS];
+    vec4 lightColors[MAX_LIGHTS];
+};
+
+// The surface being lit, from the mesh in forward_surface.glsl or from the
+// G-buffer in deferred_surface.glsl
+vec3 surfacePosition();
+vec3 surfaceNormal();
+vec3 surfaceKd();
+vec3 surfaceKs();
+float surfaceShininess();
 
 // Output for on-screen color
 out vec4 outColor;
 
-// Interpolated output data from vertex shader
-in vec3 fragPos; // World-space position
-in vec3 fragNormal; // World-space normal
-
 void main()
 {
-    vec3 normal = normalize(fragNormal);
+    vec3 fragPos = surfacePosition();
+    vec3 fragNormal = surfaceNormal();
+    vec3 kd = surfaceKd();
+    vec3 ks = surfaceKs();
+    float shininess = surfaceShininess();
 
-    vec3 lightDir = normalize(lightPos - fragPos);
+    vec3 normal = normalize(fragNormal);
 
     vec3 viewDir = normalize(viewPos - fragPos);
 
-    vec3 halfDir = normalize(lightDir + viewDir);
+    vec3 finalColor = vec3(0.0);
+    for (int i = 0; i < lightCount; i++)
+    {
+        vec3 lightColor = lightColors[i].rgb;
+        vec3 lightDir = normalize(lightPositions[i].xyz - fragPos);
+
+        vec3 halfDir = normalize(lightDir + viewDir);
 
-    float diff = max(dot(normal, lightDir), 0.0);
-    vec3 diffuse = diff * kd * lightColor;
+        float diff = max(dot(normal, lightDir), 0.0);
+        vec3 diffuse = diff * kd * lightColor;
 
-    float specAngle = max(dot(normal, halfDir), 0.0);
-    float specularStrength = pow(specAngle, shininess);
-    vec3 specular = specularStrength * lightColor * ks;
+        float specAngle = max(dot(normal, halfDir), 0.0);
+        float specularStrength = pow(specAngle, shininess);
+        vec3 specular = specularStrength * lightColor * ks;
 
-    vec3 finalColor = diffuse + specular;
+        finalColor += diffuse + specular;
+    }
     outColor = vec4(finalColor, 1.0);
 }
\ No newline at end of file
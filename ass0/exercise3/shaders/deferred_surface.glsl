@@ -0,0 +1,52 @@
+#version 410
+
+// The surface a shading shader lights in a deferred light pass, read from the
+// G-buffer written by gbuffer_frag.glsl at the pixel of the fragment. Pixels
+// the mesh does not cover are discarded. The depth of the G-buffer is written
+// as the depth of the fragment, so the depth buffer holds the mesh as if it
+// was drawn directly. The shading shaders always call surfacePosition(), which
+// does both.
+
+uniform sampler2D gbufferKd;
+uniform sampler2D gbufferKs;
+uniform sampler2D gbufferNormal;
+uniform sampler2D gbufferDepth;
+uniform mat4 inverseViewProjection;
+
+float surfaceDepth()
+{
+    float depth = texelFetch(gbufferDepth, ivec2(gl_FragCoord.xy), 0).r;
+    if (depth == 1.0)
+        discard;
+    gl_FragDepth = depth;
+    return depth;
+}
+
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+vec3 surfacePosition()
+{
+    vec2 uv = gl_FragCoord.xy / vec2(textureSize(gbufferDepth, 0));
+    vec4 world = inverseViewProjection * vec4(vec3(uv, surfaceDepth()) * 2.0 - 1.0, 1.0);
+    return world.xyz / world.w;
+}
+
+vec3 surfaceNormal()
+{
+    return decodeOctahedral(texelFetch(gbufferNormal, ivec2(gl_FragCoord.xy), 0).rg * 2.0 - 1.0);
+}
+
+vec3 surfaceKd() { return texelFetch(gbufferKd, ivec2(gl_FragCoord.xy), 0).rgb; }
+vec3 surfaceKs() { return texelFetch(gbufferKs, ivec2(gl_FragCoord.xy), 0).rgb; }
+
+float surfaceShininess()
+{
+    float encoded = texelFetch(gbufferKd, ivec2(gl_FragCoord.xy), 0).a;
+    return encoded * encoded * 128.0;
+}
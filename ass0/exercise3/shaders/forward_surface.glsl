@@ -0,0 +1,21 @@
+#version 410
+
+// The surface a shading shader lights when the mesh is drawn directly: the
+// interpolated vertex data and the material uniforms. deferred_surface.glsl
+// provides the same functions from the G-buffer, the shading shaders are
+// linked with either.
+
+// Material of the mesh
+uniform vec3 kd;
+uniform vec3 ks;
+uniform float shininess;
+
+// Interpolated output data from vertex shader
+in vec3 fragPos;     // World-space position
+in vec3 fragNormal;  // World-space normal
+
+vec3 surfacePosition() { return fragPos; }
+vec3 surfaceNormal() { return fragNormal; }
+vec3 surfaceKd() { return kd; }
+vec3 surfaceKs() { return ks; }
+float surfaceShininess() { return shininess; }
@@ -0,0 +1,9 @@
+#version 410
+
+// One triangle covering the screen, drawn with glDrawArrays(GL_TRIANGLES, 0, 3)
+// without vertex attributes
+void main()
+{
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
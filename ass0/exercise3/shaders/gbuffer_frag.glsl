@@ -0,0 +1,32 @@
+#version 410
+
+// Material of the mesh
+uniform vec3 kd;
+uniform vec3 ks;
+uniform float shininess;
+
+// Interpolated output data from vertex shader
+in vec3 fragPos;     // World-space position
+in vec3 fragNormal;  // World-space normal
+
+// The G-buffer, see deferred_surface.glsl for how it is read. The shininess is
+// stored as the square root of shininess / 128 so low exponents keep their
+// precision in 8 bits.
+layout(location = 0) out vec4 gbufferKd; // kd, encoded shininess
+layout(location = 1) out vec4 gbufferKs; // ks
+layout(location = 2) out vec2 gbufferNormal; // octahedral normal in [0, 1]
+
+// Maps a unit vector onto the octahedron and unfolds it to a square in [-1, 1]
+vec2 encodeOctahedral(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 folded = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return n.z >= 0.0 ? n.xy : folded;
+}
+
+void main()
+{
+    gbufferKd = vec4(kd, sqrt(clamp(shininess / 128.0, 0.0, 1.0)));
+    gbufferKs = vec4(ks, 1.0);
+    gbufferNormal = encodeOctahedral(normalize(fragNormal)) * 0.5 + 0.5;
+}
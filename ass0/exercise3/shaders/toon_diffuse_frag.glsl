@@ -1,28 +1,47 @@
 #version 410
 
 // Global variables for lighting calculations
-uniform vec3 lightColor;
-uniform vec3 kd;
-uniform vec3 lightPos;
 uniform int toonDiscretize;
 
+// The lights shaded in this pass, see LightBlock in main.cpp. The single pass
+// path fills it with up to MAX_LIGHTS lights, the multi pass path with one.
+#define MAX_LIGHTS 256
+layout(std140) uniform lightBuffer {
+    int lightCount;
+    vec4 lightPositions[MAX_LIGHTS];
+    vec4 lightColors[MAX_LIGHTS];
+};
+
+// The surface being lit, from the mesh in forward_surface.glsl or from the
+// G-buffer in deferred_surface.glsl
+vec3 surfacePosition();
+vec3 surfaceNormal();
+vec3 surfaceKd();
+vec3 surfaceKs();
+float surfaceShininess();
+
 // Output for on-screen color
 out vec4 outColor;
 
-// Interpolated output data from vertex shader
-in vec3 fragPos; // World-space position
-in vec3 fragNormal; // World-space normal
-
 void main()
 {
+    vec3 fragPos = surfacePosition();
+    vec3 fragNormal = surfaceNormal();
+    vec3 kd = surfaceKd();
+
     vec3 normal = normalize(fragNormal);
-    vec3 lightDir = normalize(lightPos - fragPos);
 
-    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 diffuse = vec3(0.0);
+    for (int i = 0; i < lightCount; i++)
+    {
+        vec3 lightDir = normalize(lightPositions[i].xyz - fragPos);
+
+        float diff = max(dot(normal, lightDir), 0.0);
 
-    diff = floor(diff * toonDiscretize)/toonDiscretize;
+        diff = floor(diff * toonDiscretize)/toonDiscretize;
 
-    vec3 diffuse = diff * kd * lightColor;
+        diffuse += diff * kd * lightColors[i].rgb;
+    }
 
     outColor = vec4(diffuse, 1.0);
 }
@@ -1,37 +1,56 @@
 #version 410
 
-in vec3 fragNormal;
-in vec3 fragPos;
-
-uniform vec3 lightPos;
 uniform vec3 viewPos;
 
 uniform sampler2D texToon;
-uniform vec3 kd;
-uniform vec3 ks;
-uniform float shininess;
+
+// The lights shaded in this pass, see LightBlock in main.cpp. The single pass
+// path fills it with up to MAX_LIGHTS lights, the multi pass path with one.
+#define MAX_LIGHTS 256
+layout(std140) uniform lightBuffer {
+    int lightCount;
+    vec4 lightPositions[MAX_LIGHTS];
+    vec4 lightColors[MAX_LIGHTS];
+};
+
+// The surface being lit, from the mesh in forward_surface.glsl or from the
+// G-buffer in deferred_surface.glsl
+vec3 surfacePosition();
+vec3 surfaceNormal();
+vec3 surfaceKd();
+vec3 surfaceKs();
+float surfaceShininess();
 
 out vec4 outColor;
 
 void main()
 {
+    vec3 fragPos = surfacePosition();
+    vec3 fragNormal = surfaceNormal();
+    vec3 kd = surfaceKd();
+    vec3 ks = surfaceKs();
+    float shininess = surfaceShininess();
+
     vec3 normal = normalize(fragNormal);
-    vec3 lightDir = normalize(lightPos - fragPos);
     vec3 viewDir = normalize(viewPos - fragPos);
 
+    vec3 resultColor = vec3(0.0);
+    for (int i = 0; i < lightCount; i++)
+    {
+        vec3 lightDir = normalize(lightPositions[i].xyz - fragPos);
 
-    float diff = max(dot(normal, lightDir), 0.0);
-
-    vec3 halfwayDir = normalize(lightDir + viewDir);
-    float specAngle = max(dot(normal, halfwayDir), 0.0);
-    float spec = pow(specAngle, shininess);
+        float diff = max(dot(normal, lightDir), 0.0);
 
+        vec3 halfwayDir = normalize(lightDir + viewDir);
+        float specAngle = max(dot(normal, halfwayDir), 0.0);
+        float spec = pow(specAngle, shininess);
 
-    vec3 diffuseColor = texture(texToon, vec2(diff, 0.0)).rgb;
+        vec3 diffuseColor = texture(texToon, vec2(diff, 0.0)).rgb;
 
-    vec3 specular = spec * lightPos * ks;
+        vec3 specular = spec * lightColors[i].rgb * ks;
 
-    vec3 resultColor = diffuseColor * kd + specular;
+        resultColor += diffuseColor * kd + specular;
+    }
 
     // Output the final color
     outColor = vec4(resultColor, 1.0);
@@ -0,0 +1,37 @@
+#pragma once
+// Disable compiler warnings in third-party code (which we cannot change).
+#include <framework/disable_all_warnings.h>
+#include <framework/opengl_includes.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/shader.h>
+
+// The G-buffer of the deferred path, written by gbuffer_frag.glsl and read by
+// deferred_surface.glsl. Every pixel stores the material and normal of the
+// surface in 12 bytes: kd and the encoded shininess in RGBA8, ks in RGBA8 and
+// an octahedral normal in RG16. The position is reconstructed from the depth.
+class GBuffer {
+public:
+  GBuffer() = default;
+  GBuffer(const GBuffer &) = delete;
+  GBuffer &operator=(const GBuffer &) = delete;
+  ~GBuffer();
+
+  // Binds the framebuffer for the geometry pass, recreating the textures when
+  // the size changed
+  void bindForWriting(const glm::ivec2 &size);
+  // Binds the textures to four texture units from firstUnit on and sets the
+  // uniforms of deferred_surface.glsl
+  void bindTextures(const Shader &shader, GLint firstUnit,
+                    const glm::mat4 &viewProjection) const;
+
+private:
+  void resize(const glm::ivec2 &size);
+
+  GLuint m_framebuffer = 0;
+  GLuint m_kdTexture = 0, m_ksTexture = 0, m_normalTexture = 0;
+  GLuint m_depthTexture = 0;
+  glm::ivec2 m_size{0};
+};
@@ -16,7 +16,10 @@ DISABLE_WARNINGS_POP()
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <cstdint>
 #include <cstdlib> // EXIT_FAILURE
+#include "gbuffer.h"
+#include "program_cache.h"
 #include <framework/mesh.h>
 #include <framework/shader.h>
 #include <framework/trackball.h>
@@ -27,6 +30,7 @@ DISABLE_WARNINGS_POP()
 #include <iostream>
 #include <numeric>
 #include <optional>
+#include <random>
 #include <span>
 #include <toml/toml.hpp>
 #include <vector>
@@ -68,6 +72,30 @@ struct Light {
 std::vector<Light> lights{};
 size_t selectedLightIndex = 0;
 
+// The lightBuffer uniform block of the shading shaders, in std140 layout
+constexpr int maxLightsPerPass = 256;
+struct LightBlock {
+  int32_t lightCount;
+  int32_t padding[3];
+  glm::vec4 lightPositions[maxLightsPerPass];
+  glm::vec4 lightColors[maxLightsPerPass];
+};
+
+// Shade all lights in one draw per shading model (in batches of
+// maxLightsPerPass), or draw the mesh again for every light
+bool singlePassLighting = true;
+// Draw the mesh once into the G-buffer and shade it in fullscreen passes,
+// instead of drawing the mesh for every shading pass
+bool deferredShading = false;
+// GPU time of the depth prepass or G-buffer pass plus the shading passes,
+// smoothed over frames, indexed by renderPath(). The times of the paths not in
+// use are kept so they can be compared.
+std::array<float, 4> renderTimeMs{};
+
+size_t renderPath(bool deferred, bool singlePass) {
+  return (deferred ? 2 : 0) + (singlePass ? 1 : 0);
+}
+
 static glm::vec3 userInteractionSphere(const glm::vec3 &selectedPos,
                                        const glm::vec3 &camPos) {
   // RETURN the new light position, defined as follows.
@@ -191,6 +219,27 @@ void imgui() {
   if (ImGui::Button("Reset Lights")) {
     resetLights();
   }
+  ImGui::SameLine();
+  if (ImGui::Button("Add 16 Random Lights")) {
+    static std::mt19937 rng{1};
+    std::uniform_real_distribution<float> position(-1.5f, 1.5f);
+    std::uniform_real_distribution<float> color(0.0f, 0.2f);
+    for (int i = 0; i < 16; i++) {
+      lights.push_back(
+          Light{glm::vec3(position(rng), position(rng), position(rng)),
+                glm::vec3(color(rng), color(rng), color(rng))});
+    }
+  }
+
+  ImGui::Checkbox("Single-pass lighting", &singlePassLighting);
+  ImGui::Checkbox("Deferred shading", &deferredShading);
+  ImGui::Text("%zu lights, rendering takes", lights.size());
+  ImGui::Text("  forward: %.2f ms single-pass, %.2f ms multi-pass",
+              renderTimeMs[renderPath(false, true)],
+              renderTimeMs[renderPath(false, false)]);
+  ImGui::Text("  deferred: %.2f ms single-pass, %.2f ms multi-pass",
+              renderTimeMs[renderPath(true, true)],
+              renderTimeMs[renderPath(true, false)]);
 
   // Dropdown for interaction mode
   std::array interactionModeNames{"Shadow", "Sphere", "Specular"};
@@ -477,49 +526,52 @@ int main(int argc, char **argv) {
   });
 
   const Shader lightShader =
-      ShaderBuilder()
+      CachedShaderBuilder()
           .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/light_vertex.glsl")
           .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/light_frag.glsl")
           .build();
   const Shader debugShader =
-      ShaderBuilder()
+      CachedShaderBuilder()
           .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
           .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/debug_frag.glsl")
           .build();
-  const Shader lambertShader =
-      ShaderBuilder()
-          .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
-          .addStage(GL_FRAGMENT_SHADER,
-                    RESOURCE_ROOT "shaders/lambert_frag.glsl")
-          .build();
-  const Shader phongShader =
-      ShaderBuilder()
-          .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
-          .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/phong_frag.glsl")
-          .build();
-  const Shader blinnPhongShader =
-      ShaderBuilder()
-          .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
-          .addStage(GL_FRAGMENT_SHADER,
-                    RESOURCE_ROOT "shaders/blinn_phong_frag.glsl")
-          .build();
-  const Shader toonDiffuseShader =
-      ShaderBuilder()
+  const Shader gbufferShader =
+      CachedShaderBuilder()
           .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
           .addStage(GL_FRAGMENT_SHADER,
-                    RESOURCE_ROOT "shaders/toon_diffuse_frag.glsl")
-          .build();
-  const Shader toonSpecularShader =
-      ShaderBuilder()
-          .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
-          .addStage(GL_FRAGMENT_SHADER,
-                    RESOURCE_ROOT "shaders/toon_specular_frag.glsl")
-          .build();
-  const Shader xToonShader =
-      ShaderBuilder()
-          .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
-          .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/xtoon_frag.glsl")
+                    RESOURCE_ROOT "shaders/gbuffer_frag.glsl")
           .build();
+  // Every shading model is linked twice: with forward_surface.glsl to shade the
+  // mesh while it is drawn, and with deferred_surface.glsl to shade the
+  // G-buffer in a fullscreen pass
+  const auto buildShadingShaders = [](const char *fragmentShader) {
+    return std::array<Shader, 2>{
+        CachedShaderBuilder()
+            .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
+            .addStage(GL_FRAGMENT_SHADER, fragmentShader)
+            .addStage(GL_FRAGMENT_SHADER,
+                      RESOURCE_ROOT "shaders/forward_surface.glsl")
+            .build(),
+        CachedShaderBuilder()
+            .addStage(GL_VERTEX_SHADER,
+                      RESOURCE_ROOT "shaders/fullscreen_vertex.glsl")
+            .addStage(GL_FRAGMENT_SHADER, fragmentShader)
+            .addStage(GL_FRAGMENT_SHADER,
+                      RESOURCE_ROOT "shaders/deferred_surface.glsl")
+            .build()};
+  };
+  const auto lambertShaders =
+      buildShadingShaders(RESOURCE_ROOT "shaders/lambert_frag.glsl");
+  const auto phongShaders =
+      buildShadingShaders(RESOURCE_ROOT "shaders/phong_frag.glsl");
+  const auto blinnPhongShaders =
+      buildShadingShaders(RESOURCE_ROOT "shaders/blinn_phong_frag.glsl");
+  const auto toonDiffuseShaders =
+      buildShadingShaders(RESOURCE_ROOT "shaders/toon_diffuse_frag.glsl");
+  const auto toonSpecularShaders =
+      buildShadingShaders(RESOURCE_ROOT "shaders/toon_specular_frag.glsl");
+  const auto xToonShaders =
+      buildShadingShaders(RESOURCE_ROOT "shaders/xtoon_frag.glsl");
 
   // Create Vertex Buffer Object and Index Buffer Objects.
   GLuint vbo;
@@ -563,6 +615,12 @@ int main(int argc, char **argv) {
 
   glBindVertexArray(0);
 
+  // The fullscreen triangle of the deferred shading passes has no vertex
+  // attributes, but drawing needs a vertex array object bound
+  GLuint fullscreenVao;
+  glGenVertexArrays(1, &fullscreenVao);
+  GBuffer gbuffer;
+
   // Load image from disk to CPU memory.
   int width, height,
       sourceNumChannels; // Number of channels in source image. pixels will
@@ -589,6 +647,42 @@ int main(int argc, char **argv) {
   // Free the CPU memory after we copied the image to the GPU.
   stbi_image_free(pixels);
 
+  // Uniform buffer with the lights of a shading pass
+  GLuint lightUbo;
+  glGenBuffers(1, &lightUbo);
+  glBindBuffer(GL_UNIFORM_BUFFER, lightUbo);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlock), nullptr, GL_STREAM_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  LightBlock lightBlock{};
+  auto uploadLights = [&](size_t first, size_t count) {
+    lightBlock.lightCount = static_cast<int32_t>(count);
+    for (size_t i = 0; i < count; i++) {
+      lightBlock.lightPositions[i] = glm::vec4(lights[first + i].position, 1.0f);
+      lightBlock.lightColors[i] = glm::vec4(lights[first + i].color, 1.0f);
+    }
+    // Orphan the old contents, a draw may still read them. Only the count and
+    // the lights in use are uploaded.
+    glBindBuffer(GL_UNIFORM_BUFFER, lightUbo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlock), nullptr,
+                 GL_STREAM_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0,
+                    static_cast<GLsizeiptr>(offsetof(LightBlock, lightPositions) +
+                                            count * sizeof(glm::vec4)),
+                    &lightBlock);
+    glBufferSubData(GL_UNIFORM_BUFFER, offsetof(LightBlock, lightColors),
+                    static_cast<GLsizeiptr>(count * sizeof(glm::vec4)),
+                    lightBlock.lightColors);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  };
+
+  // Timer queries of the rendering of the mesh, the result of a frame is read
+  // in a later frame so the CPU never waits for the GPU
+  std::array<GLuint, 2> shadingQueries;
+  std::array<bool, 2> shadingQueryPending{false, false};
+  std::array<size_t, 2> shadingQueryPath{0, 0};
+  glGenQueries(2, shadingQueries.data());
+  size_t frameIndex = 0;
+
   // Enable depth testing.
   glEnable(GL_DEPTH_TEST);
 
@@ -645,22 +739,87 @@ int main(int argc, char **argv) {
     };
 
     if (!debug) {
-      // Draw mesh into depth buffer but disable color writes.
-      glDepthMask(GL_TRUE);
-      glDepthFunc(GL_LEQUAL);
-      glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-      debugShader.bind();
-      render(debugShader);
+      // Read the render time of an earlier frame if the GPU is done with it,
+      // a query still waiting for its result is not reused
+      const size_t query = frameIndex++ % shadingQueries.size();
+      if (shadingQueryPending[query]) {
+        GLint available = 0;
+        glGetQueryObjectiv(shadingQueries[query], GL_QUERY_RESULT_AVAILABLE,
+                           &available);
+        if (available) {
+          GLuint64 elapsedNs = 0;
+          glGetQueryObjectui64v(shadingQueries[query], GL_QUERY_RESULT,
+                                &elapsedNs);
+          float &timeMs = renderTimeMs[shadingQueryPath[query]];
+          timeMs = 0.9f * timeMs + 0.1f * static_cast<float>(elapsedNs) * 1e-6f;
+          shadingQueryPending[query] = false;
+        }
+      }
+      const bool timeQuery = !shadingQueryPending[query];
+      if (timeQuery) {
+        glBeginQuery(GL_TIME_ELAPSED, shadingQueries[query]);
+      }
 
-      // Draw the mesh again for each light / shading model.
-      glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE); // Enable color writes.
-      glDepthMask(GL_FALSE);                           // Disable depth writes.
-      glDepthFunc(GL_EQUAL); // Only draw a pixel if it's depth matches the
-                             // value stored in the depth buffer.
-      glEnable(GL_BLEND);    // Enable blending.
+      if (deferredShading) {
+        // Draw the mesh once into the G-buffer, its depth takes the place of
+        // the depth prepass.
+        gbuffer.bindForWriting(window.getWindowSize());
+        glClear(GL_DEPTH_BUFFER_BIT);
+        gbufferShader.bind();
+        glUniform3fv(gbufferShader.getUniformLocation("kd"), 1,
+                     glm::value_ptr(shadingData.kd));
+        glUniform3fv(gbufferShader.getUniformLocation("ks"), 1,
+                     glm::value_ptr(shadingData.ks));
+        glUniform1f(gbufferShader.getUniformLocation("shininess"),
+                    shadingData.shininess);
+        render(gbufferShader);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, window.getWindowSize().x, window.getWindowSize().y);
+
+        // The shading passes cover the screen and write the depth of the
+        // G-buffer, so the depth buffer holds the mesh for the light markers.
+        glDepthFunc(GL_ALWAYS);
+      } else {
+        // Draw mesh into depth buffer but disable color writes.
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LEQUAL);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        debugShader.bind();
+        render(debugShader);
+
+        // Draw the mesh again for each light / shading model.
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE); // Enable color writes.
+        glDepthMask(GL_FALSE); // Disable depth writes.
+        glDepthFunc(GL_EQUAL); // Only draw a pixel if it's depth matches the
+                               // value stored in the depth buffer.
+      }
+      glEnable(GL_BLEND);                // Enable blending.
       glBlendFunc(GL_SRC_ALPHA, GL_ONE); // Additive blending.
 
-      for (const Light &light : lights) {
+      const size_t variant = deferredShading ? 1 : 0;
+      const Shader &lambertShader = lambertShaders[variant];
+      const Shader &phongShader = phongShaders[variant];
+      const Shader &blinnPhongShader = blinnPhongShaders[variant];
+      const Shader &toonDiffuseShader = toonDiffuseShaders[variant];
+      const Shader &toonSpecularShader = toonSpecularShaders[variant];
+      const Shader &xToonShader = xToonShaders[variant];
+
+      // Draws a shading pass over the mesh, or over the G-buffer with a
+      // fullscreen triangle
+      auto shade = [&](const Shader &shader) {
+        if (!deferredShading) {
+          render(shader);
+          return;
+        }
+        renderedSomething = true;
+        gbuffer.bindTextures(shader, 1, projection * view);
+        glBindVertexArray(fullscreenVao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+      };
+
+      // Shades the lights in the uniform buffer with the enabled models
+      auto shadeLights = [&]() {
         renderedSomething = false;
         if (!renderedSomething) {
           if (toonxLighting) {
@@ -671,12 +830,9 @@ int main(int argc, char **argv) {
             // light, shadingData and cameraPos and texToon.
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, texToon);
-            glUniform3fv(xToonShader.getUniformLocation("lightPos"), 1,
-                         glm::value_ptr(lights[selectedLightIndex].position));
             glUniform3fv(xToonShader.getUniformLocation("viewPos"), 1,
                          glm::value_ptr(cameraPos));
-            glUniform3fv(xToonShader.getUniformLocation("lightColor"), 1,
-                         glm::value_ptr(lights[selectedLightIndex].color));
+            xToonShader.bindUniformBlock("lightBuffer", 0, lightUbo);
             glUniform3fv(xToonShader.getUniformLocation("kd"), 1,
                          glm::value_ptr(shadingData.kd));
             glUniform3fv(xToonShader.getUniformLocation("ks"), 1,
@@ -684,7 +840,7 @@ int main(int argc, char **argv) {
             glUniform1f(xToonShader.getUniformLocation("shininess"),
                         shadingData.shininess);
 
-            render(xToonShader);
+            shade(xToonShader);
           } else {
             if (toonLightingDiffuse) {
               toonDiffuseShader.bind();
@@ -692,16 +848,13 @@ int main(int argc, char **argv) {
               // === SET YOUR DIFFUSE TOON UNIFORMS HERE ===
               // Values that you may want to pass to the shader are stored in
               // light, shadingData.
-              glUniform3fv(toonDiffuseShader.getUniformLocation("lightPos"), 1,
-                           glm::value_ptr(lights[selectedLightIndex].position));
-              glUniform3fv(toonDiffuseShader.getUniformLocation("lightColor"),
-                           1, glm::value_ptr(lights[selectedLightIndex].color));
+              toonDiffuseShader.bindUniformBlock("lightBuffer", 0, lightUbo);
               glUniform3fv(toonDiffuseShader.getUniformLocation("kd"), 1,
                            glm::value_ptr(shadingData.kd));
               glUniform1i(
                   toonDiffuseShader.getUniformLocation("toonDiscretize"),
                   shadingData.toonDiscretize);
-              render(toonDiffuseShader);
+              shade(toonDiffuseShader);
             }
             if (toonLightingSpecular) {
               toonSpecularShader.bind();
@@ -709,12 +862,9 @@ int main(int argc, char **argv) {
               // === SET YOUR SPECULAR TOON UNIFORMS HERE ===
               // Values that you may want to pass to the shader are stored in
               // light, shadingData and cameraPos.
-              glUniform3fv(toonSpecularShader.getUniformLocation("lightPos"), 1,
-                           glm::value_ptr(lights[selectedLightIndex].position));
               glUniform3fv(toonSpecularShader.getUniformLocation("viewPos"), 1,
                            glm::value_ptr(cameraPos));
-              glUniform3fv(toonSpecularShader.getUniformLocation("lightColor"),
-                           1, glm::value_ptr(lights[selectedLightIndex].color));
+              toonSpecularShader.bindUniformBlock("lightBuffer", 0, lightUbo);
               glUniform3fv(toonSpecularShader.getUniformLocation("ks"), 1,
                            glm::value_ptr(shadingData.ks));
               glUniform1f(toonSpecularShader.getUniformLocation("shininess"),
@@ -722,7 +872,7 @@ int main(int argc, char **argv) {
               // glUniform1f(toonSpecularShader.getUniformLocation(
               //                 "toonSpecularThreshold"),
               //             shadingData.toonSpecularThreshold);
-              render(toonSpecularShader);
+              shade(toonSpecularShader);
             }
           }
         }
@@ -732,13 +882,10 @@ int main(int argc, char **argv) {
             // === SET YOUR LAMBERT UNIFORMS HERE ===
             // Values that you may want to pass to the shader include
             // light.position, light.color and shadingData.kd.
-            glUniform3fv(lambertShader.getUniformLocation("lightPos"), 1,
-                         glm::value_ptr(lights[selectedLightIndex].position));
-            glUniform3fv(lambertShader.getUniformLocation("lightColor"), 1,
-                         glm::value_ptr(lights[selectedLightIndex].color));
+            lambertShader.bindUniformBlock("lightBuffer", 0, lightUbo);
             glUniform3fv(lambertShader.getUniformLocation("kd"), 1,
                          glm::value_ptr(shadingData.kd));
-            render(lambertShader);
+            shade(lambertShader);
           }
           if (phongSpecularLighting || blinnPhongSpecularLighting) {
             const Shader &shader =
@@ -748,12 +895,9 @@ int main(int argc, char **argv) {
             // === SET YOUR PHONG/BLINN PHONG UNIFORMS HERE ===
             // Values that you may want to pass to the shader are stored in
             // light, shadingData and cameraPos.
-            glUniform3fv(shader.getUniformLocation("lightPos"), 1,
-                         glm::value_ptr(lights[selectedLightIndex].position));
             glUniform3fv(shader.getUniformLocation("viewPos"), 1,
                          glm::value_ptr(cameraPos));
-            glUniform3fv(shader.getUniformLocation("lightColor"), 1,
-                         glm::value_ptr(lights[selectedLightIndex].color));
+            shader.bindUniformBlock("lightBuffer", 0, lightUbo);
             glUniform3fv(shader.getUniformLocation("ks"), 1,
                          glm::value_ptr(shadingData.ks));
             glUniform3fv(shader.getUniformLocation("kd"), 1,
@@ -761,9 +905,31 @@ int main(int argc, char **argv) {
             glUniform1f(shader.getUniformLocation("shininess"),
                         shadingData.shininess);
 
-            render(shader);
+            shade(shader);
           }
         }
+      };
+
+      if (singlePassLighting) {
+        // Every draw shades as many lights as fit in the uniform buffer
+        for (size_t first = 0; first < lights.size();
+             first += maxLightsPerPass) {
+          uploadLights(first, std::min(lights.size() - first,
+                                       size_t(maxLightsPerPass)));
+          shadeLights();
+        }
+      } else {
+        for (size_t i = 0; i < lights.size(); i++) {
+          uploadLights(i, 1);
+          shadeLights();
+        }
+      }
+
+      if (timeQuery) {
+        glEndQuery(GL_TIME_ELAPSED);
+        shadingQueryPending[query] = true;
+        shadingQueryPath[query] =
+            renderPath(deferredShading, singlePassLighting);
       }
 
       // Restore default depth test settings and disable blending.
@@ -814,9 +980,12 @@ int main(int argc, char **argv) {
 
   // Be a nice citizen and clean up after yourself.
   glDeleteTextures(1, &texToon);
+  glDeleteQueries(2, shadingQueries.data());
+  glDeleteBuffers(1, &lightUbo);
   glDeleteBuffers(1, &vbo);
   glDeleteBuffers(1, &ibo);
   glDeleteVertexArrays(1, &vao);
+  glDeleteVertexArrays(1, &fullscreenVao);
 
   return 0;
 }
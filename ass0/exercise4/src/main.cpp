@@ -1,4 +1,5 @@
 #include "camera.h"
+#include "program_cache.h"
 // Suppress warnings in third-party code.
 #include <framework/disable_all_warnings.h>
 DISABLE_WARNINGS_PUSH()
@@ -62,7 +63,7 @@ int main() {
       });
 
   const Shader mainShader =
-      ShaderBuilder()
+      CachedShaderBuilder()
           .addStage(GL_VERTEX_SHADER, "shaders/shader_vert.glsl")
           .addStage(GL_FRAGMENT_SHADER, "shaders/shader_frag.glsl")
           .build();
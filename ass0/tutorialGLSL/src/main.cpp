@@ -1,3 +1,4 @@
+#include "program_cache.h"
 // Disable compiler warnings in third-party code (which we cannot change).
 #include <framework/disable_all_warnings.h>
 #include <framework/opengl_includes.h>
@@ -65,7 +66,7 @@ int main(int argc, char** argv)
     });
 
     // Construct Shader Pipeline
-    const Shader debugShader = ShaderBuilder()
+    const Shader debugShader = CachedShaderBuilder()
                                    .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
                                    .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/debug_frag.glsl")
                                    .build();
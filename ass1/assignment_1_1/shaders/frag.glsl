@@ -2,31 +2,114 @@
 
 // Global variables for lighting calculations
 uniform vec3 viewPos;                // Camera position in world space
-uniform vec3 lightPos;               // Light position in world space
-uniform vec3 lightColor;             // Light color
-uniform vec3 kd;                     // Diffuse reflectivity
-uniform vec3 ks;                     // Specular reflectivity
-uniform float shininess;             // Shininess factor for specular highlight
 uniform int toonDiscretize;          // Number of levels for toon shading
 uniform float toonSpecularThreshold; // Threshold for toon specular highlight
 
-uniform int diffuseMode;             // Diffuse shading mode: 0 - debug, 1 - lambert, 2 - toon, 3 - x-toon
-uniform int specularMode;            // Specular shading mode: 0 - none, 1 - phong, 2 - blinn-phong, 3 - toon
+// The modes are compiled into a variant of the program, see
+// shader_permutations.h, so no fragment pays for the modes that are off:
+// DIFFUSE_MODE  0 - debug, 1 - lambert, 2 - toon, 3 - x-toon
+// SPECULAR_MODE 0 - none, 1 - phong, 2 - blinn-phong, 3 - toon
+// SHADOWS, PCF and EVSM 0 or 1
 
-// Shadow mapping uniforms
-uniform sampler2D shadowMap;
-uniform mat4 lightMVP;
-uniform int shadows; // 0 or 1
-uniform int pcf;     // 0 or 1
-uniform int lightMode; // 0 or 1
+// Shadow mapping uniforms, see shadow_atlas.h. lightShadows holds 5 texels
+// per light: the columns of its light matrix and (tile offset, tile scale, 0)
+// in texture coordinates of the atlas. Lights without a tile have a scale of
+// 0.
+uniform sampler2D shadowAtlas;
+uniform samplerBuffer lightShadows;
+
+// Cascaded shadow map, see shadow_cascades.h. A fragment uses the first
+// cascade that ends beyond its view depth.
+uniform sampler2DArray shadowCascades;
+uniform mat4 cascadeMatrices[4];
+uniform vec4 cascadeSplits;
+uniform int cascadeLight; // Light shadowed by the cascades instead of the atlas, -1 for none
+
+// Prefiltered EVSM moments of the atlas and the cascades, see
+// shadow_moments.h. Replace the depth comparisons when EVSM is 1.
+uniform sampler2DArray shadowAtlasMoments;
+uniform sampler2DArray shadowCascadeMoments;
+uniform vec2 evsmExponents; // Positive and negative warp exponent
+
+// Clustered lights, see light_clusters.h. lightData holds 3 texels per light:
+// (position, range), (color, cosine of the outer spot angle) and (spot
+// direction, cosine of the inner spot angle). clusterData holds the offset
+// and count of the light indices of every cluster in clusterLights.
+uniform samplerBuffer lightData;
+uniform usamplerBuffer clusterData;
+uniform usamplerBuffer clusterLights;
+uniform mat4 view;
+uniform ivec3 clusterGrid;
+uniform vec2 clusterTileSize;
+uniform float clusterDepthScale; // slice = log(depth) * scale + bias
+uniform float clusterDepthBias;
 
 // Output for on-screen color
 out vec4 outColor;
 
-// Interpolated output data from vertex shader
-in vec3 fragPos;     // World-space position
-in vec3 fragNormal;  // World-space normal
-void computeShadow(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir, out float shadow, out float attenuation) {
+// The surface being lit, implemented by forward_surface.glsl from the mesh or
+// by deferred_surface.glsl from the G-buffer
+vec3 surfacePosition();  // World-space position
+vec3 surfaceNormal();    // World-space normal
+vec3 surfaceKd();        // Diffuse reflectivity
+vec3 surfaceKs();        // Specular reflectivity
+float surfaceShininess(); // Shininess factor for specular highlight
+
+// Upper bound of the fraction of the filter region that is lit, raised by a
+// threshold to cut off the light that bleeds through overlapping casters
+float chebyshevUpperBound(vec2 moments, float mean, float minVariance)
+{
+    if (mean <= moments.x)
+        return 1.0;
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float d = mean - moments.x;
+    float pMax = variance / (variance + d * d);
+    return clamp((pMax - 0.2) / 0.8, 0.0, 1.0);
+}
+
+float evsmShadow(vec4 moments, float depth)
+{
+    depth = 2.0 * depth - 1.0;
+    vec2 warped = vec2(exp(evsmExponents.x * depth), -exp(-evsmExponents.y * depth));
+    vec2 minVariance = 1e-4 * evsmExponents * warped;
+    minVariance *= minVariance;
+    float positive = chebyshevUpperBound(moments.xy, warped.x, minVariance.x);
+    float negative = chebyshevUpperBound(moments.zw, warped.y, minVariance.y);
+    return 1.0 - min(positive, negative);
+}
+
+// Mip level of the moments for the footprint spanned by the gradients dx and
+// dy, in texture coordinates of a texture of the given size. The derivatives
+// of the position are meaningless across depth discontinuities and next to
+// the pixels the deferred pass skips, so the level is kept to a few texels
+// instead of dropping to the coarsest level there.
+const float maxMomentsLod = 2.0;
+float momentsLod(vec2 dx, vec2 dy, vec2 size)
+{
+    vec2 texelsDx = dx * size;
+    vec2 texelsDy = dy * size;
+    float footprint = max(dot(texelsDx, texelsDx), dot(texelsDy, texelsDy));
+    return clamp(0.5 * log2(max(footprint, 1e-8)), 0.0, maxMomentsLod);
+}
+
+// The shadows are computed inside the light loop, where implicit derivatives
+// are undefined, so the filter footprint of the moments comes from the
+// derivatives of the position taken in main
+void computeShadow(int light, vec3 fragPos, vec3 fragPosDx, vec3 fragPosDy, vec3 normal, vec3 lightDir, out float shadow) {
+    shadow = 0.0;
+
+    vec4 tile = texelFetch(lightShadows, 5 * light + 4);
+    if (tile.z == 0.0)
+        return;
+    mat4 lightMVP = mat4(texelFetch(lightShadows, 5 * light),
+                         texelFetch(lightShadows, 5 * light + 1),
+                         texelFetch(lightShadows, 5 * light + 2),
+                         texelFetch(lightShadows, 5 * light + 3));
+    vec4 fragPosLightSpace = lightMVP * vec4(fragPos, 1.0);
+    // Behind the light, outside its frustum
+    if (fragPosLightSpace.w <= 0.0)
+        return;
+
     // Perform perspective divide
     vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
     // Transform to [0,1] range
@@ -34,13 +117,9 @@ void computeShadow(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir, out float
 
     // Check if fragment is outside the light's view
     if (projCoords.z > 1.0) {
-        shadow = 0.0;
-        attenuation = 1.0;
         return;
     }
 
-    // Get depth from shadow map
-    float closestDepth = texture(shadowMap, projCoords.xy).r;
     // Get current fragment depth
     float currentDepth = projCoords.z;
 
@@ -50,79 +129,111 @@ void computeShadow(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir, out float
     // Bias to prevent shadow acne
     float bias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
 
-    // Initialize shadow and attenuation
-    shadow = 0.0;
-    attenuation = 1.0;
-
-    // Spotlight attenuation
-    if (lightMode == 1) {
-        float distFromCenter = distance(shadowMapCoord, vec2(0.5));
-        float radius = 0.5;
-        attenuation = clamp(1.0 - distFromCenter / radius, 0.0, 1.0);
-        // Apply a falloff curve
-        attenuation = pow(attenuation, 2.0); // Adjust exponent for sharper edges
+    // Nothing is rendered outside the tile, so the fragment is lit
+    if (any(lessThan(shadowMapCoord, vec2(0.0))) || any(greaterThan(shadowMapCoord, vec2(1.0)))) {
+        return;
     }
 
-    if (pcf == 1) {
+    // Position in the atlas, samples are kept inside the tile so the PCF
+    // kernel never reads the depth of another light
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowAtlas, 0));
+    vec2 atlasCoord = tile.xy + shadowMapCoord * tile.z;
+    vec2 tileMin = tile.xy + 0.5 * texelSize;
+    vec2 tileMax = tile.xy + tile.z - 0.5 * texelSize;
+
+#if EVSM
+    // One filtered lookup, the light matrix is a perspective projection so the
+    // gradients are the differences of the projected neighbours
+    vec4 neighbourDx = lightMVP * vec4(fragPos + fragPosDx, 1.0);
+    vec4 neighbourDy = lightMVP * vec4(fragPos + fragPosDy, 1.0);
+    vec2 dx = (neighbourDx.xy / neighbourDx.w * 0.5 + 0.5 - projCoords.xy) * tile.z;
+    vec2 dy = (neighbourDy.xy / neighbourDy.w * 0.5 + 0.5 - projCoords.xy) * tile.z;
+    float lod = momentsLod(dx, dy, vec2(textureSize(shadowAtlasMoments, 0).xy));
+    vec4 moments = textureLod(shadowAtlasMoments, vec3(clamp(atlasCoord, tileMin, tileMax), 0.0), lod);
+    shadow = evsmShadow(moments, currentDepth);
+#elif PCF
+    {
         // PCF
         float shadowSamples = 4.0;
-        float offset = 1.0 / 1024.0; // Assuming shadow map size is 1024x1024
         float shadowSum = 0.0;
         for (float x = -1.5; x <= 1.5; x += 1.0)
         {
             for (float y = -1.5; y <= 1.5; y += 1.0)
             {
-                float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * offset).r;
+                vec2 sampleCoord = clamp(atlasCoord + vec2(x, y) * texelSize, tileMin, tileMax);
+                float pcfDepth = texture(shadowAtlas, sampleCoord).r;
                 shadowSum += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
             }
         }
         shadow = shadowSum / (shadowSamples * shadowSamples);
     }
-    else {
-        // Basic shadow
-        shadow = currentDepth - bias > closestDepth ? 1.0 : 0.0;
-    }
+#else
+    // Basic shadow
+    float closestDepth = texture(shadowAtlas, atlasCoord).r;
+    shadow = currentDepth - bias > closestDepth ? 1.0 : 0.0;
+#endif
 }
-void main()
-{
-    vec3 color = vec3(0.0);
-
-    // Normalize the input vectors
-    vec3 normal = normalize(fragNormal);
-    vec3 lightDir = normalize(lightPos - fragPos);
-    vec3 viewDir = normalize(viewPos - fragPos);
+void computeCascadeShadow(vec3 fragPos, vec3 fragPosDx, vec3 fragPosDy, float depth, vec3 normal, vec3 lightDir, out float shadow) {
+    shadow = 0.0;
+    if (depth > cascadeSplits[3])
+        return;
+    int cascade = 0;
+    while (cascade < 3 && depth > cascadeSplits[cascade])
+        cascade++;
 
-    // Early exit for debug mode
-    if (diffuseMode == 0)
-    {
-        // Output the normal vector as color (mapped from [-1,1] to [0,1])
-        color = normal * 0.5 + 0.5;
-        outColor = vec4(color, 1.0);
+    vec4 fragPosLightSpace = cascadeMatrices[cascade] * vec4(fragPos, 1.0);
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5 + 0.5;
+    if (projCoords.z > 1.0)
         return;
-    }
 
-    // Compute shadow factor and attenuation
-    float shadow = 0.0;
-    float attenuation = 1.0;
-    if (shadows == 1) {
-        vec4 fragPosLightSpace = lightMVP * vec4(fragPos, 1.0);
-        computeShadow(fragPosLightSpace, normal, lightDir, shadow, attenuation);
+    // Bias to prevent shadow acne
+    float bias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
+    float currentDepth = projCoords.z;
+
+#if EVSM
+    vec2 dx = (cascadeMatrices[cascade] * vec4(fragPosDx, 0.0)).xy * 0.5;
+    vec2 dy = (cascadeMatrices[cascade] * vec4(fragPosDy, 0.0)).xy * 0.5;
+    float lod = momentsLod(dx, dy, vec2(textureSize(shadowCascadeMoments, 0).xy));
+    vec4 moments = textureLod(shadowCascadeMoments, vec3(projCoords.xy, cascade), lod);
+    shadow = evsmShadow(moments, currentDepth);
+#elif PCF
+    {
+        vec2 texelSize = 1.0 / vec2(textureSize(shadowCascades, 0).xy);
+        float shadowSum = 0.0;
+        for (float x = -1.5; x <= 1.5; x += 1.0)
+        {
+            for (float y = -1.5; y <= 1.5; y += 1.0)
+            {
+                float pcfDepth = texture(shadowCascades, vec3(projCoords.xy + vec2(x, y) * texelSize, cascade)).r;
+                shadowSum += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
+            }
+        }
+        shadow = shadowSum / 16.0;
     }
+#else
+    float closestDepth = texture(shadowCascades, vec3(projCoords.xy, cascade)).r;
+    shadow = currentDepth - bias > closestDepth ? 1.0 : 0.0;
+#endif
+}
 
+// Diffuse and specular light reflected by the fragment for a single light
+vec3 shadeLight(vec3 normal, vec3 lightDir, vec3 viewDir, vec3 lightColor,
+               vec3 kd, vec3 ks, float shininess)
+{
     // Compute diffuse component
     vec3 diffuse = vec3(0.0);
-    if (diffuseMode == 1) // Lambert
+#if DIFFUSE_MODE == 1 // Lambert
     {
         float diff = max(dot(normal, lightDir), 0.0);
         diffuse = diff * kd * lightColor;
     }
-    else if (diffuseMode == 2) // Toon
+#elif DIFFUSE_MODE == 2 // Toon
     {
         float diff = max(dot(normal, lightDir), 0.0);
         diff = floor(diff * float(toonDiscretize)) / float(toonDiscretize);
         diffuse = diff * kd * lightColor;
     }
-    else if (diffuseMode == 3) // X-Toon
+#elif DIFFUSE_MODE == 3 // X-Toon
     {
         // X-Toon shading computes both diffuse and specular components differently
         float diff = max(dot(normal, lightDir), 0.0);
@@ -137,30 +248,27 @@ void main()
         float specularStep = step(toonSpecularThreshold, specAngle);
         // Enhance the specular highlight in x-toon shading
         vec3 specular = pow(specularStep, 2.0) * ks * lightColor;
-
-        // Combine diffuse and specular, apply shadow and attenuation
-        color = (diffuse + specular) * attenuation * (1.0 - shadow);
-        outColor = vec4(color, 1.0);
-        return;
+        return diffuse + specular;
     }
+#endif
 
     // Compute specular component
     vec3 specular = vec3(0.0);
-    if (specularMode == 1) // Phong
+#if SPECULAR_MODE == 1 // Phong
     {
         vec3 reflectDir = reflect(-lightDir, normal);
         float specAngle = max(dot(reflectDir, viewDir), 0.0);
         float specularStrength = pow(specAngle, shininess);
         specular = specularStrength * ks * lightColor;
     }
-    else if (specularMode == 2) // Blinn-Phong
+#elif SPECULAR_MODE == 2 // Blinn-Phong
     {
         vec3 halfDir = normalize(lightDir + viewDir);
         float specAngle = max(dot(normal, halfDir), 0.0);
         float specularStrength = pow(specAngle, shininess);
         specular = specularStrength * ks * lightColor;
     }
-    else if (specularMode == 3) // Toon Specular
+#elif SPECULAR_MODE == 3 // Toon Specular
     {
         vec3 halfDir = normalize(lightDir + viewDir);
         float specAngle = max(dot(normal, halfDir), 0.0);
@@ -169,9 +277,74 @@ void main()
         float specularStep = step(toonSpecularThreshold, specAngle);
         specular = specularStep * ks * lightColor;
     }
+#endif
+    return diffuse + specular;
+}
+
+void main()
+{
+    vec3 color = vec3(0.0);
+
+    vec3 fragPos = surfacePosition();
+    vec3 fragPosDx = dFdx(fragPos);
+    vec3 fragPosDy = dFdy(fragPos);
+    vec3 kd = surfaceKd();
+    vec3 ks = surfaceKs();
+    float shininess = surfaceShininess();
+
+    // Normalize the input vectors
+    vec3 normal = normalize(surfaceNormal());
+    vec3 viewDir = normalize(viewPos - fragPos);
+
+    // Early exit for debug mode
+#if DIFFUSE_MODE == 0
+    // Output the normal vector as color (mapped from [-1,1] to [0,1])
+    color = normal * 0.5 + 0.5;
+    outColor = vec4(color, 1.0);
+    return;
+#endif
 
-    // Combine diffuse and specular, apply shadow and attenuation
-    color = (diffuse + specular) * attenuation * (1.0 - shadow);
+    // Find the cluster of the fragment from its tile on the screen and its
+    // exponential depth slice
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    ivec3 cluster = ivec3(ivec2(gl_FragCoord.xy / clusterTileSize),
+                          int(floor(log(depth) * clusterDepthScale + clusterDepthBias)));
+    cluster = clamp(cluster, ivec3(0), clusterGrid - 1);
+    uvec2 lightList = texelFetch(clusterData,
+        (cluster.z * clusterGrid.y + cluster.y) * clusterGrid.x + cluster.x).rg;
+
+    for (uint i = 0u; i < lightList.y; i++)
+    {
+        int light = int(texelFetch(clusterLights, int(lightList.x + i)).r);
+        vec4 positionRange = texelFetch(lightData, 3 * light);
+        vec4 colorCosOuter = texelFetch(lightData, 3 * light + 1);
+        vec4 directionCosInner = texelFetch(lightData, 3 * light + 2);
+
+        vec3 toLight = positionRange.xyz - fragPos;
+        float lightDistance = length(toLight);
+        vec3 lightDir = toLight / lightDistance;
+
+        // Smooth window that reaches zero at the range of the light, so lights
+        // outside the cluster would not have contributed anyway
+        float window = clamp(1.0 - pow(lightDistance / positionRange.w, 4.0), 0.0, 1.0);
+        float attenuation = window * window;
+        // Spot cone, point lights have an outer cosine below -1
+        attenuation *= smoothstep(colorCosOuter.w, directionCosInner.w,
+                                  dot(-lightDir, directionCosInner.xyz));
+
+        // Compute shadow factor
+        float shadow = 0.0;
+#if SHADOWS
+        if (light == cascadeLight) {
+            computeCascadeShadow(fragPos, fragPosDx, fragPosDy, depth, normal, lightDir, shadow);
+        } else {
+            computeShadow(light, fragPos, fragPosDx, fragPosDy, normal, lightDir, shadow);
+        }
+#endif
+
+        // Combine diffuse and specular, apply shadow and attenuation
+        color += shadeLight(normal, lightDir, viewDir, colorCosOuter.rgb, kd, ks, shininess) * attenuation * (1.0 - shadow);
+    }
 
     outColor = vec4(color, 1.0);
 }
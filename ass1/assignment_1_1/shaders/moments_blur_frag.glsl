@@ -0,0 +1,54 @@
+#version 410
+
+// Separable Gaussian blur of exponentially warped depth, see shadow_moments.h.
+// Pass 0 warps the depth of a square of the shadow map and blurs it
+// horizontally into the scratch texture, pass 1 blurs the scratch texture
+// vertically into the moments. Taps are clamped to the square, so tiles of
+// the atlas never blur into each other.
+
+uniform sampler2D depthMap;
+uniform sampler2DArray depthLayers;
+uniform sampler2D scratch;
+uniform int pass;
+uniform int layered; // Read depth from layer of depthLayers instead of depthMap
+uniform int layer;
+uniform ivec2 sourceOffset; // First texel of the square in the source
+uniform ivec2 targetOffset; // First texel of the square in the target
+uniform int size;
+uniform vec2 exponents;
+
+out vec4 outMoments;
+
+// Gaussian with a standard deviation of 1.5 texels
+const float weights[5] = float[](0.2666, 0.2134, 0.1096, 0.0361, 0.0076);
+
+vec4 warpedMoments(float depth)
+{
+    depth = 2.0 * depth - 1.0;
+    float positive = exp(exponents.x * depth);
+    float negative = -exp(-exponents.y * depth);
+    return vec4(positive, positive * positive, negative, negative * negative);
+}
+
+vec4 fetchMoments(ivec2 texel)
+{
+    texel = sourceOffset + clamp(texel, ivec2(0), ivec2(size - 1));
+    if (pass == 1)
+        return texelFetch(scratch, texel, 0);
+    float depth = layered == 1 ? texelFetch(depthLayers, ivec3(texel, layer), 0).r
+                               : texelFetch(depthMap, texel, 0).r;
+    return warpedMoments(depth);
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy) - targetOffset;
+    ivec2 direction = pass == 0 ? ivec2(1, 0) : ivec2(0, 1);
+    vec4 moments = weights[0] * fetchMoments(texel);
+    for (int i = 1; i < 5; i++)
+    {
+        moments += weights[i] * fetchMoments(texel + i * direction);
+        moments += weights[i] * fetchMoments(texel - i * direction);
+    }
+    outMoments = moments;
+}
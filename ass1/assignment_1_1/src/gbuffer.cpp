@@ -0,0 +1,90 @@
+#include "gbuffer.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+DISABLE_WARNINGS_POP()
+#include <array>
+#include <iostream>
+
+namespace {
+
+GLuint createTexture(const glm::ivec2 &size, GLenum internalFormat,
+                     GLenum format, GLenum type) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, static_cast<GLint>(internalFormat), size.x,
+               size.y, 0, format, type, nullptr);
+  // Only read with texelFetch, but a texture without mipmaps needs a
+  // non-mipmap filter to be complete
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  return texture;
+}
+
+} // namespace
+
+GBuffer::~GBuffer() {
+  const std::array textures{m_kdTexture, m_ksTexture, m_normalTexture,
+                            m_depthTexture};
+  glDeleteTextures(static_cast<GLsizei>(textures.size()), textures.data());
+  glDeleteFramebuffers(1, &m_framebuffer);
+}
+
+void GBuffer::resize(const glm::ivec2 &size) {
+  const std::array textures{m_kdTexture, m_ksTexture, m_normalTexture,
+                            m_depthTexture};
+  glDeleteTextures(static_cast<GLsizei>(textures.size()), textures.data());
+  if (m_framebuffer == 0)
+    glGenFramebuffers(1, &m_framebuffer);
+  m_size = size;
+
+  m_kdTexture = createTexture(size, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+  m_ksTexture = createTexture(size, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+  m_normalTexture = createTexture(size, GL_RG16, GL_RG, GL_UNSIGNED_SHORT);
+  m_depthTexture = createTexture(size, GL_DEPTH_COMPONENT24,
+                                 GL_DEPTH_COMPONENT, GL_FLOAT);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         m_kdTexture, 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D,
+                         m_ksTexture, 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D,
+                         m_normalTexture, 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                         m_depthTexture, 0);
+  const std::array<GLenum, 3> drawBuffers{
+      GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
+  glDrawBuffers(static_cast<GLsizei>(drawBuffers.size()), drawBuffers.data());
+  const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  if (status != GL_FRAMEBUFFER_COMPLETE)
+    std::cerr << "G-buffer framebuffer is incomplete" << std::endl;
+}
+
+void GBuffer::bindForWriting(const glm::ivec2 &size) {
+  if (size != m_size)
+    resize(size);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  glViewport(0, 0, size.x, size.y);
+}
+
+void GBuffer::bindTextures(const Shader &shader, GLint firstUnit,
+                           const glm::mat4 &viewProjection) const {
+  const std::array textures{m_kdTexture, m_ksTexture, m_normalTexture,
+                            m_depthTexture};
+  const std::array names{"gbufferKd", "gbufferKs", "gbufferNormal",
+                         "gbufferDepth"};
+  for (size_t i = 0; i < textures.size(); i++) {
+    const GLint unit = firstUnit + static_cast<GLint>(i);
+    glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(unit));
+    glBindTexture(GL_TEXTURE_2D, textures[i]);
+    glUniform1i(shader.getUniformLocation(names[i]), unit);
+  }
+  glActiveTexture(GL_TEXTURE0);
+
+  const glm::mat4 inverseViewProjection = glm::inverse(viewProjection);
+  glUniformMatrix4fv(shader.getUniformLocation("inverseViewProjection"), 1,
+                     GL_FALSE, glm::value_ptr(inverseViewProjection));
+}
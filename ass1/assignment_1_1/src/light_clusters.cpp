@@ -0,0 +1,261 @@
+#include "light_clusters.h"
+#include "parallel.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+
+namespace {
+// Below this many lights in view assigning them takes less time than waking
+// the worker threads, so the slices are filled on the calling thread
+constexpr size_t parallelLightCount = 64;
+
+GLuint createBufferTexture(GLuint &buffer, GLenum format) {
+  GLuint texture;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+  glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_BUFFER, texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  return texture;
+}
+
+// Replaces the contents of a buffer, an empty buffer gets one zeroed element
+// so the texture stays valid
+template <typename T>
+void uploadBuffer(GLuint buffer, const std::vector<T> &data) {
+  const T empty{};
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+  glBufferData(GL_TEXTURE_BUFFER,
+               static_cast<GLsizeiptr>(std::max(data.size(), size_t(1)) *
+                                       sizeof(T)),
+               data.empty() ? &empty : data.data(), GL_STREAM_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+} // namespace
+
+LightClusters::LightClusters() {
+  m_lightTexture = createBufferTexture(m_lightBuffer, GL_RGBA32F);
+  m_clusterTexture = createBufferTexture(m_clusterBuffer, GL_RG32UI);
+  m_indexTexture = createBufferTexture(m_indexBuffer, GL_R32UI);
+  // OpenGL 4.1 only guarantees 65536 texels, which thousands of lights can
+  // exceed on small GPUs
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &m_maxTexels);
+
+  m_sliceLights.resize(gridZ);
+  m_clusterLists.resize(gridX * gridY * gridZ);
+}
+
+LightClusters::~LightClusters() {
+  glDeleteTextures(1, &m_lightTexture);
+  glDeleteTextures(1, &m_clusterTexture);
+  glDeleteTextures(1, &m_indexTexture);
+  glDeleteBuffers(1, &m_lightBuffer);
+  glDeleteBuffers(1, &m_clusterBuffer);
+  glDeleteBuffers(1, &m_indexBuffer);
+}
+
+void LightClusters::update(std::span<const ClusteredLight> lights,
+                           const glm::mat4 &view, const glm::mat4 &projection,
+                           const glm::ivec2 &viewport) {
+  const auto start = std::chrono::high_resolution_clock::now();
+
+  glBindBuffer(GL_TEXTURE_BUFFER, m_lightBuffer);
+  glBufferData(GL_TEXTURE_BUFFER,
+               static_cast<GLsizeiptr>(
+                   std::max(lights.size(), size_t(1)) * sizeof(ClusteredLight)),
+               nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_TEXTURE_BUFFER, 0,
+                  static_cast<GLsizeiptr>(lights.size_bytes()), lights.data());
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  // Near and far plane of the perspective projection, and the terms that map
+  // the view space x and y to normalized device coordinates
+  const float nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+  const float farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+  const glm::vec2 scale{projection[0][0], projection[1][1]};
+  const glm::vec2 offset{projection[2][0], projection[2][1]};
+
+  // Slices are spaced exponentially in depth, so clusters stay roughly cubic
+  m_depthScale = gridZ / std::log(farPlane / nearPlane);
+  m_depthBias = -m_depthScale * std::log(nearPlane);
+  m_tileSize = glm::vec2(viewport) / glm::vec2(glm::ivec2(gridX, gridY));
+  auto sliceOf = [&](float depth) {
+    return std::clamp(
+        static_cast<int>(std::floor(std::log(depth) * m_depthScale +
+                                    m_depthBias)),
+        0, gridZ - 1);
+  };
+  auto sliceDepth = [&](int slice) {
+    return nearPlane *
+           std::pow(farPlane / nearPlane, static_cast<float>(slice) / gridZ);
+  };
+  auto tileOf = [](float ndc, int grid) {
+    return std::clamp(static_cast<int>(std::floor((ndc * 0.5f + 0.5f) *
+                                                  static_cast<float>(grid))),
+                      0, grid - 1);
+  };
+
+  // Find the clusters each light may overlap from the box around its sphere
+  m_bounds.clear();
+  for (size_t i = 0; i < lights.size(); i++) {
+    const glm::vec3 center{view * glm::vec4(lights[i].position, 1.0f)};
+    const float range = lights[i].range;
+    const float minDepth = -center.z - range;
+    const float maxDepth = -center.z + range;
+    if (range <= 0.0f || maxDepth < nearPlane || minDepth > farPlane)
+      continue;
+
+    LightBounds bounds{static_cast<uint32_t>(i),
+                       0,
+                       gridX - 1,
+                       0,
+                       gridY - 1,
+                       sliceOf(std::max(minDepth, nearPlane)),
+                       sliceOf(std::min(maxDepth, farPlane)),
+                       center,
+                       range};
+    // Lights reaching in front of the near plane may cover any tile
+    if (minDepth > nearPlane) {
+      glm::vec2 ndcMin{FLT_MAX}, ndcMax{-FLT_MAX};
+      for (int corner = 0; corner < 8; corner++) {
+        const glm::vec3 p =
+            center + range * glm::vec3(corner & 1 ? 1 : -1,
+                                       corner & 2 ? 1 : -1,
+                                       corner & 4 ? 1 : -1);
+        const glm::vec2 ndc =
+            (scale * glm::vec2(p.x, p.y) + offset * p.z) / -p.z;
+        ndcMin = glm::min(ndcMin, ndc);
+        ndcMax = glm::max(ndcMax, ndc);
+      }
+      if (ndcMax.x < -1.0f || ndcMax.y < -1.0f || ndcMin.x > 1.0f ||
+          ndcMin.y > 1.0f)
+        continue;
+      bounds.x0 = tileOf(ndcMin.x, gridX);
+      bounds.x1 = tileOf(ndcMax.x, gridX);
+      bounds.y0 = tileOf(ndcMin.y, gridY);
+      bounds.y1 = tileOf(ndcMax.y, gridY);
+    }
+    m_bounds.push_back(bounds);
+  }
+
+  for (auto &sliceLights : m_sliceLights)
+    sliceLights.clear();
+  for (uint32_t i = 0; i < m_bounds.size(); i++) {
+    for (int z = m_bounds[i].z0; z <= m_bounds[i].z1; z++)
+      m_sliceLights[z].push_back(i);
+  }
+
+  // Every thread fills the clusters of its own slice, testing the light
+  // spheres against the view space boxes of the clusters
+  const unsigned int numThreads = m_bounds.size() < parallelLightCount ? 1 : 0;
+  parallel_for(gridZ, numThreads, [&](int z) {
+    const float depth0 = sliceDepth(z);
+    const float depth1 = sliceDepth(z + 1);
+    for (int cluster = z * gridX * gridY; cluster < (z + 1) * gridX * gridY;
+         cluster++)
+      m_clusterLists[cluster].clear();
+
+    // The boxes around the clusters of the slice are separable, the view space
+    // x range only depends on the column and the y range on the row. They span
+    // the sides of the tiles at the near and far depth of the slice.
+    std::array<glm::vec2, gridX> columns;
+    std::array<glm::vec2, gridY> rows;
+    auto tileRange = [&](int tile, int grid, int axis) {
+      const float a = (static_cast<float>(2 * tile) / static_cast<float>(grid) -
+                       1.0f + offset[axis]) /
+                      scale[axis];
+      const float b =
+          (static_cast<float>(2 * tile + 2) / static_cast<float>(grid) - 1.0f +
+           offset[axis]) /
+          scale[axis];
+      return glm::vec2(std::min({a * depth0, a * depth1, b * depth0, b * depth1}),
+                       std::max({a * depth0, a * depth1, b * depth0, b * depth1}));
+    };
+    for (int x = 0; x < gridX; x++)
+      columns[x] = tileRange(x, gridX, 0);
+    for (int y = 0; y < gridY; y++)
+      rows[y] = tileRange(y, gridY, 1);
+    auto squaredDistance = [](float value, const glm::vec2 &range) {
+      const float d = value - std::clamp(value, range.x, range.y);
+      return d * d;
+    };
+
+    std::array<float, gridX> columnDistances;
+    for (uint32_t boundsIndex : m_sliceLights[z]) {
+      const LightBounds &bounds = m_bounds[boundsIndex];
+      const float rangeSquared = bounds.range * bounds.range;
+      const float zDistance = squaredDistance(bounds.viewPosition.z,
+                                              glm::vec2(-depth1, -depth0));
+      for (int x = bounds.x0; x <= bounds.x1; x++)
+        columnDistances[x] = squaredDistance(bounds.viewPosition.x, columns[x]);
+
+      for (int y = bounds.y0; y <= bounds.y1; y++) {
+        const float yzDistance =
+            zDistance + squaredDistance(bounds.viewPosition.y, rows[y]);
+        if (yzDistance > rangeSquared)
+          continue;
+        std::vector<uint32_t> *row = &m_clusterLists[(z * gridY + y) * gridX];
+        for (int x = bounds.x0; x <= bounds.x1; x++) {
+          if (yzDistance + columnDistances[x] <= rangeSquared)
+            row[x].push_back(bounds.light);
+        }
+      }
+    }
+  });
+
+  // Pack the lists into one index buffer, the clusters store where their
+  // list starts and its length
+  m_clusters.resize(m_clusterLists.size());
+  m_lightIndices.clear();
+  m_maxLightsPerCluster = 0;
+  m_droppedLightIndices = 0;
+  const size_t maxIndices = static_cast<size_t>(std::max(m_maxTexels, 1));
+  for (size_t i = 0; i < m_clusterLists.size(); i++) {
+    const std::vector<uint32_t> &list = m_clusterLists[i];
+    const size_t count =
+        std::min(list.size(), maxIndices - m_lightIndices.size());
+    m_droppedLightIndices += list.size() - count;
+    m_clusters[i] = glm::uvec2(static_cast<uint32_t>(m_lightIndices.size()),
+                               static_cast<uint32_t>(count));
+    m_lightIndices.insert(m_lightIndices.end(), list.begin(),
+                          list.begin() + static_cast<std::ptrdiff_t>(count));
+    m_maxLightsPerCluster =
+        std::max(m_maxLightsPerCluster, static_cast<uint32_t>(list.size()));
+  }
+  uploadBuffer(m_clusterBuffer, m_clusters);
+  uploadBuffer(m_indexBuffer, m_lightIndices);
+
+  m_assignTimeMs = std::chrono::duration<float, std::milli>(
+                       std::chrono::high_resolution_clock::now() - start)
+                       .count();
+}
+
+void LightClusters::bind(const Shader &shader, GLint firstUnit) const {
+  glActiveTexture(GL_TEXTURE0 + firstUnit);
+  glBindTexture(GL_TEXTURE_BUFFER, m_lightTexture);
+  glUniform1i(shader.getUniformLocation("lightData"), firstUnit);
+  glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+  glBindTexture(GL_TEXTURE_BUFFER, m_clusterTexture);
+  glUniform1i(shader.getUniformLocation("clusterData"), firstUnit + 1);
+  glActiveTexture(GL_TEXTURE0 + firstUnit + 2);
+  glBindTexture(GL_TEXTURE_BUFFER, m_indexTexture);
+  glUniform1i(shader.getUniformLocation("clusterLights"), firstUnit + 2);
+  glActiveTexture(GL_TEXTURE0);
+
+  glUniform3i(shader.getUniformLocation("clusterGrid"), gridX, gridY, gridZ);
+  glUniform2fv(shader.getUniformLocation("clusterTileSize"), 1,
+               glm::value_ptr(m_tileSize));
+  glUniform1f(shader.getUniformLocation("clusterDepthScale"), m_depthScale);
+  glUniform1f(shader.getUniformLocation("clusterDepthBias"), m_depthBias);
+}
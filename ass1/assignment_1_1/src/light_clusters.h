@@ -0,0 +1,86 @@
+#pragma once
+// Disable compiler warnings in third-party code (which we cannot change).
+#include <framework/disable_all_warnings.h>
+#include <framework/opengl_includes.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include <cstdint>
+#include <framework/shader.h>
+#include <span>
+#include <vector>
+
+// A light in the layout of the lightData buffer texture of frag.glsl, three
+// RGBA32F texels per light. Point lights have a cutoff below -1 so every
+// direction is inside the cone.
+struct ClusteredLight {
+  glm::vec3 position;
+  float range;
+  glm::vec3 color;
+  float spotCosOuter;
+  glm::vec3 direction;
+  float spotCosInner;
+};
+static_assert(sizeof(ClusteredLight) == 3 * 4 * sizeof(float));
+
+// Clustered forward shading: the view frustum is split into a grid of tiles
+// on the screen and exponential slices in depth, and every cluster gets the
+// list of lights whose range overlaps it. Fragments then only loop over the
+// lights of their own cluster. The lights are assigned on the CPU every
+// frame, one depth slice per thread.
+class LightClusters {
+public:
+  static constexpr int gridX = 16;
+  static constexpr int gridY = 9;
+  static constexpr int gridZ = 24;
+
+  LightClusters();
+  LightClusters(const LightClusters &) = delete;
+  LightClusters &operator=(const LightClusters &) = delete;
+  ~LightClusters();
+
+  // Uploads the lights and assigns them to the clusters of the camera
+  void update(std::span<const ClusteredLight> lights, const glm::mat4 &view,
+              const glm::mat4 &projection, const glm::ivec2 &viewport);
+  // Binds the light and cluster buffer textures to three texture units from
+  // firstUnit on and sets the uniforms frag.glsl uses to find the cluster of
+  // a fragment
+  void bind(const Shader &shader, GLint firstUnit) const;
+
+  float assignTimeMs() const { return m_assignTimeMs; }
+  size_t lightIndexCount() const { return m_lightIndices.size(); }
+  uint32_t maxLightsPerCluster() const { return m_maxLightsPerCluster; }
+  // Light indices dropped because the index buffer texture was full
+  size_t droppedLightIndices() const { return m_droppedLightIndices; }
+
+private:
+  // Screen tiles and depth slices a light overlaps, inclusive
+  struct LightBounds {
+    uint32_t light;
+    int x0, x1, y0, y1, z0, z1;
+    glm::vec3 viewPosition;
+    float range;
+  };
+
+  GLuint m_lightBuffer = 0, m_lightTexture = 0;
+  GLuint m_clusterBuffer = 0, m_clusterTexture = 0;
+  GLuint m_indexBuffer = 0, m_indexTexture = 0;
+  GLint m_maxTexels = 0;
+
+  // Values of the last update the shader needs
+  glm::vec2 m_tileSize{1.0f};
+  float m_depthScale = 0.0f, m_depthBias = 0.0f;
+
+  // Kept between frames to reuse their memory
+  std::vector<LightBounds> m_bounds;
+  std::vector<std::vector<uint32_t>> m_sliceLights;
+  std::vector<std::vector<uint32_t>> m_clusterLists;
+  std::vector<glm::uvec2> m_clusters;
+  std::vector<uint32_t> m_lightIndices;
+
+  float m_assignTimeMs = 0.0f;
+  uint32_t m_maxLightsPerCluster = 0;
+  size_t m_droppedLightIndices = 0;
+};
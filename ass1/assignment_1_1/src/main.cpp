@@ -4,6 +4,7 @@
 DISABLE_WARNINGS_PUSH()
 // Include glad before glfw3
 #include <GLFW/glfw3.h>
+#include <glm/common.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/mat4x4.hpp>
@@ -17,6 +18,13 @@ DISABLE_WARNINGS_POP()
 #include <array>
 #include <cassert>
 #include <cstdlib> // EXIT_FAILURE
+#include "gbuffer.h"
+#include "light_clusters.h"
+#include "program_cache.h"
+#include "shader_permutations.h"
+#include "shadow_atlas.h"
+#include "shadow_cascades.h"
+#include "shadow_moments.h"
 #include <framework/mesh.h>
 #include <framework/shader.h>
 #include <framework/trackball.h>
@@ -25,8 +33,10 @@ DISABLE_WARNINGS_POP()
 #include <imgui/imgui_impl_glfw.h>
 #include <imgui/imgui_impl_opengl2.h>
 #include <iostream>
+#include <limits>
 #include <numeric>
 #include <optional>
+#include <random>
 #include <span>
 #include <toml/toml.hpp>
 #include <vector>
@@ -53,8 +63,21 @@ struct {
   int specularMode = 0; // "none", "phong", "blinn-phong", "toon"
   bool shadows = true;
   bool pcf = true;
+  // Filter the shadows with prefiltered exponential variance shadow maps
+  // instead of PCF, a single lookup per fragment whatever the softness
+  bool evsm = false;
+  // Write the G-buffer and light it in a fullscreen pass instead of shading
+  // the mesh while it is drawn
+  bool deferred = false;
+  // Shadow the selected light with cascades fitted to the camera instead of
+  // its tile in the shadow atlas
+  bool cascades = true;
 } renderSettings;
 
+// GPU time of the last timed frame of the forward and the deferred path
+float forwardTimeMs = 0.0f;
+float deferredTimeMs = 0.0f;
+
 const char *diffuseModels[] = {"debug", "lambert", "toon", "x-toon"};
 const char *specularModels[] = {"none", "phong", "blinn-phong", "toon"};
 
@@ -76,6 +99,11 @@ struct Light {
   glm::vec3 direction;
   bool has_texture;
   Texture texture;
+  // Distance at which the light fades out completely, the clustered shading
+  // only considers the light within it
+  float range = 10.0f;
+  // Angle in degrees between the direction and the edge of the spot cone
+  float spot_angle = 30.0f;
 };
 
 std::vector<Light> lights{};
@@ -141,7 +169,91 @@ void selectPreviousLight() {
     --selectedLightIndex;
 }
 
-void imgui() {
+// Adds lights of random colors spread over the scene, to see the clustered
+// shading handle thousands of them
+void addRandomLights(int count) {
+  static std::mt19937 rng{1};
+  std::uniform_real_distribution<float> position(-1.5f, 1.5f);
+  std::uniform_real_distribution<float> color(0.0f, 1.0f);
+  std::uniform_real_distribution<float> range(0.2f, 0.6f);
+  for (int i = 0; i < count; i++) {
+    Light light{glm::vec3(position(rng), position(rng), position(rng)),
+                glm::vec3(color(rng), color(rng), color(rng))};
+    light.range = range(rng);
+    lights.push_back(light);
+  }
+}
+
+// Converts the lights to the layout of the light buffer of the shader
+std::vector<ClusteredLight> clusteredLights() {
+  std::vector<ClusteredLight> result;
+  result.reserve(lights.size());
+  for (const Light &light : lights) {
+    ClusteredLight clustered{light.position, light.range, light.color, -3.0f,
+                             glm::vec3(0.0f), -2.0f};
+    float directionLength = glm::length(light.direction);
+    if (light.is_spotlight && directionLength > 0.0f) {
+      // The light fades in over the outer fifth of the cone
+      float angle = glm::radians(std::clamp(light.spot_angle, 1.0f, 89.0f));
+      clustered.direction = light.direction / directionLength;
+      clustered.spotCosOuter = std::cos(angle);
+      clustered.spotCosInner = std::cos(angle * 0.8f);
+    }
+    result.push_back(clustered);
+  }
+  return result;
+}
+
+// Matrix the shadow map of a light is rendered with. The frustum ends at the
+// range of the light, since nothing beyond it is lit, and the near plane lies
+// well inside it so close casters are not clipped. A spot light looks along
+// its cone, a point light only has one tile and looks at the origin of the
+// scene with a wide frustum.
+glm::mat4 lightViewProjection(const Light &light) {
+  const float far_plane = std::max(light.range, 1e-3f);
+  const float near_plane = 0.01f * far_plane;
+  glm::vec3 direction = -light.position;
+  float fov = glm::radians(120.0f);
+  if (light.is_spotlight && glm::length(light.direction) > 0.0f) {
+    direction = light.direction;
+    fov = 2.0f * glm::radians(std::clamp(light.spot_angle, 1.0f, 89.0f));
+  }
+  if (glm::length(direction) < 1e-4f)
+    direction = glm::vec3(0.0f, -1.0f, 0.0f);
+  direction = glm::normalize(direction);
+
+  // Any up vector works as long as it is not parallel to the direction
+  const glm::vec3 up = std::abs(direction.y) > 0.99f
+                           ? glm::vec3(1.0f, 0.0f, 0.0f)
+                           : glm::vec3(0.0f, 1.0f, 0.0f);
+  const glm::mat4 lightProjection =
+      glm::perspective(fov, 1.0f, near_plane, far_plane);
+  const glm::mat4 lightView =
+      glm::lookAt(light.position, light.position + direction, up);
+  return lightProjection * lightView;
+}
+
+// The lights with the fraction of the screen their range reaches, which sizes
+// their shadow tiles. The selected light always gets the largest tile, unless
+// the cascades shadow it and it needs none.
+std::vector<ShadowedLight> shadowedLights(const glm::vec3 &cameraPos) {
+  std::vector<ShadowedLight> result;
+  result.reserve(lights.size());
+  for (size_t i = 0; i < lights.size(); i++) {
+    const Light &light = lights[i];
+    const float distance = glm::length(light.position - cameraPos);
+    const float ratio = light.range / std::max(distance, 1e-3f);
+    float coverage = std::min(ratio * ratio, 1.0f);
+    if (i == selectedLightIndex)
+      coverage = renderSettings.cascades ? 0.0f : 1.0f;
+    result.push_back(
+        ShadowedLight{lightViewProjection(light), coverage});
+  }
+  return result;
+}
+
+void imgui(const LightClusters &lightClusters, const ShadowAtlas &shadowAtlas,
+           const ShadowCascades &shadowCascades) {
 
   // Define UI here
   if (!show_imgui)
@@ -171,6 +283,18 @@ void imgui() {
                IM_ARRAYSIZE(specularModels));
   ImGui::Checkbox("Shadows", &renderSettings.shadows);
   ImGui::Checkbox("PCF", &renderSettings.pcf);
+  ImGui::Checkbox("EVSM", &renderSettings.evsm);
+  ImGui::Text("%zu lights have a shadow tile, %zu rendered this frame",
+              shadowAtlas.shadowedLights(), shadowAtlas.renderedTiles());
+  ImGui::Checkbox("Cascaded Shadows", &renderSettings.cascades);
+  if (renderSettings.cascades) {
+    const auto &splits = shadowCascades.splits();
+    ImGui::Text("Cascades end at depth %.2f, %.2f, %.2f, %.2f", splits[0],
+                splits[1], splits[2], splits[3]);
+  }
+  ImGui::Checkbox("Deferred Shading", &renderSettings.deferred);
+  ImGui::Text("Forward %.2f ms, deferred %.2f ms", forwardTimeMs,
+              deferredTimeMs);
 
   ImGui::Separator();
   ImGui::Text("Lights");
@@ -203,10 +327,13 @@ void imgui() {
 
     ImGui::ColorEdit3("Light Color", &selectedLight.color[0]);
     ImGui::DragFloat3("Light Position", &selectedLight.position[0], 0.1f);
+    ImGui::SliderFloat("Light Range", &selectedLight.range, 0.05f, 20.0f);
     ImGui::Checkbox("Is Spotlight", &selectedLight.is_spotlight);
     if (selectedLight.is_spotlight) {
       ImGui::DragFloat3("Spotlight Direction", &selectedLight.direction[0],
                         0.1f);
+      ImGui::SliderFloat("Spotlight Angle", &selectedLight.spot_angle, 1.0f,
+                         89.0f);
     }
     ImGui::Checkbox("Has Texture", &selectedLight.has_texture);
     if (selectedLight.has_texture) {
@@ -216,6 +343,19 @@ void imgui() {
     }
   }
 
+  if (ImGui::Button("Add 256 Random Lights")) {
+    addRandomLights(256);
+  }
+  ImGui::Text("%zu lights, assigned to clusters in %.2f ms", lights.size(),
+              lightClusters.assignTimeMs());
+  ImGui::Text("%zu light indices, at most %u lights per cluster",
+              lightClusters.lightIndexCount(),
+              lightClusters.maxLightsPerCluster());
+  if (lightClusters.droppedLightIndices() > 0) {
+    ImGui::Text("%zu light indices dropped, the buffer texture is full",
+                lightClusters.droppedLightIndices());
+  }
+
   std::array interactionModeNames{"Sphere", "Shadow", "Specular"};
   int current_mode = static_cast<int>(interfaceLightPlacement);
   ImGui::Combo("User Interaction Mode", &current_mode,
@@ -308,6 +448,8 @@ int main(int argc, char **argv) {
     auto direction =
         tomlArrayToVec3(config["lights"]["direction"][i].as_array()).value();
     bool has_texture = config["lights"]["has_texture"][i].value<bool>().value();
+    float range = config["lights"]["range"][i].value_or(10.0f);
+    float spot_angle = config["lights"]["spot_angle"][i].value_or(30.0f);
 
     auto tex_path = std::string(RESOURCE_ROOT) +
                     config["mesh"]["path"].value_or("resources/dragon.obj");
@@ -326,7 +468,9 @@ int main(int argc, char **argv) {
                               is_spotlight,
                               direction,
                               has_texture,
-                              {width, height, sourceNumChannels, pixels}});
+                              {width, height, sourceNumChannels, pixels},
+                              range,
+                              spot_angle});
   }
 
   // Create window
@@ -352,6 +496,7 @@ int main(int argc, char **argv) {
                                 : specular_model == "blinn-phong" ? 2
                                                                   : 3;
   renderSettings.pcf = config["render_settings"]["pcf"].value<bool>().value();
+  renderSettings.evsm = config["render_settings"]["evsm"].value_or(false);
   renderSettings.shadows =
       config["render_settings"]["shadows"].value<bool>().value();
 
@@ -367,6 +512,14 @@ int main(int argc, char **argv) {
 
   const Mesh mesh = loadMesh(mesh_path)[0];
 
+  // Bounds of the scene the shadow cascades are fitted to
+  glm::vec3 sceneMin{std::numeric_limits<float>::max()};
+  glm::vec3 sceneMax{std::numeric_limits<float>::lowest()};
+  for (const Vertex &vertex : mesh.vertices) {
+    sceneMin = glm::min(sceneMin, vertex.position);
+    sceneMax = glm::max(sceneMax, vertex.position);
+  }
+
   window.registerKeyCallback([&](int key, int /* scancode */, int action,
                                  int /* mods */) {
     if (key == '\\' && action == GLFW_PRESS) {
@@ -445,23 +598,40 @@ int main(int argc, char **argv) {
   });
 
   const Shader debugShader =
-      ShaderBuilder()
+      CachedShaderBuilder()
           .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
           .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/debug_frag.glsl")
           .build();
   const Shader lightShader =
-      ShaderBuilder()
+      CachedShaderBuilder()
           .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/light_vertex.glsl")
           .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/light_frag.glsl")
           .build();
-  const Shader shader =
-      ShaderBuilder()
+  // frag.glsl is compiled for the shading modes in use instead of branching
+  // on them, the values are packed in this order by the main loop
+  const std::vector<ShaderPermutations::Feature> shadingFeatures{
+      {"DIFFUSE_MODE", 2}, {"SPECULAR_MODE", 2}, {"SHADOWS", 1},
+      {"PCF", 1},          {"EVSM", 1}};
+  ShaderPermutations forwardShaders(
+      {{GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl"},
+       {GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/frag.glsl"},
+       {GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/forward_surface.glsl"}},
+      shadingFeatures);
+  // The deferred path: the mesh writes the G-buffer, then frag.glsl lights
+  // every pixel of it in a fullscreen pass
+  const Shader gbufferShader =
+      CachedShaderBuilder()
           .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
-          .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT
-                    "shaders/frag.glsl") // Use the combined shader filename
+          .addStage(GL_FRAGMENT_SHADER,
+                    RESOURCE_ROOT "shaders/gbuffer_frag.glsl")
           .build();
+  ShaderPermutations deferredShaders(
+      {{GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/fullscreen_vertex.glsl"},
+       {GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/frag.glsl"},
+       {GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/deferred_surface.glsl"}},
+      shadingFeatures);
   const Shader depthShader =
-      ShaderBuilder()
+      CachedShaderBuilder()
           .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/depth_vert.glsl")
           .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/depth_frag.glsl")
           .build();
@@ -508,43 +678,68 @@ int main(int argc, char **argv) {
 
   glBindVertexArray(0);
 
+  // The fullscreen triangle has no vertex attributes, but drawing needs a
+  // vertex array object bound
+  GLuint fullscreenVao;
+  glGenVertexArrays(1, &fullscreenVao);
+
   // Enable depth testing.
   glEnable(GL_DEPTH_TEST);
 
-  // Shadow mapping setup
-  const unsigned int SHADOW_WIDTH = 1024, SHADOW_HEIGHT = 1024;
-
-  GLuint depthMapFBO;
-  glGenFramebuffers(1, &depthMapFBO);
-
-  // Create depth texture
-  GLuint depthMap;
-  glGenTextures(1, &depthMap);
-  glBindTexture(GL_TEXTURE_2D, depthMap);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH,
-               SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  // Prevent texture wrapping artifacts
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-  float borderColor[] = {1.0, 1.0, 1.0, 1.0};
-  glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-
-  // Attach depth texture as FBO's depth buffer
-  glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
-                         depthMap, 0);
-  // No color output in the bound framebuffer, only depth.
-  glDrawBuffer(GL_NONE);
-  glReadBuffer(GL_NONE);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  // The lights of every cluster of the view frustum, updated every frame
+  LightClusters lightClusters;
+  GBuffer gbuffer;
+  // The shadow maps of all lights, only rendered again when a light moved
+  ShadowAtlas shadowAtlas;
+  ShadowCascades shadowCascades;
+
+  // Times the forward or deferred rendering of the mesh. The result is read
+  // when the query of the path is used again, a frame or more later.
+  std::array<GLuint, 2> renderQueries;
+  std::array<bool, 2> renderQueryPending{false, false};
+  glGenQueries(static_cast<GLsizei>(renderQueries.size()),
+               renderQueries.data());
+
+  const auto drawMesh = [&](const Shader &meshShader) {
+    glBindVertexArray(vao);
+    glVertexAttribPointer(meshShader.getAttributeLocation("pos"), 3, GL_FLOAT,
+                          GL_FALSE, sizeof(Vertex),
+                          (void *)offsetof(Vertex, position));
+    glVertexAttribPointer(meshShader.getAttributeLocation("normal"), 3,
+                          GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                          (void *)offsetof(Vertex, normal));
+    glDrawElements(GL_TRIANGLES,
+                   static_cast<GLsizei>(mesh.triangles.size()) * 3,
+                   GL_UNSIGNED_INT, nullptr);
+    glBindVertexArray(0);
+  };
+
+  // Draws the depth of the mesh as seen by a light
+  const auto drawShadowCasters = [&](const glm::mat4 &lightMVP) {
+    glUniformMatrix4fv(depthShader.getUniformLocation("lightMVP"), 1, GL_FALSE,
+                       glm::value_ptr(lightMVP));
+    glBindVertexArray(vao);
+    // Only position attribute is needed
+    glVertexAttribPointer(depthShader.getAttributeLocation("pos"), 3, GL_FLOAT,
+                          GL_FALSE, sizeof(Vertex),
+                          (void *)offsetof(Vertex, position));
+    glDrawElements(GL_TRIANGLES,
+                   static_cast<GLsizei>(mesh.triangles.size()) * 3,
+                   GL_UNSIGNED_INT, nullptr);
+    glBindVertexArray(0);
+  };
+  // The mesh is a dynamic caster of the shadow atlas when it is animated,
+  // otherwise its depth is cached
+  const auto drawAtlasCasters = [&](const glm::mat4 &lightMVP, bool dynamic) {
+    if (dynamic == animated)
+      drawShadowCasters(lightMVP);
+  };
 
   // Main loop.
   while (!window.shouldClose()) {
     window.updateInput();
 
-    imgui();
+    imgui(lightClusters, shadowAtlas, shadowCascades);
 
     // Clear the framebuffer to black and depth to maximum value (ranges from
     // [-1.0 to +1.0]).
@@ -560,61 +755,89 @@ int main(int argc, char **argv) {
     const glm::mat4 projection = trackball.projectionMatrix();
     const glm::mat4 mvp = projection * view * model;
 
-    // 1. Render depth of scene to texture (from light's perspective)
-    glm::mat4 lightProjection, lightView;
-    float near_plane = 1.0f, far_plane = 25.0f;
-    lightProjection =
-        glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, near_plane, far_plane);
-    lightView =
-        glm::lookAt(lights[selectedLightIndex].position,
-                    glm::vec3(0.0f), // Target the origin or your scene's center
-                    glm::vec3(0.0, 1.0, 0.0));
-    glm::mat4 lightMVP = lightProjection * lightView;
-
-    // Render scene from light's point of view
-    depthShader.bind();
-    glUniformMatrix4fv(depthShader.getUniformLocation("lightMVP"), 1, GL_FALSE,
-                       glm::value_ptr(lightMVP));
-
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
-
-    glBindVertexArray(vao);
-    // Only position attribute is needed
-    glVertexAttribPointer(depthShader.getAttributeLocation("pos"), 3, GL_FLOAT,
-                          GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, position));
+    // 1. Render depth of scene to the shadow tiles of the lights that moved.
+    // Without shadows the atlas keeps its tiles for when they are turned on.
+    const bool prefilter = renderSettings.shadows && renderSettings.evsm;
+    if (renderSettings.shadows) {
+      depthShader.bind();
+      shadowAtlas.update(shadowedLights(cameraPos), animated, prefilter,
+                         drawAtlasCasters);
+    }
 
-    // Draw the scene
-    glDrawElements(GL_TRIANGLES,
-                   static_cast<GLsizei>(mesh.triangles.size()) * 3,
-                   GL_UNSIGNED_INT, nullptr);
+    // The cascades follow the camera so they are rendered every frame. Like
+    // the atlas frustum of a point light, the light shines towards the origin.
+    const bool cascaded = renderSettings.shadows && renderSettings.cascades;
+    if (cascaded) {
+      glm::vec3 lightDirection = -lights[selectedLightIndex].position;
+      if (glm::length(lightDirection) < 1e-4f)
+        lightDirection = glm::vec3(0.0f, -1.0f, 0.0f);
+      depthShader.bind();
+      shadowCascades.update(glm::normalize(lightDirection), view, projection,
+                            sceneMin, sceneMax, prefilter, drawShadowCasters);
+    }
 
-    glBindVertexArray(0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // 2. Render scene as normal, or write the G-buffer and light it
+    const bool deferred = renderSettings.deferred;
+    const size_t query = deferred ? 1 : 0;
+    if (renderQueryPending[query]) {
+      GLint available = 0;
+      glGetQueryObjectiv(renderQueries[query], GL_QUERY_RESULT_AVAILABLE,
+                         &available);
+      if (available) {
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(renderQueries[query], GL_QUERY_RESULT,
+                              &elapsedNs);
+        (deferred ? deferredTimeMs : forwardTimeMs) =
+            static_cast<float>(elapsedNs) * 1e-6f;
+        renderQueryPending[query] = false;
+      }
+    }
+    const bool timeQuery = !renderQueryPending[query];
+    if (timeQuery)
+      glBeginQuery(GL_TIME_ELAPSED, renderQueries[query]);
+
+    if (deferred) {
+      // Only the depth needs clearing, pixels at the far plane are skipped
+      // by the light pass
+      gbuffer.bindForWriting(window.getWindowSize());
+      glClear(GL_DEPTH_BUFFER_BIT);
+      gbufferShader.bind();
+      glUniformMatrix4fv(gbufferShader.getUniformLocation("mvp"), 1, GL_FALSE,
+                         glm::value_ptr(mvp));
+      glUniform3fv(gbufferShader.getUniformLocation("ks"), 1,
+                   glm::value_ptr(shadingData.ks));
+      glUniform3fv(gbufferShader.getUniformLocation("kd"), 1,
+                   glm::value_ptr(shadingData.kd));
+      glUniform1f(gbufferShader.getUniformLocation("shininess"),
+                  shadingData.shininess);
+      drawMesh(gbufferShader);
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
 
-    // 2. Render scene as normal
     glViewport(0, 0, window.getWindowSize().x, window.getWindowSize().y);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    // Bind the variant of the shading modes, compiled when first used
+    ShaderPermutations &shaders = deferred ? deferredShaders : forwardShaders;
+    const Shader &shader = shaders.get(shaders.key(
+        {renderSettings.diffuseMode, renderSettings.specularMode,
+         renderSettings.shadows ? 1 : 0, renderSettings.pcf ? 1 : 0,
+         prefilter ? 1 : 0}));
     shader.bind();
 
     // Set the model/view/projection matrix
     glUniformMatrix4fv(shader.getUniformLocation("mvp"), 1, GL_FALSE,
                        glm::value_ptr(mvp));
 
-    // Pass lightMVP matrix to shader
-    glUniformMatrix4fv(shader.getUniformLocation("lightMVP"), 1, GL_FALSE,
-                       glm::value_ptr(lightMVP));
-
-    // Set lighting uniforms
-    glUniform3fv(shader.getUniformLocation("lightPos"), 1,
-                 glm::value_ptr(lights[selectedLightIndex].position));
+    // Set lighting uniforms, all lights are shaded through their clusters
+    const std::vector<ClusteredLight> frameLights = clusteredLights();
+    lightClusters.update(frameLights, view, projection,
+                         window.getWindowSize());
+    lightClusters.bind(shader, 3);
+    glUniformMatrix4fv(shader.getUniformLocation("view"), 1, GL_FALSE,
+                       glm::value_ptr(view));
     glUniform3fv(shader.getUniformLocation("viewPos"), 1,
                  glm::value_ptr(cameraPos));
-    glUniform3fv(shader.getUniformLocation("lightColor"), 1,
-                 glm::value_ptr(lights[selectedLightIndex].color));
     glUniform3fv(shader.getUniformLocation("ks"), 1,
                  glm::value_ptr(shadingData.ks));
     glUniform3fv(shader.getUniformLocation("kd"), 1,
@@ -625,40 +848,33 @@ int main(int argc, char **argv) {
     glUniform1i(shader.getUniformLocation("toonDiscretize"),
                 shadingData.toonDiscretize);
 
-    // Set mode uniforms
-    glUniform1i(shader.getUniformLocation("diffuseMode"),
-                renderSettings.diffuseMode);
-    glUniform1i(shader.getUniformLocation("specularMode"),
-                renderSettings.specularMode);
-
-    // Set shadow and PCF uniforms
-    glUniform1i(shader.getUniformLocation("shadows"),
-                renderSettings.shadows ? 1 : 0);
-    glUniform1i(shader.getUniformLocation("pcf"), renderSettings.pcf ? 1 : 0);
-    glUniform1i(shader.getUniformLocation("lightMode"),
-                lights[selectedLightIndex].is_spotlight ? 1 : 0);
-    // Bind the shadow map
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
-    glUniform1i(shader.getUniformLocation("shadowMap"), 0);
-
-    // Bind vertex data.
-    glBindVertexArray(vao);
-
-    // Set up vertex attributes
-    glVertexAttribPointer(shader.getAttributeLocation("pos"), 3, GL_FLOAT,
-                          GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, position));
-    glVertexAttribPointer(shader.getAttributeLocation("normal"), 3, GL_FLOAT,
-                          GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, normal));
-
-    // Execute draw command.
-    glDrawElements(GL_TRIANGLES,
-                   static_cast<GLsizei>(mesh.triangles.size()) * 3,
-                   GL_UNSIGNED_INT, nullptr);
+    // Set shadow uniforms
+    glUniform2f(shader.getUniformLocation("evsmExponents"),
+                ShadowMoments::positiveExponent,
+                ShadowMoments::negativeExponent);
+    // Bind the shadow atlas and cascades
+    shadowAtlas.bind(shader, 0);
+    shadowCascades.bind(shader, 10);
+    glUniform1i(shader.getUniformLocation("cascadeLight"),
+                cascaded ? static_cast<int>(selectedLightIndex) : -1);
+
+    if (deferred) {
+      // The light pass writes the depth of the G-buffer, so the depth buffer
+      // matches the forward path for the light marker and picking
+      gbuffer.bindTextures(shader, 6, projection * view);
+      glDepthFunc(GL_ALWAYS);
+      glBindVertexArray(fullscreenVao);
+      glDrawArrays(GL_TRIANGLES, 0, 3);
+      glBindVertexArray(0);
+      glDepthFunc(GL_LESS);
+    } else {
+      drawMesh(shader);
+    }
 
-    glBindVertexArray(0);
+    if (timeQuery) {
+      glEndQuery(GL_TIME_ELAPSED);
+      renderQueryPending[query] = true;
+    }
 
     lightShader.bind();
     {
@@ -684,8 +900,9 @@ int main(int argc, char **argv) {
   glDeleteBuffers(1, &vbo);
   glDeleteBuffers(1, &ibo);
   glDeleteVertexArrays(1, &vao);
-  glDeleteFramebuffers(1, &depthMapFBO);
-  glDeleteTextures(1, &depthMap);
+  glDeleteVertexArrays(1, &fullscreenVao);
+  glDeleteQueries(static_cast<GLsizei>(renderQueries.size()),
+                  renderQueries.data());
 
   return 0;
 }
@@ -0,0 +1,70 @@
+#include "shader_permutations.h"
+#include "program_cache.h"
+#include <cassert>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+ShaderPermutations::ShaderPermutations(std::vector<Stage> stages,
+                                       std::vector<Feature> features)
+    : m_stages(std::move(stages)), m_features(std::move(features)) {
+  [[maybe_unused]] int bits = 0;
+  for (const Feature &feature : m_features)
+    bits += feature.bits;
+  assert(bits <= 32);
+}
+
+uint32_t ShaderPermutations::key(std::initializer_list<int> values) const {
+  assert(values.size() == m_features.size());
+  uint32_t result = 0;
+  int shift = 0;
+  auto value = values.begin();
+  for (const Feature &feature : m_features) {
+    const uint32_t mask = (1u << feature.bits) - 1u;
+    assert((static_cast<uint32_t>(*value) & ~mask) == 0);
+    result |= (static_cast<uint32_t>(*value++) & mask) << shift;
+    shift += feature.bits;
+  }
+  return result;
+}
+
+const Shader &ShaderPermutations::get(uint32_t key) {
+  if (auto variant = m_variants.find(key); variant != m_variants.end())
+    return variant->second;
+
+  CachedShaderBuilder builder;
+  for (const Stage &stage : m_stages)
+    builder.addStageSource(stage.type, variantSource(stage, key), stage.path);
+  return m_variants.emplace(key, builder.build()).first->second;
+}
+
+std::string ShaderPermutations::variantSource(const Stage &stage,
+                                              uint32_t key) const {
+  std::ifstream file(stage.path);
+  if (!file)
+    throw ShaderLoadingException("Could not open " + stage.path.string());
+  std::stringstream source;
+  source << file.rdbuf();
+
+  // The #defines have to follow the #version directive. A #line directive
+  // keeps the line numbers of compile errors those of the original file.
+  std::string text = source.str();
+  size_t insert = 0;
+  int versionLine = 0;
+  if (const size_t version = text.find("#version"); version != std::string::npos) {
+    insert = text.find('\n', version);
+    insert = insert == std::string::npos ? text.size() : insert + 1;
+    for (size_t i = 0; i < version; i++)
+      versionLine += text[i] == '\n' ? 1 : 0;
+  }
+  std::string defines;
+  int shift = 0;
+  for (const Feature &feature : m_features) {
+    const uint32_t value = (key >> shift) & ((1u << feature.bits) - 1u);
+    defines += "#define " + feature.define + " " + std::to_string(value) + "\n";
+    shift += feature.bits;
+  }
+  defines += "#line " + std::to_string(versionLine + 2) + "\n";
+  text.insert(insert, defines);
+  return text;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <framework/opengl_includes.h>
+#include <cstdint>
+#include <filesystem>
+#include <framework/shader.h>
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Variants of a program that are specialized with a #define per feature
+// instead of branching on uniforms, so a fragment never pays for the features
+// that are off. A variant is compiled the first time it is used and kept,
+// keyed by the values of all features packed into a bitmask.
+class ShaderPermutations {
+public:
+  struct Stage {
+    GLuint type;
+    std::filesystem::path path;
+  };
+  // A #define whose value fits in bits bits
+  struct Feature {
+    std::string define;
+    int bits = 1;
+  };
+
+  ShaderPermutations(std::vector<Stage> stages, std::vector<Feature> features);
+
+  // Packs one value per feature, in the order of the features
+  uint32_t key(std::initializer_list<int> values) const;
+  // Compiles the variant on first use, throws ShaderLoadingException when it
+  // does not compile
+  const Shader &get(uint32_t key);
+
+  size_t compiledVariants() const { return m_variants.size(); }
+
+private:
+  // The source of a stage with the #defines of the variant
+  std::string variantSource(const Stage &stage, uint32_t key) const;
+
+  std::vector<Stage> m_stages;
+  std::vector<Feature> m_features;
+  std::unordered_map<uint32_t, Shader> m_variants;
+};
@@ -0,0 +1,264 @@
+#include "shadow_atlas.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+static_assert(sizeof(glm::mat4) + 4 * sizeof(float) == 5 * 4 * sizeof(float));
+
+GLuint createDepthTexture(GLuint &framebuffer) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, ShadowAtlas::atlasSize,
+               ShadowAtlas::atlasSize, 0, GL_DEPTH_COMPONENT, GL_FLOAT,
+               nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  // No color output in the framebuffer, only depth.
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                         texture, 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  return texture;
+}
+} // namespace
+
+ShadowAtlas::ShadowAtlas() {
+  m_staticTexture = createDepthTexture(m_staticFramebuffer);
+
+  glGenBuffers(1, &m_shadowBuffer);
+  glBindBuffer(GL_TEXTURE_BUFFER, m_shadowBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(LightShadow), nullptr,
+               GL_STREAM_DRAW);
+  glGenTextures(1, &m_shadowTexture);
+  glBindTexture(GL_TEXTURE_BUFFER, m_shadowTexture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_shadowBuffer);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  for (int y = 0; y < atlasSize; y += maxTileSize) {
+    for (int x = 0; x < atlasSize; x += maxTileSize) {
+      m_freeTiles[0].push_back(glm::ivec2(x, y));
+    }
+  }
+}
+
+ShadowAtlas::~ShadowAtlas() {
+  glDeleteTextures(1, &m_shadowTexture);
+  glDeleteBuffers(1, &m_shadowBuffer);
+  glDeleteFramebuffers(1, &m_dynamicFramebuffer);
+  glDeleteTextures(1, &m_dynamicTexture);
+  glDeleteFramebuffers(1, &m_staticFramebuffer);
+  glDeleteTextures(1, &m_staticTexture);
+}
+
+std::optional<glm::ivec2> ShadowAtlas::allocate(int level) {
+  std::vector<glm::ivec2> &freeTiles = m_freeTiles[level];
+  if (!freeTiles.empty()) {
+    const glm::ivec2 offset = freeTiles.back();
+    freeTiles.pop_back();
+    return offset;
+  }
+  if (level == 0)
+    return std::nullopt;
+
+  // Split a tile of the level above into four
+  const std::optional<glm::ivec2> parent = allocate(level - 1);
+  if (!parent)
+    return std::nullopt;
+  const int size = tileSize(level);
+  freeTiles.push_back(*parent + glm::ivec2(size, size));
+  freeTiles.push_back(*parent + glm::ivec2(0, size));
+  freeTiles.push_back(*parent + glm::ivec2(size, 0));
+  return *parent;
+}
+
+void ShadowAtlas::release(glm::ivec2 offset, int level) {
+  std::vector<glm::ivec2> &freeTiles = m_freeTiles[level];
+  freeTiles.push_back(offset);
+  if (level == 0)
+    return;
+
+  // Merge the tile with its three siblings when they are all free
+  const int size = tileSize(level);
+  const glm::ivec2 parent = offset - offset % (2 * size);
+  const std::array siblings{parent, parent + glm::ivec2(size, 0),
+                            parent + glm::ivec2(0, size),
+                            parent + glm::ivec2(size, size)};
+  for (const glm::ivec2 &sibling : siblings) {
+    if (std::find(freeTiles.begin(), freeTiles.end(), sibling) ==
+        freeTiles.end())
+      return;
+  }
+  std::erase_if(freeTiles, [&](const glm::ivec2 &tile) {
+    return std::find(siblings.begin(), siblings.end(), tile) !=
+           siblings.end();
+  });
+  release(parent, level - 1);
+}
+
+void ShadowAtlas::update(std::span<const ShadowedLight> lights,
+                         bool dynamicCasters, bool prefilter,
+                         const DrawCasters &drawCasters) {
+  // Lights that were removed give their tiles back
+  for (size_t i = lights.size(); i < m_tiles.size(); i++) {
+    if (m_tiles[i].level >= 0)
+      release(m_tiles[i].offset, m_tiles[i].level);
+  }
+  m_tiles.resize(lights.size());
+
+  // Each factor of 4 less coverage halves the size of the tile. A light keeps
+  // the level of its tile until the coverage is half a level beyond it, so a
+  // coverage close to a boundary does not move the tile back and forth.
+  std::vector<int> wantedLevels(lights.size(), -1);
+  for (size_t i = 0; i < lights.size(); i++) {
+    Tile &tile = m_tiles[i];
+    const float coverage = lights[i].coverage;
+    if (coverage > 0.0f) {
+      const float level = -0.5f * std::log2(std::min(coverage, 1.0f));
+      const int previous = tile.wantedLevel;
+      if (previous >= 0 && level >= float(previous) - 0.5f &&
+          level < float(previous) + 1.5f)
+        wantedLevels[i] = previous;
+      else
+        wantedLevels[i] =
+            static_cast<int>(std::min(std::floor(level), float(levels - 1)));
+    }
+    if (tile.level >= 0 && tile.wantedLevel != wantedLevels[i]) {
+      release(tile.offset, tile.level);
+      tile = Tile{};
+    }
+  }
+
+  // Hand out tiles by coverage, when the atlas runs full a light gets the
+  // largest tile that is still free
+  std::vector<size_t> order(lights.size());
+  std::iota(order.begin(), order.end(), size_t(0));
+  std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+    return lights[lhs].coverage > lights[rhs].coverage;
+  });
+  for (size_t i : order) {
+    Tile &tile = m_tiles[i];
+    if (tile.level >= 0 || wantedLevels[i] < 0)
+      continue;
+    for (int level = wantedLevels[i]; level < levels; level++) {
+      if (const std::optional<glm::ivec2> offset = allocate(level)) {
+        tile.offset = *offset;
+        tile.level = level;
+        tile.wantedLevel = wantedLevels[i];
+        break;
+      }
+    }
+  }
+
+  // Render the static casters of the tiles that are out of date
+  m_renderedTiles = 0;
+  glEnable(GL_SCISSOR_TEST);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_staticFramebuffer);
+  for (size_t i = 0; i < lights.size(); i++) {
+    Tile &tile = m_tiles[i];
+    if (tile.level < 0 || tile.cachedViewProjection == lights[i].viewProjection)
+      continue;
+    const int size = tileSize(tile.level);
+    glViewport(tile.offset.x, tile.offset.y, size, size);
+    glScissor(tile.offset.x, tile.offset.y, size, size);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    drawCasters(lights[i].viewProjection, false);
+    tile.cachedViewProjection = lights[i].viewProjection;
+    tile.momentsCached = false;
+    m_renderedTiles++;
+  }
+
+  // Copy the cached depth and draw the dynamic casters over it
+  m_dynamicCasters = dynamicCasters;
+  if (dynamicCasters) {
+    if (m_dynamicTexture == 0)
+      m_dynamicTexture = createDepthTexture(m_dynamicFramebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_staticFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_dynamicFramebuffer);
+    for (size_t i = 0; i < lights.size(); i++) {
+      const Tile &tile = m_tiles[i];
+      if (tile.level < 0)
+        continue;
+      const int size = tileSize(tile.level);
+      const glm::ivec2 end = tile.offset + size;
+      glViewport(tile.offset.x, tile.offset.y, size, size);
+      glScissor(tile.offset.x, tile.offset.y, size, size);
+      glBlitFramebuffer(tile.offset.x, tile.offset.y, end.x, end.y,
+                        tile.offset.x, tile.offset.y, end.x, end.y,
+                        GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+      drawCasters(lights[i].viewProjection, true);
+    }
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDisable(GL_SCISSOR_TEST);
+
+  // Moments of the tiles whose depth changed, which is all of them when the
+  // dynamic casters are drawn
+  if (prefilter) {
+    if (!m_moments)
+      m_moments.emplace(atlasSize, 1, levels - 1, maxTileSize);
+    bool changed = false;
+    for (Tile &tile : m_tiles) {
+      if (tile.level < 0 || (tile.momentsCached && !dynamicCasters))
+        continue;
+      m_moments->update(dynamicCasters ? m_dynamicTexture : m_staticTexture,
+                        false, 0, tile.offset, tileSize(tile.level));
+      tile.momentsCached = !dynamicCasters;
+      changed = true;
+    }
+    if (changed)
+      m_moments->generateMipmaps();
+  } else {
+    for (Tile &tile : m_tiles)
+      tile.momentsCached = false;
+  }
+
+  m_shadowedLights = 0;
+  m_lightShadows.resize(std::max(lights.size(), size_t(1)));
+  m_lightShadows[0] = LightShadow{};
+  for (size_t i = 0; i < lights.size(); i++) {
+    const Tile &tile = m_tiles[i];
+    LightShadow &shadow = m_lightShadows[i];
+    shadow.viewProjection = lights[i].viewProjection;
+    shadow.tileOffset = glm::vec2(tile.offset) / float(atlasSize);
+    shadow.tileScale =
+        tile.level < 0 ? 0.0f : float(tileSize(tile.level)) / float(atlasSize);
+    if (tile.level >= 0)
+      m_shadowedLights++;
+  }
+  glBindBuffer(GL_TEXTURE_BUFFER, m_shadowBuffer);
+  glBufferData(GL_TEXTURE_BUFFER,
+               static_cast<GLsizeiptr>(m_lightShadows.size() *
+                                       sizeof(LightShadow)),
+               m_lightShadows.data(), GL_STREAM_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void ShadowAtlas::bind(const Shader &shader, GLint firstUnit) const {
+  glActiveTexture(GL_TEXTURE0 + firstUnit);
+  glBindTexture(GL_TEXTURE_2D,
+                m_dynamicCasters ? m_dynamicTexture : m_staticTexture);
+  glUniform1i(shader.getUniformLocation("shadowAtlas"), firstUnit);
+  glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+  glBindTexture(GL_TEXTURE_BUFFER, m_shadowTexture);
+  glUniform1i(shader.getUniformLocation("lightShadows"), firstUnit + 1);
+  glActiveTexture(GL_TEXTURE0);
+  if (m_moments) {
+    m_moments->bind(shader, "shadowAtlasMoments", firstUnit + 2);
+  } else {
+    // Samplers of different types may not share a unit, even when unused
+    glUniform1i(shader.getUniformLocation("shadowAtlasMoments"), firstUnit + 2);
+  }
+}
@@ -0,0 +1,101 @@
+#pragma once
+// Disable compiler warnings in third-party code (which we cannot change).
+#include <framework/disable_all_warnings.h>
+#include <framework/opengl_includes.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include "shadow_moments.h"
+#include <array>
+#include <framework/shader.h>
+#include <functional>
+#include <optional>
+#include <span>
+#include <vector>
+
+// A light that casts shadows into the atlas
+struct ShadowedLight {
+  glm::mat4 viewProjection;
+  // Estimated fraction of the screen the light reaches, in [0, 1]. Picks the
+  // tile size, lights that reach nothing get no tile.
+  float coverage;
+};
+
+// The shadow maps of all lights in one depth texture. Every light gets a
+// square tile whose size follows its coverage, handed out by a buddy
+// allocator so tiles keep their place while the other lights come and go.
+// The depth of the static casters is cached per tile and only rendered again
+// when the matrix of the light or its tile changed. Dynamic casters are drawn
+// every frame over a copy of the cached depth. When prefiltered, the moments
+// of a tile are likewise only computed again when its depth changed.
+class ShadowAtlas {
+public:
+  static constexpr int atlasSize = 4096;
+  static constexpr int maxTileSize = 1024;
+  // Tile sizes from maxTileSize down to maxTileSize >> (levels - 1)
+  static constexpr int levels = 4;
+
+  // Draws the static or the dynamic casters with the given light matrix into
+  // the bound framebuffer
+  using DrawCasters =
+      std::function<void(const glm::mat4 &lightViewProjection, bool dynamic)>;
+
+  ShadowAtlas();
+  ShadowAtlas(const ShadowAtlas &) = delete;
+  ShadowAtlas &operator=(const ShadowAtlas &) = delete;
+  ~ShadowAtlas();
+
+  // Assigns the tiles and renders the ones that are out of date, and their
+  // EVSM moments when prefiltered. Changes the bound framebuffer, viewport,
+  // scissor test and program.
+  void update(std::span<const ShadowedLight> lights, bool dynamicCasters,
+              bool prefilter, const DrawCasters &drawCasters);
+  // Binds the atlas, the buffer texture with the matrix and tile of every
+  // light and the moments to firstUnit and the two units after it
+  void bind(const Shader &shader, GLint firstUnit) const;
+
+  size_t shadowedLights() const { return m_shadowedLights; }
+  size_t renderedTiles() const { return m_renderedTiles; }
+
+private:
+  struct Tile {
+    glm::ivec2 offset{0};
+    int level = -1; // -1 when the light has no tile
+    // Level asked for when the tile was allocated, a smaller tile is kept
+    // until the wanted level changes
+    int wantedLevel = -1;
+    // Light matrix of the cached depth, empty when nothing is cached
+    std::optional<glm::mat4> cachedViewProjection;
+    // Whether the moments match the depth of the tile
+    bool momentsCached = false;
+  };
+  // A light in the layout of the lightShadows buffer texture of frag.glsl
+  struct LightShadow {
+    glm::mat4 viewProjection;
+    glm::vec2 tileOffset; // In texture coordinates of the atlas
+    float tileScale;      // 0 when the light has no tile
+    float padding = 0.0f;
+  };
+
+  static int tileSize(int level) { return maxTileSize >> level; }
+  std::optional<glm::ivec2> allocate(int level);
+  void release(glm::ivec2 offset, int level);
+
+  GLuint m_staticTexture = 0, m_staticFramebuffer = 0;
+  // Static depth with the dynamic casters drawn over it, created when first
+  // needed
+  GLuint m_dynamicTexture = 0, m_dynamicFramebuffer = 0;
+  GLuint m_shadowBuffer = 0, m_shadowTexture = 0;
+  bool m_dynamicCasters = false;
+  // Created when prefiltering is first enabled. The smallest tiles keep 16
+  // texels in the last mip level, so mipmapping never mixes tiles.
+  std::optional<ShadowMoments> m_moments;
+
+  std::array<std::vector<glm::ivec2>, levels> m_freeTiles;
+  std::vector<Tile> m_tiles;
+  std::vector<LightShadow> m_lightShadows;
+
+  size_t m_shadowedLights = 0;
+  size_t m_renderedTiles = 0;
+};
@@ -0,0 +1,190 @@
+#include "shadow_cascades.h"
+DISABLE_WARNINGS_PUSH()
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/vec4.hpp>
+DISABLE_WARNINGS_POP()
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace {
+// Share of the logarithmic split scheme in the splits, the rest is uniform
+constexpr float logarithmicSplitWeight = 0.8f;
+// Mip levels of the moments, down to 128 texels for distant shadows
+constexpr int momentsMaxLevel = 4;
+// The radius of a cascade is rounded up to a multiple of this fraction of the
+// scene radius in light space
+constexpr float radiusStepFraction = 1.0f / 64.0f;
+
+std::array<glm::vec3, 8> boxCorners(const glm::vec3 &min,
+                                    const glm::vec3 &max) {
+  std::array<glm::vec3, 8> corners;
+  for (int i = 0; i < 8; i++) {
+    corners[i] = glm::vec3(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y,
+                           i & 4 ? max.z : min.z);
+  }
+  return corners;
+}
+} // namespace
+
+ShadowCascades::ShadowCascades() {
+  glGenTextures(1, &m_texture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution,
+               resolution, cascadeCount, 0, GL_DEPTH_COMPONENT, GL_FLOAT,
+               nullptr);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  // The layer is attached when it is rendered. No color output, only depth.
+  glGenFramebuffers(1, &m_framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  m_matrices.fill(glm::mat4(1.0f));
+}
+
+ShadowCascades::~ShadowCascades() {
+  glDeleteFramebuffers(1, &m_framebuffer);
+  glDeleteTextures(1, &m_texture);
+}
+
+void ShadowCascades::update(const glm::vec3 &lightDirection,
+                            const glm::mat4 &view, const glm::mat4 &projection,
+                            const glm::vec3 &sceneMin,
+                            const glm::vec3 &sceneMax, bool prefilter,
+                            const DrawCasters &drawCasters) {
+  // Near and far plane of the perspective projection of the camera
+  const float cameraNear = projection[3][2] / (projection[2][2] - 1.0f);
+  const float cameraFar = projection[3][2] / (projection[2][2] + 1.0f);
+
+  // Only the depth range the scene occupies needs shadows
+  const std::array<glm::vec3, 8> sceneCorners = boxCorners(sceneMin, sceneMax);
+  float sceneNear = FLT_MAX, sceneFar = -FLT_MAX;
+  for (const glm::vec3 &corner : sceneCorners) {
+    const float depth = -(view * glm::vec4(corner, 1.0f)).z;
+    sceneNear = std::min(sceneNear, depth);
+    sceneFar = std::max(sceneFar, depth);
+  }
+  const float nearDepth = std::clamp(sceneNear, cameraNear, cameraFar);
+  const float farDepth =
+      std::max(std::clamp(sceneFar, cameraNear, cameraFar), nearDepth + 1e-3f);
+
+  // Practical split scheme, a blend of logarithmic and uniform splits
+  for (int i = 0; i < cascadeCount; i++) {
+    const float t = float(i + 1) / float(cascadeCount);
+    const float logarithmic = nearDepth * std::pow(farDepth / nearDepth, t);
+    const float uniform = nearDepth + (farDepth - nearDepth) * t;
+    m_splits[i] = logarithmicSplitWeight * logarithmic +
+                  (1.0f - logarithmicSplitWeight) * uniform;
+  }
+
+  // Light space is a rotation looking along the light, so the sizes of the
+  // projections do not depend on the position of the camera
+  const glm::vec3 up = std::abs(lightDirection.y) > 0.99f
+                           ? glm::vec3(0.0f, 0.0f, 1.0f)
+                           : glm::vec3(0.0f, 1.0f, 0.0f);
+  const glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), lightDirection, up);
+
+  glm::vec3 sceneLightMin(FLT_MAX), sceneLightMax(-FLT_MAX);
+  for (const glm::vec3 &corner : sceneCorners) {
+    const glm::vec3 lightCorner = glm::vec3(lightView * glm::vec4(corner, 1.0f));
+    sceneLightMin = glm::min(sceneLightMin, lightCorner);
+    sceneLightMax = glm::max(sceneLightMax, lightCorner);
+  }
+  const glm::vec3 sceneLightCenter = 0.5f * (sceneLightMin + sceneLightMax);
+  const float sceneLightRadius = 0.5f * std::max(sceneLightMax.x - sceneLightMin.x,
+                                                 sceneLightMax.y - sceneLightMin.y);
+  const float radiusStep =
+      std::max(sceneLightRadius, 1e-3f) * radiusStepFraction;
+
+  const glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  glViewport(0, 0, resolution, resolution);
+  for (int i = 0; i < cascadeCount; i++) {
+    // Corners of the slice of the camera frustum in light space
+    const float sliceNear = i == 0 ? nearDepth : m_splits[i - 1];
+    const float sliceFar = m_splits[i];
+    std::array<glm::vec3, 8> slice;
+    for (int corner = 0; corner < 8; corner++) {
+      const float depth = corner & 4 ? sliceFar : sliceNear;
+      const float ndcDepth =
+          (-projection[2][2] * depth + projection[3][2]) / depth;
+      const glm::vec4 world =
+          inverseViewProjection * glm::vec4(corner & 1 ? 1.0f : -1.0f,
+                                            corner & 2 ? 1.0f : -1.0f,
+                                            ndcDepth, 1.0f);
+      slice[corner] = glm::vec3(lightView * (world / world.w));
+    }
+
+    // The bounding sphere keeps its size when the camera rotates. The splits
+    // follow the depth range of the scene, which changes with every move of
+    // the camera, so the radius is rounded up to a fixed step. It and the
+    // texel size then only change when the slice grows past a step.
+    glm::vec3 center(0.0f);
+    for (const glm::vec3 &corner : slice)
+      center += corner / 8.0f;
+    float radius = 0.0f;
+    for (const glm::vec3 &corner : slice)
+      radius = std::max(radius, glm::length(corner - center));
+    radius = std::ceil(radius / radiusStep) * radiusStep;
+
+    if (sceneLightRadius < radius) {
+      // The whole scene is smaller than the slice
+      center = sceneLightCenter;
+      radius = sceneLightRadius;
+    } else {
+      // Move the projection in whole texels only
+      const float texelSize = 2.0f * radius / float(resolution);
+      center.x = std::floor(center.x / texelSize) * texelSize;
+      center.y = std::floor(center.y / texelSize) * texelSize;
+    }
+
+    // Light space looks down -z, the depth range covers all casters
+    const glm::mat4 lightProjection =
+        glm::ortho(center.x - radius, center.x + radius, center.y - radius,
+                   center.y + radius, -sceneLightMax.z - 1e-3f,
+                   -sceneLightMin.z + 1e-3f);
+    m_matrices[i] = lightProjection * lightView;
+
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_texture,
+                              0, i);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    drawCasters(m_matrices[i]);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  if (prefilter) {
+    if (!m_moments)
+      m_moments.emplace(resolution, cascadeCount, momentsMaxLevel, resolution);
+    for (int i = 0; i < cascadeCount; i++)
+      m_moments->update(m_texture, true, i, glm::ivec2(0), resolution);
+    m_moments->generateMipmaps();
+  }
+}
+
+void ShadowCascades::bind(const Shader &shader, GLint unit) const {
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+  glUniform1i(shader.getUniformLocation("shadowCascades"), unit);
+  glActiveTexture(GL_TEXTURE0);
+  if (m_moments) {
+    m_moments->bind(shader, "shadowCascadeMoments", unit + 1);
+  } else {
+    // Samplers of different types may not share a unit, even when unused
+    glUniform1i(shader.getUniformLocation("shadowCascadeMoments"), unit + 1);
+  }
+
+  glUniformMatrix4fv(shader.getUniformLocation("cascadeMatrices"),
+                     cascadeCount, GL_FALSE, glm::value_ptr(m_matrices[0]));
+  glUniform4fv(shader.getUniformLocation("cascadeSplits"), 1, m_splits.data());
+}
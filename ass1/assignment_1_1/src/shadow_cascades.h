@@ -0,0 +1,55 @@
+#pragma once
+// Disable compiler warnings in third-party code (which we cannot change).
+#include <framework/disable_all_warnings.h>
+#include <framework/opengl_includes.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+DISABLE_WARNINGS_POP()
+#include "shadow_moments.h"
+#include <array>
+#include <framework/shader.h>
+#include <functional>
+#include <optional>
+
+// Cascaded shadow maps of a directional light. The camera frustum, clipped to
+// the depth range of the scene, is split into slices that grow with the
+// distance, and every slice gets a layer of a depth texture array. The
+// orthographic projection of a layer covers the bounding sphere of its slice
+// (or the scene, when that is smaller). Its radius is rounded up to a fixed
+// step and its center snapped to whole texels, so the shadows do not shimmer
+// when the camera moves. The depth range of every
+// layer spans the whole scene so all casters are included.
+class ShadowCascades {
+public:
+  static constexpr int cascadeCount = 4;
+  static constexpr int resolution = 2048;
+
+  // Draws the casters with the given light matrix into the bound framebuffer
+  using DrawCasters = std::function<void(const glm::mat4 &lightViewProjection)>;
+
+  ShadowCascades();
+  ShadowCascades(const ShadowCascades &) = delete;
+  ShadowCascades &operator=(const ShadowCascades &) = delete;
+  ~ShadowCascades();
+
+  // Fits the cascades to the camera and renders them, and their EVSM moments
+  // when prefiltered. Changes the bound framebuffer, viewport and program.
+  void update(const glm::vec3 &lightDirection, const glm::mat4 &view,
+              const glm::mat4 &projection, const glm::vec3 &sceneMin,
+              const glm::vec3 &sceneMax, bool prefilter,
+              const DrawCasters &drawCasters);
+  // Binds the texture array to unit and the moments to the unit after it,
+  // and sets the matrices and split depths
+  void bind(const Shader &shader, GLint unit) const;
+
+  // View-space depth at which every cascade ends
+  const std::array<float, cascadeCount> &splits() const { return m_splits; }
+
+private:
+  GLuint m_texture = 0, m_framebuffer = 0;
+  // Created when prefiltering is first enabled
+  std::optional<ShadowMoments> m_moments;
+  std::array<glm::mat4, cascadeCount> m_matrices;
+  std::array<float, cascadeCount> m_splits{};
+};
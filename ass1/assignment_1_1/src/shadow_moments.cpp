@@ -0,0 +1,132 @@
+#include "shadow_moments.h"
+#include "program_cache.h"
+#include <algorithm>
+
+namespace {
+GLuint createFramebuffer(GLuint texture, bool layered) {
+  GLuint framebuffer;
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  // The layer of the texture array is attached when it is written
+  if (!layered)
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           texture, 0);
+  glDrawBuffer(GL_COLOR_ATTACHMENT0);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  return framebuffer;
+}
+} // namespace
+
+ShadowMoments::ShadowMoments(int resolution, int layers, int maxLevel,
+                             int maxSize)
+    : m_blurShader(CachedShaderBuilder()
+                       .addStage(GL_VERTEX_SHADER,
+                                 RESOURCE_ROOT "shaders/fullscreen_vertex.glsl")
+                       .addStage(GL_FRAGMENT_SHADER,
+                                 RESOURCE_ROOT "shaders/moments_blur_frag.glsl")
+                       .build()),
+      m_maxSize(maxSize) {
+  // Mipmaps for the filtered lookups, limited to maxLevel so that small tiles
+  // of an atlas keep a few texels and do not blend with their neighbours
+  glGenTextures(1, &m_texture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+  for (int level = 0; level <= maxLevel; level++) {
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA16F,
+                 std::max(resolution >> level, 1),
+                 std::max(resolution >> level, 1), layers, 0, GL_RGBA,
+                 GL_FLOAT, nullptr);
+  }
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, maxLevel);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  // Holds the horizontal pass of one square
+  glGenTextures(1, &m_scratchTexture);
+  glBindTexture(GL_TEXTURE_2D, m_scratchTexture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, maxSize, maxSize, 0, GL_RGBA,
+               GL_FLOAT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  m_framebuffer = createFramebuffer(m_texture, true);
+  m_scratchFramebuffer = createFramebuffer(m_scratchTexture, false);
+  glGenVertexArrays(1, &m_vao);
+}
+
+ShadowMoments::~ShadowMoments() {
+  glDeleteVertexArrays(1, &m_vao);
+  glDeleteFramebuffers(1, &m_scratchFramebuffer);
+  glDeleteFramebuffers(1, &m_framebuffer);
+  glDeleteTextures(1, &m_scratchTexture);
+  glDeleteTextures(1, &m_texture);
+}
+
+void ShadowMoments::update(GLuint depthTexture, bool layered, int layer,
+                           const glm::ivec2 &offset, int size) {
+  size = std::min(size, m_maxSize);
+  m_blurShader.bind();
+  glUniform1i(m_blurShader.getUniformLocation("depthMap"), 0);
+  glUniform1i(m_blurShader.getUniformLocation("depthLayers"), 1);
+  glUniform1i(m_blurShader.getUniformLocation("scratch"), 2);
+  glUniform1i(m_blurShader.getUniformLocation("layered"), layered ? 1 : 0);
+  glUniform1i(m_blurShader.getUniformLocation("layer"), layer);
+  glUniform1i(m_blurShader.getUniformLocation("size"), size);
+  glUniform2f(m_blurShader.getUniformLocation("exponents"), positiveExponent,
+              negativeExponent);
+  glActiveTexture(GL_TEXTURE0 + (layered ? 1 : 0));
+  glBindTexture(layered ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D, depthTexture);
+
+  // The depth test would discard the fullscreen triangle
+  glDisable(GL_DEPTH_TEST);
+  glBindVertexArray(m_vao);
+
+  // Warp and blur horizontally into the corner of the scratch texture
+  glBindFramebuffer(GL_FRAMEBUFFER, m_scratchFramebuffer);
+  glViewport(0, 0, size, size);
+  glUniform1i(m_blurShader.getUniformLocation("pass"), 0);
+  glUniform2i(m_blurShader.getUniformLocation("sourceOffset"), offset.x,
+              offset.y);
+  glUniform2i(m_blurShader.getUniformLocation("targetOffset"), 0, 0);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  // Blur vertically into the square of the moments. The scratch texture is
+  // only bound now, while it is no longer the target.
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_2D, m_scratchTexture);
+  glActiveTexture(GL_TEXTURE0);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_texture, 0,
+                            layer);
+  glViewport(offset.x, offset.y, size, size);
+  glUniform1i(m_blurShader.getUniformLocation("pass"), 1);
+  glUniform2i(m_blurShader.getUniformLocation("sourceOffset"), 0, 0);
+  glUniform2i(m_blurShader.getUniformLocation("targetOffset"), offset.x,
+              offset.y);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindVertexArray(0);
+  glEnable(GL_DEPTH_TEST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ShadowMoments::generateMipmaps() {
+  glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+  glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void ShadowMoments::bind(const Shader &shader, const char *samplerName,
+                         GLint unit) const {
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+  glUniform1i(shader.getUniformLocation(samplerName), unit);
+  glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,43 @@
+#pragma once
+// Disable compiler warnings in third-party code (which we cannot change).
+#include <framework/disable_all_warnings.h>
+#include <framework/opengl_includes.h>
+DISABLE_WARNINGS_PUSH()
+#include <glm/vec2.hpp>
+DISABLE_WARNINGS_POP()
+#include <framework/shader.h>
+
+// Prefiltered exponential variance shadow maps (EVSM). Squares of a depth
+// texture are converted to the moments of their positively and negatively
+// warped depth (RGBA16F), blurred with a separable Gaussian and mipmapped.
+// A fragment then needs a single filtered fetch whatever the softness, and
+// the moments are only computed again when the depth changed.
+class ShadowMoments {
+public:
+  // Limited by the range of 16-bit floats, exp(2 * 5) fits
+  static constexpr float positiveExponent = 5.0f;
+  static constexpr float negativeExponent = 5.0f;
+
+  // A texture array of layers moments maps of resolution squared, with mip
+  // levels up to maxLevel. Squares up to maxSize are converted at once.
+  ShadowMoments(int resolution, int layers, int maxLevel, int maxSize);
+  ShadowMoments(const ShadowMoments &) = delete;
+  ShadowMoments &operator=(const ShadowMoments &) = delete;
+  ~ShadowMoments();
+
+  // Converts the square at offset of a depth texture, or of a layer of a
+  // depth texture array, to blurred moments at the same place. Changes the
+  // bound framebuffer, viewport and program.
+  void update(GLuint depthTexture, bool layered, int layer,
+              const glm::ivec2 &offset, int size);
+  void generateMipmaps();
+  void bind(const Shader &shader, const char *samplerName, GLint unit) const;
+
+private:
+  Shader m_blurShader;
+  GLuint m_texture = 0, m_scratchTexture = 0;
+  GLuint m_framebuffer = 0, m_scratchFramebuffer = 0;
+  // The blur is a fullscreen triangle without vertex attributes
+  GLuint m_vao = 0;
+  int m_maxSize;
+};
@@ -5,6 +5,7 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/gtc/type_ptr.hpp>
 DISABLE_WARNINGS_POP()
 
+#include <program_cache.h>
 #include <render/mesh.h>
 #include <utils/constants.h>
 #include <utils/render_utils.hpp>
@@ -130,7 +131,7 @@ void ParticlesSimulator::deleteFramebuffersAndTextures() {
 void ParticlesSimulator::initShaders() {
   // Simulation shader
   try {
-    ShaderBuilder simulationBuilder;
+    CachedShaderBuilder simulationBuilder;
     simulationBuilder.addStage(GL_VERTEX_SHADER, utils::SHADERS_DIR_PATH /
                                                      "simulation" /
                                                      "screen-quad.vert");
@@ -144,7 +145,7 @@ void ParticlesSimulator::initShaders() {
 
   // Draw shader
   try {
-    ShaderBuilder drawBuilder;
+    CachedShaderBuilder drawBuilder;
     drawBuilder.addStage(GL_VERTEX_SHADER, utils::SHADERS_DIR_PATH /
                                                "simulation" /
                                                "particle-draw.vert");
@@ -158,7 +159,7 @@ void ParticlesSimulator::initShaders() {
 
   // Set initial positions and velocities shader
   try {
-    ShaderBuilder initialPositionBuilder;
+    CachedShaderBuilder initialPositionBuilder;
     initialPositionBuilder.addStage(GL_VERTEX_SHADER, utils::SHADERS_DIR_PATH /
                                                           "simulation" /
                                                           "screen-quad.vert");
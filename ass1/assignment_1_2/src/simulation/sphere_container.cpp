@@ -5,6 +5,7 @@ DISABLE_WARNINGS_PUSH()
 #include <glm/gtc/type_ptr.hpp>
 DISABLE_WARNINGS_POP()
 
+#include <program_cache.h>
 #include <utils/constants.h>
 
 #include <iostream>
@@ -14,7 +15,7 @@ SphereContainer::SphereContainer(const Config& config)
     : config(config)
     , model(utils::RESOURCES_DIR_PATH / "sphere.obj", true) {
     try {
-        ShaderBuilder sphereDrawBuilder;
+        CachedShaderBuilder sphereDrawBuilder;
         sphereDrawBuilder.addStage(GL_VERTEX_SHADER,    utils::SHADERS_DIR_PATH / "sphere-container" / "draw-sphere.vert");
         sphereDrawBuilder.addStage(GL_FRAGMENT_SHADER,  utils::SHADERS_DIR_PATH / "sphere-container" / "draw-sphere.frag");
         drawSpherePass = sphereDrawBuilder.build();
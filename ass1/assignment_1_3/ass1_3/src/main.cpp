@@ -7,6 +7,7 @@ DISABLE_WARNINGS_PUSH()
 #include <imgui/imgui_impl_opengl3.h>
 DISABLE_WARNINGS_POP()
 
+#include "program_cache.h"
 #include "shapes.h"
 #include <framework/shader.h>
 #include <framework/trackball.h>
@@ -158,19 +159,19 @@ int main() {
   // colorShader : creates the final image by aggregating the acummulated
   // samples
   const Shader rasterizeShader =
-      ShaderBuilder()
+      CachedShaderBuilder()
           .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
           .addStage(GL_FRAGMENT_SHADER,
                     RESOURCE_ROOT "shaders/rasterize_primitive.glsl")
           .build();
   const Shader sampleShader =
-      ShaderBuilder()
+      CachedShaderBuilder()
           .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
           .addStage(GL_FRAGMENT_SHADER,
                     RESOURCE_ROOT "shaders/sample_shader.glsl")
           .build();
   const Shader colorShader =
-      ShaderBuilder()
+      CachedShaderBuilder()
           .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
           .addStage(GL_FRAGMENT_SHADER,
                     RESOURCE_ROOT "shaders/color_shader.glsl")
@@ -178,7 +179,7 @@ int main() {
 
   // Load debug shader for showing the intermediate textures.
   const Shader textureShader =
-      ShaderBuilder()
+      CachedShaderBuilder()
           .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
           .addStage(GL_FRAGMENT_SHADER,
                     RESOURCE_ROOT "shaders/texture_shader.glsl")
@@ -0,0 +1,73 @@
+#version 410
+
+// Output in the same layout as the accumulator, the summed weighted colors in
+// rgb and the summed weights in a
+layout(location = 0) out vec4 outColor;
+
+// The accumulator, or the output of the previous pass
+uniform sampler2D accumulator_texture;
+// The rasterized shapes, the filter does not reach across them
+uniform isampler2D rasterized_texture;
+
+uniform ivec2 screen_dimensions;
+// Distance in pixels between the taps of this pass, doubles every pass
+uniform int step_width;
+
+//Set gl_FragCoord to pixel center
+layout(pixel_center_integer) in vec4 gl_FragCoord;
+
+// B-spline weights of the taps along one axis
+const float kernel[3] = float[](0.25, 0.5, 0.25);
+
+// Checks the pixels on the way from one pixel to the other, the first one
+// excluded. Taking at least one pixel per row and column cannot step over
+// shapes rasterized more than a pixel wide.
+bool crosses_shape(ivec2 from, ivec2 to) {
+  ivec2 delta = to - from;
+  int steps = max(abs(delta.x), abs(delta.y));
+  for (int i = 1; i <= steps; i++) {
+    ivec2 pixel = from + ivec2(round(vec2(delta) * float(i) / float(steps)));
+    if (texelFetch(rasterized_texture, pixel, 0).x >= 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// One pass of the a-trous wavelet filter. The taps are summed in accumulator
+// space, so every pixel contributes with the weight of the samples it has
+// taken and pixels without samples contribute nothing. Only the pixels in the
+// same region as this one are used.
+void main()
+{
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  vec4 center = texelFetch(accumulator_texture, pixel, 0);
+
+  // Pixels on a shape lie between the regions on both of its sides
+  if (texelFetch(rasterized_texture, pixel, 0).x >= 0) {
+    outColor = center;
+    return;
+  }
+
+  vec4 sum = vec4(0);
+  float kernel_sum = 0;
+  for (int y = -1; y <= 1; y++) {
+    for (int x = -1; x <= 1; x++) {
+      ivec2 tap = pixel + ivec2(x, y) * step_width;
+      if (any(lessThan(tap, ivec2(0))) ||
+          any(greaterThanEqual(tap, screen_dimensions))) {
+        continue;
+      }
+      if ((x != 0 || y != 0) && crosses_shape(pixel, tap)) {
+        continue;
+      }
+
+      float weight = kernel[x + 1] * kernel[y + 1];
+      sum += weight * texelFetch(accumulator_texture, tap, 0);
+      kernel_sum += weight;
+    }
+  }
+  // The color shader divides by the summed sample weights, normalizing keeps
+  // them in the range of the accumulator
+  outColor = sum / kernel_sum;
+}
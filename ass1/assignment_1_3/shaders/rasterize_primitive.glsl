@@ -2,6 +2,10 @@
 
 // Output for shape id
 layout(location = 0) out int shape_id;
+// Output for the colors on the left and right side of the line at this pixel,
+// as 16 bit fixed point in the order left rgb, right rgb. The colors change
+// little within a pixel, so the sample shader uses these for every hit in it.
+layout(location = 1) out uvec4 boundary;
 
 // Circle and line struct equivalent to the one in shape.h
 struct Circle {
@@ -26,11 +30,21 @@ layout(std140) uniform circleBuffer {
 }
 cb;
 
-layout(std140) uniform lineBuffer {
-  int line_count;
-  Line lines[800];
+// The lines in the layout of the Line struct, 5 texels each. Unlike a uniform
+// block a buffer texture does not limit the number of lines
+uniform samplerBuffer line_data;
+
+Line fetch_line(int index) {
+  vec4 points = texelFetch(line_data, index * 5);
+  Line line;
+  line.start_point = points.xy;
+  line.end_point = points.zw;
+  line.color_left[0] = texelFetch(line_data, index * 5 + 1);
+  line.color_left[1] = texelFetch(line_data, index * 5 + 2);
+  line.color_right[0] = texelFetch(line_data, index * 5 + 3);
+  line.color_right[1] = texelFetch(line_data, index * 5 + 4);
+  return line;
 }
-lb;
 
 // The type of the shape we are rasterizing, the same as the enumerator in
 // shapes.h
@@ -42,61 +56,70 @@ uniform uint shape_type;
 // The maximum distance to the shape for a pixel to be part of the shape
 uniform float rasterize_width;
 
+// Id of the shape whose geometry this fragment belongs to, see
+// rasterize_vertex.glsl
+flat in int instance_id;
+
 void main() {
-  shape_id = -1;
   vec2 pixel_pos = gl_FragCoord.xy;
+  bool inside = false;
+  boundary = uvec4(0);
   // ---- CIRCLE
   if (shape_type == 0) {
-    // Rasterize Circles
-    for (int i = 0; i < cb.circle_count; ++i) {
-      vec2 circlePos = cb.circles[i].position;
-      float radius = cb.circles[i].radius;
-
-      // Compute distance from pixel center to circle center
-      float dist = distance(pixel_pos, circlePos);
-
-      // Check if within (radius - rasterize_width) to (radius +
-      // rasterize_width)
-      if (dist >= (radius - rasterize_width) &&
-          dist <= (radius + rasterize_width)) {
-        shape_id = i; // Assign the first (lowest index) overlapping circle
-        break;        // Exit loop since we need the lowest index
-      }
-    }
+    vec2 circlePos = cb.circles[instance_id].position;
+    float radius = cb.circles[instance_id].radius;
+
+    // Compute distance from pixel center to circle center
+    float dist = distance(pixel_pos, circlePos);
+
+    // Check if within (radius - rasterize_width) to (radius +
+    // rasterize_width)
+    inside = dist >= (radius - rasterize_width) &&
+             dist <= (radius + rasterize_width);
   }
   // ---- LINE
   else if (shape_type == 1) {
-    for (int i = 0; i < lb.line_count; ++i) {
-      Line line = lb.lines[i];
-      vec2 line_dir = line.end_point - line.start_point;
-      float line_length = length(line_dir);
-      vec2 line_dir_norm = normalize(line_dir);
-      vec2 to_pixel = pixel_pos - line.start_point;
-
-      // Project the pixel position onto the line direction
-      float projection = dot(to_pixel, line_dir_norm);
-
-      float dist_to_segment;
-
-      if (projection < 0.0) {
-        // Perpendicular projection falls before the start of the segment
-        dist_to_segment = length(to_pixel);
-      } else if (projection > line_length) {
-        // Perpendicular projection falls after the end of the segment
-        vec2 to_end = pixel_pos - line.end_point;
-        dist_to_segment = length(to_end);
-      } else {
-        // Perpendicular projection falls within the segment
-        vec2 closest_point = line.start_point + line_dir_norm * projection;
-        vec2 perpendicular_vec = pixel_pos - closest_point;
-        dist_to_segment = length(perpendicular_vec);
-      }
-
-      // Check if the distance is within the rasterization width
-      if (dist_to_segment <= rasterize_width) {
-        shape_id = i;
-        break;
-      }
+    Line line = fetch_line(instance_id);
+    vec2 line_dir = line.end_point - line.start_point;
+    float line_length = length(line_dir);
+    vec2 line_dir_norm = normalize(line_dir);
+    vec2 to_pixel = pixel_pos - line.start_point;
+
+    // Project the pixel position onto the line direction
+    float projection = dot(to_pixel, line_dir_norm);
+
+    float dist_to_segment;
+
+    if (projection < 0.0) {
+      // Perpendicular projection falls before the start of the segment
+      dist_to_segment = length(to_pixel);
+    } else if (projection > line_length) {
+      // Perpendicular projection falls after the end of the segment
+      vec2 to_end = pixel_pos - line.end_point;
+      dist_to_segment = length(to_end);
+    } else {
+      // Perpendicular projection falls within the segment
+      vec2 closest_point = line.start_point + line_dir_norm * projection;
+      vec2 perpendicular_vec = pixel_pos - closest_point;
+      dist_to_segment = length(perpendicular_vec);
     }
+
+    // Check if the distance is within the rasterization width
+    inside = dist_to_segment <= rasterize_width;
+
+    // Colors at the pixel center
+    float t = clamp(projection / line_length, 0.0, 1.0);
+    vec3 left = mix(line.color_left[0], line.color_left[1], t).rgb;
+    vec3 right = mix(line.color_right[0], line.color_right[1], t).rgb;
+    boundary = uvec4(packUnorm2x16(left.rg),
+                     packUnorm2x16(vec2(left.b, right.r)),
+                     packUnorm2x16(right.gb), 0u);
   }
-}
\ No newline at end of file
+
+  // Pixels of the geometry that are not part of the shape keep the id of a
+  // shape drawn below, or the -1 the texture is cleared to
+  if (!inside) {
+    discard;
+  }
+  shape_id = instance_id;
+}
@@ -0,0 +1,95 @@
+#version 410
+
+// Expands every shape into geometry covering it, one instance per shape: a
+// quad around each line and a ring around each circle. The fragment shader
+// rasterize_primitive.glsl keeps the pixels that are part of the shape, and the
+// depth test keeps the lowest id where shapes overlap.
+
+// Circle and line struct equivalent to the one in shape.h
+struct Circle {
+  vec4 color;
+  vec2 position;
+  float radius;
+};
+
+struct Line {
+  vec2 start_point;
+  vec2 end_point;
+  vec4 color_left[2];
+  vec4 color_right[2];
+};
+
+layout(std140) uniform circleBuffer {
+  int circle_count;
+  Circle circles[32];
+}
+cb;
+
+// The lines in the layout of the Line struct, 5 texels each. Unlike a uniform
+// block a buffer texture does not limit the number of lines
+uniform samplerBuffer line_data;
+
+Line fetch_line(int index) {
+  vec4 points = texelFetch(line_data, index * 5);
+  Line line;
+  line.start_point = points.xy;
+  line.end_point = points.zw;
+  line.color_left[0] = texelFetch(line_data, index * 5 + 1);
+  line.color_left[1] = texelFetch(line_data, index * 5 + 2);
+  line.color_right[0] = texelFetch(line_data, index * 5 + 3);
+  line.color_right[1] = texelFetch(line_data, index * 5 + 4);
+  return line;
+}
+
+// The type of the shape we are rasterizing, the same as the enumerator in
+// shapes.h
+uniform uint shape_type;
+
+// The maximum distance to the shape for a pixel to be part of the shape
+uniform float rasterize_width;
+
+// Size of the texture rendered to, and the number of instances drawn
+uniform ivec2 screen_dimensions;
+uniform int shape_count;
+
+// Number of quads in a ring, the same as ring_segments in main.cpp
+const int ring_segments = 64;
+
+// Id of the shape, the same for every fragment of the instance
+flat out int instance_id;
+
+void main() {
+  const float M_PI = 3.1415926535897932384626433832795;
+  instance_id = gl_InstanceID;
+
+  // The geometry is grown by a pixel more than the width, so every pixel
+  // center within rasterize_width is inside it
+  float grow = rasterize_width + 1.0;
+  vec2 position;
+  if (shape_type == 0) {
+    // Triangle strip alternating between the inner and outer edge of the ring,
+    // the outer edge is pushed out so its straight pieces contain the circle
+    Circle circle = cb.circles[gl_InstanceID];
+    float angle = 2.0 * M_PI * float(gl_VertexID / 2) / float(ring_segments);
+    float radius = (gl_VertexID & 1) == 0
+                       ? max(circle.radius - grow, 0.0)
+                       : (circle.radius + grow) / cos(M_PI / float(ring_segments));
+    position = circle.position + radius * vec2(cos(angle), sin(angle));
+  } else {
+    // Triangle strip over the 4 corners of the quad
+    Line line = fetch_line(gl_InstanceID);
+    vec2 line_dir = line.end_point - line.start_point;
+    float line_length = length(line_dir);
+    vec2 along = line_length > 0.0 ? line_dir / line_length : vec2(1.0, 0.0);
+    vec2 across = vec2(-along.y, along.x);
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    position = 0.5 * (line.start_point + line.end_point) +
+               along * corner.x * (0.5 * line_length + grow) +
+               across * corner.y * grow;
+  }
+
+  // Lower ids are closer, so they win the depth test
+  float depth = (float(gl_InstanceID) + 0.5) / float(max(shape_count, 1));
+  gl_Position = vec4(position / vec2(screen_dimensions) * 2.0 - 1.0,
+                     depth * 2.0 - 1.0, 1.0);
+}
@@ -0,0 +1,16 @@
+#version 410
+
+// Output for the accumulator, only written for the pixels that are reset
+layout(location = 0) out vec4 outColor;
+
+// 1 for the pixels whose samples are removed
+uniform usampler2D reset_mask;
+
+void main()
+{
+	// Pixels outside the mask keep their samples
+	if (texelFetch(reset_mask, ivec2(gl_FragCoord.xy), 0).r == 0u) {
+		discard;
+	}
+	outColor = vec4(0);
+}
@@ -0,0 +1,210 @@
+#version 430
+
+#define M_PI 3.14159265359f
+
+// Threads per work group, every thread marches one ray at a time
+layout(local_size_x = 64) in;
+
+// Circle and line struct equivalent to the one in shape.h
+struct Circle {
+  vec4 color;
+  vec2 position;
+  float radius;
+};
+
+struct Line {
+  vec2 start_point;
+  vec2 end_point;
+  vec4 color_left[2];
+  vec4 color_right[2];
+};
+
+// The uniform buffers for the shapes containing the count of shapes in the
+// first slot and after that, the actual shapes
+layout(std140) uniform circleBuffer {
+  int circle_count;
+  Circle circles[32];
+}
+cb;
+
+// The lines in the layout of the Line struct, 5 texels each. Unlike a uniform
+// block a buffer texture does not limit the number of lines
+uniform samplerBuffer line_data;
+uniform int line_count;
+
+Line fetch_line(int index) {
+  vec4 points = texelFetch(line_data, index * 5);
+  Line line;
+  line.start_point = points.xy;
+  line.end_point = points.zw;
+  line.color_left[0] = texelFetch(line_data, index * 5 + 1);
+  line.color_left[1] = texelFetch(line_data, index * 5 + 2);
+  line.color_right[0] = texelFetch(line_data, index * 5 + 3);
+  line.color_right[1] = texelFetch(line_data, index * 5 + 4);
+  return line;
+}
+
+// Textures for the rasterized shapes and the colors on both sides of the
+// lines, see rasterize_primitive.glsl
+uniform isampler2D rasterized_texture;
+uniform usampler2D boundary_texture;
+
+// The accumulator, a ray adds its sample to the pixel it starts from. Each
+// pixel has one ray per dispatch, so no two threads write the same pixel.
+layout(rgba32f) uniform image2D accumulator_image;
+
+// The same settings as the sample shader
+uniform uint shape_type;
+uniform uint frame_nr;
+uniform ivec2 screen_dimensions;
+uniform float step_size;
+uniform uint max_raymarch_iter;
+
+// Instrumentation, the number of march steps of every ray and how it ended
+// are stored in ray_stats_image, see sampler_stats.h
+uniform bool instrument;
+layout(rg32i) uniform writeonly iimage2D ray_stats_image;
+
+// How a ray ended, the same as RayOutcome in sampler_stats.h
+#define RAY_HIT 1
+#define RAY_MAX_STEPS 2
+#define RAY_EXIT 3
+
+// Number of steps every thread takes before the threads without a ray take a
+// new one from the queue
+uniform uint steps_per_round;
+
+// Queue of the rays of this dispatch, the pixels of the screen in order. The
+// counter is the index of the next pixel without a ray, it starts at 0.
+layout(std430, binding = 0) buffer rayQueue { uint next_ray; };
+
+// Random number generator outputs numbers between [0-1]
+float get_random_numbers(inout uint seed) {
+  seed = 1664525u * seed + 1013904223u;
+  seed += 1664525u * seed;
+  seed ^= (seed >> 16u);
+  seed += 1664525u * seed;
+  seed ^= (seed >> 16u);
+  return float(seed) * pow(0.5, 32.0);
+}
+
+// Adds the sample of a ray from ray_origin that hit a shape at intersection,
+// the same as the sample shader
+void add_sample(ivec2 pixel, vec2 ray_origin, vec2 intersection) {
+  ivec2 texel_coord = ivec2(intersection);
+  int shape_idx = texelFetch(rasterized_texture, texel_coord, 0).r;
+  vec4 accumulator = imageLoad(accumulator_image, pixel);
+
+  // ---- Circle
+  if (shape_type == 0) {
+    if (shape_idx < 0 || shape_idx >= cb.circle_count) {
+      return;
+    }
+    Circle current_circle = cb.circles[shape_idx];
+    if (distance(intersection, current_circle.position) >=
+        current_circle.radius) {
+      return;
+    }
+    accumulator.rgb += current_circle.color.rgb * current_circle.color.a;
+    accumulator.a += current_circle.color.a;
+  }
+  // ---- Line
+  else {
+    if (shape_idx < 0 || shape_idx >= line_count) {
+      return;
+    }
+    Line line = fetch_line(shape_idx);
+    vec2 start_point = line.start_point;
+    vec2 line_dir = line.end_point - start_point;
+    float line_length = length(line_dir);
+    vec2 to_pixel = intersection - start_point;
+
+    float projection =
+        clamp(dot(to_pixel, line_dir) / line_length, 0.0, line_length);
+    float dist_to_segment =
+        length(to_pixel - line_dir * (projection / line_length));
+    float weight = 1.0 / (dist_to_segment + 0.001);
+
+    vec2 to_origin = ray_origin - start_point;
+    float cross_product = line_dir.x * to_origin.y - line_dir.y * to_origin.x;
+
+    uvec4 boundary = texelFetch(boundary_texture, texel_coord, 0);
+    vec3 line_color;
+    if (cross_product > 0.0) {
+      line_color = vec3(unpackUnorm2x16(boundary.x),
+                        unpackUnorm2x16(boundary.y).x);
+    } else {
+      line_color =
+          vec3(unpackUnorm2x16(boundary.y).y, unpackUnorm2x16(boundary.z));
+    }
+    accumulator.rgb += line_color * weight;
+    accumulator.a += weight;
+  }
+  imageStore(accumulator_image, pixel, accumulator);
+}
+
+// Persistent threads: every thread keeps taking rays from the queue until it
+// is empty. The rays march a few steps at a time, after which the threads
+// whose ray ended take a new one. The threads of a group then keep marching
+// instead of waiting for the longest ray of the group to end.
+void main() {
+  uint ray_count = uint(screen_dimensions.x * screen_dimensions.y);
+
+  // State of the ray of this thread
+  bool active = false;
+  ivec2 pixel;
+  vec2 ray_origin;
+  vec2 direction;
+  vec2 position;
+  uint steps = 0u;
+
+  while (true) {
+    if (!active) {
+      uint ray = atomicAdd(next_ray, 1u);
+      if (ray >= ray_count) {
+        break;
+      }
+      pixel = ivec2(int(ray % uint(screen_dimensions.x)),
+                    int(ray / uint(screen_dimensions.x)));
+      // The pixel center and the random direction of the sample shader
+      ray_origin = vec2(pixel) + 0.5;
+      uint seed = uint(pixel.x) + uint(pixel.y) * uint(screen_dimensions.x) +
+                  frame_nr;
+      float angle = 2.0 * M_PI * get_random_numbers(seed);
+      direction = vec2(cos(angle), sin(angle));
+      position = ray_origin;
+      steps = 0u;
+      active = true;
+    }
+
+    int outcome = 0;
+    for (uint i = 0u; i < steps_per_round && active; ++i) {
+      if (steps >= max_raymarch_iter) {
+        outcome = RAY_MAX_STEPS;
+        break;
+      }
+      steps++;
+      position += direction * step_size;
+
+      if (position.x < 0.0 || position.x >= float(screen_dimensions.x) ||
+          position.y < 0.0 || position.y >= float(screen_dimensions.y)) {
+        outcome = RAY_EXIT;
+        break;
+      }
+
+      int shape_idx = texelFetch(rasterized_texture, ivec2(position), 0).r;
+      int shape_count = shape_type == 0 ? cb.circle_count : line_count;
+      if (shape_idx >= 0 && shape_idx < shape_count) {
+        add_sample(pixel, ray_origin, position);
+        outcome = RAY_HIT;
+        break;
+      }
+    }
+    if (outcome != 0) {
+      active = false;
+      if (instrument) {
+        imageStore(ray_stats_image, pixel, ivec4(int(steps), outcome, 0, 0));
+      }
+    }
+  }
+}
@@ -4,6 +4,15 @@
 
 // Output for accumulated color
 layout(location = 0) out vec4 outColor;
+// Output for the instrumentation, the number of march steps or grid cells of
+// the ray and how it ended. Only kept when the framebuffer has a second
+// attachment, see sampler_stats.h.
+layout(location = 1) out ivec2 ray_stats;
+
+// How a ray ended, the same as RayOutcome in sampler_stats.h
+#define RAY_HIT 1
+#define RAY_MAX_STEPS 2
+#define RAY_EXIT 3
 
 // Circle and line struct equivalent to the one in shape.h
 struct Circle {
@@ -27,14 +36,28 @@ layout(std140) uniform circleBuffer {
 }
 cb;
 
-layout(std140) uniform lineBuffer {
-  int line_count;
-  Line lines[800];
+// The lines in the layout of the Line struct, 5 texels each. Unlike a uniform
+// block a buffer texture does not limit the number of lines
+uniform samplerBuffer line_data;
+uniform int line_count;
+
+Line fetch_line(int index) {
+  vec4 points = texelFetch(line_data, index * 5);
+  Line line;
+  line.start_point = points.xy;
+  line.end_point = points.zw;
+  line.color_left[0] = texelFetch(line_data, index * 5 + 1);
+  line.color_left[1] = texelFetch(line_data, index * 5 + 2);
+  line.color_right[0] = texelFetch(line_data, index * 5 + 3);
+  line.color_right[1] = texelFetch(line_data, index * 5 + 4);
+  return line;
 }
-lb;
 
 // Textures for the rasterized shapes, and the accumulator
 uniform isampler2D rasterized_texture;
+// Colors on both sides of the line in every pixel, see
+// rasterize_primitive.glsl
+uniform usampler2D boundary_texture;
 uniform sampler2D accumulator_texture;
 
 // The type of the shape we are rasterizing, the same as the enumerator in
@@ -54,6 +77,31 @@ uniform float step_size;
 // The maximum amount of raymarching steps we can take
 uniform uint max_raymarch_iter;
 
+// Intersect the lines exactly by walking a uniform grid over the screen,
+// instead of marching over the rasterized texture
+uniform bool exact_traversal;
+// Intersect the Bezier curves directly instead of their lines, only with
+// exact_traversal
+uniform bool native_curves;
+
+// The grid, see segment_grid.h. grid_cells holds the index of the first entry
+// of every cell in grid_segments, followed by the total number of entries.
+// segment_data holds the lines in the layout of the Line struct, 5 texels
+// each, or the curves in the layout of the BezierCurve struct, 6 texels each
+uniform isamplerBuffer grid_cells;
+uniform isamplerBuffer grid_segments;
+uniform samplerBuffer segment_data;
+uniform ivec2 grid_dimensions;
+uniform float grid_cell_size;
+// The grid is in the pixels of the whole image, pixel p that is drawn lies at
+// (p + pixel_offset) / pixel_scale in it. Tiles of the viewer render a part of
+// the image at a finer level this way, the whole image uses 0 and 1.
+uniform vec2 pixel_offset;
+uniform float pixel_scale;
+
+// Number of recently intersected shapes remembered while walking the grid
+#define MAILBOX_SIZE 8
+
 // Random number generator outputs numbers between [0-1]
 float get_random_numbers(inout uint seed) {
   seed = 1664525u * seed + 1013904223u;
@@ -64,16 +112,22 @@ float get_random_numbers(inout uint seed) {
   return float(seed) * pow(0.5, 32.0);
 }
 
-// Ray marching function
-vec2 march_ray(vec2 origin, vec2 direction, float step_size) {
+// Ray marching function, also returns the number of steps taken and how the
+// ray ended
+vec2 march_ray(vec2 origin, vec2 direction, float step_size, out int steps,
+               out int outcome) {
   vec2 current_position = origin;
+  steps = 0;
+  outcome = RAY_MAX_STEPS;
   for (uint i = 0; i < max_raymarch_iter; ++i) {
     current_position += direction * step_size;
+    steps++;
 
     if (current_position.x < 0.0 ||
         current_position.x >= float(screen_dimensions.x) ||
         current_position.y < 0.0 ||
         current_position.y >= float(screen_dimensions.y)) {
+      outcome = RAY_EXIT;
       return vec2(-1.0, -1.0);
     }
 
@@ -81,14 +135,270 @@ vec2 march_ray(vec2 origin, vec2 direction, float step_size) {
     int shape_idx = texelFetch(rasterized_texture, texel_coord, 0).r;
 
     if (shape_type == 0 && shape_idx >= 0 && shape_idx < cb.circle_count) {
+      outcome = RAY_HIT;
       return current_position; // Intersection with circle
-    } else if (shape_type == 1 && shape_idx >= 0 && shape_idx < lb.line_count) {
+    } else if (shape_type == 1 && shape_idx >= 0 && shape_idx < line_count) {
+      outcome = RAY_HIT;
       return current_position; // Intersection with line
     }
   }
   return vec2(-1.0, -1.0); // Indicates no hit
 }
 
+float cross2(vec2 a, vec2 b) { return a.x * b.y - a.y * b.x; }
+
+// Intersects the ray with a line, updates the hit if it is closer
+void intersect_segment(int segment, vec2 origin, vec2 direction,
+                       inout float hit_t, inout float hit_s,
+                       inout bool hit_left, inout int hit_segment) {
+  vec4 points = texelFetch(segment_data, segment * 5);
+  // Solve origin + t * direction = start + s * (end - start)
+  vec2 edge = points.zw - points.xy;
+  float denominator = cross2(direction, edge);
+  if (abs(denominator) < 1e-12) {
+    return;
+  }
+  vec2 to_start = points.xy - origin;
+  float t = cross2(to_start, edge) / denominator;
+  float s = cross2(to_start, direction) / denominator;
+  if (t > 0.0 && t < hit_t && s >= 0.0 && s <= 1.0) {
+    hit_t = t;
+    hit_s = s;
+    // The ray comes from the side the denominator points to
+    hit_left = denominator > 0.0;
+    hit_segment = segment;
+  }
+}
+
+// Value of a*u^3 + b*u^2 + c*u + d
+float cubic(vec4 coefficients, float u) {
+  return ((coefficients.x * u + coefficients.y) * u + coefficients.z) * u +
+         coefficients.w;
+}
+
+// Intersects the ray with a Bezier curve, updates the hit if it is closer.
+// The same as intersect_bezier_curve in segment_grid.cpp: a convex hull
+// rejection, then the roots of the distance from the curve to the ray are
+// found with bracketed Newton steps on every monotonic piece of the cubic.
+void intersect_curve(int curve, vec2 origin, vec2 direction,
+                     inout float hit_t, inout float hit_s,
+                     inout bool hit_left, inout int hit_segment) {
+  vec4 points01 = texelFetch(segment_data, curve * 6);
+  vec4 points23 = texelFetch(segment_data, curve * 6 + 1);
+  vec2 p0 = points01.xy - origin;
+  vec2 p1 = points01.zw - origin;
+  vec2 p2 = points23.xy - origin;
+  vec2 p3 = points23.zw - origin;
+
+  // Signed distances of the control points to the line through the ray
+  vec2 normal = vec2(-direction.y, direction.x);
+  vec4 distances = vec4(dot(normal, p0), dot(normal, p1), dot(normal, p2),
+                        dot(normal, p3));
+  vec4 along = vec4(dot(direction, p0), dot(direction, p1),
+                    dot(direction, p2), dot(direction, p3));
+  float min_distance =
+      min(min(distances.x, distances.y), min(distances.z, distances.w));
+  float max_distance =
+      max(max(distances.x, distances.y), max(distances.z, distances.w));
+  if (all(lessThanEqual(along, vec4(0.0))) || min_distance > 0.0 ||
+      max_distance < 0.0) {
+    return;
+  }
+
+  // The distance in the power basis
+  vec4 coefficients = vec4(
+      -distances.x + 3.0 * distances.y - 3.0 * distances.z + distances.w,
+      3.0 * distances.x - 6.0 * distances.y + 3.0 * distances.z,
+      -3.0 * distances.x + 3.0 * distances.y, distances.x);
+
+  // Split [0, 1] at the extrema of the cubic
+  float bounds[4];
+  int n_bounds = 1;
+  bounds[0] = 0.0;
+  float qa = 3.0 * coefficients.x;
+  float qb = 2.0 * coefficients.y;
+  float discriminant = qb * qb - 4.0 * qa * coefficients.z;
+  if (discriminant >= 0.0) {
+    float q = -0.5 * (qb + (qb < 0.0 ? -1.0 : 1.0) * sqrt(discriminant));
+    float e0 = qa != 0.0 ? q / qa : -1.0;
+    float e1 = q != 0.0 ? coefficients.z / q : -1.0;
+    float first = min(e0, e1);
+    float second = max(e0, e1);
+    if (first > 0.0 && first < 1.0) {
+      bounds[n_bounds++] = first;
+    }
+    if (second > 0.0 && second < 1.0) {
+      bounds[n_bounds++] = second;
+    }
+  }
+  bounds[n_bounds++] = 1.0;
+
+  for (int i = 0; i + 1 < n_bounds; ++i) {
+    float lo = bounds[i];
+    float hi = bounds[i + 1];
+    float f_lo = cubic(coefficients, lo);
+    float f_hi = cubic(coefficients, hi);
+    if ((f_lo > 0.0 && f_hi > 0.0) || (f_lo < 0.0 && f_hi < 0.0)) {
+      continue;
+    }
+
+    float u = f_lo == 0.0 ? lo : 0.5 * (lo + hi);
+    for (int iteration = 0; iteration < 32 && f_lo != 0.0; ++iteration) {
+      float f_u = cubic(coefficients, u);
+      if (f_u == 0.0) {
+        break;
+      }
+      // Keep the root inside [lo, hi]
+      if ((f_u > 0.0) == (f_lo > 0.0)) {
+        lo = u;
+      } else {
+        hi = u;
+      }
+      float derivative = (3.0 * coefficients.x * u + 2.0 * coefficients.y) *
+                             u + coefficients.z;
+      float next = derivative != 0.0 ? u - f_u / derivative : lo;
+      if (!(next > lo && next < hi)) {
+        next = 0.5 * (lo + hi);
+      }
+      bool converged = abs(next - u) < 1e-7;
+      u = next;
+      if (converged) {
+        break;
+      }
+    }
+
+    // Distance along the ray of the point on the curve
+    float s = 1.0 - u;
+    vec2 point = s * s * s * p0 + 3.0 * s * s * u * p1 +
+                 3.0 * s * u * u * p2 + u * u * u * p3;
+    float t = dot(point, direction) / dot(direction, direction);
+    if (t > 0.0 && t < hit_t) {
+      vec2 tangent =
+          s * s * (p1 - p0) + 2.0 * s * u * (p2 - p1) + u * u * (p3 - p2);
+      if (dot(tangent, tangent) < 1e-12) {
+        tangent = p3 - p0;
+      }
+      hit_t = t;
+      hit_s = u;
+      hit_left = cross2(direction, tangent) > 0.0;
+      hit_segment = curve;
+    }
+  }
+}
+
+// Walks the grid cells along the ray with a 2D DDA and intersects the lines or
+// curves of every cell, returns the id of the closest one hit or -1. hit_s is
+// the position of the hit along the line or the curve parameter, hit_left if
+// the ray origin is on the left side. cells is the number of cells visited.
+int trace_grid(vec2 origin, vec2 direction, out float hit_s,
+               out bool hit_left, out int cells) {
+  // Avoid dividing by zero for rays along an axis
+  vec2 step_direction =
+      vec2(abs(direction.x) < 1e-8 ? 1e-8 : direction.x,
+           abs(direction.y) < 1e-8 ? 1e-8 : direction.y);
+
+  ivec2 cell = clamp(ivec2(floor(origin / grid_cell_size)), ivec2(0),
+                     grid_dimensions - 1);
+  ivec2 cell_step = ivec2(step_direction.x > 0.0 ? 1 : -1,
+                          step_direction.y > 0.0 ? 1 : -1);
+  vec2 inverse_direction = 1.0 / step_direction;
+  // Distance along the ray to the next cell boundary in x and y, and between
+  // two boundaries
+  vec2 next_boundary = (vec2(cell) + vec2(max(cell_step, ivec2(0)))) *
+                       grid_cell_size;
+  vec2 t_max = (next_boundary - origin) * inverse_direction;
+  vec2 t_delta = abs(grid_cell_size * inverse_direction);
+
+  // A shape crossing several cells only has to be intersected once
+  int mailbox[MAILBOX_SIZE];
+  for (int i = 0; i < MAILBOX_SIZE; ++i) {
+    mailbox[i] = -1;
+  }
+  int mailbox_next = 0;
+
+  int hit_segment = -1;
+  float hit_t = 1e30;
+  hit_s = 0.0;
+  hit_left = false;
+  cells = 0;
+  while (all(greaterThanEqual(cell, ivec2(0))) &&
+         all(lessThan(cell, grid_dimensions))) {
+    cells++;
+    int cell_index = cell.y * grid_dimensions.x + cell.x;
+    int first = texelFetch(grid_cells, cell_index).r;
+    int last = texelFetch(grid_cells, cell_index + 1).r;
+    for (int i = first; i < last; ++i) {
+      int segment = texelFetch(grid_segments, i).r;
+      bool tested = false;
+      for (int j = 0; j < MAILBOX_SIZE; ++j) {
+        tested = tested || mailbox[j] == segment;
+      }
+      if (tested) {
+        continue;
+      }
+      mailbox[mailbox_next] = segment;
+      mailbox_next = (mailbox_next + 1) % MAILBOX_SIZE;
+
+      if (native_curves) {
+        intersect_curve(segment, origin, direction, hit_t, hit_s, hit_left,
+                        hit_segment);
+      } else {
+        intersect_segment(segment, origin, direction, hit_t, hit_s, hit_left,
+                          hit_segment);
+      }
+    }
+
+    // A shape can cross several cells, the hit only counts once the ray
+    // reached it
+    if (hit_segment >= 0 && hit_t <= min(t_max.x, t_max.y)) {
+      return hit_segment;
+    }
+
+    if (t_max.x < t_max.y) {
+      t_max.x += t_delta.x;
+      cell.x += cell_step.x;
+    } else {
+      t_max.y += t_delta.y;
+      cell.y += cell_step.y;
+    }
+  }
+  // A hit beyond the last cell is outside the screen
+  return -1;
+}
+
+// Sample using the exact grid traversal, the hits lie exactly on the lines or
+// curves. Also returns the number of cells visited and how the ray ended.
+vec4 sample_exact(vec2 ray_origin, vec2 direction, vec4 accumulator,
+                  out int cells, out int outcome) {
+  float s;
+  bool left;
+  int segment = trace_grid(ray_origin, direction, s, left, cells);
+  if (segment < 0) {
+    outcome = RAY_EXIT;
+    return accumulator;
+  }
+  outcome = RAY_HIT;
+
+  // color_left[0], color_left[1], color_right[0], color_right[1] follow the
+  // points, which take 1 texel for a line and 2 for a curve
+  int stride = native_curves ? 6 : 5;
+  int colors = segment * stride + (native_curves ? 2 : 1);
+  vec4 line_color;
+  if (left) {
+    line_color = mix(texelFetch(segment_data, colors),
+                     texelFetch(segment_data, colors + 1), s);
+  } else {
+    line_color = mix(texelFetch(segment_data, colors + 2),
+                     texelFetch(segment_data, colors + 3), s);
+  }
+
+  // Same weight as a marched hit at distance 0 from the line
+  float weight = 1.0 / 0.001;
+  accumulator.rgb += line_color.rgb * weight;
+  accumulator.a += weight;
+  return accumulator;
+}
+
 void main() {
   vec2 ray_origin = vec2(gl_FragCoord.xy);
   uint seed = uint(ray_origin.x) +
@@ -97,13 +407,24 @@ void main() {
   float angle = 2.0 * M_PI * get_random_numbers(seed);
   vec2 direction = vec2(cos(angle), sin(angle));
 
-  vec2 intersection = march_ray(ray_origin, direction, step_size);
-
   ivec2 frag_coord = ivec2(ray_origin);
   vec4 previous_accumulator =
       texture(accumulator_texture,
               frag_coord / vec2(screen_dimensions)); // Use texture() to sample
 
+  int steps;
+  int outcome;
+  if (exact_traversal && shape_type == 1) {
+    outColor = sample_exact((ray_origin + pixel_offset) / pixel_scale,
+                            direction, previous_accumulator, steps, outcome);
+    ray_stats = ivec2(steps, outcome);
+    return;
+  }
+
+  vec2 intersection = march_ray(ray_origin, direction, step_size, steps,
+                                outcome);
+  ray_stats = ivec2(steps, outcome);
+
   vec4 new_accumulator = previous_accumulator;
 
   bool hit = false;
@@ -136,46 +457,35 @@ void main() {
       ivec2 texel_cord = ivec2(intersection);
       int shape_idx = texelFetch(rasterized_texture, texel_cord, 0).r;
 
-      if (shape_idx >= 0 && shape_idx < lb.line_count) {
-        Line current_line = lb.lines[shape_idx];
-        vec2 line_dir = current_line.end_point - current_line.start_point;
+      if (shape_idx >= 0 && shape_idx < line_count) {
+        // Only the end points of the line are read, the colors at this pixel
+        // were found when rasterizing
+        Line line = fetch_line(shape_idx);
+        vec2 start_point = line.start_point;
+        vec2 line_dir = line.end_point - start_point;
         float line_length = length(line_dir);
-        vec2 line_dir_norm = normalize(line_dir);
-        vec2 to_pixel = intersection - current_line.start_point;
-
-        // Project the intersection point onto the line direction
-        float projection = dot(to_pixel, line_dir_norm);
-
-        float dist_to_segment;
-
-        if (projection < 0.0) {
-          // Intersection is before the start of the segment
-          dist_to_segment = length(to_pixel);
-        } else if (projection > line_length) {
-          // Intersection is after the end of the segment
-          vec2 to_end = intersection - current_line.end_point;
-          dist_to_segment = length(to_end);
-        } else {
-          // Intersection is within the segment
-          vec2 closest_point = current_line.start_point + line_dir_norm * projection;
-          vec2 perpendicular_vec = intersection - closest_point;
-          dist_to_segment = length(perpendicular_vec);
-        }
-
+        vec2 to_pixel = intersection - start_point;
+
+        // Distance from the intersection to the segment, the weight favours
+        // the hits closest to the line
+        float projection = clamp(dot(to_pixel, line_dir) / line_length, 0.0,
+                                 line_length);
+        float dist_to_segment =
+            length(to_pixel - line_dir * (projection / line_length));
         float weight = 1.0 / (dist_to_segment + 0.001);
 
-        float t = clamp(projection / line_length, 0.0, 1.0);
-
-
-        vec2 to_origin = ray_origin - current_line.start_point;
+        vec2 to_origin = ray_origin - start_point;
 
         float cross_product = line_dir.x * to_origin.y - line_dir.y * to_origin.x;
 
-        vec4 line_color;
+        uvec4 boundary = texelFetch(boundary_texture, texel_cord, 0);
+        vec3 line_color;
         if (cross_product > 0.0) {
-          line_color = mix(current_line.color_left[0], current_line.color_left[1], t);
+          line_color = vec3(unpackUnorm2x16(boundary.x),
+                            unpackUnorm2x16(boundary.y).x);
         } else {
-          line_color = mix(current_line.color_right[0], current_line.color_right[1], t);
+          line_color = vec3(unpackUnorm2x16(boundary.y).y,
+                            unpackUnorm2x16(boundary.z));
         }
 
         new_accumulator.rgb += line_color.rgb * weight;
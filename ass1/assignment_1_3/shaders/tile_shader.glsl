@@ -0,0 +1,27 @@
+#version 410
+
+// Output for on-screen color
+layout(location = 0) out vec4 outColor;
+
+// Accumulated samples of the tile
+uniform sampler2D accumulator_texture;
+
+// Screen rectangle the tile is drawn in, origin and size in pixels
+uniform vec4 tile_rect;
+
+// Size of the tile in the accumulator, in texels
+uniform int tile_size;
+
+void main()
+{
+  // Position in the tile
+  vec2 tile_coord = (gl_FragCoord.xy - tile_rect.xy) / tile_rect.zw;
+  ivec2 texel_coord = clamp(ivec2(tile_coord * float(tile_size)), ivec2(0), ivec2(tile_size - 1));
+  vec4 accumulator_color = texelFetch(accumulator_texture, texel_coord, 0);
+
+  // Without samples the coarser tile drawn below stays visible
+  if (accumulator_color.a == 0) {
+    discard;
+  }
+  outColor = vec4(accumulator_color.rgb / accumulator_color.a, 1);
+}
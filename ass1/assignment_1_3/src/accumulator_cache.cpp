@@ -0,0 +1,199 @@
+#include "accumulator_cache.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+
+size_t AccumulatorKeyHash::operator()(const AccumulatorKey& key) const {
+	//Combine the hashes of the fields, the floats by their bits
+	size_t hash = 0;
+	auto combine = [&](size_t value) { hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2); };
+	combine((size_t)key.shape);
+	combine((size_t)key.solver);
+	combine((size_t)key.multigrid_cycles);
+	combine(std::bit_cast<uint32_t>(key.rasterize_width));
+	combine(std::bit_cast<uint32_t>(key.step_size));
+	combine(key.max_raymarch_iters);
+	combine((size_t)key.exact_traversal << 1 | (size_t)key.native_curves);
+	return hash;
+}
+
+AccumulatorKey AccumulatorKey::normalized() const {
+	AccumulatorKey key = *this;
+	//Circles are always ray marched, the multigrid solver only solves curves
+	if (key.shape != Shape::Line) {
+		key.solver = 0;
+		key.exact_traversal = false;
+	}
+	if (key.solver != 1) key.multigrid_cycles = 0;
+	//Only marched rays read the rasterized shapes and take steps
+	if (key.solver == 1 || key.exact_traversal) {
+		key.rasterize_width = 0.0f;
+		key.step_size = 0.0f;
+		key.max_raymarch_iters = 0;
+	}
+	if (key.solver == 1) key.exact_traversal = false;
+	if (!key.exact_traversal) key.native_curves = false;
+	return key;
+}
+
+AccumulatorCache::AccumulatorCache(glm::ivec2 resolution, size_t budget_bytes)
+	: resolution(resolution), max_accumulators(std::max(budget_bytes / bytes_per_accumulator(), (size_t)1)) {
+}
+
+AccumulatorCache::~AccumulatorCache() {
+	clear();
+	for (Accumulator& accumulator : free_accumulators) {
+		glDeleteFramebuffers(1, &accumulator.rasterized_shape_buffer);
+		glDeleteFramebuffers(1, &accumulator.accumulator_buffer);
+		glDeleteTextures(1, &accumulator.texRasterized);
+		glDeleteTextures(1, &accumulator.texBoundary);
+		glDeleteRenderbuffers(1, &accumulator.rasterized_depth);
+		glDeleteTextures(1, &accumulator.texAccumulator);
+	}
+}
+
+Accumulator& AccumulatorCache::get(const AccumulatorKey& key) {
+	//The edit of the settings is finished once they are cached, the scratch accumulator of other settings is not needed anymore
+	if (scratch_accumulator && scratch_accumulator->first != key) drop_scratch();
+
+	auto it = lookup.find(key);
+	if (it != lookup.end()) {
+		accumulators.splice(accumulators.begin(), accumulators, it->second);
+		return it->second->second;
+	}
+
+	//Make room by freeing the least recently used accumulator
+	if (accumulators.size() >= max_accumulators) {
+		lookup.erase(accumulators.back().first);
+		free_accumulators.push_back(std::move(accumulators.back().second));
+		accumulators.pop_back();
+	}
+
+	//Settings that were edited into the scratch accumulator keep its samples, others start empty
+	Accumulator accumulator;
+	if (scratch_accumulator && scratch_accumulator->first == key) {
+		accumulator = std::move(scratch_accumulator->second);
+		scratch_accumulator.reset();
+	} else {
+		accumulator = take_free_accumulator();
+		reset_accumulator(accumulator);
+	}
+
+	accumulators.emplace_front(key, std::move(accumulator));
+	lookup[key] = accumulators.begin();
+	return accumulators.front().second;
+}
+
+Accumulator& AccumulatorCache::scratch(const AccumulatorKey& key) {
+	auto it = lookup.find(key);
+	if (it != lookup.end()) return it->second->second;
+
+	if (!scratch_accumulator || scratch_accumulator->first != key) {
+		Accumulator accumulator = scratch_accumulator ? std::move(scratch_accumulator->second) : take_free_accumulator();
+		reset_accumulator(accumulator);
+		scratch_accumulator.emplace(key, std::move(accumulator));
+	}
+	return scratch_accumulator->second;
+}
+
+void AccumulatorCache::clear() {
+	for (auto& [key, accumulator] : accumulators) {
+		free_accumulators.push_back(std::move(accumulator));
+	}
+	accumulators.clear();
+	lookup.clear();
+	drop_scratch();
+}
+
+void AccumulatorCache::clear_except(const AccumulatorKey& key) {
+	if (scratch_accumulator && scratch_accumulator->first != key) drop_scratch();
+	for (auto it = accumulators.begin(); it != accumulators.end();) {
+		if (it->first == key) {
+			++it;
+			continue;
+		}
+		lookup.erase(it->first);
+		free_accumulators.push_back(std::move(it->second));
+		it = accumulators.erase(it);
+	}
+}
+
+//R32I ids, RGBA32UI boundary colors, 24 bit depth stored in 32 bits and the RGBA32F accumulator
+size_t AccumulatorCache::bytes_per_accumulator() const {
+	return (size_t)resolution.x * (size_t)resolution.y * (4 + 16 + 4 + 16);
+}
+
+void AccumulatorCache::drop_scratch() {
+	if (!scratch_accumulator) return;
+	free_accumulators.push_back(std::move(scratch_accumulator->second));
+	scratch_accumulator.reset();
+}
+
+//Takes the textures of a cleared accumulator, or makes new ones
+Accumulator AccumulatorCache::take_free_accumulator() {
+	if (free_accumulators.empty()) return create_accumulator();
+	Accumulator accumulator = std::move(free_accumulators.back());
+	free_accumulators.pop_back();
+	return accumulator;
+}
+
+//Creates the textures and framebuffers of an accumulator, the rasterize framebuffer writes the ids and the boundary colors with a depth buffer
+Accumulator AccumulatorCache::create_accumulator() const {
+	Accumulator accumulator;
+
+	glGenTextures(1, &accumulator.texRasterized);
+	glBindTexture(GL_TEXTURE_2D, accumulator.texRasterized);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32I, resolution.x, resolution.y, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glGenTextures(1, &accumulator.texBoundary);
+	glBindTexture(GL_TEXTURE_2D, accumulator.texBoundary);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32UI, resolution.x, resolution.y, 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glGenTextures(1, &accumulator.texAccumulator);
+	glBindTexture(GL_TEXTURE_2D, accumulator.texAccumulator);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, resolution.x, resolution.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &accumulator.rasterized_shape_buffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, accumulator.rasterized_shape_buffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumulator.texRasterized, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, accumulator.texBoundary, 0);
+	const GLenum draw_buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, draw_buffers);
+	glGenRenderbuffers(1, &accumulator.rasterized_depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, accumulator.rasterized_depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, resolution.x, resolution.y);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, accumulator.rasterized_depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &accumulator.accumulator_buffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, accumulator.accumulator_buffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumulator.texAccumulator, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	return accumulator;
+}
+
+//Removes the samples of the previous owner of the textures
+void AccumulatorCache::reset_accumulator(Accumulator& accumulator) const {
+	accumulator.rasterized = false;
+	accumulator.frame_nr = 0;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, accumulator.accumulator_buffer);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "shapes.h"
+
+#include <framework/opengl_includes.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <list>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// The settings of the menu the rasterized shapes and the accumulated samples depend on, samples taken with equal settings can be added up
+struct AccumulatorKey {
+	Shape shape;
+	int solver;
+	int multigrid_cycles;
+	float rasterize_width;
+	float step_size;
+	unsigned int max_raymarch_iters;
+	bool exact_traversal;
+	bool native_curves;
+
+	// The key with the settings the active solver does not use set to 0, so changing those keeps the samples
+	AccumulatorKey normalized() const;
+
+	bool operator==(const AccumulatorKey& other) const = default;
+};
+
+struct AccumulatorKeyHash {
+	size_t operator()(const AccumulatorKey& key) const;
+};
+
+// Rasterized shapes and accumulated samples of the whole window for one set of settings
+struct Accumulator {
+	GLuint texRasterized = 0;
+	GLuint texBoundary = 0;
+	GLuint rasterized_depth = 0;
+	GLuint rasterized_shape_buffer = 0;
+	GLuint texAccumulator = 0;
+	GLuint accumulator_buffer = 0;
+
+	// False until the shapes are rasterized, and the multigrid solution is found if that solver is used
+	bool rasterized = false;
+	// Width the lines were rasterized with, the key leaves it out when the samples do not depend on it
+	float rasterized_width = 0.0f;
+	// Frame number of the next sample, so resuming continues the random sequence
+	unsigned int frame_nr = 0;
+};
+
+// Least recently used cache of accumulators, so switching back to earlier settings continues from the samples taken with them.
+// The number of accumulators follows from a budget of video memory, at least one is always kept. Settings that are still being
+// edited use one more scratch accumulator outside the budget.
+class AccumulatorCache {
+public:
+	AccumulatorCache(glm::ivec2 resolution, size_t budget_bytes);
+	AccumulatorCache(const AccumulatorCache&) = delete;
+	AccumulatorCache& operator=(const AccumulatorCache&) = delete;
+	~AccumulatorCache();
+
+	/// <summary>
+	/// Looks up the accumulator of a set of settings and marks it as used, if it is not cached an empty one is added for it
+	/// </summary>
+	/// <param name="key">The settings to get the accumulator of</param>
+	/// <returns>The accumulator, with rasterized false and no samples if it was not cached</returns>
+	Accumulator& get(const AccumulatorKey& key);
+
+	/// <summary>
+	/// Gets an accumulator for settings that are still being edited, such as those passed while dragging a slider. Only one
+	/// is kept and no cached accumulator is evicted for it, a later get with the same key moves it into the cache with its samples.
+	/// </summary>
+	/// <param name="key">The settings to get the accumulator of</param>
+	/// <returns>The cached accumulator of key, or else the scratch accumulator, reset if it was used for other settings</returns>
+	Accumulator& scratch(const AccumulatorKey& key);
+
+	// Drops all accumulators and the scratch accumulator, for when the shapes change. The textures are kept for new accumulators.
+	void clear();
+	// Drops all accumulators except the one of key, cached or scratch, for when the shapes change and that accumulator is updated for it
+	void clear_except(const AccumulatorKey& key);
+
+	size_t size() const { return accumulators.size(); }
+	size_t capacity() const { return max_accumulators; }
+	// Video memory of the textures of one accumulator
+	size_t bytes_per_accumulator() const;
+
+private:
+	void drop_scratch();
+	Accumulator take_free_accumulator();
+	Accumulator create_accumulator() const;
+	void reset_accumulator(Accumulator& accumulator) const;
+
+	glm::ivec2 resolution;
+	size_t max_accumulators;
+
+	// Most recently used accumulator first
+	std::list<std::pair<AccumulatorKey, Accumulator>> accumulators;
+	std::unordered_map<AccumulatorKey, std::list<std::pair<AccumulatorKey, Accumulator>>::iterator, AccumulatorKeyHash> lookup;
+	// Accumulator of the settings being edited
+	std::optional<std::pair<AccumulatorKey, Accumulator>> scratch_accumulator;
+	// Textures of cleared accumulators
+	std::vector<Accumulator> free_accumulators;
+};
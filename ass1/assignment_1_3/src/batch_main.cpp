@@ -0,0 +1,429 @@
+// Headless batch renderer for diffusion curve files, renders on the CPU so no
+// OpenGL context (or window) is needed.
+#include "cpu_renderer.h"
+#include "curve_cache.h"
+#include "image_io.h"
+#include "multigrid.h"
+#include "region_renderer.h"
+#include "shapes.h"
+#include "walk_on_spheres.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Solvers available on the CPU
+enum class Solver { MonteCarlo, Multigrid, WalkOnSpheres };
+
+// Everything that can be set on the command line
+struct BatchSettings {
+  std::vector<std::filesystem::path> inputs;
+  std::filesystem::path output_dir = ".";
+  std::string format = "png";
+  glm::ivec2 resolution{512, 512};
+  Solver solver = Solver::MonteCarlo;
+  // Samples (or walks) per pixel for Monte Carlo and walk on spheres,
+  // V-cycles for multigrid
+  unsigned int samples = 256;
+  int max_curve_subdivision = max_linearize_depth;
+  // Maximum distance in pixels between a curve and its lines
+  float curve_tolerance = 0.25f;
+  MarchSettings march;
+  // Intersect the Bezier curves directly instead of linearizing them, only
+  // with Monte Carlo
+  bool native_curves = false;
+  WalkSettings walk;
+  // Number of files rendered at the same time, 0 picks based on the number of
+  // files and hardware threads
+  unsigned int jobs = 0;
+  // Folder with preprocessed curve files, empty to always parse the XML
+  std::filesystem::path cache_folder = default_curve_cache_folder();
+  // Render the image in tiles of this size that are streamed to the file, so
+  // memory per pixel does not grow with the resolution. 0 renders the whole
+  // image at once
+  int tile_size = 0;
+};
+
+void print_usage(const char *program) {
+  std::cout
+      << "Usage: " << program << " [options] <file.xml | folder | @list.txt>...\n"
+      << "  -o, --output <dir>        output folder (default .)\n"
+      << "  -f, --format <png|exr>    output format (default png)\n"
+      << "  -r, --resolution <WxH>    output resolution (default 512x512)\n"
+      << "  -s, --samples <n>         samples per pixel, or V-cycles for "
+         "multigrid (default 256)\n"
+      << "      --solver <montecarlo|multigrid|walkonspheres>\n"
+      << "      --step-size <f>       ray marching step size (default 0.05)\n"
+      << "      --max-iters <n>       maximum ray marching steps (default "
+         "10000)\n"
+      << "      --width <f>           rasterize width (default 0.75)\n"
+      << "      --exact               intersect the lines exactly through a "
+         "uniform grid instead of ray marching\n"
+      << "      --cell-size <f>       grid cell size for --exact and --curves "
+         "(default 8)\n"
+      << "      --curves              intersect the Bezier curves directly, "
+         "without linearizing them\n"
+      << "      --subdivision <n>     maximum curve subdivision (default 30)\n"
+      << "      --tolerance <f>       curve flattening tolerance in pixels "
+         "(default 0.25)\n"
+      << "      --epsilon <f>         walk on spheres hit distance (default "
+         "0.01)\n"
+      << "  -t, --tile <n>            render in tiles of n pixels, streamed to "
+         "an exr file, with --exact, --curves or walkonspheres\n"
+      << "  -j, --jobs <n>            files rendered concurrently\n"
+      << "      --cache <dir>         preprocessed curve cache folder\n"
+      << "      --no-cache            always parse the XML files\n";
+}
+
+// Adds a command line input to the file list, folders add all their xml files
+// and @file adds every line of the file
+void add_input(std::vector<std::filesystem::path> &inputs,
+               const std::string &input) {
+  if (!input.empty() && input[0] == '@') {
+    std::ifstream list(input.substr(1));
+    std::string line;
+    while (std::getline(list, line)) {
+      if (!line.empty())
+        add_input(inputs, line);
+    }
+  } else if (std::filesystem::is_directory(input)) {
+    std::vector<std::filesystem::path> folder_files;
+    for (const auto &entry : std::filesystem::directory_iterator(input)) {
+      if (entry.path().extension() == ".xml")
+        folder_files.push_back(entry.path());
+    }
+    std::sort(folder_files.begin(), folder_files.end());
+    inputs.insert(inputs.end(), folder_files.begin(), folder_files.end());
+  } else {
+    inputs.push_back(input);
+  }
+}
+
+bool parse_arguments(int argc, char **argv, BatchSettings &settings) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    // Options take a value unless they are flags
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc)
+        throw std::invalid_argument("missing value for " + arg);
+      return argv[++i];
+    };
+
+    if (arg == "-h" || arg == "--help") {
+      return false;
+    } else if (arg == "-o" || arg == "--output") {
+      settings.output_dir = value();
+    } else if (arg == "-f" || arg == "--format") {
+      settings.format = value();
+      if (settings.format != "png" && settings.format != "exr")
+        throw std::invalid_argument("unknown format " + settings.format);
+    } else if (arg == "-r" || arg == "--resolution") {
+      std::string res = value();
+      size_t split = res.find('x');
+      settings.resolution.x = std::stoi(res.substr(0, split));
+      settings.resolution.y = split == std::string::npos
+                                  ? settings.resolution.x
+                                  : std::stoi(res.substr(split + 1));
+    } else if (arg == "-s" || arg == "--samples") {
+      settings.samples = (unsigned int)std::stoul(value());
+    } else if (arg == "--solver") {
+      std::string solver = value();
+      if (solver == "montecarlo")
+        settings.solver = Solver::MonteCarlo;
+      else if (solver == "multigrid")
+        settings.solver = Solver::Multigrid;
+      else if (solver == "walkonspheres")
+        settings.solver = Solver::WalkOnSpheres;
+      else
+        throw std::invalid_argument("unknown solver " + solver);
+    } else if (arg == "--step-size") {
+      settings.march.step_size = std::stof(value());
+    } else if (arg == "--max-iters") {
+      settings.march.max_raymarch_iters = (unsigned int)std::stoul(value());
+    } else if (arg == "--width") {
+      settings.march.rasterize_width = std::stof(value());
+    } else if (arg == "--exact") {
+      settings.march.exact_traversal = true;
+    } else if (arg == "--curves") {
+      settings.native_curves = true;
+    } else if (arg == "--cell-size") {
+      settings.march.grid_cell_size = std::stof(value());
+    } else if (arg == "--epsilon") {
+      settings.walk.epsilon = std::stof(value());
+    } else if (arg == "--tolerance") {
+      settings.curve_tolerance = std::stof(value());
+    } else if (arg == "--subdivision") {
+      settings.max_curve_subdivision = std::stoi(value());
+    } else if (arg == "-t" || arg == "--tile") {
+      settings.tile_size = std::stoi(value());
+    } else if (arg == "-j" || arg == "--jobs") {
+      settings.jobs = (unsigned int)std::stoul(value());
+    } else if (arg == "--cache") {
+      settings.cache_folder = value();
+    } else if (arg == "--no-cache") {
+      settings.cache_folder.clear();
+    } else if (!arg.empty() && arg[0] == '-') {
+      throw std::invalid_argument("unknown option " + arg);
+    } else {
+      add_input(settings.inputs, arg);
+    }
+  }
+  // PNG files cannot be written in parts
+  if (settings.tile_size > 0 && settings.format != "exr")
+    throw std::invalid_argument("tiled rendering only writes exr files");
+  // Tiles see all curves through a grid or BVH of the whole image, ray
+  // marching would need the rasterized lines of the whole image and multigrid
+  // solves the whole image at once
+  if (settings.tile_size > 0 &&
+      (settings.solver == Solver::Multigrid ||
+       (settings.solver == Solver::MonteCarlo &&
+        !settings.march.exact_traversal && !settings.native_curves)))
+    throw std::invalid_argument(
+        "tiled rendering needs --exact, --curves or walkonspheres");
+  if (settings.native_curves && settings.solver != Solver::MonteCarlo)
+    throw std::invalid_argument("--curves only works with montecarlo");
+  return !settings.inputs.empty() && settings.resolution.x > 0 &&
+         settings.resolution.y > 0;
+}
+
+// Renders the lines with the selected solver
+std::vector<glm::vec3> render_lines(std::span<const Line> lines,
+                                    glm::ivec2 resolution,
+                                    const BatchSettings &settings,
+                                    unsigned int n_threads) {
+  if (settings.solver == Solver::MonteCarlo) {
+    // Exact traversal does not need the rasterized lines
+    std::vector<int> shape_ids;
+    if (!settings.march.exact_traversal)
+      rasterize_lines_cpu(shape_ids, lines, resolution,
+                          settings.march.rasterize_width);
+    std::vector<glm::vec4> accumulator;
+    sample_monte_carlo_cpu(accumulator, lines, shape_ids, resolution,
+                           settings.march, 0, settings.samples, n_threads);
+    return resolve_accumulator(accumulator);
+  } else if (settings.solver == Solver::WalkOnSpheres) {
+    SegmentBVH bvh(lines);
+    std::vector<glm::vec4> accumulator;
+    sample_walk_on_spheres(accumulator, lines, bvh, resolution, settings.walk,
+                           0, settings.samples, n_threads);
+    return resolve_accumulator(accumulator);
+  } else {
+    ColorConstraints constraints;
+    rasterize_color_constraints(constraints, lines, resolution);
+    std::vector<glm::vec4> image;
+    solve_multigrid(image, constraints, (int)settings.samples);
+    return resolve_accumulator(image);
+  }
+}
+
+// Renders the Bezier curves with Monte Carlo, intersecting them without
+// linearizing
+std::vector<glm::vec3> render_curves(std::span<const BezierCurve> curves,
+                                     glm::ivec2 resolution,
+                                     const BatchSettings &settings,
+                                     unsigned int n_threads) {
+  std::vector<glm::vec4> accumulator;
+  sample_monte_carlo_curves_cpu(accumulator, curves, resolution,
+                                settings.march, 0, settings.samples,
+                                n_threads);
+  return resolve_accumulator(accumulator);
+}
+
+// Curves and lines of a file. They point into the cache mapping, or into the
+// vectors when the cache is off
+struct LoadedCurves {
+  CachedCurves cached;
+  std::vector<BezierCurve> loaded_curves;
+  std::vector<Line> loaded_lines;
+  std::span<const BezierCurve> curves;
+  std::span<const Line> lines;
+};
+
+// Loads the curves of a file and, unless the curves are rendered natively,
+// their lines. The solvers read them straight from the cache mapping
+void load_curves(LoadedCurves &loaded, const std::filesystem::path &input,
+                 const BatchSettings &settings, unsigned int n_threads) {
+  if (!settings.cache_folder.empty()) {
+    loaded.cached = load_curves_cached(
+        input, settings.cache_folder, settings.resolution,
+        settings.curve_tolerance, settings.max_curve_subdivision);
+    loaded.curves = loaded.cached.curves;
+    loaded.lines = loaded.cached.lines;
+  } else {
+    load_Bezier_curves(loaded.loaded_curves, input.string().c_str(),
+                       settings.resolution);
+    if (!settings.native_curves)
+      linearize_bezier_curves(loaded.loaded_lines, loaded.loaded_curves,
+                              settings.curve_tolerance,
+                              settings.max_curve_subdivision, n_threads);
+    loaded.curves = loaded.loaded_curves;
+    loaded.lines = loaded.loaded_lines;
+  }
+}
+
+// Renders a file tile by tile, every tile is written to the file before the
+// next one starts. The tiles see all curves of the image through a grid or
+// BVH built once, so the file is the same as the image rendered at once.
+// Returns the timings as text
+std::string render_file_tiled(const std::filesystem::path &input,
+                              const std::filesystem::path &output,
+                              const BatchSettings &settings,
+                              unsigned int n_threads) {
+  using clock = std::chrono::steady_clock;
+  auto elapsed_ms = [](clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(clock::now() - start)
+        .count();
+  };
+
+  auto start = clock::now();
+  LoadedCurves loaded;
+  load_curves(loaded, input, settings, n_threads);
+  RegionMethod method = settings.native_curves ? RegionMethod::Curves
+                        : settings.solver == Solver::WalkOnSpheres
+                            ? RegionMethod::WalkOnSpheres
+                            : RegionMethod::Lines;
+  RegionRenderer renderer(method, loaded.lines, loaded.curves,
+                          settings.resolution, settings.march.grid_cell_size,
+                          settings.walk);
+  double load_ms = elapsed_ms(start);
+
+  start = clock::now();
+  ExrTileWriter writer(output, settings.resolution, settings.tile_size);
+  glm::ivec2 tile_count = writer.tile_count();
+  bool written = true;
+  for (int tile_y = 0; tile_y < tile_count.y && written; tile_y++) {
+    for (int tile_x = 0; tile_x < tile_count.x && written; tile_x++) {
+      glm::ivec2 tile_min, tile_max;
+      writer.tile_region({tile_x, tile_y}, tile_min, tile_max);
+      written = writer.write_tile(
+          {tile_x, tile_y},
+          renderer.render(tile_min, tile_max, settings.samples, n_threads));
+    }
+  }
+  written = written && writer.finish();
+  double render_ms = elapsed_ms(start);
+
+  if (!written)
+    throw std::runtime_error("could not write " + output.string());
+
+  char timings[256];
+  std::snprintf(timings, sizeof(timings),
+                "%d tiles, %zu %s, load %.1f ms%s, render and write %.1f ms",
+                tile_count.x * tile_count.y,
+                settings.native_curves ? loaded.curves.size()
+                                       : loaded.lines.size(),
+                settings.native_curves ? "curves" : "lines", load_ms,
+                loaded.cached.from_cache ? " (cached)" : "", render_ms);
+  return output.string() + ": " + timings;
+}
+
+// Renders a single diffusion curve file and writes the image, returns the
+// timings of the steps as text
+std::string render_file(const std::filesystem::path &input,
+                        const BatchSettings &settings,
+                        unsigned int n_threads) {
+  std::filesystem::path output =
+      settings.output_dir / input.filename().replace_extension(settings.format);
+  if (settings.tile_size > 0)
+    return render_file_tiled(input, output, settings, n_threads);
+
+  using clock = std::chrono::steady_clock;
+  auto elapsed_ms = [](clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(clock::now() - start)
+        .count();
+  };
+
+  auto start = clock::now();
+  LoadedCurves loaded;
+  load_curves(loaded, input, settings, n_threads);
+  double load_ms = elapsed_ms(start);
+
+  start = clock::now();
+  std::vector<glm::vec3> colors =
+      settings.native_curves
+          ? render_curves(loaded.curves, settings.resolution, settings,
+                          n_threads)
+          : render_lines(loaded.lines, settings.resolution, settings,
+                         n_threads);
+  double render_ms = elapsed_ms(start);
+
+  start = clock::now();
+  bool written = settings.format == "exr"
+                     ? write_exr(output, colors, settings.resolution)
+                     : write_png(output, colors, settings.resolution);
+  double write_ms = elapsed_ms(start);
+
+  if (!written)
+    throw std::runtime_error("could not write " + output.string());
+
+  char timings[256];
+  std::snprintf(timings, sizeof(timings),
+                "%zu %s, load %.1f ms%s, render %.1f ms, write %.1f ms",
+                settings.native_curves ? loaded.curves.size()
+                                       : loaded.lines.size(),
+                settings.native_curves ? "curves" : "lines", load_ms,
+                loaded.cached.from_cache ? " (cached)" : "", render_ms,
+                write_ms);
+  return output.string() + ": " + timings;
+}
+
+int main(int argc, char **argv) {
+  BatchSettings settings;
+  try {
+    if (!parse_arguments(argc, argv, settings)) {
+      print_usage(argv[0]);
+      return 1;
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    print_usage(argv[0]);
+    return 1;
+  }
+  std::filesystem::create_directories(settings.output_dir);
+
+  // Split the hardware threads over the files rendered at the same time, the
+  // remaining threads are used inside each file
+  unsigned int hardware_threads =
+      std::max(std::thread::hardware_concurrency(), 1u);
+  unsigned int n_files = (unsigned int)settings.inputs.size();
+  unsigned int jobs = settings.jobs > 0
+                          ? settings.jobs
+                          : std::min(n_files, hardware_threads);
+  unsigned int threads_per_job = std::max(hardware_threads / jobs, 1u);
+
+  std::mutex output_mutex;
+  std::atomic<int> n_failed = 0;
+  auto batch_start = std::chrono::steady_clock::now();
+
+  // The files form the work queue, each job takes the next file when it is
+  // done with the previous one
+  parallel_for((int)n_files, jobs, [&](int i) {
+    const std::filesystem::path &input = settings.inputs[i];
+    try {
+      std::string report = render_file(input, settings, threads_per_job);
+      std::lock_guard<std::mutex> lock(output_mutex);
+      std::cout << report << std::endl;
+    } catch (const std::exception &e) {
+      n_failed++;
+      std::lock_guard<std::mutex> lock(output_mutex);
+      std::cerr << input.string() << ": failed, " << e.what() << std::endl;
+    }
+  });
+
+  double total_ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - batch_start)
+                        .count();
+  std::cout << n_files - n_failed << "/" << n_files << " files rendered in "
+            << total_ms << " ms" << std::endl;
+  return n_failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,407 @@
+// Convergence benchmark for the CPU solvers. Renders every diffusion curve file
+// under a set of sampling configurations and measures how fast the error
+// against a high sample reference goes down, the results are written as CSV.
+#include "cpu_renderer.h"
+#include "multigrid.h"
+#include "segment_bvh.h"
+#include "shapes.h"
+#include "walk_on_spheres.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Solvers and ray intersection modes that can be benchmarked
+enum class BenchmarkSolver { March, Exact, Curves, WalkOnSpheres, Multigrid };
+
+// One sampling configuration, step_size is only used by March
+struct BenchmarkConfig {
+  std::string name;
+  BenchmarkSolver solver;
+  float step_size = 0.05f;
+};
+
+// Everything that can be set on the command line
+struct BenchmarkSettings {
+  std::vector<std::filesystem::path> inputs;
+  std::filesystem::path output = "benchmark.csv";
+  std::filesystem::path summary = "benchmark_summary.csv";
+  glm::ivec2 resolution{128, 128};
+  // The samples per pixel double from 1 up to max_samples, for multigrid
+  // these are V-cycles up to max_cycles
+  unsigned int max_samples = 256;
+  int max_cycles = 16;
+  // Samples per pixel of the reference, rendered with exact traversal
+  unsigned int reference_samples = 2048;
+  // RMSE at which a configuration counts as converged
+  float threshold = 0.02f;
+  std::vector<float> step_sizes{0.05f, 0.1f, 0.25f, 0.5f};
+  std::vector<std::string> solvers{"march", "exact", "curves", "walkonspheres",
+                                   "multigrid"};
+  int max_curve_subdivision = max_linearize_depth;
+  float curve_tolerance = 0.25f;
+  MarchSettings march;
+  WalkSettings walk;
+};
+
+// Random numbers of the reference start after every frame number used by the
+// configurations, so the reference noise is independent of theirs
+constexpr unsigned int reference_first_frame = 1u << 24;
+
+void print_usage(const char *program) {
+  std::cout
+      << "Usage: " << program << " [options] [file.xml | folder]...\n"
+      << "Without inputs every file in resources/diffusionCurveXMLs is used.\n"
+      << "  -o, --output <file>       convergence per checkpoint (default "
+         "benchmark.csv)\n"
+      << "      --summary <file>      time to threshold per configuration "
+         "(default benchmark_summary.csv)\n"
+      << "  -r, --resolution <WxH>    resolution (default 128x128)\n"
+      << "  -s, --samples <n>         maximum samples per pixel (default "
+         "256)\n"
+      << "      --cycles <n>          maximum multigrid V-cycles (default 16)\n"
+      << "      --reference <n>       reference samples per pixel (default "
+         "2048)\n"
+      << "      --threshold <f>       RMSE counted as converged (default "
+         "0.02)\n"
+      << "      --step-sizes <f,...>  ray marching step sizes (default "
+         "0.05,0.1,0.25,0.5)\n"
+      << "      --solvers <s,...>     any of march, exact, curves, "
+         "walkonspheres, multigrid (default all)\n"
+      << "      --width <f>           rasterize width (default 0.75)\n"
+      << "      --cell-size <f>       grid cell size for exact and curves "
+         "(default 8)\n"
+      << "      --subdivision <n>     maximum curve subdivision (default 30)\n"
+      << "      --tolerance <f>       curve flattening tolerance in pixels "
+         "(default 0.25)\n";
+}
+
+// Splits a comma separated list
+std::vector<std::string> split_list(const std::string &list) {
+  std::vector<std::string> items;
+  std::stringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (!item.empty())
+      items.push_back(item);
+  }
+  return items;
+}
+
+bool parse_arguments(int argc, char **argv, BenchmarkSettings &settings) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc)
+        throw std::invalid_argument("missing value for " + arg);
+      return argv[++i];
+    };
+
+    if (arg == "-h" || arg == "--help") {
+      return false;
+    } else if (arg == "-o" || arg == "--output") {
+      settings.output = value();
+    } else if (arg == "--summary") {
+      settings.summary = value();
+    } else if (arg == "-r" || arg == "--resolution") {
+      std::string res = value();
+      size_t split = res.find('x');
+      settings.resolution.x = std::stoi(res.substr(0, split));
+      settings.resolution.y = split == std::string::npos
+                                  ? settings.resolution.x
+                                  : std::stoi(res.substr(split + 1));
+    } else if (arg == "-s" || arg == "--samples") {
+      settings.max_samples = (unsigned int)std::stoul(value());
+    } else if (arg == "--cycles") {
+      settings.max_cycles = std::stoi(value());
+    } else if (arg == "--reference") {
+      settings.reference_samples = (unsigned int)std::stoul(value());
+    } else if (arg == "--threshold") {
+      settings.threshold = std::stof(value());
+    } else if (arg == "--step-sizes") {
+      settings.step_sizes.clear();
+      for (const std::string &step : split_list(value()))
+        settings.step_sizes.push_back(std::stof(step));
+    } else if (arg == "--solvers") {
+      settings.solvers = split_list(value());
+    } else if (arg == "--width") {
+      settings.march.rasterize_width = std::stof(value());
+    } else if (arg == "--cell-size") {
+      settings.march.grid_cell_size = std::stof(value());
+    } else if (arg == "--subdivision") {
+      settings.max_curve_subdivision = std::stoi(value());
+    } else if (arg == "--tolerance") {
+      settings.curve_tolerance = std::stof(value());
+    } else if (!arg.empty() && arg[0] == '-') {
+      throw std::invalid_argument("unknown option " + arg);
+    } else if (std::filesystem::is_directory(arg)) {
+      for (const auto &entry : std::filesystem::directory_iterator(arg)) {
+        if (entry.path().extension() == ".xml")
+          settings.inputs.push_back(entry.path());
+      }
+    } else {
+      settings.inputs.push_back(arg);
+    }
+  }
+
+  if (settings.inputs.empty()) {
+    for (const auto &entry : std::filesystem::directory_iterator(
+             RESOURCE_ROOT "resources/diffusionCurveXMLs")) {
+      if (entry.path().extension() == ".xml")
+        settings.inputs.push_back(entry.path());
+    }
+  }
+  std::sort(settings.inputs.begin(), settings.inputs.end());
+  return settings.resolution.x > 0 && settings.resolution.y > 0 &&
+         settings.max_samples > 0;
+}
+
+// Configurations from the solver and step size lists
+std::vector<BenchmarkConfig>
+make_configs(const BenchmarkSettings &settings) {
+  std::vector<BenchmarkConfig> configs;
+  for (const std::string &solver : settings.solvers) {
+    if (solver == "march") {
+      for (float step_size : settings.step_sizes) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "march_%g", step_size);
+        configs.push_back({name, BenchmarkSolver::March, step_size});
+      }
+    } else if (solver == "exact") {
+      configs.push_back({solver, BenchmarkSolver::Exact});
+    } else if (solver == "curves") {
+      configs.push_back({solver, BenchmarkSolver::Curves});
+    } else if (solver == "walkonspheres") {
+      configs.push_back({solver, BenchmarkSolver::WalkOnSpheres});
+    } else if (solver == "multigrid") {
+      configs.push_back({solver, BenchmarkSolver::Multigrid});
+    } else {
+      throw std::invalid_argument("unknown solver " + solver);
+    }
+  }
+  return configs;
+}
+
+// Step size for the CSV, empty for the solvers that do not march
+std::string step_size_column(const BenchmarkConfig &config) {
+  if (config.solver != BenchmarkSolver::March)
+    return "";
+  char step_size[32];
+  std::snprintf(step_size, sizeof(step_size), "%g", config.step_size);
+  return step_size;
+}
+
+// Root mean square error over all color channels of all pixels. Pixels that
+// are not finite in either image are left out, some files have curves with
+// undefined colors
+float rmse(const std::vector<glm::vec3> &image,
+           const std::vector<glm::vec3> &reference) {
+  double sum = 0.0;
+  size_t n_pixels = 0;
+  for (size_t i = 0; i < image.size(); i++) {
+    glm::vec3 difference = image[i] - reference[i];
+    float squared = glm::dot(difference, difference);
+    if (!std::isfinite(squared))
+      continue;
+    sum += squared;
+    n_pixels++;
+  }
+  return n_pixels == 0 ? 0.0f
+                       : (float)std::sqrt(sum / (3.0 * (double)n_pixels));
+}
+
+// Result of a configuration on a file, for the summary
+struct ConvergenceResult {
+  float final_rmse = 0.0f;
+  double total_ms = 0.0;
+  unsigned int total_samples = 0;
+  // Time and samples of the first checkpoint below the threshold, or -1
+  double time_to_threshold_ms = -1.0;
+  long long samples_to_threshold = -1;
+};
+
+// Renders the configuration with doubling sample counts and writes a CSV row
+// for every checkpoint. The Monte Carlo solvers keep adding to the same
+// accumulator, so the time of a checkpoint is the total time spent so far
+ConvergenceResult run_config(const BenchmarkConfig &config,
+                             const std::string &file_name,
+                             const std::vector<BezierCurve> &curves,
+                             const std::vector<Line> &lines,
+                             const std::vector<glm::vec3> &reference,
+                             const BenchmarkSettings &settings,
+                             std::ostream &csv) {
+  using clock = std::chrono::steady_clock;
+  glm::ivec2 resolution = settings.resolution;
+  size_t n_pixels = (size_t)resolution.x * resolution.y;
+
+  MarchSettings march = settings.march;
+  march.step_size = config.step_size;
+  march.exact_traversal = config.solver == BenchmarkSolver::Exact;
+
+  // Preprocessing is part of the time of the first checkpoint
+  auto start = clock::now();
+  std::vector<int> shape_ids;
+  if (config.solver == BenchmarkSolver::March)
+    rasterize_lines_cpu(shape_ids, lines, resolution, march.rasterize_width);
+  SegmentBVH bvh = config.solver == BenchmarkSolver::WalkOnSpheres
+                       ? SegmentBVH(lines)
+                       : SegmentBVH(std::vector<Line>());
+  ColorConstraints constraints;
+  if (config.solver == BenchmarkSolver::Multigrid)
+    rasterize_color_constraints(constraints, lines, resolution);
+  double elapsed_ms =
+      std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+  bool multigrid = config.solver == BenchmarkSolver::Multigrid;
+  unsigned int max_samples =
+      multigrid ? (unsigned int)std::max(settings.max_cycles, 1)
+                : settings.max_samples;
+
+  ConvergenceResult result;
+  std::vector<glm::vec4> accumulator;
+  unsigned int samples = 0;
+  for (unsigned int checkpoint = 1; samples < max_samples;
+       checkpoint = std::min(checkpoint * 2, max_samples)) {
+    start = clock::now();
+    unsigned int new_samples = checkpoint - samples;
+    switch (config.solver) {
+    case BenchmarkSolver::March:
+    case BenchmarkSolver::Exact:
+      sample_monte_carlo_cpu(accumulator, lines, shape_ids, resolution, march,
+                             samples, new_samples);
+      break;
+    case BenchmarkSolver::Curves:
+      sample_monte_carlo_curves_cpu(accumulator, curves, resolution, march,
+                                    samples, new_samples);
+      break;
+    case BenchmarkSolver::WalkOnSpheres:
+      sample_walk_on_spheres(accumulator, lines, bvh, resolution,
+                             settings.walk, samples, new_samples);
+      break;
+    case BenchmarkSolver::Multigrid:
+      // V-cycles cannot be added to a previous solve, so the solve is redone
+      // and only its own time counts
+      elapsed_ms = 0.0;
+      solve_multigrid(accumulator, constraints, (int)checkpoint);
+      break;
+    }
+    elapsed_ms +=
+        std::chrono::duration<double, std::milli>(clock::now() - start)
+            .count();
+    samples = checkpoint;
+
+    float error = rmse(resolve_accumulator(accumulator), reference);
+    double samples_per_second =
+        (double)samples * (double)n_pixels / (elapsed_ms / 1000.0);
+    csv << file_name << "," << config.name << ","
+        << step_size_column(config) << ","
+        << samples << "," << elapsed_ms << "," << samples_per_second << ","
+        << error << "\n";
+
+    if (result.samples_to_threshold < 0 && error <= settings.threshold) {
+      result.time_to_threshold_ms = elapsed_ms;
+      result.samples_to_threshold = samples;
+    }
+    result.final_rmse = error;
+    result.total_ms = elapsed_ms;
+    result.total_samples = samples;
+  }
+  csv.flush();
+  return result;
+}
+
+int main(int argc, char **argv) {
+  BenchmarkSettings settings;
+  std::vector<BenchmarkConfig> configs;
+  try {
+    if (!parse_arguments(argc, argv, settings)) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    configs = make_configs(settings);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  std::ofstream csv(settings.output);
+  std::ofstream summary(settings.summary);
+  if (!csv || !summary) {
+    std::cerr << "could not open the output files" << std::endl;
+    return 1;
+  }
+  csv << "file,config,step_size,samples,time_ms,samples_per_second,rmse\n";
+  summary << "file,config,step_size,samples,time_ms,samples_per_second,"
+             "final_rmse,time_to_threshold_ms,samples_to_threshold\n";
+
+  for (const std::filesystem::path &input : settings.inputs) {
+    std::string file_name = input.filename().string();
+    std::vector<BezierCurve> curves;
+    std::vector<Line> lines;
+    try {
+      load_Bezier_curves(curves, input.string().c_str(), settings.resolution);
+    } catch (const std::exception &e) {
+      std::cerr << file_name << ": failed, " << e.what() << std::endl;
+      continue;
+    }
+    linearize_bezier_curves(lines, curves, settings.curve_tolerance,
+                            settings.max_curve_subdivision);
+
+    // The reference intersects the lines exactly, so it has no ray marching
+    // bias and the error of every configuration includes its own bias
+    auto start = std::chrono::steady_clock::now();
+    MarchSettings reference_march = settings.march;
+    reference_march.exact_traversal = true;
+    std::vector<glm::vec4> reference_accumulator;
+    sample_monte_carlo_cpu(reference_accumulator, lines, {},
+                           settings.resolution, reference_march,
+                           reference_first_frame, settings.reference_samples);
+    std::vector<glm::vec3> reference =
+        resolve_accumulator(reference_accumulator);
+    size_t undefined_pixels =
+        std::count_if(reference.begin(), reference.end(), [](glm::vec3 color) {
+          return !std::isfinite(color.x + color.y + color.z);
+        });
+    std::cout << file_name << ": " << lines.size() << " lines, reference in "
+              << std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - start)
+                     .count()
+              << " ms";
+    if (undefined_pixels > 0)
+      std::cout << ", " << undefined_pixels
+                << " pixels without a defined color are left out";
+    std::cout << std::endl;
+
+    for (const BenchmarkConfig &config : configs) {
+      ConvergenceResult result = run_config(config, file_name, curves, lines,
+                                            reference, settings, csv);
+      double samples_per_second = (double)result.total_samples *
+                                  settings.resolution.x *
+                                  settings.resolution.y /
+                                  (result.total_ms / 1000.0);
+      summary << file_name << "," << config.name << ","
+              << step_size_column(config) << "," << result.total_samples << "," << result.total_ms << ","
+              << samples_per_second << "," << result.final_rmse << ","
+              << result.time_to_threshold_ms << ","
+              << result.samples_to_threshold << "\n";
+      summary.flush();
+
+      std::cout << "  " << config.name << ": rmse " << result.final_rmse
+                << " after " << result.total_samples << " in "
+                << result.total_ms << " ms";
+      if (result.samples_to_threshold >= 0)
+        std::cout << ", below " << settings.threshold << " after "
+                  << result.time_to_threshold_ms << " ms";
+      std::cout << std::endl;
+    }
+  }
+  return 0;
+}
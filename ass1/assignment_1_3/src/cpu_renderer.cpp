@@ -0,0 +1,194 @@
+#include "cpu_renderer.h"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+
+constexpr float M_PI_F = 3.14159265359f;
+
+//Forward declarations for helper functions
+float distance_to_segment(glm::vec2 point, const Line& line, float& projection);
+glm::vec3 line_color(const Line& line, glm::vec2 ray_origin, float t);
+glm::vec2 march_ray(glm::vec2 origin, glm::vec2 direction, const std::vector<int>& shape_ids, glm::ivec2 resolution, const MarchSettings& settings, int& shape_id);
+template <typename Sample>
+void accumulate_samples(std::vector<glm::vec4>& accumulator, glm::ivec2 resolution, glm::ivec2 region_min, glm::ivec2 region_max, unsigned int first_frame,
+	unsigned int n_samples, unsigned int n_threads, Sample sample);
+
+void rasterize_lines_cpu(std::vector<int>& shape_ids, std::span<const Line> lines, glm::ivec2 resolution, float rasterize_width) {
+	//The region version clears every pixel it rasterizes
+	shape_ids.resize(resolution.x * resolution.y);
+	rasterize_lines_cpu(shape_ids, lines, resolution, rasterize_width, glm::ivec2(0), resolution);
+}
+
+void rasterize_lines_cpu(std::vector<int>& shape_ids, std::span<const Line> lines, glm::ivec2 resolution, float rasterize_width,
+	glm::ivec2 region_min, glm::ivec2 region_max) {
+	region_min = glm::max(region_min, glm::ivec2(0));
+	region_max = glm::min(region_max, resolution);
+	for (int y = region_min.y; y < region_max.y; y++) {
+		std::fill_n(shape_ids.begin() + (y * resolution.x + region_min.x), std::max(region_max.x - region_min.x, 0), -1);
+	}
+
+	//Instead of testing every line for every pixel, only test the pixels in the bounding box of each line
+	//Lines are visited in order, so the first id written to a pixel is the lowest one
+	for (int i = 0; i < (int)lines.size(); i++) {
+		const Line& line = lines[i];
+		glm::ivec2 bb_min = glm::ivec2(glm::floor(glm::min(line.start_point, line.end_point) - rasterize_width - 0.5f));
+		glm::ivec2 bb_max = glm::ivec2(glm::ceil(glm::max(line.start_point, line.end_point) + rasterize_width - 0.5f));
+		bb_min = glm::max(bb_min, region_min);
+		bb_max = glm::min(bb_max, region_max - 1);
+
+		for (int y = bb_min.y; y <= bb_max.y; y++) {
+			for (int x = bb_min.x; x <= bb_max.x; x++) {
+				int& id = shape_ids[y * resolution.x + x];
+				if (id >= 0) continue;
+
+				float projection;
+				if (distance_to_segment(glm::vec2(x, y) + 0.5f, line, projection) <= rasterize_width) {
+					id = i;
+				}
+			}
+		}
+	}
+}
+
+void sample_monte_carlo_cpu(std::vector<glm::vec4>& accumulator, std::span<const Line> lines, const std::vector<int>& shape_ids, glm::ivec2 resolution,
+	const MarchSettings& settings, unsigned int first_frame, unsigned int n_samples, unsigned int n_threads) {
+	if (settings.exact_traversal) {
+		SegmentGrid grid;
+		build_segment_grid(grid, lines, resolution, settings.grid_cell_size);
+		sample_segment_grid_cpu(accumulator, lines, grid, resolution, glm::ivec2(0), resolution, first_frame, n_samples, n_threads);
+		return;
+	}
+
+	accumulate_samples(accumulator, resolution, glm::ivec2(0), resolution, first_frame, n_samples, n_threads, [&](glm::vec2 ray_origin, glm::vec2 direction, glm::vec4& pixel) {
+		int shape_id;
+		glm::vec2 intersection = march_ray(ray_origin, direction, shape_ids, resolution, settings, shape_id);
+		if (shape_id < 0) return;
+
+		float projection;
+		float dist_to_segment = distance_to_segment(intersection, lines[shape_id], projection);
+		float weight = 1.0f / (dist_to_segment + 0.001f);
+		float t = std::clamp(projection / glm::length(lines[shape_id].end_point - lines[shape_id].start_point), 0.0f, 1.0f);
+		pixel += glm::vec4(line_color(lines[shape_id], ray_origin, t) * weight, weight);
+	});
+}
+
+void sample_segment_grid_cpu(std::vector<glm::vec4>& accumulator, std::span<const Line> lines, const SegmentGrid& grid, glm::ivec2 resolution,
+	glm::ivec2 region_min, glm::ivec2 region_max, unsigned int first_frame, unsigned int n_samples, unsigned int n_threads) {
+	accumulate_samples(accumulator, resolution, region_min, region_max, first_frame, n_samples, n_threads, [&](glm::vec2 ray_origin, glm::vec2 direction, glm::vec4& pixel) {
+		//The hit lies exactly on the line, so the distance term of the weight is 0
+		SegmentHit hit = trace_segment_grid(grid, lines, ray_origin, direction);
+		if (hit.segment < 0) return;
+
+		float weight = 1.0f / 0.001f;
+		pixel += glm::vec4(line_color(lines[hit.segment], ray_origin, hit.s) * weight, weight);
+	});
+}
+
+void sample_monte_carlo_curves_cpu(std::vector<glm::vec4>& accumulator, std::span<const BezierCurve> curves, glm::ivec2 resolution, const MarchSettings& settings,
+	unsigned int first_frame, unsigned int n_samples, unsigned int n_threads) {
+	SegmentGrid grid;
+	build_curve_grid(grid, curves, resolution, settings.grid_cell_size);
+	sample_curve_grid_cpu(accumulator, curves, grid, resolution, glm::ivec2(0), resolution, first_frame, n_samples, n_threads);
+}
+
+void sample_curve_grid_cpu(std::vector<glm::vec4>& accumulator, std::span<const BezierCurve> curves, const SegmentGrid& grid, glm::ivec2 resolution,
+	glm::ivec2 region_min, glm::ivec2 region_max, unsigned int first_frame, unsigned int n_samples, unsigned int n_threads) {
+	accumulate_samples(accumulator, resolution, region_min, region_max, first_frame, n_samples, n_threads, [&](glm::vec2 ray_origin, glm::vec2 direction, glm::vec4& pixel) {
+		SegmentHit hit = trace_curve_grid(grid, curves, ray_origin, direction);
+		if (hit.segment < 0) return;
+
+		//Same weight as an exact hit on a line, the colors are interpolated along the curve parameter like split_curve does
+		const BezierCurve& curve = curves[hit.segment];
+		glm::vec4 curve_color = hit.left ? glm::mix(curve.color_left[0], curve.color_left[1], hit.s) : glm::mix(curve.color_right[0], curve.color_right[1], hit.s);
+		float weight = 1.0f / 0.001f;
+		pixel += glm::vec4(glm::vec3(curve_color) * weight, weight);
+	});
+}
+
+std::vector<glm::vec3> resolve_accumulator(const std::vector<glm::vec4>& accumulator) {
+	std::vector<glm::vec3> colors(accumulator.size());
+	for (size_t i = 0; i < accumulator.size(); i++) {
+		colors[i] = accumulator[i].w == 0 ? glm::vec3(0) : glm::vec3(accumulator[i]) / accumulator[i].w;
+	}
+	return colors;
+}
+
+//Same random number generator as the sample shader, outputs numbers between [0-1]
+float get_random_number(uint32_t& seed) {
+	seed = 1664525u * seed + 1013904223u;
+	seed += 1664525u * seed;
+	seed ^= (seed >> 16u);
+	seed += 1664525u * seed;
+	seed ^= (seed >> 16u);
+	return (float)seed * std::pow(0.5f, 32.0f);
+}
+
+//Distance from point to the line segment, also returns the projection of the point on the line direction
+float distance_to_segment(glm::vec2 point, const Line& line, float& projection) {
+	glm::vec2 line_dir = line.end_point - line.start_point;
+	float line_length = glm::length(line_dir);
+	glm::vec2 to_point = point - line.start_point;
+	projection = glm::dot(to_point, line_dir / line_length);
+
+	if (projection < 0.0f) return glm::length(to_point);
+	if (projection > line_length) return glm::length(point - line.end_point);
+	return glm::length(to_point - line_dir / line_length * projection);
+}
+
+//Color of the line at t, on the side of the line the ray came from
+glm::vec3 line_color(const Line& line, glm::vec2 ray_origin, float t) {
+	glm::vec2 line_dir = line.end_point - line.start_point;
+	glm::vec2 to_origin = ray_origin - line.start_point;
+	float cross_product = line_dir.x * to_origin.y - line_dir.y * to_origin.x;
+
+	return glm::vec3(cross_product > 0.0f ? glm::mix(line.color_left[0], line.color_left[1], t) : glm::mix(line.color_right[0], line.color_right[1], t));
+}
+
+//Marches the ray over the rasterized ids, returns the hit position and the id of the line that was hit, or -1
+glm::vec2 march_ray(glm::vec2 origin, glm::vec2 direction, const std::vector<int>& shape_ids, glm::ivec2 resolution, const MarchSettings& settings, int& shape_id) {
+	glm::vec2 current_position = origin;
+	shape_id = -1;
+	for (unsigned int i = 0; i < settings.max_raymarch_iters; i++) {
+		current_position += direction * settings.step_size;
+
+		if (current_position.x < 0.0f || current_position.x >= (float)resolution.x ||
+			current_position.y < 0.0f || current_position.y >= (float)resolution.y) {
+			return current_position;
+		}
+
+		int id = shape_ids[(int)current_position.y * resolution.x + (int)current_position.x];
+		if (id >= 0) {
+			shape_id = id;
+			return current_position;
+		}
+	}
+	return current_position;
+}
+
+//Calls sample(ray_origin, direction, pixel) for every sample of every pixel in the region, with the random directions of the sample shader.
+//The accumulator only holds the region, but the rays and seeds are those of the pixels in the whole image.
+template <typename Sample>
+void accumulate_samples(std::vector<glm::vec4>& accumulator, glm::ivec2 resolution, glm::ivec2 region_min, glm::ivec2 region_max, unsigned int first_frame,
+	unsigned int n_samples, unsigned int n_threads, Sample sample) {
+	glm::ivec2 region_size = region_max - region_min;
+	if (accumulator.size() != (size_t)region_size.x * region_size.y) {
+		accumulator.assign(region_size.x * region_size.y, glm::vec4(0));
+	}
+
+	//Each row is a work item, rows can take very different amounts of time so they are handed out dynamically
+	parallel_for(region_size.y, n_threads, [&](int row) {
+		int y = region_min.y + row;
+		for (int x = region_min.x; x < region_max.x; x++) {
+			glm::vec2 ray_origin = glm::vec2(x, y) + 0.5f;
+			glm::vec4& pixel = accumulator[row * region_size.x + (x - region_min.x)];
+
+			for (unsigned int frame_nr = first_frame; frame_nr < first_frame + n_samples; frame_nr++) {
+				//Same seeding as the sample shader so both produce the same sequence
+				uint32_t seed = (uint32_t)x + (uint32_t)y * (uint32_t)resolution.x + frame_nr;
+				float angle = 2.0f * M_PI_F * get_random_number(seed);
+				sample(ray_origin, glm::vec2(std::cos(angle), std::sin(angle)), pixel);
+			}
+		}
+	});
+}
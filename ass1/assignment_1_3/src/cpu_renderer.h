@@ -0,0 +1,117 @@
+#pragma once
+
+#include "parallel.h"
+#include "segment_grid.h"
+#include "shapes.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Parameters of the ray marcher, the same as the uniforms of sample_shader.glsl
+struct MarchSettings {
+	float rasterize_width = 0.75f;
+	float step_size = 0.05f;
+	unsigned int max_raymarch_iters = 10000;
+	bool exact_traversal = false;		//Intersect the lines exactly through a SegmentGrid instead of marching over the rasterized ids
+	float grid_cell_size = 8.0f;		//Cell size in pixels of that grid
+};
+
+/// <summary>
+/// The random number generator of sample_shader.glsl, outputs numbers between [0-1] and advances the seed
+/// </summary>
+/// <param name="seed">State of the generator</param>
+/// <returns>Random number between [0-1]</returns>
+float get_random_number(uint32_t& seed);
+
+/// <summary>
+/// CPU version of rasterize_primitive.glsl for lines, writes the lowest id of the lines within rasterize_width of each pixel center, or -1
+/// </summary>
+/// <param name="shape_ids">Output id per pixel, resized to resolution</param>
+/// <param name="lines">The lines to rasterize, in pixel coordinates</param>
+/// <param name="resolution">The resolution of the raster</param>
+/// <param name="rasterize_width">The maximum distance to a line for a pixel to be part of it</param>
+void rasterize_lines_cpu(std::vector<int>& shape_ids, std::span<const Line> lines, glm::ivec2 resolution, float rasterize_width);
+
+/// <summary>
+/// Re-rasterizes the pixels in [region_min, region_max) only and keeps the ids of all other pixels, for updating the raster after
+/// an edit. The pixels in the region get the same ids as rasterizing everything would give them.
+/// </summary>
+/// <param name="shape_ids">Ids per pixel from rasterize_lines_cpu, updated in place</param>
+/// <param name="lines">The lines to rasterize, in pixel coordinates</param>
+/// <param name="resolution">The resolution of the raster</param>
+/// <param name="rasterize_width">The maximum distance to a line for a pixel to be part of it</param>
+/// <param name="region_min">First pixel of the region, inclusive</param>
+/// <param name="region_max">Last pixel of the region, exclusive</param>
+void rasterize_lines_cpu(std::vector<int>& shape_ids, std::span<const Line> lines, glm::ivec2 resolution, float rasterize_width,
+	glm::ivec2 region_min, glm::ivec2 region_max);
+
+/// <summary>
+/// CPU version of sample_shader.glsl for lines, adds n_samples ray-marched samples per pixel to the accumulator.
+/// The accumulator layout is the same as the accumulator texture: weighted color sum in rgb and the total weight in alpha.
+/// </summary>
+/// <param name="accumulator">Accumulated samples, resized to resolution if it has the wrong size</param>
+/// <param name="lines">The lines to sample</param>
+/// <param name="shape_ids">The rasterized lines from rasterize_lines_cpu, not used with exact_traversal</param>
+/// <param name="resolution">The resolution of the image</param>
+/// <param name="settings">Ray marching parameters</param>
+/// <param name="first_frame">Frame number of the first sample, used to seed the random numbers like frame_nr in the shader</param>
+/// <param name="n_samples">Number of samples to take per pixel</param>
+/// <param name="n_threads">Number of threads to use, 0 uses all hardware threads</param>
+void sample_monte_carlo_cpu(std::vector<glm::vec4>& accumulator, std::span<const Line> lines, const std::vector<int>& shape_ids, glm::ivec2 resolution,
+	const MarchSettings& settings, unsigned int first_frame, unsigned int n_samples, unsigned int n_threads = 0);
+
+/// <summary>
+/// Same sampling as sample_monte_carlo_cpu with exact_traversal, for the pixels of a region of the image only. The rays start from
+/// the pixels of the whole image with their random numbers, and see every line in the grid, so rendering an image region by
+/// region gives exactly the image rendered at once.
+/// </summary>
+/// <param name="accumulator">Accumulated samples of the region, resized to the size of the region if it has the wrong size</param>
+/// <param name="lines">All lines of the image</param>
+/// <param name="grid">Grid built over lines for the whole image</param>
+/// <param name="resolution">The resolution of the whole image</param>
+/// <param name="region_min">First pixel of the region, inclusive</param>
+/// <param name="region_max">Last pixel of the region, exclusive</param>
+/// <param name="first_frame">Frame number of the first sample, used to seed the random numbers like frame_nr in the shader</param>
+/// <param name="n_samples">Number of samples to take per pixel</param>
+/// <param name="n_threads">Number of threads to use, 0 uses all hardware threads</param>
+void sample_segment_grid_cpu(std::vector<glm::vec4>& accumulator, std::span<const Line> lines, const SegmentGrid& grid, glm::ivec2 resolution,
+	glm::ivec2 region_min, glm::ivec2 region_max, unsigned int first_frame, unsigned int n_samples, unsigned int n_threads = 0);
+
+/// <summary>
+/// Same sampling as sample_monte_carlo_cpu with exact_traversal, but the rays are intersected with the Bezier curves directly
+/// instead of with their linear approximation, so the curves are never linearized
+/// </summary>
+/// <param name="accumulator">Accumulated samples, resized to resolution if it has the wrong size</param>
+/// <param name="curves">The split Bezier curves, in pixel coordinates</param>
+/// <param name="resolution">The resolution of the image</param>
+/// <param name="settings">Only grid_cell_size is used</param>
+/// <param name="first_frame">Frame number of the first sample, used to seed the random numbers like frame_nr in the shader</param>
+/// <param name="n_samples">Number of samples to take per pixel</param>
+/// <param name="n_threads">Number of threads to use, 0 uses all hardware threads</param>
+void sample_monte_carlo_curves_cpu(std::vector<glm::vec4>& accumulator, std::span<const BezierCurve> curves, glm::ivec2 resolution, const MarchSettings& settings,
+	unsigned int first_frame, unsigned int n_samples, unsigned int n_threads = 0);
+
+/// <summary>
+/// Same sampling as sample_monte_carlo_curves_cpu for the pixels of a region of the image only, like sample_segment_grid_cpu
+/// </summary>
+/// <param name="accumulator">Accumulated samples of the region, resized to the size of the region if it has the wrong size</param>
+/// <param name="curves">All split Bezier curves of the image</param>
+/// <param name="grid">Grid built over the curves for the whole image with build_curve_grid</param>
+/// <param name="resolution">The resolution of the whole image</param>
+/// <param name="region_min">First pixel of the region, inclusive</param>
+/// <param name="region_max">Last pixel of the region, exclusive</param>
+/// <param name="first_frame">Frame number of the first sample, used to seed the random numbers like frame_nr in the shader</param>
+/// <param name="n_samples">Number of samples to take per pixel</param>
+/// <param name="n_threads">Number of threads to use, 0 uses all hardware threads</param>
+void sample_curve_grid_cpu(std::vector<glm::vec4>& accumulator, std::span<const BezierCurve> curves, const SegmentGrid& grid, glm::ivec2 resolution,
+	glm::ivec2 region_min, glm::ivec2 region_max, unsigned int first_frame, unsigned int n_samples, unsigned int n_threads = 0);
+
+/// <summary>
+/// Converts an accumulator to displayable colors the same way color_shader.glsl does
+/// </summary>
+/// <param name="accumulator">The accumulated samples</param>
+/// <returns>The averaged colors, black where no sample hit a curve</returns>
+std::vector<glm::vec3> resolve_accumulator(const std::vector<glm::vec4>& accumulator);
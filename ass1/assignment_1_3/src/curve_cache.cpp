@@ -0,0 +1,217 @@
+#include "curve_cache.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <system_error>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//Increase when the layout of the file, BezierCurve, Line or the loading/linearization changes
+constexpr uint32_t cache_version = 2;
+
+//Layout of a cache file: this header, n_curves BezierCurves and n_lines Lines.
+//The header and both structs are multiples of 16 bytes so the arrays are correctly aligned in the mapping.
+struct CacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t content_hash;
+	glm::ivec2 resolution;
+	float tolerance;
+	int32_t max_depth;
+	uint64_t n_curves;
+	uint64_t n_lines;
+};
+static_assert(sizeof(CacheHeader) % 16 == 0 && sizeof(BezierCurve) % 16 == 0 && sizeof(Line) % 16 == 0);
+
+//Forward declarations for helper functions
+uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull);
+bool is_valid_cache(const void* data, size_t size, const CacheHeader& expected);
+
+CachedCurves::CachedCurves(CachedCurves&& other) noexcept {
+	*this = std::move(other);
+}
+
+CachedCurves& CachedCurves::operator=(CachedCurves&& other) noexcept {
+	if (this == &other) return *this;
+	unmap();
+
+	mapped_data = other.mapped_data;
+	mapped_size = other.mapped_size;
+#ifdef _WIN32
+	file_mapping = other.file_mapping;
+	other.file_mapping = nullptr;
+#endif
+	other.mapped_data = nullptr;
+	other.mapped_size = 0;
+
+	//Moving a vector keeps its buffer, so spans into it stay valid
+	owned_curves = std::move(other.owned_curves);
+	owned_lines = std::move(other.owned_lines);
+	curves = other.curves;
+	lines = other.lines;
+	from_cache = other.from_cache;
+	other.curves = {};
+	other.lines = {};
+	return *this;
+}
+
+CachedCurves::~CachedCurves() {
+	unmap();
+}
+
+bool CachedCurves::map(const std::filesystem::path& path) {
+#ifdef _WIN32
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping) return false;
+	void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data) {
+		CloseHandle(mapping);
+		return false;
+	}
+	file_mapping = mapping;
+	mapped_data = data;
+	mapped_size = (size_t)file_size.QuadPart;
+#else
+	int file = open(path.c_str(), O_RDONLY);
+	if (file < 0) return false;
+	struct stat file_stat;
+	if (fstat(file, &file_stat) != 0 || file_stat.st_size == 0) {
+		close(file);
+		return false;
+	}
+	void* data = mmap(nullptr, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (data == MAP_FAILED) return false;
+	mapped_data = data;
+	mapped_size = (size_t)file_stat.st_size;
+#endif
+	return true;
+}
+
+void CachedCurves::unmap() {
+	if (!mapped_data) return;
+#ifdef _WIN32
+	UnmapViewOfFile(mapped_data);
+	CloseHandle(file_mapping);
+	file_mapping = nullptr;
+#else
+	munmap(mapped_data, mapped_size);
+#endif
+	mapped_data = nullptr;
+	mapped_size = 0;
+}
+
+CachedCurves load_curves_cached(const std::filesystem::path& xml_path, const std::filesystem::path& cache_folder, glm::ivec2 resolution, float tolerance, int max_depth) {
+	//Hash the file contents, this is much cheaper than parsing them
+	std::ifstream xml_file(xml_path, std::ios::binary);
+	if (!xml_file) throw std::runtime_error("cannot open file " + xml_path.string());
+	std::vector<char> xml_bytes((std::istreambuf_iterator<char>(xml_file)), std::istreambuf_iterator<char>());
+
+	CacheHeader header = {};
+	std::memcpy(header.magic, "DCC1", 4);
+	header.version = cache_version;
+	header.content_hash = hash_bytes(xml_bytes.data(), xml_bytes.size());
+	header.resolution = resolution;
+	header.tolerance = tolerance;
+	header.max_depth = max_depth;
+
+	//The settings are part of the file name as well, so different settings for the same file do not overwrite each other
+	uint64_t key = hash_bytes(&header, sizeof(header));
+	char file_name[32];
+	std::snprintf(file_name, sizeof(file_name), "%016llx.dcc", (unsigned long long)key);
+	std::filesystem::path cache_path = cache_folder / file_name;
+
+	CachedCurves result;
+	if (result.map(cache_path)) {
+		if (is_valid_cache(result.mapped_data, result.mapped_size, header)) {
+			const CacheHeader* cached_header = (const CacheHeader*)result.mapped_data;
+			const BezierCurve* curve_data = (const BezierCurve*)((const char*)result.mapped_data + sizeof(CacheHeader));
+			const Line* line_data = (const Line*)(curve_data + cached_header->n_curves);
+			result.curves = { curve_data, (size_t)cached_header->n_curves };
+			result.lines = { line_data, (size_t)cached_header->n_lines };
+			result.from_cache = true;
+			return result;
+		}
+		result.unmap();
+	}
+
+	//Cache miss, parse and linearize the curves
+	load_Bezier_curves(result.owned_curves, xml_path.string().c_str(), resolution);
+	linearize_bezier_curves(result.owned_lines, result.owned_curves, tolerance, max_depth);
+	result.curves = result.owned_curves;
+	result.lines = result.owned_lines;
+
+	//Write to a temporary file first and rename it, so concurrent jobs never map a partially written entry. The random name
+	//keeps jobs in other processes that write the same entry out of each other's file.
+	header.n_curves = result.owned_curves.size();
+	header.n_lines = result.owned_lines.size();
+	std::error_code error;
+	std::filesystem::create_directories(cache_folder, error);
+	std::filesystem::path temp_path = cache_path;
+	std::random_device random;
+	char suffix[32];
+	std::snprintf(suffix, sizeof(suffix), ".%08x%08x.tmp", random(), random());
+	temp_path += suffix;
+	{
+		std::ofstream cache_file(temp_path, std::ios::binary);
+		cache_file.write((const char*)&header, sizeof(header));
+		cache_file.write((const char*)result.owned_curves.data(), result.owned_curves.size() * sizeof(BezierCurve));
+		cache_file.write((const char*)result.owned_lines.data(), result.owned_lines.size() * sizeof(Line));
+		cache_file.close();
+		if (!cache_file) error = std::make_error_code(std::errc::io_error);
+	}
+	//Failing to write the cache is not an error, the next load simply parses again
+	if (!error) std::filesystem::rename(temp_path, cache_path, error);
+	if (error) std::filesystem::remove(temp_path, error);
+
+	return result;
+}
+
+std::filesystem::path default_curve_cache_folder() {
+	std::error_code error;
+	std::filesystem::path temp = std::filesystem::temp_directory_path(error);
+	return (error ? std::filesystem::path(".") : temp) / "diffusion_curve_cache";
+}
+
+//64 bit FNV-1a hash
+uint64_t hash_bytes(const void* data, size_t size, uint64_t hash) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+//Checks that the mapped file belongs to the same content and settings, and that its size matches the counts in the header
+bool is_valid_cache(const void* data, size_t size, const CacheHeader& expected) {
+	if (size < sizeof(CacheHeader)) return false;
+	const CacheHeader& header = *(const CacheHeader*)data;
+	if (std::memcmp(header.magic, expected.magic, 4) != 0 || header.version != expected.version || header.content_hash != expected.content_hash ||
+		header.resolution != expected.resolution || header.tolerance != expected.tolerance || header.max_depth != expected.max_depth) {
+		return false;
+	}
+	return size == sizeof(CacheHeader) + header.n_curves * sizeof(BezierCurve) + header.n_lines * sizeof(Line);
+}
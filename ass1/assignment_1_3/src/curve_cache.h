@@ -0,0 +1,58 @@
+#pragma once
+
+#include "shapes.h"
+
+#include <glm/glm.hpp>
+
+#include <filesystem>
+#include <span>
+#include <vector>
+
+// Curves and lines of a diffusion curve file, either pointing into a memory mapped cache file or into vectors owned by this object
+class CachedCurves {
+public:
+	CachedCurves() = default;
+	CachedCurves(const CachedCurves&) = delete;
+	CachedCurves(CachedCurves&& other) noexcept;
+	CachedCurves& operator=(CachedCurves&& other) noexcept;
+	~CachedCurves();
+
+	std::span<const BezierCurve> curves;
+	std::span<const Line> lines;
+	bool from_cache = false;		//True if the file did not have to be parsed
+
+private:
+	friend CachedCurves load_curves_cached(const std::filesystem::path&, const std::filesystem::path&, glm::ivec2, float, int);
+
+	bool map(const std::filesystem::path& path);
+	void unmap();
+
+	// Memory mapping of the cache file
+	void* mapped_data = nullptr;
+	size_t mapped_size = 0;
+#ifdef _WIN32
+	void* file_mapping = nullptr;
+#endif
+
+	// Storage when the data did not come from the cache
+	std::vector<BezierCurve> owned_curves;
+	std::vector<Line> owned_lines;
+};
+
+/// <summary>
+/// Loads the split Bezier curves and their linear approximation for a diffusion curve file. The cache entry is keyed by a hash of
+/// the XML contents and the settings, on a hit the file is memory mapped without any parsing, on a miss the XML is parsed and
+/// linearized and a new entry is written.
+/// </summary>
+/// <param name="xml_path">The diffusion curve file</param>
+/// <param name="cache_folder">Folder with the cache files, created if it does not exist</param>
+/// <param name="resolution">The resolution we intent to render the curves at</param>
+/// <param name="tolerance">Tolerance in pixels passed to linearize_bezier_curves</param>
+/// <param name="max_depth">Maximum subdivision passed to linearize_bezier_curves</param>
+/// <returns>The curves and lines</returns>
+CachedCurves load_curves_cached(const std::filesystem::path& xml_path, const std::filesystem::path& cache_folder, glm::ivec2 resolution, float tolerance, int max_depth);
+
+/// <summary>
+/// Default folder for the curve cache, in the temporary directory of the system
+/// </summary>
+std::filesystem::path default_curve_cache_folder();
@@ -0,0 +1,108 @@
+#include "curve_editing.h"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <limits>
+
+//Control points closer than this (in pixels) are considered the same point
+constexpr float coincident_distance = 0.01f;
+
+bool find_control_point(const std::vector<BezierCurve>& curves, glm::vec2 position, float max_distance, glm::vec2& control_point) {
+	float best_distance = max_distance;
+	bool found = false;
+	for (const BezierCurve& curve : curves) {
+		for (const glm::vec2& point : curve.control_points) {
+			float distance = glm::distance(point, position);
+			if (distance <= best_distance) {
+				best_distance = distance;
+				control_point = point;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+std::vector<int> move_control_point(std::vector<BezierCurve>& curves, glm::vec2 from, glm::vec2 to) {
+	std::vector<int> changed_curves;
+	for (int i = 0; i < (int)curves.size(); i++) {
+		bool changed = false;
+		for (glm::vec2& point : curves[i].control_points) {
+			if (glm::distance(point, from) < coincident_distance) {
+				point = to;
+				changed = true;
+			}
+		}
+		if (changed) changed_curves.push_back(i);
+	}
+	return changed_curves;
+}
+
+bool update_curve_lines(std::vector<Line>& lines, const std::vector<size_t>& curve_line_offsets, const std::vector<BezierCurve>& curves,
+	const std::vector<int>& changed_curves, float tolerance, int max_depth, glm::vec2& dirty_min, glm::vec2& dirty_max) {
+	//Linearize all changed curves first, so nothing is replaced if one of them changes its number of lines
+	std::vector<std::vector<Line>> new_lines(changed_curves.size());
+	for (size_t i = 0; i < changed_curves.size(); i++) {
+		int curve = changed_curves[i];
+		linearize_bezier_curves(new_lines[i], std::span<const BezierCurve>(&curves[curve], 1), tolerance, max_depth, 1);
+		if (new_lines[i].size() != curve_line_offsets[curve + 1] - curve_line_offsets[curve]) return false;
+	}
+
+	auto grow = [&](const Line& line) {
+		dirty_min = glm::min(dirty_min, glm::min(line.start_point, line.end_point));
+		dirty_max = glm::max(dirty_max, glm::max(line.start_point, line.end_point));
+	};
+
+	for (size_t i = 0; i < changed_curves.size(); i++) {
+		size_t offset = curve_line_offsets[changed_curves[i]];
+		for (size_t j = 0; j < new_lines[i].size(); j++) {
+			grow(lines[offset + j]);
+			grow(new_lines[i][j]);
+			lines[offset + j] = new_lines[i][j];
+		}
+	}
+	return true;
+}
+
+PixelRect compute_reset_mask(std::vector<uint8_t>& mask, const std::vector<int>& shape_ids, glm::ivec2 resolution, PixelRect dirty, int reach) {
+	mask.assign(resolution.x * resolution.y, 0);
+	dirty.min = glm::max(dirty.min, glm::ivec2(0));
+	dirty.max = glm::min(dirty.max, resolution);
+	if (dirty.empty()) return {};
+
+	reach = std::max(reach, 1);
+	PixelRect bounds = dirty;
+	std::vector<int> stack;
+
+	//All pixels in the dirty rectangle are reset, the empty ones are where the flood fill starts
+	for (int y = dirty.min.y; y < dirty.max.y; y++) {
+		for (int x = dirty.min.x; x < dirty.max.x; x++) {
+			int ind = y * resolution.x + x;
+			mask[ind] = 1;
+			if (shape_ids[ind] < 0) stack.push_back(ind);
+		}
+	}
+
+	//Flood fill through empty pixels, a pixel on a shape is reset but the fill does not continue from it. Every pixel within reach
+	//is a neighbour, so shapes thinner than reach do not stop the fill, just like they do not stop a ray
+	while (!stack.empty()) {
+		int ind = stack.back();
+		stack.pop_back();
+		glm::ivec2 pixel{ ind % resolution.x, ind / resolution.x };
+		glm::ivec2 min = glm::max(pixel - reach, glm::ivec2(0));
+		glm::ivec2 max = glm::min(pixel + reach + 1, resolution);
+
+		for (int y = min.y; y < max.y; y++) {
+			for (int x = min.x; x < max.x; x++) {
+				int neighbour_ind = y * resolution.x + x;
+				if (mask[neighbour_ind]) continue;
+
+				mask[neighbour_ind] = 1;
+				bounds.min = glm::min(bounds.min, glm::ivec2(x, y));
+				bounds.max = glm::max(bounds.max, glm::ivec2(x + 1, y + 1));
+				if (shape_ids[neighbour_ind] < 0) stack.push_back(neighbour_ind);
+			}
+		}
+	}
+	return bounds;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "shapes.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Rectangle of pixels, min is inclusive and max exclusive
+struct PixelRect {
+	glm::ivec2 min{ 0 };
+	glm::ivec2 max{ 0 };
+
+	bool empty() const { return max.x <= min.x || max.y <= min.y; }
+};
+
+/// <summary>
+/// Finds the control point closest to position
+/// </summary>
+/// <param name="curves">The curves to search</param>
+/// <param name="position">Position in pixels</param>
+/// <param name="max_distance">Control points further away are ignored</param>
+/// <param name="control_point">Output for the position of the closest control point</param>
+/// <returns>True if a control point was found within max_distance</returns>
+bool find_control_point(const std::vector<BezierCurve>& curves, glm::vec2 position, float max_distance, glm::vec2& control_point);
+
+/// <summary>
+/// Moves every control point at from to to. Curves are split at their color control points, so the end point of one curve is
+/// the start point of the next, moving all coincident points keeps them connected.
+/// </summary>
+/// <param name="curves">The curves to edit</param>
+/// <param name="from">Current position of the control point</param>
+/// <param name="to">New position of the control point</param>
+/// <returns>Indices of the curves that changed</returns>
+std::vector<int> move_control_point(std::vector<BezierCurve>& curves, glm::vec2 from, glm::vec2 to);
+
+/// <summary>
+/// Re-linearizes the changed curves and replaces their lines in place. This only works if every curve keeps its number of lines,
+/// otherwise the ids of all following lines shift and the caller has to linearize everything again.
+/// </summary>
+/// <param name="lines">Lines of all curves, updated in place</param>
+/// <param name="curve_line_offsets">Index of the first line of every curve, and the total number of lines at the end</param>
+/// <param name="curves">The edited curves</param>
+/// <param name="changed_curves">Indices of the curves that changed</param>
+/// <param name="tolerance">Tolerance in pixels passed to linearize_bezier_curves</param>
+/// <param name="max_depth">Maximum subdivision passed to linearize_bezier_curves</param>
+/// <param name="dirty_min">Grows to contain the old and new lines of the changed curves, in pixels</param>
+/// <param name="dirty_max">Grows to contain the old and new lines of the changed curves, in pixels</param>
+/// <returns>False if the number of lines of a curve changed and nothing was replaced</returns>
+bool update_curve_lines(std::vector<Line>& lines, const std::vector<size_t>& curve_line_offsets, const std::vector<BezierCurve>& curves,
+	const std::vector<int>& changed_curves, float tolerance, int max_depth, glm::vec2& dirty_min, glm::vec2& dirty_max);
+
+/// <summary>
+/// Marks the pixels whose samples can change when the shapes inside dirty change. Rays cannot pass through rasterized shapes,
+/// so only pixels connected to the dirty rectangle through empty pixels can see it. Regions closed off by other shapes keep their samples.
+/// A ray marching with a large step can jump over a thin shape though, so the fill continues to every empty pixel within reach pixels.
+/// </summary>
+/// <param name="mask">Output, 1 for pixels to reset, resized to resolution</param>
+/// <param name="shape_ids">Rasterized shapes, -1 for empty pixels</param>
+/// <param name="resolution">The resolution of the raster</param>
+/// <param name="dirty">Pixels where shapes changed, these are always reset</param>
+/// <param name="reach">Distance in pixels a ray can move past a shape in one step, at least 1 so rays also pass diagonal gaps</param>
+/// <returns>Bounding rectangle of the marked pixels</returns>
+PixelRect compute_reset_mask(std::vector<uint8_t>& mask, const std::vector<int>& shape_ids, glm::ivec2 resolution, PixelRect dirty, int reach = 1);
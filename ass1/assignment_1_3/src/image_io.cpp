@@ -0,0 +1,168 @@
+#include "image_io.h"
+
+#include <framework/disable_all_warnings.h>
+DISABLE_WARNINGS_PUSH()
+// Static implementation so this does not clash with a copy compiled into the framework
+#define STB_IMAGE_WRITE_STATIC
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb/stb_image_write.h>
+DISABLE_WARNINGS_POP()
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+//Forward declarations for helper functions
+std::vector<char> exr_header(glm::ivec2 resolution, int tile_size);
+void write_attribute(std::vector<char>& header, const std::string& name, const std::string& type, const void* value, int32_t size);
+
+bool write_png(const std::filesystem::path& path, const std::vector<glm::vec3>& pixels, glm::ivec2 resolution) {
+	std::vector<uint8_t> bytes(resolution.x * resolution.y * 3);
+	for (int y = 0; y < resolution.y; y++) {
+		for (int x = 0; x < resolution.x; x++) {
+			const glm::vec3& color = pixels[(resolution.y - 1 - y) * resolution.x + x];
+			for (int c = 0; c < 3; c++) {
+				bytes[(y * resolution.x + x) * 3 + c] = (uint8_t)std::lround(std::clamp(color[c], 0.0f, 1.0f) * 255.0f);
+			}
+		}
+	}
+	return stbi_write_png(path.string().c_str(), resolution.x, resolution.y, 3, bytes.data(), resolution.x * 3) != 0;
+}
+
+bool write_exr(const std::filesystem::path& path, const std::vector<glm::vec3>& pixels, glm::ivec2 resolution) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file) return false;
+
+	std::vector<char> header = exr_header(resolution, 0);
+	file.write(header.data(), header.size());
+
+	//Offset table pointing to the start of every scanline chunk
+	const int32_t line_data_size = resolution.x * 3 * (int32_t)sizeof(float);
+	const uint64_t chunk_size = 2 * sizeof(int32_t) + line_data_size;
+	uint64_t offset = header.size() + resolution.y * sizeof(uint64_t);
+	for (int y = 0; y < resolution.y; y++) {
+		file.write((const char*)&offset, sizeof(offset));
+		offset += chunk_size;
+	}
+
+	//Scanlines, the channels of each line are stored one after the other in the order of the channel list
+	std::vector<float> line_data(resolution.x * 3);
+	for (int32_t y = 0; y < resolution.y; y++) {
+		const glm::vec3* row = &pixels[(resolution.y - 1 - y) * resolution.x];
+		for (int x = 0; x < resolution.x; x++) {
+			line_data[x] = row[x].z;
+			line_data[resolution.x + x] = row[x].y;
+			line_data[2 * resolution.x + x] = row[x].x;
+		}
+		file.write((const char*)&y, sizeof(y));
+		file.write((const char*)&line_data_size, sizeof(line_data_size));
+		file.write((const char*)line_data.data(), line_data_size);
+	}
+
+	return (bool)file;
+}
+
+ExrTileWriter::ExrTileWriter(const std::filesystem::path& path, glm::ivec2 resolution, int tile_size)
+	: file(path, std::ios::binary), resolution(resolution), tile_size(tile_size) {
+	std::vector<char> header = exr_header(resolution, tile_size);
+	file.write(header.data(), header.size());
+
+	//The offset table is filled in by finish, when the position of every tile is known
+	glm::ivec2 count = tile_count();
+	tile_offsets.assign((size_t)count.x * count.y, 0);
+	offset_table_position = file.tellp();
+	file.write((const char*)tile_offsets.data(), tile_offsets.size() * sizeof(uint64_t));
+}
+
+glm::ivec2 ExrTileWriter::tile_count() const {
+	return (resolution + tile_size - 1) / tile_size;
+}
+
+void ExrTileWriter::tile_region(glm::ivec2 tile, glm::ivec2& min, glm::ivec2& max) const {
+	//The file counts rows from the top, the pixels from the bottom
+	min = glm::ivec2(tile.x * tile_size, std::max(resolution.y - (tile.y + 1) * tile_size, 0));
+	max = glm::ivec2(std::min((tile.x + 1) * tile_size, resolution.x), resolution.y - tile.y * tile_size);
+}
+
+bool ExrTileWriter::write_tile(glm::ivec2 tile, const std::vector<glm::vec3>& pixels) {
+	glm::ivec2 min, max;
+	tile_region(tile, min, max);
+	glm::ivec2 size = max - min;
+
+	tile_offsets[(size_t)tile.y * tile_count().x + tile.x] = (uint64_t)file.tellp();
+	const int32_t tile_coordinates[4] = { tile.x, tile.y, 0, 0 };		//tile x, tile y, level x, level y
+	const int32_t data_size = size.x * size.y * 3 * (int32_t)sizeof(float);
+	file.write((const char*)tile_coordinates, sizeof(tile_coordinates));
+	file.write((const char*)&data_size, sizeof(data_size));
+
+	//Same layout as a scanline chunk for every line of the tile
+	std::vector<float> line_data(size.x * 3);
+	for (int y = 0; y < size.y; y++) {
+		const glm::vec3* row = &pixels[(size_t)(size.y - 1 - y) * size.x];
+		for (int x = 0; x < size.x; x++) {
+			line_data[x] = row[x].z;
+			line_data[size.x + x] = row[x].y;
+			line_data[2 * size.x + x] = row[x].x;
+		}
+		file.write((const char*)line_data.data(), line_data.size() * sizeof(float));
+	}
+	return (bool)file;
+}
+
+bool ExrTileWriter::finish() {
+	if (std::find(tile_offsets.begin(), tile_offsets.end(), 0) != tile_offsets.end()) return false;
+	file.seekp(offset_table_position);
+	file.write((const char*)tile_offsets.data(), tile_offsets.size() * sizeof(uint64_t));
+	file.close();
+	return !file.fail();
+}
+
+//Magic number, version and header of a single part uncompressed float BGR file, tiled with a single level if tile_size > 0
+std::vector<char> exr_header(glm::ivec2 resolution, int tile_size) {
+	std::vector<char> header = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+	if (tile_size > 0) header[5] |= 0x2;		//Single part tiled flag, bit 9 of the version field
+
+	//Channel list, channels have to be sorted by name and are stored as 32 bit floats (pixel type 2)
+	std::vector<char> channels;
+	for (const char* name : { "B", "G", "R" }) {
+		channels.insert(channels.end(), name, name + 2);
+		const int32_t channel_info[4] = { 2, 0, 1, 1 };		//pixel type, pLinear + reserved bytes, x sampling, y sampling
+		channels.insert(channels.end(), (const char*)channel_info, (const char*)channel_info + sizeof(channel_info));
+	}
+	channels.push_back(0);
+
+	const int32_t window[4] = { 0, 0, resolution.x - 1, resolution.y - 1 };
+	const uint8_t compression = 0;		//NO_COMPRESSION, every chunk is a single scanline or tile
+	const uint8_t line_order = 0;		//INCREASING_Y
+	const float pixel_aspect_ratio = 1;
+	const float screen_window_center[2] = { 0, 0 };
+	const float screen_window_width = 1;
+
+	write_attribute(header, "channels", "chlist", channels.data(), (int32_t)channels.size());
+	write_attribute(header, "compression", "compression", &compression, sizeof(compression));
+	write_attribute(header, "dataWindow", "box2i", window, sizeof(window));
+	write_attribute(header, "displayWindow", "box2i", window, sizeof(window));
+	write_attribute(header, "lineOrder", "lineOrder", &line_order, sizeof(line_order));
+	write_attribute(header, "pixelAspectRatio", "float", &pixel_aspect_ratio, sizeof(pixel_aspect_ratio));
+	write_attribute(header, "screenWindowCenter", "v2f", screen_window_center, sizeof(screen_window_center));
+	write_attribute(header, "screenWindowWidth", "float", &screen_window_width, sizeof(screen_window_width));
+	if (tile_size > 0) {
+		//x size, y size and a mode of ONE_LEVEL
+		char tile_description[9] = {};
+		const uint32_t tile_sizes[2] = { (uint32_t)tile_size, (uint32_t)tile_size };
+		std::memcpy(tile_description, tile_sizes, sizeof(tile_sizes));
+		write_attribute(header, "tiles", "tiledesc", tile_description, sizeof(tile_description));
+	}
+	header.push_back(0);
+	return header;
+}
+
+//Appends an attribute in the OpenEXR header layout: name, type, size and value
+void write_attribute(std::vector<char>& header, const std::string& name, const std::string& type, const void* value, int32_t size) {
+	header.insert(header.end(), name.c_str(), name.c_str() + name.size() + 1);
+	header.insert(header.end(), type.c_str(), type.c_str() + type.size() + 1);
+	header.insert(header.end(), (const char*)&size, (const char*)&size + sizeof(size));
+	header.insert(header.end(), (const char*)value, (const char*)value + size);
+}
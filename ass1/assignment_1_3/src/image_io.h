@@ -0,0 +1,58 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+// Both writers take the pixels bottom row first, like OpenGL textures, and flip them to the top down order of the file formats
+
+/// <summary>
+/// Writes the colors as an 8 bit RGB PNG file, values are clamped to [0, 1]
+/// </summary>
+/// <param name="path">File to write</param>
+/// <param name="pixels">Row major colors, the first row is the bottom of the image</param>
+/// <param name="resolution">Size of the image</param>
+/// <returns>True if the file was written</returns>
+bool write_png(const std::filesystem::path& path, const std::vector<glm::vec3>& pixels, glm::ivec2 resolution);
+
+/// <summary>
+/// Writes the colors as an uncompressed 32 bit float RGB OpenEXR file
+/// </summary>
+/// <param name="path">File to write</param>
+/// <param name="pixels">Row major colors, the first row is the bottom of the image</param>
+/// <param name="resolution">Size of the image</param>
+/// <returns>True if the file was written</returns>
+bool write_exr(const std::filesystem::path& path, const std::vector<glm::vec3>& pixels, glm::ivec2 resolution);
+
+// Writes an uncompressed 32 bit float RGB OpenEXR file one tile at a time, so the whole image never has to be in memory.
+// Tiles are square and counted from the top left of the image like in the file, tiles on the right and bottom edge are cut off at the image size.
+class ExrTileWriter {
+public:
+	ExrTileWriter(const std::filesystem::path& path, glm::ivec2 resolution, int tile_size);
+
+	// Number of tiles in x and y
+	glm::ivec2 tile_count() const;
+	// Pixels covered by a tile, in image coordinates with the first row at the bottom like the pixels passed to write_tile
+	void tile_region(glm::ivec2 tile, glm::ivec2& min, glm::ivec2& max) const;
+
+	/// <summary>
+	/// Writes a single tile, tiles can be written in any order
+	/// </summary>
+	/// <param name="tile">Index of the tile, from the top left</param>
+	/// <param name="pixels">Row major colors of the tile region, the first row is the bottom of the tile</param>
+	/// <returns>True if the tile was written</returns>
+	bool write_tile(glm::ivec2 tile, const std::vector<glm::vec3>& pixels);
+
+	// Writes the offsets of the tiles, returns true if all tiles were written without errors
+	bool finish();
+
+private:
+	std::ofstream file;
+	glm::ivec2 resolution;
+	int tile_size;
+	std::streamoff offset_table_position = 0;
+	std::vector<uint64_t> tile_offsets;
+};
@@ -7,10 +7,23 @@ DISABLE_WARNINGS_PUSH()
 #include <imgui/imgui_impl_opengl3.h>
 DISABLE_WARNINGS_POP()
 
+#include "accumulator_cache.h"
+#include "cpu_renderer.h"
+#include "curve_cache.h"
+#include "curve_editing.h"
+#include "multigrid.h"
+#include "program_cache.h"
+#include "sampler_stats.h"
+#include "segment_grid.h"
 #include "shapes.h"
+#include "tile_cache.h"
 #include <framework/shader.h>
 #include <framework/trackball.h>
 #include <framework/window.h>
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
 #include <iostream>
 #include <random>
 
@@ -22,12 +35,96 @@ std::unique_ptr<Trackball> pTrackball;
 // Forward declaration for GLFW callback function
 void keyboard(int key, int /* scancode */, int /* action */, int /* mods */);
 void reshape(const glm::ivec2 &size);
+void scroll(const glm::vec2 &offset);
+
+// Buffer textures with the segment grid and the lines or curves for the exact
+// traversal in the sample shader
+struct GridTextures {
+  GLuint cell_buffer, cell_texture;
+  GLuint segment_buffer, segment_texture;
+  GLuint line_buffer, line_texture;
+  glm::ivec2 dimensions{0};
+  // Cell size the grid was built with, the slider may have moved since
+  float cell_size = 0.0f;
+};
+// Buffer texture with the lines for the shaders, in the layout of the Line
+// struct. A uniform block would limit the number of lines.
+struct LineTexture {
+  GLuint buffer, texture;
+  int count = 0;
+};
+// Time per pass of the fragment and the compute sampler over the same passes,
+// and the largest difference of the colors they gave
+struct SamplerComparison {
+  int passes = 0;
+  float fragment_ms = 0.0f;
+  float compute_ms = 0.0f;
+  float difference = 0.0f;
+};
 void rasterize_shape(const GLuint &VAO, const GLuint &frameBuffer,
                      const Shader &shader, const GLuint &circleBuffer,
-                     const GLuint &lineBuffer, const float &line_width,
-                     const Shape &shapetype);
+                     const LineTexture &lineTexture, const float &line_width,
+                     const Shape &shapetype, const glm::ivec2 &dimensions,
+                     int shape_count);
+void sample_shape(const GLuint &VAO, const GLuint &frameBuffer,
+                  const Shader &shader, const GLuint &circleBuffer,
+                  const LineTexture &lineTexture,
+                  const GLuint &rasterizedTexture,
+                  const GLuint &boundaryTexture,
+                  const GLuint &accumulatorTexture, const glm::ivec2 &dimensions,
+                  unsigned int frame, const Shape &shapetype,
+                  const GridTextures *grid = nullptr,
+                  const glm::vec2 &pixelOffset = glm::vec2(0.0f),
+                  float pixelScale = 1.0f);
+void sample_shape_compute(const Shader &shader, const GLuint &queueBuffer,
+                          const GLuint &circleBuffer,
+                          const LineTexture &lineTexture,
+                          const GLuint &rasterizedTexture,
+                          const GLuint &boundaryTexture,
+                          const GLuint &accumulatorTexture,
+                          const glm::ivec2 &dimensions, unsigned int frame,
+                          const Shape &shapetype,
+                          const GLuint *statsTexture = nullptr);
+SamplerComparison compare_samplers(
+    const GLuint &VAO, const Shader &sampleShader, const Shader &computeShader,
+    const GLuint &queueBuffer, const GLuint &circleBuffer,
+    const LineTexture &lineTexture, const Accumulator &accumulator,
+    const GLuint (&frameBuffers)[2], const GLuint (&textures)[2],
+    const Shape &shapetype, int passes);
+GLuint denoise_accumulator(const GLuint &VAO, const Shader &shader,
+                           const GLuint (&frameBuffers)[2],
+                           const GLuint (&textures)[2],
+                           const GLuint &rasterizedTexture,
+                           const GLuint &accumulatorTexture,
+                           const glm::ivec2 &dimensions, int passes);
+float solve_diffusion_multigrid(const GLuint &accumulatorTexture,
+                                const std::vector<Line> &lines, int v_cycles);
+void create_line_texture(LineTexture &lineTexture);
+void upload_lines(LineTexture &lineTexture, const std::vector<Line> &lines);
+void bind_lines(const Shader &shader, const LineTexture &lineTexture);
+void create_grid_textures(GridTextures &grid);
+void upload_segment_grid(GridTextures &grid, const std::vector<Line> &lines,
+                         const std::vector<BezierCurve> &curves);
+void reset_accumulator_region(const GLuint &VAO, const GLuint &frameBuffer,
+                              const Shader &shader, const GLuint &maskTexture,
+                              const std::vector<uint8_t> &mask,
+                              const PixelRect &region);
+void update_view();
+int view_level();
+std::vector<TileKey> visible_tiles(int level);
+void refine_tiles(TileCache &cache, const std::vector<TileKey> &keys,
+                  const GridTextures &grid, const GLuint &VAO,
+                  const Shader &sampleShader, const GLuint &circleBuffer,
+                  const LineTexture &lineTexture);
+void draw_tiles(TileCache &cache, int level, const Shader &tileShader,
+                const GLuint &VAO);
 
 int constexpr file_name_buffer_size = 40;
+// Size of the circle array in the shaders
+int constexpr max_shader_circles = 32;
+// Number of quads in the ring drawn around a circle by the rasterize pass, the
+// same as ring_segments in rasterize_vertex.glsl
+int constexpr ring_segments = 64;
 
 // Show the debug menu
 bool debug_menu_on = true;
@@ -41,9 +138,14 @@ std::filesystem::path xml_folder(RESOURCE_ROOT "/resources/diffusionCurveXMLs");
 // The xml file name is in a larger buffer for some leniency when the user
 // changes it
 char file_name_buffer[file_name_buffer_size] = "arch.xml";
+// Folder with the preprocessed curve files, so reloading a file skips parsing
+std::filesystem::path curve_cache_folder = default_curve_cache_folder();
 
-// The maximum amount curves should be subdivided to fit the lines better.
-int max_curve_subdivision = 0;
+// The maximum amount curves should be subdivided to fit the lines better, the
+// tolerance decides where the subdivision stops below this
+int max_curve_subdivision = max_linearize_depth;
+// Maximum distance in pixels between a curve and the lines approximating it
+float curve_tolerance = 0.25f;
 
 // Uniform for the maximum distance from a shape to be considered part of it
 float rasterize_width = 0.75f;
@@ -51,6 +153,81 @@ float rasterize_width = 0.75f;
 float step_size = 0.05f;
 unsigned int max_raymarch_iters = 10000;
 
+// Which solver produces the image for the curves,
+//  0 - Monte Carlo ray marching in the sample shader
+//  1 - Multigrid Laplace solver on the CPU
+int solver_type = 0;
+// Number of V-cycles run by the multigrid solver
+int multigrid_cycles = 4;
+// Residual and time of the last multigrid solve, shown in the menu
+float multigrid_residual = 0.0f;
+float multigrid_time_ms = 0.0f;
+
+// Intersect the curves exactly by walking a grid of the lines in the sample
+// shader, instead of marching over the rasterized texture
+bool exact_traversal = false;
+// Size of the grid cells in pixels
+float grid_cell_size = 8.0f;
+// Intersect the Bezier curves directly in the exact traversal instead of the
+// lines approximating them
+bool native_curves = false;
+
+// Drag the control points of the curves with the mouse, only the part of the
+// image that can see the change is re-rasterized and resampled
+bool edit_curves = false;
+// Distance in pixels from the cursor in which a control point is picked up
+float control_point_pick_distance = 8.0f;
+// Percentage of the pixels reset by the last edit, shown in the menu
+float edit_reset_percentage = 0.0f;
+
+// Pan and zoom viewer, renders the curves in tiles at the detail of the zoom
+// level and keeps the tiles it rendered
+bool tile_viewer = false;
+// Size of the tiles, in pixels
+int constexpr viewer_tile_size = 256;
+// Deepest level, level l renders the image at 2^l times the window resolution
+int constexpr viewer_max_level = 6;
+// Number of tiles kept in video memory, each takes about 1MB
+size_t constexpr viewer_cache_capacity = 64;
+// Sample passes per frame spread over the visible tiles, and the number of
+// samples after which a tile is not refined further
+int viewer_passes_per_frame = 4;
+int viewer_max_samples = 512;
+// Center of the view in pixels of level 0, and screen pixels per level 0 pixel
+glm::vec2 view_center = glm::vec2(resolution) / 2.0f;
+float view_zoom = 1.0f;
+// Scroll wheel movement since the last frame and the mouse state for panning
+float scroll_offset = 0.0f;
+bool view_panning = false;
+glm::vec2 view_last_cursor{0.0f};
+
+// Take the samples with a compute shader when the context has OpenGL 4.3, for
+// ray marching only. Its threads take a new ray after every round of
+// compute_steps_per_round steps if theirs ended. Off by default, whether it
+// beats the fragment shader depends on the GPU, which the sampler comparison
+// in the menu measures.
+bool compute_sampling = false;
+int compute_steps_per_round = 16;
+// Passes each sampler takes in the comparison, and its last result
+int sampler_comparison_passes = 32;
+SamplerComparison sampler_comparison;
+// Work groups of 64 threads the compute shader keeps running until all rays
+// are done, enough to fill a large GPU
+int constexpr compute_sampling_groups = 512;
+
+// Video memory for the accumulators of the settings used, so switching back
+// to earlier settings continues from their samples
+size_t accumulator_cache_budget_mb = 128;
+
+// Edge-aware filter of the shown image while it is still noisy, the
+// accumulator itself is left as is. Every pass doubles the reach of the filter.
+bool denoise_preview = false;
+int denoise_passes = 4;
+
+// Count the march steps and the outcome of every ray of the sample passes and
+// time them, the statistics are read back a few frames later
+bool instrument_sampler = false;
+
 // If sampling is paused, and a flag to take 1 sample even if paused
 bool paused = false;
 bool one_sample = false;
@@ -107,6 +284,7 @@ int main() {
   // Setup GLFW callbacks
   pWindow->registerKeyCallback(keyboard);
   pWindow->registerWindowResizeCallback(reshape);
+  pWindow->registerScrollCallback(scroll);
 
   // Create Quad covering the entire screen
   int quad_indices[6] = {
@@ -158,46 +336,93 @@ int main() {
   // colorShader : creates the final image by aggregating the acummulated
   // samples
   const Shader rasterizeShader =
-      ShaderBuilder()
-          .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
+      CachedShaderBuilder()
+          .addStage(GL_VERTEX_SHADER,
+                    RESOURCE_ROOT "shaders/rasterize_vertex.glsl")
           .addStage(GL_FRAGMENT_SHADER,
                     RESOURCE_ROOT "shaders/rasterize_primitive.glsl")
           .build();
   const Shader sampleShader =
-      ShaderBuilder()
+      CachedShaderBuilder()
           .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
           .addStage(GL_FRAGMENT_SHADER,
                     RESOURCE_ROOT "shaders/sample_shader.glsl")
           .build();
   const Shader colorShader =
-      ShaderBuilder()
+      CachedShaderBuilder()
           .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
           .addStage(GL_FRAGMENT_SHADER,
                     RESOURCE_ROOT "shaders/color_shader.glsl")
           .build();
+  // denoiseShader : filters the accumulated samples for display, without
+  // mixing the colors on both sides of a shape
+  const Shader denoiseShader =
+      CachedShaderBuilder()
+          .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
+          .addStage(GL_FRAGMENT_SHADER,
+                    RESOURCE_ROOT "shaders/denoise_shader.glsl")
+          .build();
+  // resetShader : clears the samples of the pixels an edit can change
+  const Shader resetShader =
+      CachedShaderBuilder()
+          .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
+          .addStage(GL_FRAGMENT_SHADER,
+                    RESOURCE_ROOT "shaders/reset_shader.glsl")
+          .build();
+
+  // sampleComputeShader : the same samples as sampleShader for ray marching,
+  // with threads that keep taking rays from a queue. It needs OpenGL 4.3,
+  // contexts with only 4.1 keep the fragment shader.
+  GLint gl_major_version = 0;
+  GLint gl_minor_version = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &gl_major_version);
+  glGetIntegerv(GL_MINOR_VERSION, &gl_minor_version);
+  const bool compute_supported =
+      gl_major_version > 4 || (gl_major_version == 4 && gl_minor_version >= 3);
+  Shader sampleComputeShader;
+  GLuint rayQueue = 0;
+  if (compute_supported) {
+    sampleComputeShader =
+        CachedShaderBuilder()
+            .addStage(GL_COMPUTE_SHADER,
+                      RESOURCE_ROOT "shaders/sample_compute.glsl")
+            .build();
+    glGenBuffers(1, &rayQueue);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, rayQueue);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL,
+                 GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  }
 
   // Load debug shader for showing the intermediate textures.
   const Shader textureShader =
-      ShaderBuilder()
+      CachedShaderBuilder()
           .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
           .addStage(GL_FRAGMENT_SHADER,
                     RESOURCE_ROOT "shaders/texture_shader.glsl")
           .build();
 
+  // Shader drawing the tiles of the pan and zoom viewer
+  const Shader tileShader =
+      CachedShaderBuilder()
+          .addStage(GL_VERTEX_SHADER, RESOURCE_ROOT "shaders/vertex.glsl")
+          .addStage(GL_FRAGMENT_SHADER, RESOURCE_ROOT "shaders/tile_shader.glsl")
+          .build();
+
   // We load Both the bezier curves and circles so we can switch on the fly.
 
   // Load the bezier curves from the XML files into memory as
-  // shape::BezierCurves
-  std::vector<BezierCurve> curves;
-  load_Bezier_curves(curves, (xml_folder / file_name_buffer).string().c_str(),
-                     resolution);
-
-  // Create a linear approximation of the bezier curves
-  std::vector<Line> lines;
-  for (BezierCurve curve : curves) {
-    auto new_lines = linearize_bezier_curve(curve, 1, max_curve_subdivision);
-    lines.insert(lines.begin(), new_lines.begin(), new_lines.end());
-  }
+  // shape::BezierCurves, together with their linear approximation. Both come
+  // from the curve cache if this file was loaded with these settings before.
+  // Dragging control points edits them in place, so the viewer works on a
+  // copy of the read-only mapping.
+  CachedCurves cached_curves =
+      load_curves_cached(xml_folder / file_name_buffer, curve_cache_folder,
+                         resolution, curve_tolerance, max_curve_subdivision);
+  std::vector<BezierCurve> curves(cached_curves.curves.begin(),
+                                  cached_curves.curves.end());
+  std::vector<Line> lines(cached_curves.lines.begin(),
+                          cached_curves.lines.end());
 
   // Create random circles
   std::vector<Circle> circles;
@@ -223,88 +448,236 @@ int main() {
 
   int number_of_lines = (int)lines.size();
 
-  GLuint lineUbo;
-  glGenBuffers(1, &lineUbo);
-  glBindBuffer(GL_UNIFORM_BUFFER, lineUbo);
-  // Set buffer size but dont put anything in it just yet
-  glBufferData(GL_UNIFORM_BUFFER, number_of_lines * sizeof(Line) + 16, NULL,
-               GL_DYNAMIC_DRAW);
-  // put the number of circles in the first 4 bytes to the number of circles
-  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(int), &number_of_lines);
-  // GLSL data is 16 byte alligned so the actual data starts at byte 16
-  glBufferSubData(GL_UNIFORM_BUFFER, 16, number_of_lines * sizeof(Line),
-                  lines.data());
-  glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-  // Create texture for the rasterized shapes
-  GLuint texRasterized;
-  glGenTextures(1, &texRasterized);
-  glBindTexture(GL_TEXTURE_2D, texRasterized);
-
-  // We want the texture to represent the id of the rasterized shape so we
-  // request a 32 bit int as internal format We dont put any data in the texture
-  // as that is what the first renderpass is for
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_R32I, resolution.x, resolution.y, 0,
-               GL_RED_INTEGER, GL_UNSIGNED_BYTE, NULL);
-  // Set behaviour for when texture coordinates are outside the [0, 1] range.
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-  // Set interpolation for texture sampling (GL_NEAREST for no interpolation).
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
+  LineTexture lineTexture;
+  create_line_texture(lineTexture);
+  upload_lines(lineTexture, lines);
+
+  // The grid for the exact traversal has no limit on the number of lines
+  GridTextures grid_textures;
+  create_grid_textures(grid_textures);
+  upload_segment_grid(grid_textures, lines, curves);
+
+  // The rasterized shapes and the sample accumulator of the settings in use,
+  // and of settings used before as long as they fit in the budget. Each holds
+  // a 32 bit int id texture, the colors on both sides of the lines packed in
+  // 4 unsigned ints, a depth buffer for the rasterize pass and an accumulator
+  // with 32 bit floats for each color channel.
+  AccumulatorCache accumulator_cache(resolution,
+                                     accumulator_cache_budget_mb << 20);
+
+  // A texture with the steps and outcome of the ray of every pixel, and the
+  // timer queries of the sample passes
+  SamplerStats sampler_stats(resolution);
+
+  // Two textures in the layout of the accumulator for the denoise passes, each
+  // pass reads the output of the one before it
+  GLuint texDenoised[2];
+  GLuint denoise_buffers[2];
+  glGenTextures(2, texDenoised);
+  glGenFramebuffers(2, denoise_buffers);
+  for (int i = 0; i < 2; i++) {
+    glBindTexture(GL_TEXTURE_2D, texDenoised[i]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, resolution.x, resolution.y, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, denoise_buffers[i]);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           texDenoised[i], 0);
+  }
   glBindTexture(GL_TEXTURE_2D, 0);
-
-  // Create framebuffer attached to the rasterized shape texture
-  // We put this framewbuffer as output to the drawcall, just like
-  // shadowmapping.
-  GLuint rasterized_shape_buffer;
-  glGenFramebuffers(1, &rasterized_shape_buffer);
-  glBindFramebuffer(GL_FRAMEBUFFER, rasterized_shape_buffer);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-                         texRasterized, 0);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-  // Repeat the entire procces for the sample acummulator texture
-  GLuint texAccumulator;
-  glGenTextures(1, &texAccumulator);
-  glBindTexture(GL_TEXTURE_2D, texAccumulator);
-
-  // The acumulator needs to be reasonable precision, so we will use 32 bit
-  // floats for each color channel
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, resolution.x, resolution.y, 0,
-               GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  // Number of shapes of the selected type, one instance each in the rasterize
+  // pass
+  auto shape_count = [&]() {
+    return shape == Shape::Circle ? number_of_circles : number_of_lines;
+  };
 
-  // Set behaviour for when texture coordinates are outside the [0, 1] range.
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  // The settings of the menu the accumulated samples depend on, only those the
+  // active solver uses
+  auto accumulator_key = [&]() {
+    return AccumulatorKey{shape,           solver_type,        multigrid_cycles,
+                          rasterize_width, step_size,          max_raymarch_iters,
+                          exact_traversal, native_curves}
+        .normalized();
+  };
+  // Settings the accumulators are cached under. A dragged slider changes the
+  // settings every frame, so they are only cached once the edit is finished
+  // and sample into a scratch accumulator until then.
+  AccumulatorKey committed_key = accumulator_key();
+
+  // Gets the accumulator of the current settings. The shapes of a new one are
+  // rasterized in an initial rendering pass, this only needs to happen once
+  // (or after a reset)
+  auto use_accumulator = [&]() -> Accumulator & {
+    AccumulatorKey key = accumulator_key();
+    Accumulator &accumulator = key == committed_key
+                                   ? accumulator_cache.get(key)
+                                   : accumulator_cache.scratch(key);
+    // The key leaves the rasterize width out when the samples do not depend on
+    // it, the shapes are still shown with the width of the menu
+    if (!accumulator.rasterized ||
+        accumulator.rasterized_width != rasterize_width) {
+      rasterize_shape(vao, accumulator.rasterized_shape_buffer,
+                      rasterizeShader, circleUbo, lineTexture,
+                      rasterize_width, shape, resolution, shape_count());
+      accumulator.rasterized_width = rasterize_width;
+    }
+    if (!accumulator.rasterized) {
+      // The multigrid solution is found once per accumulator
+      if (solver_type == 1 && shape == Shape::Line) {
+        multigrid_residual = solve_diffusion_multigrid(
+            accumulator.texAccumulator, lines, multigrid_cycles);
+      }
+      accumulator.rasterized = true;
+    }
+    return accumulator;
+  };
 
-  // Set interpolation for texture sampling (GL_NEAREST for no interpolation).
+  // State of dragging a control point: the point being dragged, the range of
+  // lines of every curve and a CPU copy of the rasterized lines to find the
+  // pixels affected by an edit
+  bool dragging = false;
+  glm::vec2 drag_point{0.0f};
+  std::vector<size_t> curve_line_offsets;
+  std::vector<int> shape_ids;
+  std::vector<uint8_t> reset_mask;
+  // The reset mask on the GPU, only the part around an edit is uploaded
+  GLuint texResetMask;
+  glGenTextures(1, &texResetMask);
+  glBindTexture(GL_TEXTURE_2D, texResetMask);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, resolution.x, resolution.y, 0,
+               GL_RED_INTEGER, GL_UNSIGNED_BYTE, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
   glBindTexture(GL_TEXTURE_2D, 0);
 
-  GLuint accumulator_buffer;
-  glGenFramebuffers(1, &accumulator_buffer);
-  glBindFramebuffer(GL_FRAMEBUFFER, accumulator_buffer);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-                         texAccumulator, 0);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-  // Rasterize the shapes in an intial rendering pass, this only needs to happen
-  // once (or after a reset)
-  rasterize_shape(vao, rasterized_shape_buffer, rasterizeShader, circleUbo,
-                  lineUbo, rasterize_width, shape);
-
-  // With the shapes rasterized we can start taking samples of our integral
-  // Keep track of the frame nr for the random number generator
-  unsigned int frame_nr = 0;
+  // Tiles of the pan and zoom viewer. Their rays are traced through a grid of
+  // the whole image, with the curves linearized at the detail of the level
+  // shown, so every tile sees all the curves however many there are.
+  TileCache tile_cache(viewer_cache_capacity, glm::ivec2(viewer_tile_size));
+  GridTextures tile_grid;
+  create_grid_textures(tile_grid);
+  std::vector<Line> tile_lines;
+  // Level the tile grid was built for, -1 when it has to be rebuilt
+  int tile_grid_level = -1;
 
   while (!pWindow->shouldClose()) {
     pWindow->updateInput();
 
+    // With the shapes rasterized we can start taking samples of our integral,
+    // the accumulator keeps track of the frame nr for the random number
+    // generator
+    Accumulator &accumulator = use_accumulator();
+
+    // Move the dragged control point and update only what it affects
+    if (edit_curves && shape == Shape::Line && !tile_viewer) {
+      bool mouse_down =
+          pWindow->isMouseButtonPressed(GLFW_MOUSE_BUTTON_LEFT) &&
+          !ImGui::GetIO().WantCaptureMouse;
+      // The cursor is in window coordinates with y down, the curves are in
+      // pixels with y up
+      glm::vec2 window_size = pWindow->getWindowSize();
+      glm::vec2 cursor = pWindow->getCursorPos();
+      glm::vec2 mouse_pixel{cursor.x / window_size.x * resolution.x,
+                            (1.0f - cursor.y / window_size.y) * resolution.y};
+
+      if (!mouse_down) {
+        dragging = false;
+      } else if (!dragging) {
+        dragging = find_control_point(curves, mouse_pixel,
+                                      control_point_pick_distance, drag_point);
+        if (dragging) {
+          // Linearizing gives the same lines as before, but also the range of
+          // lines belonging to each curve
+          linearize_bezier_curves(lines, curves, curve_tolerance,
+                                  max_curve_subdivision, 0,
+                                  &curve_line_offsets);
+          rasterize_lines_cpu(shape_ids, lines, resolution, rasterize_width);
+        }
+      } else if (mouse_pixel != drag_point) {
+        std::vector<int> changed_curves =
+            move_control_point(curves, drag_point, mouse_pixel);
+        drag_point = mouse_pixel;
+
+        glm::vec2 dirty_min{FLT_MAX};
+        glm::vec2 dirty_max{-FLT_MAX};
+        PixelRect dirty;
+        if (update_curve_lines(lines, curve_line_offsets, curves,
+                               changed_curves, curve_tolerance,
+                               max_curve_subdivision, dirty_min, dirty_max)) {
+          // Only upload the lines of the changed curves
+          glBindBuffer(GL_TEXTURE_BUFFER, lineTexture.buffer);
+          for (int curve : changed_curves) {
+            size_t first = curve_line_offsets[curve];
+            size_t count = curve_line_offsets[curve + 1] - first;
+            glBufferSubData(GL_TEXTURE_BUFFER, first * sizeof(Line),
+                            count * sizeof(Line), &lines[first]);
+          }
+          glBindBuffer(GL_TEXTURE_BUFFER, 0);
+          upload_segment_grid(grid_textures, lines, curves);
+
+          // Pixels within rasterize_width of the old or new lines can change
+          float margin = rasterize_width + 1.0f;
+          dirty.min = glm::ivec2(glm::floor(dirty_min - margin));
+          dirty.max = glm::ivec2(glm::ceil(dirty_max + margin));
+        } else {
+          // A curve changed its number of lines, so the ids of all lines
+          // after it shift and everything has to be redone
+          linearize_bezier_curves(lines, curves, curve_tolerance,
+                                  max_curve_subdivision, 0,
+                                  &curve_line_offsets);
+          number_of_lines = (int)lines.size();
+          upload_lines(lineTexture, lines);
+          upload_segment_grid(grid_textures, lines, curves);
+          dirty = {glm::ivec2(0), resolution};
+        }
+
+        // Re-rasterize the dirty rectangle only, the clear in rasterize_shape
+        // also stays inside the scissor rectangle
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(dirty.min.x, dirty.min.y, dirty.max.x - dirty.min.x,
+                  dirty.max.y - dirty.min.y);
+        rasterize_shape(vao, accumulator.rasterized_shape_buffer,
+                        rasterizeShader, circleUbo, lineTexture,
+                        rasterize_width, shape, resolution, shape_count());
+        glDisable(GL_SCISSOR_TEST);
+        rasterize_lines_cpu(shape_ids, lines, resolution, rasterize_width,
+                            dirty.min, dirty.max);
+
+        if (solver_type == 1) {
+          // The multigrid solution is global, solve again
+          multigrid_residual = solve_diffusion_multigrid(
+              accumulator.texAccumulator, lines, multigrid_cycles);
+          edit_reset_percentage = 100.0f;
+        } else {
+          // Reset the samples of the pixels that can see the change. Marched
+          // rays can jump over lines thinner than a step, exact rays only
+          // through the corners of the raster.
+          int reach = exact_traversal || native_curves
+                          ? 1
+                          : (int)std::ceil(std::max(step_size, 1.0f));
+          PixelRect region = compute_reset_mask(reset_mask, shape_ids,
+                                                resolution, dirty, reach);
+          reset_accumulator_region(vao, accumulator.accumulator_buffer,
+                                   resetShader, texResetMask, reset_mask,
+                                   region);
+          edit_reset_percentage =
+              100.0f *
+              (float)std::count(reset_mask.begin(), reset_mask.end(), 1) /
+              (float)reset_mask.size();
+        }
+        // The other accumulators were taken with the curves before the edit
+        accumulator_cache.clear_except(accumulator_key());
+      }
+    } else {
+      dragging = false;
+    }
+
     // Clear screen
     glViewport(0, 0, pWindow->getWindowSize().x, pWindow->getWindowSize().y);
     glClearColor(0.0, 0.0, 0.0, 0.0);
@@ -313,60 +686,102 @@ int main() {
     // Bind vertex data
     glBindVertexArray(vao);
 
+    // The multigrid solver writes the accumulator directly, so only sample
+    // when it is not in use
+    bool use_multigrid = solver_type == 1 && shape == Shape::Line;
+    // The tile viewer has its own textures and only works with Monte Carlo
+    bool use_tile_viewer =
+        tile_viewer && solver_type == 0 && shape == Shape::Line;
+
+    if (use_tile_viewer) {
+      //----- refine and draw the visible tiles
+      update_view();
+      int level = view_level();
+      if (!paused || one_sample) {
+        if (tile_grid_level != level) {
+          if (!native_curves) {
+            linearize_bezier_curves(tile_lines, curves,
+                                    curve_tolerance / std::exp2((float)level),
+                                    max_curve_subdivision);
+          }
+          upload_segment_grid(tile_grid, tile_lines, curves);
+          tile_grid_level = level;
+        }
+        refine_tiles(tile_cache, visible_tiles(level), tile_grid, vao,
+                     sampleShader, circleUbo, lineTexture);
+        one_sample = false;
+      }
+      draw_tiles(tile_cache, level, tileShader, vao);
+      glBindVertexArray(vao);
+    }
     // Only take sample if not paused, or the take one sample flag is set
-    if (!paused || one_sample) {
+    else if (!use_multigrid && (!paused || one_sample)) {
       //----- run the sample shader
-      sampleShader.bind();
+      bool exact = exact_traversal && shape == Shape::Line;
+      if (instrument_sampler) {
+        sampler_stats.begin_timer();
+      }
+      if (compute_supported && compute_sampling && !exact) {
+        GLuint stats_texture = sampler_stats.texture();
+        sample_shape_compute(sampleComputeShader, rayQueue, circleUbo,
+                             lineTexture, accumulator.texRasterized,
+                             accumulator.texBoundary,
+                             accumulator.texAccumulator, resolution,
+                             accumulator.frame_nr, shape,
+                             instrument_sampler ? &stats_texture : nullptr);
+      } else {
+        // The instrumented framebuffer also writes the statistics of the rays
+        GLuint frame_buffer =
+            instrument_sampler
+                ? sampler_stats.framebuffer(accumulator.texAccumulator)
+                : accumulator.accumulator_buffer;
+        sample_shape(vao, frame_buffer, sampleShader, circleUbo, lineTexture,
+                     accumulator.texRasterized, accumulator.texBoundary,
+                     accumulator.texAccumulator, resolution,
+                     accumulator.frame_nr, shape,
+                     exact_traversal ? &grid_textures : nullptr);
+      }
+      if (instrument_sampler) {
+        sampler_stats.end_timer();
+        sampler_stats.read_statistics();
+      }
 
-      sampleShader.bindUniformBlock("circleBuffer", 0, circleUbo);
-      sampleShader.bindUniformBlock("lineBuffer", 1, lineUbo);
+      // reset take one sample flag
+      one_sample = false;
+      accumulator.frame_nr++;
+    }
 
-      glUniform1ui(sampleShader.getUniformLocation("shape_type"),
-                   static_cast<GLuint>(shape));
+    //----- run the aggregate shader
 
-      glUniform1ui(sampleShader.getUniformLocation("frame_nr"), frame_nr);
-      glUniform1ui(sampleShader.getUniformLocation("max_raymarch_iter"),
-                   max_raymarch_iters);
-      glUniform2iv(sampleShader.getUniformLocation("screen_dimensions"), 1,
+    if (!use_tile_viewer) {
+      // The multigrid solution has no noise to remove
+      GLuint shown_texture = accumulator.texAccumulator;
+      if (denoise_preview && !use_multigrid) {
+        shown_texture = denoise_accumulator(
+            vao, denoiseShader, denoise_buffers, texDenoised,
+            accumulator.texRasterized, accumulator.texAccumulator, resolution,
+            denoise_passes);
+        glViewport(0, 0, pWindow->getWindowSize().x,
+                   pWindow->getWindowSize().y);
+      }
+
+      colorShader.bind();
+      glUniform2iv(colorShader.getUniformLocation("screen_dimensions"), 1,
                    glm::value_ptr(resolution));
-      glUniform1f(sampleShader.getUniformLocation("step_size"), step_size);
 
       glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, texRasterized);
-      glUniform1i(sampleShader.getUniformLocation("rasterized_texture"), 0);
-
-      glActiveTexture(GL_TEXTURE1);
-      glBindTexture(GL_TEXTURE_2D, texAccumulator);
-      glUniform1i(sampleShader.getUniformLocation("accumulator_texture"), 1);
+      glBindTexture(GL_TEXTURE_2D, shown_texture);
+      glUniform1i(colorShader.getUniformLocation("accumulator_texture"), 0);
 
-      glBindFramebuffer(GL_FRAMEBUFFER, accumulator_buffer);
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
       glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(6), GL_UNSIGNED_INT,
                      nullptr);
       glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-      // reset take one sample flag
-      one_sample = false;
-      frame_nr++;
     }
 
-    //----- run the aggregate shader
-
-    colorShader.bind();
-    glUniform2iv(colorShader.getUniformLocation("screen_dimensions"), 1,
-                 glm::value_ptr(resolution));
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texAccumulator);
-    glUniform1i(colorShader.getUniformLocation("accumulator_texture"), 0);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(6), GL_UNSIGNED_INT,
-                   nullptr);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
     // Overwrite output framebuffer with texture if a texture should be shown
     // instead.
-    if (output_type > 0) {
+    if (!use_tile_viewer && output_type > 0) {
       textureShader.bind();
 
       glUniform2iv(textureShader.getUniformLocation("screen_dimensions"), 1,
@@ -374,11 +789,11 @@ int main() {
       glUniform1i(textureShader.getUniformLocation("texture_id"), output_type);
 
       glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, texRasterized);
+      glBindTexture(GL_TEXTURE_2D, accumulator.texRasterized);
       glUniform1i(textureShader.getUniformLocation("rasterized_texture"), 0);
 
       glActiveTexture(GL_TEXTURE1);
-      glBindTexture(GL_TEXTURE_2D, texAccumulator);
+      glBindTexture(GL_TEXTURE_2D, accumulator.texAccumulator);
       glUniform1i(textureShader.getUniformLocation("accumulator_texture"), 1);
 
       glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -391,7 +806,12 @@ int main() {
 
     //----- Debug menu
     if (debug_menu_on) {
-      // Flags used in the menu to reset textures or reload primitives.
+      // Flags used in the menu to reset textures or reload primitives. Changes
+      // of the settings in the key of the accumulators switch to the
+      // accumulator of the new settings at the next frame.
+      bool settings_changed = false;
+      // Set when the edit of a setting in the key is finished
+      bool settings_committed = false;
       bool reset_rasterize = false;
       bool reset_accumulator = false;
       bool redo_circles = false;
@@ -402,9 +822,28 @@ int main() {
       // Shape type selector
       const char *shape_list[2] = {"Circles", "Curves"};
       if (ImGui::Combo("shape type", ((int *)&shape), shape_list, 2)) {
-        reset_rasterize = true;
-        reset_accumulator = true;
+        settings_changed = true;
       };
+      settings_committed |= ImGui::IsItemDeactivatedAfterEdit();
+
+      // Solver selector, the multigrid solver only works on curves
+      const char *solver_list[2] = {"Monte Carlo", "Multigrid"};
+      if (ImGui::Combo("solver", &solver_type, solver_list, 2)) {
+        settings_changed = true;
+      }
+      settings_committed |= ImGui::IsItemDeactivatedAfterEdit();
+      if (solver_type == 1) {
+        if (ImGui::SliderInt("multigrid V-cycles", &multigrid_cycles, 0, 16)) {
+          settings_changed = true;
+        }
+        settings_committed |= ImGui::IsItemDeactivatedAfterEdit();
+        if (shape == Shape::Line) {
+          ImGui::Text("residual %.2e, %.1f ms", multigrid_residual,
+                      multigrid_time_ms);
+        } else {
+          ImGui::Text("multigrid only supports curves");
+        }
+      }
 
       // Pause sampling and 1 sample buttons
       if (ImGui::Button("Pause sampling")) {
@@ -415,33 +854,112 @@ int main() {
 
       // Rasterize width slider
       if (ImGui::SliderFloat("rasterize width", &rasterize_width, 0, 2)) {
-        reset_rasterize = true;
-        reset_accumulator = true;
+        settings_changed = true;
       }
+      settings_committed |= ImGui::IsItemDeactivatedAfterEdit();
 
       // Step size slider
       if (ImGui::SliderFloat("Step size", &step_size, 0, 2)) {
-        reset_accumulator = true;
+        settings_changed = true;
+      }
+      settings_committed |= ImGui::IsItemDeactivatedAfterEdit();
+
+      // Exact traversal of the curves, with the cell size of its grid
+      if (ImGui::Checkbox("exact curve traversal", &exact_traversal)) {
+        settings_changed = true;
+      }
+      settings_committed |= ImGui::IsItemDeactivatedAfterEdit();
+      if (exact_traversal) {
+        if (ImGui::SliderFloat("grid cell size (pixels)", &grid_cell_size,
+                               2.0f, 64.0f)) {
+          upload_segment_grid(grid_textures, lines, curves);
+        }
+        if (ImGui::Checkbox("intersect Bezier curves directly",
+                            &native_curves)) {
+          upload_segment_grid(grid_textures, lines, curves);
+          settings_changed = true;
+        }
+        settings_committed |= ImGui::IsItemDeactivatedAfterEdit();
+      }
+
+      // Sampling with the compute shader takes the same samples, so the
+      // accumulator is kept when switching
+      if (compute_supported) {
+        ImGui::Checkbox("compute shader sampling", &compute_sampling);
+        if (compute_sampling) {
+          ImGui::SliderInt("steps per round", &compute_steps_per_round, 1,
+                           256);
+        }
+        if (exact_traversal && shape == Shape::Line) {
+          ImGui::Text("the compute shader only samples with ray marching");
+        } else {
+          // Uses the denoise textures as scratch space, they are filled again
+          // when the preview is drawn
+          ImGui::SliderInt("comparison passes", &sampler_comparison_passes, 1,
+                           256);
+          if (ImGui::Button("compare with fragment shader")) {
+            sampler_comparison = compare_samplers(
+                vao, sampleShader, sampleComputeShader, rayQueue, circleUbo,
+                lineTexture, accumulator, denoise_buffers, texDenoised, shape,
+                sampler_comparison_passes);
+          }
+          if (sampler_comparison.passes > 0) {
+            ImGui::Text("fragment %.2f ms, compute %.2f ms per pass (%.2fx)",
+                        sampler_comparison.fragment_ms,
+                        sampler_comparison.compute_ms,
+                        sampler_comparison.fragment_ms /
+                            std::max(sampler_comparison.compute_ms, 1e-6f));
+            ImGui::Text("largest color difference %.1e over %d passes",
+                        sampler_comparison.difference,
+                        sampler_comparison.passes);
+          }
+        }
+      } else {
+        ImGui::Text("compute shader sampling needs OpenGL 4.3");
+      }
+
+      // Statistics of the rays of the sample passes, from a few frames back
+      ImGui::Checkbox("instrument sampler", &instrument_sampler);
+      if (instrument_sampler) {
+        sampler_stats.update();
+        const RayStatistics &stats = sampler_stats.statistics();
+        float time_ms = sampler_stats.sample_time_ms();
+        double rays = std::max<double>(static_cast<double>(stats.rays), 1.0);
+        ImGui::Text("sample pass %.2f ms, %.1f Mrays/s", time_ms,
+                    time_ms > 0.0f ? stats.rays / (time_ms * 1e3) : 0.0);
+        ImGui::Text("hit %.1f%%, max steps %.1f%%, exit %.1f%%",
+                    100.0 * stats.hits / rays, 100.0 * stats.max_steps / rays,
+                    100.0 * stats.exits / rays);
+        ImGui::Text("%.1f steps per ray (longest %d), %.1f%% without a hit",
+                    stats.steps / rays, stats.longest_ray,
+                    100.0 * stats.wasted_steps /
+                        std::max<double>(static_cast<double>(stats.steps),
+                                         1.0));
+        // Bin i holds the rays with [2^(i-1), 2^i) steps
+        float histogram[RayStatistics::histogram_bins];
+        for (int i = 0; i < RayStatistics::histogram_bins; i++) {
+          histogram[i] = static_cast<float>(stats.step_histogram[i]);
+        }
+        ImGui::PlotHistogram("steps (log2)", histogram,
+                             RayStatistics::histogram_bins, 0, nullptr, 0.0f,
+                             FLT_MAX, ImVec2(0, 60));
       }
 
       // Max raymarching steps input
       if (ImGui::InputInt("max raymarch iters", ((int *)&max_raymarch_iters))) {
         max_raymarch_iters = std::max(max_raymarch_iters, 0u);
-        reset_accumulator = true;
+        settings_changed = true;
       }
+      settings_committed |= ImGui::IsItemDeactivatedAfterEdit();
 
       // Number of circles input
       if (ImGui::InputInt("number of circles", ((int *)&number_of_circles))) {
-        reset_rasterize = true;
-        reset_accumulator = true;
         redo_circles = true;
         randomize_circles(circles, number_of_circles, circle_seed);
       }
 
       // Seed for circles
       if (ImGui::InputInt("circle_seed of circles", ((int *)&circle_seed))) {
-        reset_rasterize = true;
-        reset_accumulator = true;
         redo_circles = true;
         randomize_circles(circles, number_of_circles, circle_seed);
       }
@@ -450,25 +968,71 @@ int main() {
       ImGui::InputText("Diffusioncurve file", file_name_buffer,
                        file_name_buffer_size);
       if (ImGui::Button("Reload diffusion curves")) {
-        reset_accumulator = true;
-        reset_rasterize = true;
         redo_lines = true;
       }
 
       // Maximum level of subdivision of bezier curves into lines, after
       // subdividing on color control points.
       if (ImGui::SliderInt("maximum diffusion curve subdivision",
-                           &max_curve_subdivision, 0, 10)) {
-        reset_accumulator = true;
-        reset_rasterize = true;
+                           &max_curve_subdivision, 0,
+                           max_linearize_depth)) {
+        redo_lines = true;
+      }
+
+      // Distance in pixels the lines may be away from the curves, so the
+      // number of lines follows the resolution
+      if (ImGui::SliderFloat("curve tolerance (pixels)", &curve_tolerance,
+                             0.05f, 4.0f)) {
         redo_lines = true;
       }
 
+      // Dragging control points of the curves
+      ImGui::Checkbox("edit control points", &edit_curves);
+      if (edit_curves) {
+        ImGui::SliderFloat("pick distance (pixels)",
+                           &control_point_pick_distance, 1.0f, 32.0f);
+        ImGui::Text("last edit reset %.1f%% of the pixels",
+                    edit_reset_percentage);
+      }
+
+      // Pan and zoom viewer
+      if (ImGui::Checkbox("tile viewer (scroll to zoom, drag to pan)",
+                          &tile_viewer)) {
+        // The curves may have been edited since the tiles were rendered
+        tile_cache.clear();
+        tile_grid_level = -1;
+      }
+      if (tile_viewer) {
+        ImGui::SliderInt("tile passes per frame", &viewer_passes_per_frame, 1,
+                         32);
+        ImGui::SliderInt("tile samples", &viewer_max_samples, 1, 4096);
+        ImGui::Text("zoom %.2fx, level %d, %zu/%zu tiles cached", view_zoom,
+                    view_level(), tile_cache.size(), tile_cache.capacity());
+        if (shape != Shape::Line || solver_type != 0) {
+          ImGui::Text("the tile viewer only supports curves with Monte Carlo");
+        }
+        if (ImGui::Button("reset view")) {
+          view_center = glm::vec2(resolution) / 2.0f;
+          view_zoom = 1.0f;
+        }
+      }
+
+      // Filter the noise of the samples taken so far from the shown image
+      ImGui::Checkbox("denoise preview", &denoise_preview);
+      if (denoise_preview) {
+        ImGui::SliderInt("denoise passes", &denoise_passes, 1, 6);
+      }
+
       // Selector for the output shown on screen
       const char *output_list[3] = {"color_shader", "rasterize_texture",
                                     "accumulator_texture"};
       ImGui::Combo("output type", &output_type, output_list, 3);
 
+      // Accumulators of earlier settings, switching back resumes them
+      ImGui::Text("%zu/%zu accumulators cached (%zu MB each)",
+                  accumulator_cache.size(), accumulator_cache.capacity(),
+                  accumulator_cache.bytes_per_accumulator() >> 20);
+
       // Buttons to reset textures
       reset_accumulator |= ImGui::Button("reset sample");
       ImGui::SameLine();
@@ -493,59 +1057,60 @@ int main() {
 
       // Load a new diffusion curve file
       if (redo_lines) {
-        // Clear current curves and load the new folder into it
-        curves.clear();
-        load_Bezier_curves(curves,
-                           (xml_folder / file_name_buffer).string().c_str(),
-                           resolution);
-
-        // Create a linear approximation of the bezier curves
-        lines.clear();
-
-        for (BezierCurve curve : curves) {
-          auto new_lines =
-              linearize_bezier_curve(curve, 1, max_curve_subdivision);
-          lines.insert(lines.begin(), new_lines.begin(), new_lines.end());
-        }
+        // Load the curves and their linear approximation, from the cache if
+        // possible
+        cached_curves =
+            load_curves_cached(xml_folder / file_name_buffer,
+                               curve_cache_folder, resolution,
+                               curve_tolerance, max_curve_subdivision);
+        curves.assign(cached_curves.curves.begin(),
+                      cached_curves.curves.end());
+        lines.assign(cached_curves.lines.begin(), cached_curves.lines.end());
 
         number_of_lines = (int)lines.size();
+        upload_lines(lineTexture, lines);
+        upload_segment_grid(grid_textures, lines, curves);
+        dragging = false;
+      }
 
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+      if (redo_circles || redo_lines) {
+        // All accumulators were taken with the old shapes, the next frame
+        // starts a new one
+        accumulator_cache.clear();
+      } else {
+        // Reset rasterized_texture, and re-rasterize
+        if (reset_rasterize) {
+          rasterize_shape(vao, accumulator.rasterized_shape_buffer,
+                          rasterizeShader, circleUbo, lineTexture,
+                          rasterize_width, shape, resolution, shape_count());
+        }
 
-        glBindBuffer(GL_UNIFORM_BUFFER, lineUbo);
-        // Set buffer size but dont put anything in it just yet
-        glBufferData(GL_UNIFORM_BUFFER, number_of_lines * sizeof(Line) + 16,
-                     NULL, GL_DYNAMIC_DRAW);
-        // put the number of circles in the first 4 bytes to the number of
-        // circles
-        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(int), &number_of_lines);
-        // GLSL data is 16 byte alligned so the actual data starts at byte 16
-        glBufferSubData(GL_UNIFORM_BUFFER, 16, number_of_lines * sizeof(Line),
-                        lines.data());
-        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        // Reset the acummulator texture
+        if (reset_accumulator) {
+          // Bind the accumulator framebuffer
+          glBindFramebuffer(GL_FRAMEBUFFER, accumulator.accumulator_buffer);
+          // Clear the bufffer
+          glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+          // unbind buffer
+          glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+          // Recompute the solution if the multigrid solver is used
+          if (solver_type == 1 && shape == Shape::Line) {
+            multigrid_residual = solve_diffusion_multigrid(
+                accumulator.texAccumulator, lines, multigrid_cycles);
+          }
+        }
       }
 
-      // Reset rasterized_texture, and re-rasterize
-      if (reset_rasterize) {
-        // Bind the rasterized framebuffer
-        glBindFramebuffer(GL_FRAMEBUFFER, rasterized_shape_buffer);
-        // Clear the bufffer
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        // unbind buffer
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-        rasterize_shape(vao, rasterized_shape_buffer, rasterizeShader,
-                        circleUbo, lineUbo, rasterize_width, shape);
+      // The next frame caches the accumulator of the finished edit
+      if (settings_committed) {
+        committed_key = accumulator_key();
       }
 
-      // Reset the acummulator texture
-      if (reset_accumulator) {
-        // Bind the accumulator framebuffer
-        glBindFramebuffer(GL_FRAMEBUFFER, accumulator_buffer);
-        // Clear the bufffer
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        // unbind buffer
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+      // The tiles were sampled with the old settings or shapes
+      if (settings_changed || reset_accumulator || redo_circles || redo_lines) {
+        tile_cache.clear();
+        tile_grid_level = -1;
       }
 
       ImGui::End();
@@ -555,26 +1120,599 @@ int main() {
   }
 }
 
-// Function to create the rasterized_texture texture
+// Function to create the rasterized_texture texture. Every shape is drawn as
+// an instance covering only the pixels near it, and the depth test keeps the
+// lowest id where shapes overlap. The framebuffer needs a depth attachment,
+// and the boundary texture as second color attachment for lines.
+// With the scissor test enabled only the scissor rectangle is redone.
 void rasterize_shape(const GLuint &VAO, const GLuint &frameBuffer,
                      const Shader &shader, const GLuint &circleBuffer,
-                     const GLuint &lineBuffer, const float &line_width,
-                     const Shape &shapetype) {
+                     const LineTexture &lineTexture, const float &line_width,
+                     const Shape &shapetype, const glm::ivec2 &dimensions,
+                     int shape_count) {
+  // Circles beyond the array in the shaders are left out, the lines have no
+  // limit
+  if (shapetype == Shape::Circle)
+    shape_count = std::min(shape_count, max_shader_circles);
+  shape_count = std::max(shape_count, 0);
+
   // Bind all the data
   glBindVertexArray(VAO);
   shader.bind();
   shader.bindUniformBlock("circleBuffer", 0, circleBuffer);
-  shader.bindUniformBlock("lineBuffer", 1, lineBuffer);
+  bind_lines(shader, lineTexture);
   glUniform1ui(shader.getUniformLocation("shape_type"),
                static_cast<GLuint>(shapetype));
   glUniform1f(shader.getUniformLocation("rasterize_width"), line_width);
-  // Bind the rasterized shape framebuffer do the rendering pass and unbind the
-  // buffer
+  glUniform2iv(shader.getUniformLocation("screen_dimensions"), 1,
+               glm::value_ptr(dimensions));
+  glUniform1i(shader.getUniformLocation("shape_count"), shape_count);
+
+  // Pixels no shape covers keep the -1 of the clear
+  glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+  glViewport(0, 0, dimensions.x, dimensions.y);
+  const GLint no_shape = -1;
+  glClearBufferiv(GL_COLOR, 0, &no_shape);
+  glClear(GL_DEPTH_BUFFER_BIT);
+
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(GL_LESS);
+  if (shapetype == Shape::Circle) {
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 2 * (ring_segments + 1),
+                          shape_count);
+  } else {
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, shape_count);
+  }
+  glDisable(GL_DEPTH_TEST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  glBindVertexArray(0);
+}
+
+// Function to add a sample to the accumulator texture
+void sample_shape(const GLuint &VAO, const GLuint &frameBuffer,
+                  const Shader &shader, const GLuint &circleBuffer,
+                  const LineTexture &lineTexture,
+                  const GLuint &rasterizedTexture,
+                  const GLuint &boundaryTexture,
+                  const GLuint &accumulatorTexture, const glm::ivec2 &dimensions,
+                  unsigned int frame, const Shape &shapetype,
+                  const GridTextures *grid, const glm::vec2 &pixelOffset,
+                  float pixelScale) {
+  // Bind all the data
+  glBindVertexArray(VAO);
+  shader.bind();
+
+  shader.bindUniformBlock("circleBuffer", 0, circleBuffer);
+  bind_lines(shader, lineTexture);
+
+  glUniform1ui(shader.getUniformLocation("shape_type"),
+               static_cast<GLuint>(shapetype));
+
+  glUniform1ui(shader.getUniformLocation("frame_nr"), frame);
+  glUniform1ui(shader.getUniformLocation("max_raymarch_iter"),
+               max_raymarch_iters);
+  glUniform2iv(shader.getUniformLocation("screen_dimensions"), 1,
+               glm::value_ptr(dimensions));
+  glUniform1f(shader.getUniformLocation("step_size"), step_size);
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, rasterizedTexture);
+  glUniform1i(shader.getUniformLocation("rasterized_texture"), 0);
+
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, accumulatorTexture);
+  glUniform1i(shader.getUniformLocation("accumulator_texture"), 1);
+
+  glActiveTexture(GL_TEXTURE5);
+  glBindTexture(GL_TEXTURE_2D, boundaryTexture);
+  glUniform1i(shader.getUniformLocation("boundary_texture"), 5);
+  glActiveTexture(GL_TEXTURE0);
+
+  // The grid samplers always get their own units, samplers of different types
+  // may not share a unit even when they are not used
+  glUniform1i(shader.getUniformLocation("exact_traversal"), grid != nullptr);
+  glUniform1i(shader.getUniformLocation("native_curves"), native_curves);
+  glUniform1i(shader.getUniformLocation("grid_cells"), 2);
+  glUniform1i(shader.getUniformLocation("grid_segments"), 3);
+  glUniform1i(shader.getUniformLocation("segment_data"), 4);
+  if (grid) {
+    glUniform2iv(shader.getUniformLocation("grid_dimensions"), 1,
+                 glm::value_ptr(grid->dimensions));
+    glUniform1f(shader.getUniformLocation("grid_cell_size"), grid->cell_size);
+    glUniform2fv(shader.getUniformLocation("pixel_offset"), 1,
+                 glm::value_ptr(pixelOffset));
+    glUniform1f(shader.getUniformLocation("pixel_scale"), pixelScale);
+
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_BUFFER, grid->cell_texture);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_BUFFER, grid->segment_texture);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_BUFFER, grid->line_texture);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
   glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
   glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(6), GL_UNSIGNED_INT,
                  nullptr);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Takes one sample per pixel with the compute shader, the same samples as
+// sample_shape takes with ray marching. A fixed number of work groups take the
+// rays from a queue, whose counter is reset first.
+void sample_shape_compute(const Shader &shader, const GLuint &queueBuffer,
+                          const GLuint &circleBuffer,
+                          const LineTexture &lineTexture,
+                          const GLuint &rasterizedTexture,
+                          const GLuint &boundaryTexture,
+                          const GLuint &accumulatorTexture,
+                          const glm::ivec2 &dimensions, unsigned int frame,
+                          const Shape &shapetype, const GLuint *statsTexture) {
+  // Bind all the data
+  shader.bind();
+  shader.bindUniformBlock("circleBuffer", 0, circleBuffer);
+  bind_lines(shader, lineTexture);
+
+  glUniform1ui(shader.getUniformLocation("shape_type"),
+               static_cast<GLuint>(shapetype));
+  glUniform1ui(shader.getUniformLocation("frame_nr"), frame);
+  glUniform1ui(shader.getUniformLocation("max_raymarch_iter"),
+               max_raymarch_iters);
+  glUniform2iv(shader.getUniformLocation("screen_dimensions"), 1,
+               glm::value_ptr(dimensions));
+  glUniform1f(shader.getUniformLocation("step_size"), step_size);
+  glUniform1ui(shader.getUniformLocation("steps_per_round"),
+               static_cast<GLuint>(compute_steps_per_round));
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, rasterizedTexture);
+  glUniform1i(shader.getUniformLocation("rasterized_texture"), 0);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, boundaryTexture);
+  glUniform1i(shader.getUniformLocation("boundary_texture"), 1);
+  glActiveTexture(GL_TEXTURE0);
+
+  glBindImageTexture(0, accumulatorTexture, 0, GL_FALSE, 0, GL_READ_WRITE,
+                     GL_RGBA32F);
+  glUniform1i(shader.getUniformLocation("accumulator_image"), 0);
+
+  glUniform1i(shader.getUniformLocation("instrument"), statsTexture != nullptr);
+  glUniform1i(shader.getUniformLocation("ray_stats_image"), 1);
+  if (statsTexture) {
+    glBindImageTexture(1, *statsTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY,
+                       GL_RG32I);
+  }
+
+  const GLuint first_ray = 0;
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, queueBuffer);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &first_ray);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, queueBuffer);
+
+  int rays = dimensions.x * dimensions.y;
+  glDispatchCompute(std::min(compute_sampling_groups, (rays + 63) / 64), 1, 1);
+
+  // The image stores have to be visible to everything that uses the
+  // accumulator next: drawing, clearing, texture updates and the next dispatch
+  glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT |
+                  GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT |
+                  GL_FRAMEBUFFER_BARRIER_BIT);
+}
+
+// Takes the same passes with the fragment and the compute sampler, each into
+// one of the two textures, and times them. Both take the same samples, so their
+// colors should only differ by rounding.
+SamplerComparison compare_samplers(
+    const GLuint &VAO, const Shader &sampleShader, const Shader &computeShader,
+    const GLuint &queueBuffer, const GLuint &circleBuffer,
+    const LineTexture &lineTexture, const Accumulator &accumulator,
+    const GLuint (&frameBuffers)[2], const GLuint (&textures)[2],
+    const Shape &shapetype, int passes) {
+  SamplerComparison comparison;
+  comparison.passes = passes;
+
+  glViewport(0, 0, resolution.x, resolution.y);
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  for (int i = 0; i < 2; i++) {
+    glBindFramebuffer(GL_FRAMEBUFFER, frameBuffers[i]);
+    glClear(GL_COLOR_BUFFER_BIT);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+  // The time includes waiting for the GPU to finish the passes
+  auto time_passes = [&](auto &&take_pass) {
+    glFinish();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int frame = 0; frame < passes; frame++) {
+      take_pass(static_cast<unsigned int>(frame));
+    }
+    glFinish();
+    return std::chrono::duration<float, std::milli>(
+               std::chrono::high_resolution_clock::now() - start)
+               .count() /
+           static_cast<float>(passes);
+  };
+  comparison.fragment_ms = time_passes([&](unsigned int frame) {
+    sample_shape(VAO, frameBuffers[0], sampleShader, circleBuffer, lineTexture,
+                 accumulator.texRasterized, accumulator.texBoundary,
+                 textures[0], resolution, frame, shapetype);
+  });
+  comparison.compute_ms = time_passes([&](unsigned int frame) {
+    sample_shape_compute(computeShader, queueBuffer, circleBuffer, lineTexture,
+                         accumulator.texRasterized, accumulator.texBoundary,
+                         textures[1], resolution, frame, shapetype);
+  });
+
+  std::vector<glm::vec4> results[2];
+  for (int i = 0; i < 2; i++) {
+    results[i].resize(static_cast<size_t>(resolution.x) * resolution.y);
+    glBindTexture(GL_TEXTURE_2D, textures[i]);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, results[i].data());
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  for (size_t i = 0; i < results[0].size(); i++) {
+    const glm::vec4 &fragment = results[0][i];
+    const glm::vec4 &compute = results[1][i];
+    if (fragment.w > 0.0f && compute.w > 0.0f) {
+      glm::vec3 difference = glm::abs(glm::vec3(fragment) / fragment.w -
+                                      glm::vec3(compute) / compute.w);
+      comparison.difference =
+          std::max({comparison.difference, difference.x, difference.y,
+                    difference.z});
+    }
+  }
+
+  glViewport(0, 0, pWindow->getWindowSize().x, pWindow->getWindowSize().y);
+  return comparison;
+}
+
+// Filters the accumulator for display with passes of an a-trous wavelet filter,
+// guided by the rasterized shapes so no colors are mixed across them. The
+// passes alternate between the two textures, the accumulator is only read.
+// Returns the texture holding the result, in the layout of the accumulator.
+GLuint denoise_accumulator(const GLuint &VAO, const Shader &shader,
+                           const GLuint (&frameBuffers)[2],
+                           const GLuint (&textures)[2],
+                           const GLuint &rasterizedTexture,
+                           const GLuint &accumulatorTexture,
+                           const glm::ivec2 &dimensions, int passes) {
+  glBindVertexArray(VAO);
+  shader.bind();
+  glUniform2iv(shader.getUniformLocation("screen_dimensions"), 1,
+               glm::value_ptr(dimensions));
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, rasterizedTexture);
+  glUniform1i(shader.getUniformLocation("rasterized_texture"), 0);
+  glUniform1i(shader.getUniformLocation("accumulator_texture"), 1);
+
+  glViewport(0, 0, dimensions.x, dimensions.y);
+  GLuint input = accumulatorTexture;
+  for (int i = 0; i < passes; i++) {
+    glUniform1i(shader.getUniformLocation("step_width"), 1 << i);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, input);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, frameBuffers[i % 2]);
+    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(6), GL_UNSIGNED_INT,
+                   nullptr);
+    input = textures[i % 2];
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glActiveTexture(GL_TEXTURE0);
+
+  return input;
+}
+
+// Solves the diffusion curves with the multigrid solver and writes the result
+// in the accumulator texture, with an alpha of 1 so the color shader shows it
+// as is. Returns the residual of the solution.
+float solve_diffusion_multigrid(const GLuint &accumulatorTexture,
+                                const std::vector<Line> &lines, int v_cycles) {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  ColorConstraints constraints;
+  rasterize_color_constraints(constraints, lines, resolution);
+  std::vector<glm::vec4> image;
+  float residual = solve_multigrid(image, constraints, v_cycles);
+
+  multigrid_time_ms = std::chrono::duration<float, std::milli>(
+                          std::chrono::high_resolution_clock::now() - start)
+                          .count();
+
+  glBindTexture(GL_TEXTURE_2D, accumulatorTexture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, resolution.x, resolution.y, GL_RGBA,
+                  GL_FLOAT, image.data());
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  return residual;
+}
+
+// Creates the buffer of the lines and the buffer texture reading it, every
+// line is read as 5 vec4s
+void create_line_texture(LineTexture &lineTexture) {
+  glGenBuffers(1, &lineTexture.buffer);
+  glBindBuffer(GL_TEXTURE_BUFFER, lineTexture.buffer);
+  glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_DYNAMIC_DRAW);
+
+  glGenTextures(1, &lineTexture.texture);
+  glBindTexture(GL_TEXTURE_BUFFER, lineTexture.texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lineTexture.buffer);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// Replaces the contents of the line buffer with lines
+void upload_lines(LineTexture &lineTexture, const std::vector<Line> &lines) {
+  lineTexture.count = (int)lines.size();
+
+  // Empty buffers are not allowed as texture storage
+  glBindBuffer(GL_TEXTURE_BUFFER, lineTexture.buffer);
+  glBufferData(GL_TEXTURE_BUFFER,
+               std::max(lines.size() * sizeof(Line), (size_t)16), NULL,
+               GL_DYNAMIC_DRAW);
+  glBufferSubData(GL_TEXTURE_BUFFER, 0, lines.size() * sizeof(Line),
+                  lines.data());
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// Binds the lines to texture unit 6, which no other sampler of the shaders
+// uses
+void bind_lines(const Shader &shader, const LineTexture &lineTexture) {
+  glActiveTexture(GL_TEXTURE6);
+  glBindTexture(GL_TEXTURE_BUFFER, lineTexture.texture);
+  glUniform1i(shader.getUniformLocation("line_data"), 6);
+  glUniform1i(shader.getUniformLocation("line_count"), lineTexture.count);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+// Creates the buffers of the segment grid and the buffer textures reading them
+void create_grid_textures(GridTextures &grid) {
+  const std::pair<GLuint *, GLuint *> buffers[3] = {
+      {&grid.cell_buffer, &grid.cell_texture},
+      {&grid.segment_buffer, &grid.segment_texture},
+      {&grid.line_buffer, &grid.line_texture}};
+  // The grid holds indices, the lines are read as vec4s
+  const GLenum formats[3] = {GL_R32I, GL_R32I, GL_RGBA32F};
+
+  for (int i = 0; i < 3; i++) {
+    glGenBuffers(1, buffers[i].first);
+    glBindBuffer(GL_TEXTURE_BUFFER, *buffers[i].first);
+    glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_DYNAMIC_DRAW);
+
+    glGenTextures(1, buffers[i].second);
+    glBindTexture(GL_TEXTURE_BUFFER, *buffers[i].second);
+    glTexBuffer(GL_TEXTURE_BUFFER, formats[i], *buffers[i].first);
+  }
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// Rebuilds the segment grid with the current cell size and uploads it together
+// with the shapes in it, the curves if native_curves is set or else the lines
+void upload_segment_grid(GridTextures &grid, const std::vector<Line> &lines,
+                         const std::vector<BezierCurve> &curves) {
+  SegmentGrid segment_grid;
+  if (native_curves)
+    build_curve_grid(segment_grid, curves, resolution, grid_cell_size);
+  else
+    build_segment_grid(segment_grid, lines, resolution, grid_cell_size);
+  grid.dimensions = segment_grid.dimensions;
+  grid.cell_size = grid_cell_size;
+
+  // Empty buffers are not allowed as texture storage, so every buffer gets at
+  // least a few bytes
+  auto upload = [](GLuint buffer, size_t size, const void *data) {
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, std::max(size, (size_t)16), NULL,
+                 GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+  };
+  upload(grid.cell_buffer, segment_grid.cell_offsets.size() * sizeof(int32_t),
+         segment_grid.cell_offsets.data());
+  upload(grid.segment_buffer,
+         segment_grid.cell_segments.size() * sizeof(int32_t),
+         segment_grid.cell_segments.data());
+  if (native_curves)
+    upload(grid.line_buffer, curves.size() * sizeof(BezierCurve),
+           curves.data());
+  else
+    upload(grid.line_buffer, lines.size() * sizeof(Line), lines.data());
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// Clears the masked pixels of the accumulator on the GPU. Only the region of
+// the mask is uploaded, and the clear is scissored to it.
+void reset_accumulator_region(const GLuint &VAO, const GLuint &frameBuffer,
+                              const Shader &shader, const GLuint &maskTexture,
+                              const std::vector<uint8_t> &mask,
+                              const PixelRect &region) {
+  if (region.empty())
+    return;
+
+  // Upload the region straight out of the full mask
+  glBindTexture(GL_TEXTURE_2D, maskTexture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, resolution.x);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, region.min.x);
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, region.min.y);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, region.min.x, region.min.y,
+                  region.max.x - region.min.x, region.max.y - region.min.y,
+                  GL_RED_INTEGER, GL_UNSIGNED_BYTE, mask.data());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+
+  glBindVertexArray(VAO);
+  shader.bind();
+  glActiveTexture(GL_TEXTURE0);
+  glUniform1i(shader.getUniformLocation("reset_mask"), 0);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+  glViewport(0, 0, resolution.x, resolution.y);
+  glEnable(GL_SCISSOR_TEST);
+  glScissor(region.min.x, region.min.y, region.max.x - region.min.x,
+            region.max.y - region.min.y);
+  glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(6), GL_UNSIGNED_INT,
+                 nullptr);
+  glDisable(GL_SCISSOR_TEST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Zooms around the cursor with the scroll wheel and pans while the left mouse
+// button is held, unless the mouse is over the menu
+void update_view() {
+  glm::vec2 window_size = pWindow->getWindowSize();
+  // The cursor is in window coordinates with y down, the view has y up
+  glm::vec2 cursor = pWindow->getCursorPos();
+  cursor.y = window_size.y - cursor.y;
+  bool mouse_free = !ImGui::GetIO().WantCaptureMouse;
+
+  if (scroll_offset != 0.0f && mouse_free) {
+    // Keep the point under the cursor in place
+    glm::vec2 cursor_offset = cursor - window_size / 2.0f;
+    glm::vec2 cursor_point = view_center + cursor_offset / view_zoom;
+    view_zoom = std::clamp(view_zoom * std::pow(1.25f, scroll_offset), 0.25f,
+                           std::exp2((float)viewer_max_level));
+    view_center = cursor_point - cursor_offset / view_zoom;
+  }
+  scroll_offset = 0.0f;
+
+  if (pWindow->isMouseButtonPressed(GLFW_MOUSE_BUTTON_LEFT) &&
+      (view_panning || mouse_free)) {
+    if (view_panning) {
+      view_center -= (cursor - view_last_cursor) / view_zoom;
+    }
+    view_panning = true;
+    view_last_cursor = cursor;
+  } else {
+    view_panning = false;
+  }
+}
+
+// The level with pixels no larger than a screen pixel at the current zoom
+int view_level() {
+  return std::clamp((int)std::ceil(std::log2(view_zoom)), 0, viewer_max_level);
+}
+
+// The tiles of level on screen, the ones closest to the center of the view
+// first
+std::vector<TileKey> visible_tiles(int level) {
+  float scale = std::exp2((float)level);
+  glm::vec2 half_view =
+      glm::vec2(pWindow->getWindowSize()) / (2.0f * view_zoom);
+  glm::ivec2 tile_count =
+      (resolution * (1 << level) + viewer_tile_size - 1) / viewer_tile_size;
+
+  glm::ivec2 first = glm::max(
+      glm::ivec2(glm::floor((view_center - half_view) * scale /
+                            (float)viewer_tile_size)),
+      glm::ivec2(0));
+  glm::ivec2 last = glm::min(
+      glm::ivec2(glm::floor((view_center + half_view) * scale /
+                            (float)viewer_tile_size)),
+      tile_count - 1);
+
+  std::vector<TileKey> keys;
+  for (int y = first.y; y <= last.y; y++) {
+    for (int x = first.x; x <= last.x; x++) {
+      keys.push_back({level, {x, y}});
+    }
+  }
+
+  glm::vec2 center_tile = view_center * scale / (float)viewer_tile_size - 0.5f;
+  std::sort(keys.begin(), keys.end(), [&](const TileKey &a, const TileKey &b) {
+    return glm::distance(glm::vec2(a.index), center_tile) <
+           glm::distance(glm::vec2(b.index), center_tile);
+  });
+  return keys;
+}
+
+// Gives the next sample passes to the visible tiles with the fewest samples.
+// The tiles are sampled with exact traversal of the grid, which is in the
+// pixels of level 0, so the pixels of a tile are moved and scaled into it.
+void refine_tiles(TileCache &cache, const std::vector<TileKey> &keys,
+                  const GridTextures &grid, const GLuint &VAO,
+                  const Shader &sampleShader, const GLuint &circleBuffer,
+                  const LineTexture &lineTexture) {
+  glViewport(0, 0, viewer_tile_size, viewer_tile_size);
+
+  for (int pass = 0; pass < viewer_passes_per_frame; pass++) {
+    const TileKey *next_key = nullptr;
+    unsigned int fewest_samples = (unsigned int)viewer_max_samples;
+    for (const TileKey &key : keys) {
+      Tile *tile = cache.find(key);
+      unsigned int samples = tile ? tile->samples : 0;
+      if (samples < fewest_samples) {
+        fewest_samples = samples;
+        next_key = &key;
+      }
+    }
+    // All visible tiles are converged
+    if (!next_key)
+      break;
+
+    Tile &tile = cache.get(*next_key);
+    // Offset the random numbers per tile, so neighbouring tiles do not show
+    // the same noise
+    unsigned int seed_offset =
+        (unsigned int)TileKeyHash()(*next_key) * 2654435761u;
+    // The exact traversal does not read the rasterized textures
+    sample_shape(VAO, tile.accumulator_buffer, sampleShader, circleBuffer,
+                 lineTexture, 0, 0, tile.texAccumulator,
+                 glm::ivec2(viewer_tile_size), seed_offset + tile.samples,
+                 Shape::Line, &grid,
+                 glm::vec2(next_key->index * viewer_tile_size),
+                 std::exp2((float)next_key->level));
+    tile.samples++;
+  }
+
+  glViewport(0, 0, pWindow->getWindowSize().x, pWindow->getWindowSize().y);
+}
+
+// Draws the cached tiles on screen. Coarser levels are drawn first, so they
+// show wherever the tiles of finer levels have no samples yet.
+void draw_tiles(TileCache &cache, int level, const Shader &tileShader,
+                const GLuint &VAO) {
+  glm::vec2 window_size = pWindow->getWindowSize();
+
+  glBindVertexArray(VAO);
+  tileShader.bind();
+  glUniform1i(tileShader.getUniformLocation("tile_size"), viewer_tile_size);
+  glUniform1i(tileShader.getUniformLocation("accumulator_texture"), 0);
+  glActiveTexture(GL_TEXTURE0);
+
+  // Tiles of much coarser levels would need viewports larger than allowed
+  for (int l = std::max(level - 4, 0); l <= level; l++) {
+    float tile_extent = viewer_tile_size / std::exp2((float)l);
+    for (const TileKey &key : visible_tiles(l)) {
+      Tile *tile = cache.find(key);
+      if (!tile || tile->samples == 0)
+        continue;
+
+      // Each tile is drawn by moving the viewport of the screen quad
+      glm::vec2 origin =
+          (glm::vec2(key.index) * tile_extent - view_center) * view_zoom +
+          window_size / 2.0f;
+      glm::ivec2 rect_min = glm::ivec2(glm::floor(origin));
+      glm::ivec2 rect_size =
+          glm::ivec2(glm::floor(origin + tile_extent * view_zoom)) - rect_min;
+      glViewport(rect_min.x, rect_min.y, rect_size.x, rect_size.y);
+      glUniform4f(tileShader.getUniformLocation("tile_rect"),
+                  (float)rect_min.x, (float)rect_min.y, (float)rect_size.x,
+                  (float)rect_size.y);
+
+      glBindTexture(GL_TEXTURE_2D, tile->texAccumulator);
+      glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(6), GL_UNSIGNED_INT,
+                     nullptr);
+    }
+  }
+
+  glViewport(0, 0, (int)window_size.x, (int)window_size.y);
   glBindVertexArray(0);
 }
 
@@ -585,4 +1723,6 @@ void keyboard(int key, int /* scancode */, int action, int /* mods */) {
   }
 }
 
-void reshape(const glm::ivec2 &size) { glViewport(0, 0, size.x, size.y); }
\ No newline at end of file
+void reshape(const glm::ivec2 &size) { glViewport(0, 0, size.x, size.y); }
+
+void scroll(const glm::vec2 &offset) { scroll_offset += offset.y; }
\ No newline at end of file
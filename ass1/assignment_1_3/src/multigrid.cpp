@@ -0,0 +1,270 @@
+#include "multigrid.h"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+
+//Grids smaller than this are solved directly with Gauss-Seidel instead of being coarsened further
+constexpr int coarsest_grid_size = 4;
+constexpr int coarsest_grid_iters = 64;
+
+//One level of the multigrid hierarchy
+struct GridLevel {
+	int width;
+	int height;
+	std::vector<glm::vec4> u;			//Current solution (or error estimate on coarse levels during a V-cycle)
+	std::vector<glm::vec4> f;			//Right hand side
+	std::vector<glm::vec4> color;		//Constraint colors, used for the full multigrid start
+	std::vector<uint8_t> fixed;			//Constrained pixels, a coarse pixel is fixed if any of its children is
+};
+
+//Forward declarations for helper functions
+void smooth(GridLevel& level, int iters);
+void compute_residual(const GridLevel& level, std::vector<glm::vec4>& residual);
+void restrict_residual(const GridLevel& fine, const std::vector<glm::vec4>& residual, GridLevel& coarse);
+void prolongate_add(const GridLevel& coarse, GridLevel& fine);
+void interpolate_solution(const GridLevel& coarse, GridLevel& fine);
+void v_cycle(std::vector<GridLevel>& levels, size_t level_ind, int smoothing_iters);
+glm::vec4 sample_bilinear(const GridLevel& level, float x, float y);
+
+void rasterize_color_constraints(ColorConstraints& constraints, std::span<const Line> lines, glm::ivec2 resolution) {
+	constraints.size = resolution;
+	constraints.color.assign(resolution.x * resolution.y, glm::vec4(0));
+	constraints.fixed.assign(resolution.x * resolution.y, 0);
+
+	//Pixels can be hit by multiple lines, so we average all colors written to them
+	std::vector<float> weights(resolution.x * resolution.y, 0);
+
+	auto splat = [&](glm::vec2 position, glm::vec4 color) {
+		glm::ivec2 pixel = glm::ivec2(glm::floor(position));
+		if (pixel.x < 0 || pixel.y < 0 || pixel.x >= resolution.x || pixel.y >= resolution.y) return;
+		int ind = pixel.y * resolution.x + pixel.x;
+		constraints.color[ind] += glm::vec4(glm::vec3(color), 1);
+		weights[ind] += 1;
+	};
+
+	for (const Line& line : lines) {
+		glm::vec2 dir = line.end_point - line.start_point;
+		float line_length = glm::length(dir);
+		if (line_length == 0) continue;
+
+		//The left side is the side for which cross(dir, side) > 0, matching the sample shader
+		glm::vec2 normal = glm::vec2(-dir.y, dir.x) / line_length;
+
+		//Step at most half a pixel so no pixel along the line is skipped
+		int steps = (int)std::ceil(line_length * 2) + 1;
+		for (int i = 0; i <= steps; i++) {
+			float t = (float)i / steps;
+			glm::vec2 position = glm::mix(line.start_point, line.end_point, t);
+			splat(position + normal, glm::mix(line.color_left[0], line.color_left[1], t));
+			splat(position - normal, glm::mix(line.color_right[0], line.color_right[1], t));
+		}
+	}
+
+	for (size_t i = 0; i < weights.size(); i++) {
+		if (weights[i] > 0) {
+			constraints.color[i] /= weights[i];
+			constraints.fixed[i] = 1;
+		}
+	}
+}
+
+float solve_multigrid(std::vector<glm::vec4>& image, const ColorConstraints& constraints, int v_cycles, int smoothing_iters) {
+	//Build the hierarchy, halving the resolution until the coarsest grid is reached
+	std::vector<GridLevel> levels(1);
+	levels[0].width = constraints.size.x;
+	levels[0].height = constraints.size.y;
+	levels[0].color = constraints.color;
+	levels[0].fixed = constraints.fixed;
+
+	while (std::min(levels.back().width, levels.back().height) > coarsest_grid_size) {
+		const GridLevel& fine = levels.back();
+		GridLevel coarse;
+		coarse.width = (fine.width + 1) / 2;
+		coarse.height = (fine.height + 1) / 2;
+		coarse.color.assign(coarse.width * coarse.height, glm::vec4(0));
+		coarse.fixed.assign(coarse.width * coarse.height, 0);
+
+		//Coarse constraint color is the average of its fixed children
+		for (int y = 0; y < coarse.height; y++) {
+			for (int x = 0; x < coarse.width; x++) {
+				glm::vec4 color_sum(0);
+				int n_fixed = 0;
+				for (int dy = 0; dy < 2; dy++) {
+					for (int dx = 0; dx < 2; dx++) {
+						int fx = 2 * x + dx;
+						int fy = 2 * y + dy;
+						if (fx >= fine.width || fy >= fine.height) continue;
+						int ind = fy * fine.width + fx;
+						if (fine.fixed[ind]) {
+							color_sum += fine.color[ind];
+							n_fixed++;
+						}
+					}
+				}
+				if (n_fixed > 0) {
+					coarse.color[y * coarse.width + x] = color_sum / (float)n_fixed;
+					coarse.fixed[y * coarse.width + x] = 1;
+				}
+			}
+		}
+		levels.push_back(std::move(coarse));
+	}
+
+	for (GridLevel& level : levels) {
+		level.u.assign(level.width * level.height, glm::vec4(0));
+		level.f.assign(level.width * level.height, glm::vec4(0));
+	}
+
+	//Full multigrid start: solve on the coarsest grid and interpolate the solution up as the initial guess for the next level
+	GridLevel& coarsest = levels.back();
+	for (size_t i = 0; i < coarsest.u.size(); i++) {
+		if (coarsest.fixed[i]) coarsest.u[i] = coarsest.color[i];
+	}
+	smooth(coarsest, coarsest_grid_iters);
+
+	for (size_t level_ind = levels.size() - 1; level_ind > 0; level_ind--) {
+		interpolate_solution(levels[level_ind], levels[level_ind - 1]);
+		smooth(levels[level_ind - 1], smoothing_iters);
+	}
+
+	//Refine the finest level with V-cycles
+	for (int cycle = 0; cycle < v_cycles; cycle++) {
+		v_cycle(levels, 0, smoothing_iters);
+	}
+
+	//Report how well the equation is satisfied
+	std::vector<glm::vec4> residual;
+	compute_residual(levels[0], residual);
+	glm::vec4 squared_sum(0);
+	for (const glm::vec4& r : residual) squared_sum += r * r;
+	glm::vec4 rms = glm::sqrt(squared_sum / (float)std::max<size_t>(residual.size(), 1));
+
+	image = std::move(levels[0].u);
+	return (rms.x + rms.y + rms.z) / 3.0f;
+}
+
+//Recursive V-cycle, solves for the error on all levels coarser than level_ind
+void v_cycle(std::vector<GridLevel>& levels, size_t level_ind, int smoothing_iters) {
+	GridLevel& level = levels[level_ind];
+
+	if (level_ind == levels.size() - 1) {
+		smooth(level, coarsest_grid_iters);
+		return;
+	}
+
+	smooth(level, smoothing_iters);
+
+	//Move the residual to the coarser grid and solve for the error there, the error is 0 at the constraints
+	std::vector<glm::vec4> residual;
+	compute_residual(level, residual);
+	GridLevel& coarse = levels[level_ind + 1];
+	restrict_residual(level, residual, coarse);
+	std::fill(coarse.u.begin(), coarse.u.end(), glm::vec4(0));
+
+	v_cycle(levels, level_ind + 1, smoothing_iters);
+
+	prolongate_add(coarse, level);
+	smooth(level, smoothing_iters);
+}
+
+//Red-black Gauss-Seidel on the 5 point Laplacian, with Neumann boundaries at the image border
+void smooth(GridLevel& level, int iters) {
+	const int w = level.width;
+	const int h = level.height;
+	for (int iter = 0; iter < iters; iter++) {
+		for (int parity = 0; parity < 2; parity++) {
+			for (int y = 0; y < h; y++) {
+				for (int x = (y + parity) & 1; x < w; x += 2) {
+					int ind = y * w + x;
+					if (level.fixed[ind]) continue;
+
+					glm::vec4 sum = level.f[ind];
+					float n = 0;
+					if (x > 0) { sum += level.u[ind - 1]; n++; }
+					if (x < w - 1) { sum += level.u[ind + 1]; n++; }
+					if (y > 0) { sum += level.u[ind - w]; n++; }
+					if (y < h - 1) { sum += level.u[ind + w]; n++; }
+					level.u[ind] = sum / n;
+				}
+			}
+		}
+	}
+}
+
+//Residual of (n * u - sum(neighbours)) = f for the free pixels, 0 for the constrained ones
+void compute_residual(const GridLevel& level, std::vector<glm::vec4>& residual) {
+	const int w = level.width;
+	const int h = level.height;
+	residual.assign(w * h, glm::vec4(0));
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			int ind = y * w + x;
+			if (level.fixed[ind]) continue;
+
+			glm::vec4 sum(0);
+			float n = 0;
+			if (x > 0) { sum += level.u[ind - 1]; n++; }
+			if (x < w - 1) { sum += level.u[ind + 1]; n++; }
+			if (y > 0) { sum += level.u[ind - w]; n++; }
+			if (y < h - 1) { sum += level.u[ind + w]; n++; }
+			residual[ind] = level.f[ind] - (n * level.u[ind] - sum);
+		}
+	}
+}
+
+//Averages 2x2 blocks of the residual, scaled by 4 because the coarse grid spacing is twice as large
+void restrict_residual(const GridLevel& fine, const std::vector<glm::vec4>& residual, GridLevel& coarse) {
+	for (int y = 0; y < coarse.height; y++) {
+		for (int x = 0; x < coarse.width; x++) {
+			glm::vec4 sum(0);
+			float n = 0;
+			for (int dy = 0; dy < 2; dy++) {
+				for (int dx = 0; dx < 2; dx++) {
+					int fx = 2 * x + dx;
+					int fy = 2 * y + dy;
+					if (fx >= fine.width || fy >= fine.height) continue;
+					sum += residual[fy * fine.width + fx];
+					n++;
+				}
+			}
+			coarse.f[y * coarse.width + x] = 4.0f * sum / n;
+		}
+	}
+}
+
+//Adds the bilinearly interpolated coarse error to the free fine pixels
+void prolongate_add(const GridLevel& coarse, GridLevel& fine) {
+	for (int y = 0; y < fine.height; y++) {
+		for (int x = 0; x < fine.width; x++) {
+			int ind = y * fine.width + x;
+			if (fine.fixed[ind]) continue;
+			fine.u[ind] += sample_bilinear(coarse, (x + 0.5f) / 2 - 0.5f, (y + 0.5f) / 2 - 0.5f);
+		}
+	}
+}
+
+//Initializes the fine level with its constraints and the interpolated coarse solution everywhere else
+void interpolate_solution(const GridLevel& coarse, GridLevel& fine) {
+	for (int y = 0; y < fine.height; y++) {
+		for (int x = 0; x < fine.width; x++) {
+			int ind = y * fine.width + x;
+			fine.u[ind] = fine.fixed[ind] ? fine.color[ind] : sample_bilinear(coarse, (x + 0.5f) / 2 - 0.5f, (y + 0.5f) / 2 - 0.5f);
+		}
+	}
+}
+
+glm::vec4 sample_bilinear(const GridLevel& level, float x, float y) {
+	x = std::clamp(x, 0.0f, (float)(level.width - 1));
+	y = std::clamp(y, 0.0f, (float)(level.height - 1));
+	int x0 = (int)x;
+	int y0 = (int)y;
+	int x1 = std::min(x0 + 1, level.width - 1);
+	int y1 = std::min(y0 + 1, level.height - 1);
+	float fx = x - x0;
+	float fy = y - y0;
+
+	glm::vec4 bottom = glm::mix(level.u[y0 * level.width + x0], level.u[y0 * level.width + x1], fx);
+	glm::vec4 top = glm::mix(level.u[y1 * level.width + x0], level.u[y1 * level.width + x1], fx);
+	return glm::mix(bottom, top, fy);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "shapes.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Dirichlet constraints for the Laplace equation, one entry per pixel (row major, y = 0 is the bottom row like gl_FragCoord)
+struct ColorConstraints {
+	glm::ivec2 size;
+	std::vector<glm::vec4> color;	//Constrained color, alpha is 1 for every constrained pixel
+	std::vector<uint8_t> fixed;		//1 if the pixel is constrained, 0 if it is free
+};
+
+/// <summary>
+/// Rasterizes the left and right colors of the lines into the pixels directly next to them,
+/// as done in Orzan et al. "Diffusion Curves: A Vector Representation for Smooth-Shaded Images"
+/// </summary>
+/// <param name="constraints">Output constraints, resized to resolution</param>
+/// <param name="lines">The linearized diffusion curves, in pixel coordinates</param>
+/// <param name="resolution">The resolution of the image to solve</param>
+void rasterize_color_constraints(ColorConstraints& constraints, std::span<const Line> lines, glm::ivec2 resolution);
+
+/// <summary>
+/// Solves the Laplace equation for the free pixels with a full multigrid start followed by V-cycles.
+/// Pixels that no constraint can reach keep an alpha of 0.
+/// </summary>
+/// <param name="image">Output image, resized to the constraint size</param>
+/// <param name="constraints">The boundary colors to diffuse</param>
+/// <param name="v_cycles">Number of V-cycles after the initial full multigrid pass</param>
+/// <param name="smoothing_iters">Red-black Gauss-Seidel iterations before and after each coarse grid correction</param>
+/// <returns>The RMS residual of the final solution, averaged over the color channels</returns>
+float solve_multigrid(std::vector<glm::vec4>& image, const ColorConstraints& constraints, int v_cycles, int smoothing_iters = 2);
@@ -0,0 +1,36 @@
+#include "region_renderer.h"
+
+#include "cpu_renderer.h"
+
+RegionRenderer::RegionRenderer(RegionMethod method, std::span<const Line> lines, std::span<const BezierCurve> curves, glm::ivec2 resolution,
+	float grid_cell_size, const WalkSettings& walk)
+	: method(method), lines(lines), curves(curves), resolution(resolution), walk(walk) {
+	switch (method) {
+	case RegionMethod::Lines:
+		build_segment_grid(grid, lines, resolution, grid_cell_size);
+		break;
+	case RegionMethod::Curves:
+		build_curve_grid(grid, curves, resolution, grid_cell_size);
+		break;
+	case RegionMethod::WalkOnSpheres:
+		bvh.emplace(lines);
+		break;
+	}
+}
+
+std::vector<glm::vec3> RegionRenderer::render(glm::ivec2 region_min, glm::ivec2 region_max, unsigned int n_samples, unsigned int n_threads) const {
+	//Every region starts at frame 0, its seeds already differ from other regions through the pixel coordinates
+	std::vector<glm::vec4> accumulator;
+	switch (method) {
+	case RegionMethod::Lines:
+		sample_segment_grid_cpu(accumulator, lines, grid, resolution, region_min, region_max, 0, n_samples, n_threads);
+		break;
+	case RegionMethod::Curves:
+		sample_curve_grid_cpu(accumulator, curves, grid, resolution, region_min, region_max, 0, n_samples, n_threads);
+		break;
+	case RegionMethod::WalkOnSpheres:
+		sample_walk_on_spheres(accumulator, lines, *bvh, resolution, region_min, region_max, walk, 0, n_samples, n_threads);
+		break;
+	}
+	return resolve_accumulator(accumulator);
+}
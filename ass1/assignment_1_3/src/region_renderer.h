@@ -0,0 +1,57 @@
+#pragma once
+
+#include "segment_bvh.h"
+#include "segment_grid.h"
+#include "shapes.h"
+#include "walk_on_spheres.h"
+
+#include <glm/glm.hpp>
+
+#include <optional>
+#include <span>
+#include <vector>
+
+// How a RegionRenderer finds the boundary seen by a sample
+enum class RegionMethod {
+	Lines,				//Rays traced exactly through a segment grid over the lines
+	Curves,				//Rays traced through a grid over the Bezier curves, without linearizing them
+	WalkOnSpheres		//Walks over a BVH of the lines
+};
+
+// Renders any rectangle of an image against all lines or curves of the image. The grid or BVH is built once for the whole image
+// and the samples of a rectangle are those of the same pixels in the whole image, so an image rendered rectangle by rectangle
+// is exactly the image rendered at once. Only the rectangle being rendered needs memory per pixel.
+class RegionRenderer {
+public:
+	/// <summary>
+	/// Builds the grid or BVH for the whole image, lines and curves have to stay alive while the renderer is used
+	/// </summary>
+	/// <param name="method">How the samples find the boundary</param>
+	/// <param name="lines">All lines of the image, not used with RegionMethod::Curves</param>
+	/// <param name="curves">All split Bezier curves of the image, only used with RegionMethod::Curves</param>
+	/// <param name="resolution">The resolution of the whole image</param>
+	/// <param name="grid_cell_size">Size of the grid cells in pixels, for Lines and Curves</param>
+	/// <param name="walk">Walk parameters, for WalkOnSpheres</param>
+	RegionRenderer(RegionMethod method, std::span<const Line> lines, std::span<const BezierCurve> curves, glm::ivec2 resolution,
+		float grid_cell_size, const WalkSettings& walk);
+
+	/// <summary>
+	/// Renders the pixels in [region_min, region_max) of the image
+	/// </summary>
+	/// <param name="region_min">First pixel of the region, inclusive</param>
+	/// <param name="region_max">Last pixel of the region, exclusive</param>
+	/// <param name="n_samples">Samples or walks per pixel</param>
+	/// <param name="n_threads">Number of threads to use, 0 uses all hardware threads</param>
+	/// <returns>The colors of the region, row by row</returns>
+	std::vector<glm::vec3> render(glm::ivec2 region_min, glm::ivec2 region_max, unsigned int n_samples, unsigned int n_threads = 0) const;
+
+private:
+	RegionMethod method;
+	std::span<const Line> lines;
+	std::span<const BezierCurve> curves;
+	glm::ivec2 resolution;
+	WalkSettings walk;
+
+	SegmentGrid grid;
+	std::optional<SegmentBVH> bvh;
+};
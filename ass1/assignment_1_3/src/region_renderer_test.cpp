@@ -0,0 +1,84 @@
+// Renders the bundled diffusion curve files region by region with RegionRenderer and checks that the result is exactly the image
+// rendered at once, for every method. Tiles that do not divide the resolution also cover the partial tiles at the edges.
+#include "cpu_renderer.h"
+#include "region_renderer.h"
+#include "segment_bvh.h"
+#include "shapes.h"
+#include "walk_on_spheres.h"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <span>
+#include <string>
+#include <vector>
+
+constexpr glm::ivec2 resolution{ 150, 100 };
+constexpr int tile_size = 64;
+constexpr unsigned int n_samples = 4;
+
+//Renders the image tile by tile and copies the tiles into one image
+std::vector<glm::vec3> render_tiled(const RegionRenderer& renderer) {
+	std::vector<glm::vec3> image(resolution.x * resolution.y);
+	for (int tile_y = 0; tile_y < resolution.y; tile_y += tile_size) {
+		for (int tile_x = 0; tile_x < resolution.x; tile_x += tile_size) {
+			glm::ivec2 tile_min{ tile_x, tile_y };
+			glm::ivec2 tile_max = glm::min(tile_min + tile_size, resolution);
+			std::vector<glm::vec3> tile = renderer.render(tile_min, tile_max, n_samples);
+
+			int width = tile_max.x - tile_min.x;
+			for (int y = tile_min.y; y < tile_max.y; y++) {
+				std::copy_n(&tile[(y - tile_min.y) * width], width, &image[y * resolution.x + tile_min.x]);
+			}
+		}
+	}
+	return image;
+}
+
+//Counts the pixels that differ, and reports the first one
+bool compare(const char* name, const std::vector<glm::vec3>& tiled, const std::vector<glm::vec3>& untiled) {
+	int differences = 0;
+	for (int i = 0; i < (int)untiled.size(); i++) {
+		if (tiled[i] == untiled[i]) continue;
+		if (differences++ == 0) {
+			std::printf("%s: pixel (%d, %d) is (%g, %g, %g) tiled and (%g, %g, %g) untiled\n", name, i % resolution.x, i / resolution.x,
+				tiled[i].x, tiled[i].y, tiled[i].z, untiled[i].x, untiled[i].y, untiled[i].z);
+		}
+	}
+	if (differences > 0) std::printf("%s: %d pixels differ\n", name, differences);
+	return differences == 0;
+}
+
+int main() {
+	bool passed = true;
+	for (const char* file : { "arch.xml", "zephyr.xml" }) {
+		std::string path = std::string(RESOURCE_ROOT "resources/diffusionCurveXMLs/") + file;
+		std::vector<BezierCurve> curves;
+		load_Bezier_curves(curves, path.c_str(), resolution);
+		std::vector<Line> lines;
+		linearize_bezier_curves(lines, curves, 0.25f);
+
+		MarchSettings march;
+		march.exact_traversal = true;
+		WalkSettings walk;
+		std::vector<int> no_shape_ids;
+		std::vector<glm::vec4> accumulator;
+
+		sample_monte_carlo_cpu(accumulator, lines, no_shape_ids, resolution, march, 0, n_samples);
+		RegionRenderer line_renderer(RegionMethod::Lines, lines, curves, resolution, march.grid_cell_size, walk);
+		passed &= compare((std::string(file) + " lines").c_str(), render_tiled(line_renderer), resolve_accumulator(accumulator));
+
+		accumulator.clear();
+		sample_monte_carlo_curves_cpu(accumulator, curves, resolution, march, 0, n_samples);
+		RegionRenderer curve_renderer(RegionMethod::Curves, lines, curves, resolution, march.grid_cell_size, walk);
+		passed &= compare((std::string(file) + " curves").c_str(), render_tiled(curve_renderer), resolve_accumulator(accumulator));
+
+		accumulator.clear();
+		SegmentBVH bvh(lines);
+		sample_walk_on_spheres(accumulator, lines, bvh, resolution, walk, 0, n_samples);
+		RegionRenderer walk_renderer(RegionMethod::WalkOnSpheres, lines, curves, resolution, march.grid_cell_size, walk);
+		passed &= compare((std::string(file) + " walk on spheres").c_str(), render_tiled(walk_renderer), resolve_accumulator(accumulator));
+	}
+	std::printf(passed ? "tiled and untiled images are the same\n" : "tiled and untiled images differ\n");
+	return passed ? 0 : 1;
+}
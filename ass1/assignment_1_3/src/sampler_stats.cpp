@@ -0,0 +1,119 @@
+#include "sampler_stats.h"
+
+#include <algorithm>
+#include <bit>
+
+SamplerStats::SamplerStats(glm::ivec2 resolution)
+	: resolution(resolution) {
+	//Steps and outcome of the ray of every pixel
+	glGenTextures(1, &texStats);
+	glBindTexture(GL_TEXTURE_2D, texStats);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32I, resolution.x, resolution.y, 0, GL_RG_INTEGER, GL_INT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	//The accumulator is attached when the framebuffer is used
+	glGenFramebuffers(1, &stats_buffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, stats_buffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, texStats, 0);
+	const GLenum draw_buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, draw_buffers);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenBuffers(1, &readback_buffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback_buffer);
+	glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)resolution.x * resolution.y * sizeof(glm::ivec2), NULL, GL_STREAM_READ);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	glGenQueries(timer_queries, queries.data());
+}
+
+SamplerStats::~SamplerStats() {
+	if (readback_fence) glDeleteSync(readback_fence);
+	glDeleteQueries(timer_queries, queries.data());
+	glDeleteBuffers(1, &readback_buffer);
+	glDeleteFramebuffers(1, &stats_buffer);
+	glDeleteTextures(1, &texStats);
+}
+
+GLuint SamplerStats::framebuffer(GLuint accumulatorTexture) {
+	glBindFramebuffer(GL_FRAMEBUFFER, stats_buffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumulatorTexture, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return stats_buffer;
+}
+
+void SamplerStats::begin_timer() {
+	//All queries still wait for their result, skip this pass
+	if (pending_queries == timer_queries) return;
+	glBeginQuery(GL_TIME_ELAPSED, queries[next_query]);
+}
+
+void SamplerStats::end_timer() {
+	if (pending_queries == timer_queries) return;
+	glEndQuery(GL_TIME_ELAPSED);
+	next_query = (next_query + 1) % timer_queries;
+	pending_queries++;
+}
+
+void SamplerStats::read_statistics() {
+	if (readback_fence) return;
+
+	//The copy to the pixel buffer happens on the GPU, the fence tells when it is done
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, stats_buffer);
+	glReadBuffer(GL_COLOR_ATTACHMENT1);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback_buffer);
+	glReadPixels(0, 0, resolution.x, resolution.y, GL_RG_INTEGER, GL_INT, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	readback_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void SamplerStats::update() {
+	//Timer results arrive in order, take all that are available
+	while (pending_queries > 0) {
+		GLuint query = queries[(next_query - pending_queries + timer_queries) % timer_queries];
+		GLint available = 0;
+		glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) break;
+		GLuint64 elapsed_ns = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed_ns);
+		last_time_ms = (float)elapsed_ns * 1e-6f;
+		pending_queries--;
+	}
+
+	if (!readback_fence) return;
+	GLenum wait = glClientWaitSync(readback_fence, 0, 0);
+	if (wait == GL_TIMEOUT_EXPIRED) return;
+	glDeleteSync(readback_fence);
+	readback_fence = nullptr;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback_buffer);
+	const glm::ivec2* rays = (const glm::ivec2*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+	if (rays) {
+		RayStatistics statistics;
+		for (size_t i = 0; i < (size_t)resolution.x * resolution.y; i++) {
+			int steps = rays[i].x;
+			RayOutcome outcome = (RayOutcome)rays[i].y;
+			if (outcome == RayOutcome::None) continue;
+
+			statistics.rays++;
+			statistics.steps += steps;
+			statistics.longest_ray = std::max(statistics.longest_ray, steps);
+			if (outcome == RayOutcome::Hit) {
+				statistics.hits++;
+			} else {
+				statistics.wasted_steps += steps;
+				if (outcome == RayOutcome::MaxSteps) statistics.max_steps++;
+				else statistics.exits++;
+			}
+			//The number of bits of steps is the bin of the power of 2 range it is in
+			int bin = std::min((int)std::bit_width((unsigned int)std::max(steps, 0)), RayStatistics::histogram_bins - 1);
+			statistics.step_histogram[bin]++;
+		}
+		last_statistics = statistics;
+	}
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <framework/opengl_includes.h>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+
+// How a ray of the sampler ended, the same as the RAY_ defines in the sample shaders
+enum class RayOutcome {
+	None = 0,
+	Hit = 1,
+	MaxSteps = 2,
+	Exit = 3
+};
+
+// Statistics of the rays of one sample pass
+struct RayStatistics {
+	// Bin 0 counts the rays that took no steps, bin i > 0 the rays that took [2^(i-1), 2^i) steps, the last bin also all longer rays
+	static constexpr int histogram_bins = 20;
+
+	uint64_t rays = 0;
+	uint64_t hits = 0;
+	uint64_t max_steps = 0;
+	uint64_t exits = 0;
+	// Steps of all rays, and of the rays that did not hit anything
+	uint64_t steps = 0;
+	uint64_t wasted_steps = 0;
+	int longest_ray = 0;
+	std::array<uint64_t, histogram_bins> step_histogram{};
+};
+
+// Instrumentation of the sample passes. The sample shaders write the steps and outcome of every ray to a texture, which is read back
+// without stalling through a pixel buffer and reduced on the CPU once the GPU is done with it. The time of the sample passes is measured
+// with timer queries, read back the same way.
+class SamplerStats {
+public:
+	SamplerStats(glm::ivec2 resolution);
+	SamplerStats(const SamplerStats&) = delete;
+	SamplerStats& operator=(const SamplerStats&) = delete;
+	~SamplerStats();
+
+	/// <summary>
+	/// Gets a framebuffer writing to the accumulator and the statistics texture, for the fragment shader sampler
+	/// </summary>
+	/// <param name="accumulatorTexture">The accumulator to attach as first color attachment</param>
+	/// <returns>The framebuffer with the statistics texture as second color attachment</returns>
+	GLuint framebuffer(GLuint accumulatorTexture);
+	// The statistics texture, for the compute shader sampler to bind as image
+	GLuint texture() const { return texStats; }
+
+	// Measure the time of the commands between begin_timer and end_timer, at most one pass per frame
+	void begin_timer();
+	void end_timer();
+	// Starts reading the statistics of the last sample pass, unless a read is still in flight
+	void read_statistics();
+	// Collects the results the GPU has finished, never waits for it
+	void update();
+
+	const RayStatistics& statistics() const { return last_statistics; }
+	// Time of the last measured sample pass in milliseconds
+	float sample_time_ms() const { return last_time_ms; }
+
+private:
+	static constexpr int timer_queries = 4;
+
+	glm::ivec2 resolution;
+	GLuint texStats = 0;
+	GLuint stats_buffer = 0;
+	GLuint readback_buffer = 0;
+	GLsync readback_fence = nullptr;
+	std::array<GLuint, timer_queries> queries{};
+	// Queries are used in a ring, pending_queries of them end before next_query
+	int next_query = 0;
+	int pending_queries = 0;
+
+	RayStatistics last_statistics;
+	float last_time_ms = 0.0f;
+};
@@ -0,0 +1,171 @@
+#include "segment_bvh.h"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+//Segments per leaf, small leaves keep the number of distance computations per query low
+constexpr int max_leaf_size = 4;
+//Maximum size of the traversal stack, every level pushes at most 3 more nodes than it pops
+constexpr int max_stack_size = 64;
+
+SegmentBVH::SegmentBVH(std::span<const Line> lines) {
+	segment_index.resize(lines.size());
+	for (int i = 0; i < (int)lines.size(); i++) {
+		segment_index[i] = i;
+	}
+
+	if (!lines.empty()) {
+		build(lines, 0, (int)lines.size());
+	}
+
+	//Store the segments in the order of the leaves
+	start_x.resize(lines.size());
+	start_y.resize(lines.size());
+	dir_x.resize(lines.size());
+	dir_y.resize(lines.size());
+	for (size_t i = 0; i < lines.size(); i++) {
+		const Line& line = lines[segment_index[i]];
+		start_x[i] = line.start_point.x;
+		start_y[i] = line.start_point.y;
+		dir_x[i] = line.end_point.x - line.start_point.x;
+		dir_y[i] = line.end_point.y - line.start_point.y;
+	}
+}
+
+//Builds the node for the segments in segment_index[first, first + count) and returns its index
+int SegmentBVH::build(std::span<const Line> lines, int first, int count) {
+	auto centroid = [&](int segment) {
+		return 0.5f * (lines[segment].start_point + lines[segment].end_point);
+	};
+
+	//Split the range in two at the median along the longest axis, twice, giving up to 4 children
+	std::vector<std::pair<int, int>> ranges = { { first, count } };
+	for (int round = 0; round < 2; round++) {
+		std::vector<std::pair<int, int>> split_ranges;
+		for (auto [range_first, range_count] : ranges) {
+			if (range_count <= max_leaf_size) {
+				split_ranges.push_back({ range_first, range_count });
+				continue;
+			}
+
+			glm::vec2 centroid_min(std::numeric_limits<float>::max());
+			glm::vec2 centroid_max(std::numeric_limits<float>::lowest());
+			for (int i = range_first; i < range_first + range_count; i++) {
+				centroid_min = glm::min(centroid_min, centroid(segment_index[i]));
+				centroid_max = glm::max(centroid_max, centroid(segment_index[i]));
+			}
+			int axis = (centroid_max.x - centroid_min.x) >= (centroid_max.y - centroid_min.y) ? 0 : 1;
+
+			int half = range_count / 2;
+			std::nth_element(segment_index.begin() + range_first, segment_index.begin() + range_first + half, segment_index.begin() + range_first + range_count,
+				[&](int a, int b) { return centroid(a)[axis] < centroid(b)[axis]; });
+
+			split_ranges.push_back({ range_first, half });
+			split_ranges.push_back({ range_first + half, range_count - half });
+		}
+		ranges = split_ranges;
+	}
+
+	int node_ind = (int)nodes.size();
+	nodes.push_back({});
+
+	for (int slot = 0; slot < 4; slot++) {
+		glm::vec2 bb_min(std::numeric_limits<float>::infinity());
+		glm::vec2 bb_max(-std::numeric_limits<float>::infinity());
+		int child = 0;
+		int child_count = -1;
+
+		if (slot < (int)ranges.size()) {
+			auto [range_first, range_count] = ranges[slot];
+			for (int i = range_first; i < range_first + range_count; i++) {
+				const Line& line = lines[segment_index[i]];
+				bb_min = glm::min(bb_min, glm::min(line.start_point, line.end_point));
+				bb_max = glm::max(bb_max, glm::max(line.start_point, line.end_point));
+			}
+
+			if (range_count <= max_leaf_size) {
+				child = range_first;
+				child_count = range_count;
+			} else {
+				child = build(lines, range_first, range_count);
+				child_count = 0;
+			}
+		}
+
+		//Nodes might have been reallocated by the recursive build, so index again
+		BVHNode4& node = nodes[node_ind];
+		node.min_x[slot] = bb_min.x;
+		node.min_y[slot] = bb_min.y;
+		node.max_x[slot] = bb_max.x;
+		node.max_y[slot] = bb_max.y;
+		node.child[slot] = child;
+		node.count[slot] = child_count;
+	}
+
+	return node_ind;
+}
+
+ClosestSegment SegmentBVH::closest_segment(glm::vec2 point, float max_distance) const {
+	ClosestSegment best = { -1, max_distance, 0 };
+	float best_sq = max_distance * max_distance;
+	if (nodes.empty()) return best;
+
+	struct StackEntry {
+		int node;
+		float distance_sq;
+	};
+	StackEntry stack[max_stack_size];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, 0 };
+
+	while (stack_size > 0) {
+		StackEntry entry = stack[--stack_size];
+		if (entry.distance_sq >= best_sq) continue;
+		const BVHNode4& node = nodes[entry.node];
+
+		//Squared distance to the 4 child boxes, empty slots have inverted infinite boxes and end up at infinity
+		float box_distance_sq[4];
+		for (int i = 0; i < 4; i++) {
+			float dx = std::max(std::max(node.min_x[i] - point.x, point.x - node.max_x[i]), 0.0f);
+			float dy = std::max(std::max(node.min_y[i] - point.y, point.y - node.max_y[i]), 0.0f);
+			box_distance_sq[i] = dx * dx + dy * dy;
+		}
+
+		//Sort the children front to back
+		int order[4] = { 0, 1, 2, 3 };
+		std::sort(order, order + 4, [&](int a, int b) { return box_distance_sq[a] < box_distance_sq[b]; });
+
+		//Test the leaves front to back first so best_sq shrinks as fast as possible
+		for (int i : order) {
+			if (node.count[i] <= 0 || box_distance_sq[i] >= best_sq) continue;
+
+			for (int j = node.child[i]; j < node.child[i] + node.count[i]; j++) {
+				float to_x = point.x - start_x[j];
+				float to_y = point.y - start_y[j];
+				float length_sq = dir_x[j] * dir_x[j] + dir_y[j] * dir_y[j];
+				float t = length_sq > 0 ? std::clamp((to_x * dir_x[j] + to_y * dir_y[j]) / length_sq, 0.0f, 1.0f) : 0.0f;
+				float dx = to_x - t * dir_x[j];
+				float dy = to_y - t * dir_y[j];
+				float distance_sq = dx * dx + dy * dy;
+				if (distance_sq < best_sq) {
+					best_sq = distance_sq;
+					best.segment = segment_index[j];
+					best.t = t;
+				}
+			}
+		}
+
+		//Push the inner nodes back to front so the closest one is popped first
+		for (int k = 3; k >= 0; k--) {
+			int i = order[k];
+			if (node.count[i] != 0 || box_distance_sq[i] >= best_sq) continue;
+			stack[stack_size++] = { node.child[i], box_distance_sq[i] };
+		}
+	}
+
+	if (best.segment >= 0) best.distance = std::sqrt(best_sq);
+	return best;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "shapes.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Node of a 4 wide bounding volume hierarchy, the bounds of the 4 children are stored as arrays
+// so the distance to all of them can be computed at once with SIMD
+struct BVHNode4 {
+	float min_x[4];
+	float min_y[4];
+	float max_x[4];
+	float max_y[4];
+	int32_t child[4];		//Index of the child node, or the first segment if the child is a leaf
+	int32_t count[4];		//Number of segments for a leaf, 0 for inner nodes and -1 for empty slots
+};
+
+// Result of a closest point query
+struct ClosestSegment {
+	int segment;			//Index in the original line array, -1 if there are no segments
+	float distance;
+	float t;				//Parameter of the closest point along the segment, 0 at the start and 1 at the end
+};
+
+// 4 wide BVH over line segments for closest point queries
+class SegmentBVH {
+public:
+	SegmentBVH(std::span<const Line> lines);
+
+	/// <summary>
+	/// Finds the segment closest to point
+	/// </summary>
+	/// <param name="point">Query point</param>
+	/// <param name="max_distance">Segments further away than this are ignored</param>
+	/// <returns>The closest segment, with segment -1 if nothing is within max_distance</returns>
+	ClosestSegment closest_segment(glm::vec2 point, float max_distance) const;
+
+private:
+	int build(std::span<const Line> lines, int first, int count);
+
+	std::vector<BVHNode4> nodes;
+
+	// Segments in BVH order, split into arrays so leaves can be tested with SIMD
+	std::vector<float> start_x, start_y, dir_x, dir_y;
+	std::vector<int> segment_index;
+};
@@ -0,0 +1,332 @@
+#include "segment_grid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+//Subdividing a curve deeper than this to bin it gives pieces far below a cell
+constexpr int max_curve_bin_depth = 8;
+//Number of recently intersected shapes remembered while tracing, a shape crossing several cells along the ray is intersected once
+constexpr int mailbox_size = 8;
+
+//Forward declarations for helper functions
+float cross(glm::vec2 a, glm::vec2 b);
+bool segment_crosses_box(const Line& line, glm::vec2 box_min, glm::vec2 box_max);
+template <typename ForEachCell>
+void build_grid(SegmentGrid& grid, int n_shapes, glm::ivec2 resolution, float cell_size, ForEachCell for_each_cell);
+template <typename Intersect>
+SegmentHit trace_grid(const SegmentGrid& grid, glm::vec2 origin, glm::vec2 direction, Intersect intersect);
+int solve_cubic_in_unit_interval(float a, float b, float c, float d, float roots[3]);
+void split_control_points(const glm::vec2 points[4], glm::vec2 first[4], glm::vec2 second[4]);
+
+void build_segment_grid(SegmentGrid& grid, std::span<const Line> lines, glm::ivec2 resolution, float cell_size) {
+	build_grid(grid, (int)lines.size(), resolution, cell_size, [&](int i, glm::ivec2 dimensions, auto visit) {
+		const Line& line = lines[i];
+		glm::ivec2 cell_min = glm::ivec2(glm::floor(glm::min(line.start_point, line.end_point) / cell_size));
+		glm::ivec2 cell_max = glm::ivec2(glm::floor(glm::max(line.start_point, line.end_point) / cell_size));
+		cell_min = glm::max(cell_min, glm::ivec2(0));
+		cell_max = glm::min(cell_max, dimensions - 1);
+		for (int y = cell_min.y; y <= cell_max.y; y++) {
+			for (int x = cell_min.x; x <= cell_max.x; x++) {
+				glm::vec2 box_min = glm::vec2(x, y) * cell_size;
+				if (segment_crosses_box(line, box_min, box_min + cell_size)) visit(y * dimensions.x + x);
+			}
+		}
+	});
+}
+
+void build_curve_grid(SegmentGrid& grid, std::span<const BezierCurve> curves, glm::ivec2 resolution, float cell_size) {
+	build_grid(grid, (int)curves.size(), resolution, cell_size, [&](int i, glm::ivec2 dimensions, auto visit) {
+		//The curve lies in the bounding box of its control points. Splitting it until the pieces are about a cell large
+		//keeps it out of most cells its whole bounding box covers.
+		struct StackEntry {
+			glm::vec2 points[4];
+			int depth;
+		};
+		StackEntry stack[max_curve_bin_depth + 2];
+		int stack_size = 1;
+		std::copy(curves[i].control_points, curves[i].control_points + 4, stack[0].points);
+		stack[0].depth = 0;
+
+		while (stack_size > 0) {
+			StackEntry entry = stack[--stack_size];
+			glm::vec2 box_min = entry.points[0];
+			glm::vec2 box_max = entry.points[0];
+			for (const glm::vec2& point : entry.points) {
+				box_min = glm::min(box_min, point);
+				box_max = glm::max(box_max, point);
+			}
+
+			glm::vec2 extent = box_max - box_min;
+			if (entry.depth < max_curve_bin_depth && std::max(extent.x, extent.y) > cell_size) {
+				split_control_points(entry.points, stack[stack_size].points, stack[stack_size + 1].points);
+				stack[stack_size].depth = entry.depth + 1;
+				stack[stack_size + 1].depth = entry.depth + 1;
+				stack_size += 2;
+				continue;
+			}
+
+			//The same margin as segment_crosses_box, for pieces lying on a cell border
+			glm::ivec2 cell_min = glm::max(glm::ivec2(glm::floor((box_min - 1e-3f) / cell_size)), glm::ivec2(0));
+			glm::ivec2 cell_max = glm::min(glm::ivec2(glm::floor((box_max + 1e-3f) / cell_size)), dimensions - 1);
+			for (int y = cell_min.y; y <= cell_max.y; y++) {
+				for (int x = cell_min.x; x <= cell_max.x; x++) {
+					visit(y * dimensions.x + x);
+				}
+			}
+		}
+	});
+}
+
+SegmentHit trace_segment_grid(const SegmentGrid& grid, std::span<const Line> lines, glm::vec2 origin, glm::vec2 direction) {
+	return trace_grid(grid, origin, direction, [&](int id, SegmentHit& hit) {
+		const Line& line = lines[id];
+		//Solve origin + t * direction = start + s * (end - start)
+		glm::vec2 edge = line.end_point - line.start_point;
+		float denominator = cross(direction, edge);
+		if (std::abs(denominator) < 1e-12f) return;
+		glm::vec2 to_start = line.start_point - origin;
+		float t = cross(to_start, edge) / denominator;
+		float s = cross(to_start, direction) / denominator;
+		if (t > 0.0f && t < hit.t && s >= 0.0f && s <= 1.0f) {
+			//The ray comes from the side the denominator points to
+			hit = { id, t, s, denominator > 0.0f };
+		}
+	});
+}
+
+SegmentHit trace_curve_grid(const SegmentGrid& grid, std::span<const BezierCurve> curves, glm::vec2 origin, glm::vec2 direction) {
+	return trace_grid(grid, origin, direction, [&](int id, SegmentHit& hit) {
+		float t, u;
+		bool left;
+		if (intersect_bezier_curve(curves[id], origin, direction, t, u, left) && t < hit.t) {
+			hit = { id, t, u, left };
+		}
+	});
+}
+
+bool intersect_bezier_curve(const BezierCurve& curve, glm::vec2 origin, glm::vec2 direction, float& t, float& u, bool& left) {
+	//Signed distances of the control points to the line through the ray, and their positions along the ray
+	glm::vec2 normal{ -direction.y, direction.x };
+	float distances[4];
+	bool in_front = false;
+	for (int i = 0; i < 4; i++) {
+		glm::vec2 to_point = curve.control_points[i] - origin;
+		distances[i] = glm::dot(normal, to_point);
+		in_front |= glm::dot(direction, to_point) > 0.0f;
+	}
+
+	//The curve lies in the convex hull of its control points, it misses the ray if the hull is behind the origin or on one side of the ray
+	float min_distance = std::min({ distances[0], distances[1], distances[2], distances[3] });
+	float max_distance = std::max({ distances[0], distances[1], distances[2], distances[3] });
+	if (!in_front || min_distance > 0.0f || max_distance < 0.0f) return false;
+
+	//The distance to the ray along the curve is a cubic in Bernstein form, convert it to the power basis and find where it is 0
+	float a = -distances[0] + 3.0f * distances[1] - 3.0f * distances[2] + distances[3];
+	float b = 3.0f * distances[0] - 6.0f * distances[1] + 3.0f * distances[2];
+	float c = -3.0f * distances[0] + 3.0f * distances[1];
+	float roots[3];
+	int n_roots = solve_cubic_in_unit_interval(a, b, c, distances[0], roots);
+
+	//Closest root in front of the origin
+	const glm::vec2* p = curve.control_points;
+	float direction_length2 = glm::dot(direction, direction);
+	t = std::numeric_limits<float>::max();
+	for (int i = 0; i < n_roots; i++) {
+		float r = roots[i];
+		float s = 1.0f - r;
+		glm::vec2 point = s * s * s * p[0] + 3.0f * s * s * r * p[1] + 3.0f * s * r * r * p[2] + r * r * r * p[3];
+		float root_t = glm::dot(point - origin, direction) / direction_length2;
+		if (root_t > 0.0f && root_t < t) {
+			t = root_t;
+			u = r;
+		}
+	}
+	if (t == std::numeric_limits<float>::max()) return false;
+
+	//The ray reaches the curve from the side it came from, the tangent falls back to the chord where control points coincide
+	float s = 1.0f - u;
+	glm::vec2 tangent = s * s * (p[1] - p[0]) + 2.0f * s * u * (p[2] - p[1]) + u * u * (p[3] - p[2]);
+	if (glm::dot(tangent, tangent) < 1e-12f) tangent = p[3] - p[0];
+	left = cross(direction, tangent) > 0.0f;
+	return true;
+}
+
+//2D cross product, positive if b is to the left of a
+float cross(glm::vec2 a, glm::vec2 b) {
+	return a.x * b.y - a.y * b.x;
+}
+
+//Checks if the segment crosses the box, assuming their bounding boxes overlap. The box is grown slightly, so segments along cell borders are in both cells.
+bool segment_crosses_box(const Line& line, glm::vec2 box_min, glm::vec2 box_max) {
+	constexpr float margin = 1e-3f;
+	box_min -= margin;
+	box_max += margin;
+
+	//The segment misses the box if all corners are on the same side of its line
+	glm::vec2 edge = line.end_point - line.start_point;
+	const glm::vec2 corners[4] = { box_min, { box_max.x, box_min.y }, box_max, { box_min.x, box_max.y } };
+	bool left = false;
+	bool right = false;
+	for (const glm::vec2& corner : corners) {
+		float side = cross(edge, corner - line.start_point);
+		left |= side >= 0.0f;
+		right |= side <= 0.0f;
+	}
+	return left && right;
+}
+
+//Fills the grid with the shapes, for_each_cell(i, dimensions, visit) calls visit for every cell shape i is in. A shape visiting a cell twice is only added once.
+template <typename ForEachCell>
+void build_grid(SegmentGrid& grid, int n_shapes, glm::ivec2 resolution, float cell_size, ForEachCell for_each_cell) {
+	grid.cell_size = cell_size;
+	grid.dimensions = glm::max(glm::ivec2(glm::ceil(glm::vec2(resolution) / cell_size)), glm::ivec2(1));
+	int n_cells = grid.dimensions.x * grid.dimensions.y;
+
+	//Last shape added to every cell, the cells of a shape are all visited before the next shape
+	std::vector<int32_t> last_shape(n_cells, -1);
+
+	//Count the shapes per cell, the prefix sum gives the offsets and the second pass fills them in
+	grid.cell_offsets.assign(n_cells + 1, 0);
+	for (int i = 0; i < n_shapes; i++) {
+		for_each_cell(i, grid.dimensions, [&](int cell) {
+			if (last_shape[cell] == i) return;
+			last_shape[cell] = i;
+			grid.cell_offsets[cell + 1]++;
+		});
+	}
+	std::inclusive_scan(grid.cell_offsets.begin(), grid.cell_offsets.end(), grid.cell_offsets.begin());
+
+	grid.cell_segments.resize(grid.cell_offsets[n_cells]);
+	std::vector<int32_t> fill(grid.cell_offsets.begin(), grid.cell_offsets.end() - 1);
+	std::fill(last_shape.begin(), last_shape.end(), -1);
+	for (int i = 0; i < n_shapes; i++) {
+		for_each_cell(i, grid.dimensions, [&](int cell) {
+			if (last_shape[cell] == i) return;
+			last_shape[cell] = i;
+			grid.cell_segments[fill[cell]++] = i;
+		});
+	}
+}
+
+//Walks the cells along the ray with a 2D DDA, intersect(id, hit) replaces hit if shape id is hit closer
+template <typename Intersect>
+SegmentHit trace_grid(const SegmentGrid& grid, glm::vec2 origin, glm::vec2 direction, Intersect intersect) {
+	//Avoid dividing by zero for rays along an axis
+	glm::vec2 step_direction = direction;
+	for (int c = 0; c < 2; c++) {
+		if (std::abs(step_direction[c]) < 1e-8f) step_direction[c] = 1e-8f;
+	}
+
+	glm::ivec2 cell = glm::clamp(glm::ivec2(glm::floor(origin / grid.cell_size)), glm::ivec2(0), grid.dimensions - 1);
+	glm::ivec2 cell_step = glm::ivec2(step_direction.x > 0.0f ? 1 : -1, step_direction.y > 0.0f ? 1 : -1);
+	glm::vec2 inverse_direction = 1.0f / step_direction;
+	//Distance along the ray to the next vertical and horizontal cell boundary, and between two boundaries
+	glm::vec2 next_boundary = (glm::vec2(cell) + glm::vec2(glm::max(cell_step, glm::ivec2(0)))) * grid.cell_size;
+	glm::vec2 t_max = (next_boundary - origin) * inverse_direction;
+	glm::vec2 t_delta = glm::abs(grid.cell_size * inverse_direction);
+
+	//The intersection gives the closest hit on the whole shape, so testing it again in a later cell gives nothing new
+	int32_t mailbox[mailbox_size];
+	std::fill(mailbox, mailbox + mailbox_size, -1);
+	int mailbox_next = 0;
+
+	SegmentHit hit;
+	hit.t = std::numeric_limits<float>::max();
+	while (cell.x >= 0 && cell.y >= 0 && cell.x < grid.dimensions.x && cell.y < grid.dimensions.y) {
+		int cell_index = cell.y * grid.dimensions.x + cell.x;
+		for (int i = grid.cell_offsets[cell_index]; i < grid.cell_offsets[cell_index + 1]; i++) {
+			int32_t id = grid.cell_segments[i];
+			if (std::find(mailbox, mailbox + mailbox_size, id) != mailbox + mailbox_size) continue;
+			mailbox[mailbox_next] = id;
+			mailbox_next = (mailbox_next + 1) % mailbox_size;
+			intersect(id, hit);
+		}
+
+		//A shape can cross several cells, the hit only counts once the ray reached it
+		float t_exit = std::min(t_max.x, t_max.y);
+		if (hit.segment >= 0 && hit.t <= t_exit) return hit;
+
+		if (t_max.x < t_max.y) {
+			t_max.x += t_delta.x;
+			cell.x += cell_step.x;
+		} else {
+			t_max.y += t_delta.y;
+			cell.y += cell_step.y;
+		}
+	}
+	//A hit found in the last cells but beyond them is outside the image
+	return {};
+}
+
+//Finds the roots in [0, 1] of a*u^3 + b*u^2 + c*u + d. The cubic is split at its extrema into monotonic pieces, and the root of
+//every piece that changes sign is found with Newton steps kept inside the bracket by bisection. Returns the number of roots.
+int solve_cubic_in_unit_interval(float a, float b, float c, float d, float roots[3]) {
+	auto f = [&](float u) { return ((a * u + b) * u + c) * u + d; };
+	auto df = [&](float u) { return (3.0f * a * u + 2.0f * b) * u + c; };
+
+	//Extrema are the roots of the derivative 3a*u^2 + 2b*u + c, solved without cancellation
+	float bounds[4] = { 0.0f };
+	int n_bounds = 1;
+	float qa = 3.0f * a;
+	float qb = 2.0f * b;
+	float discriminant = qb * qb - 4.0f * qa * c;
+	if (discriminant >= 0.0f) {
+		float q = -0.5f * (qb + std::copysign(std::sqrt(discriminant), qb));
+		float extrema[2] = { qa != 0.0f ? q / qa : -1.0f, q != 0.0f ? c / q : -1.0f };
+		std::sort(extrema, extrema + 2);
+		for (float extremum : extrema) {
+			if (extremum > 0.0f && extremum < 1.0f) bounds[n_bounds++] = extremum;
+		}
+	}
+	bounds[n_bounds++] = 1.0f;
+
+	int n_roots = 0;
+	for (int i = 0; i + 1 < n_bounds; i++) {
+		float lo = bounds[i];
+		float hi = bounds[i + 1];
+		float f_lo = f(lo);
+		float f_hi = f(hi);
+		if ((f_lo > 0.0f && f_hi > 0.0f) || (f_lo < 0.0f && f_hi < 0.0f)) continue;
+		if (f_lo == 0.0f) {
+			roots[n_roots++] = lo;
+			continue;
+		}
+
+		float u = 0.5f * (lo + hi);
+		for (int iteration = 0; iteration < 32; iteration++) {
+			float f_u = f(u);
+			if (f_u == 0.0f) break;
+			//Keep the root inside [lo, hi]
+			if ((f_u > 0.0f) == (f_lo > 0.0f)) lo = u;
+			else hi = u;
+
+			float derivative = df(u);
+			float next = derivative != 0.0f ? u - f_u / derivative : lo;
+			if (!(next > lo && next < hi)) next = 0.5f * (lo + hi);
+			if (std::abs(next - u) < 1e-7f) {
+				u = next;
+				break;
+			}
+			u = next;
+		}
+		roots[n_roots++] = u;
+	}
+	return n_roots;
+}
+
+//de Casteljau split of 4 control points in the middle
+void split_control_points(const glm::vec2 points[4], glm::vec2 first[4], glm::vec2 second[4]) {
+	glm::vec2 p01 = 0.5f * (points[0] + points[1]);
+	glm::vec2 p12 = 0.5f * (points[1] + points[2]);
+	glm::vec2 p23 = 0.5f * (points[2] + points[3]);
+	glm::vec2 p012 = 0.5f * (p01 + p12);
+	glm::vec2 p123 = 0.5f * (p12 + p23);
+	glm::vec2 middle = 0.5f * (p012 + p123);
+
+	const glm::vec2 first_points[4] = { points[0], p01, p012, middle };
+	const glm::vec2 second_points[4] = { middle, p123, p23, points[3] };
+	std::copy(first_points, first_points + 4, first);
+	std::copy(second_points, second_points + 4, second);
+}
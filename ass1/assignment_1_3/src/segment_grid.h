@@ -0,0 +1,82 @@
+#pragma once
+
+#include "shapes.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Uniform grid over the image listing the segments, or the Bezier curves, crossing every cell. The arrays have the layout of
+// the buffer textures grid_cells and grid_segments in sample_shader.glsl, so they can be uploaded as is.
+struct SegmentGrid {
+	glm::ivec2 dimensions{ 0 };
+	float cell_size = 1.0f;
+	// Index of the first entry of every cell in cell_segments, followed by the total number of entries
+	std::vector<int32_t> cell_offsets;
+	// Ids of the segments or curves crossing each cell, cell after cell
+	std::vector<int32_t> cell_segments;
+};
+
+// Closest intersection of a ray with the segments or curves
+struct SegmentHit {
+	int segment = -1;		//Id of the segment or curve that was hit, -1 if the ray left the grid without a hit
+	float t = 0.0f;			//Distance along the ray direction
+	float s = 0.0f;			//Position of the hit along the segment or curve parameter, 0 at the start and 1 at the end
+	bool left = false;		//If the ray origin is on the left side, where color_left applies
+};
+
+/// <summary>
+/// Inserts every segment in the cells it crosses, parts of segments outside the image are left out like they are
+/// left out of the rasterized texture
+/// </summary>
+/// <param name="grid">Output grid</param>
+/// <param name="lines">The segments, in pixel coordinates</param>
+/// <param name="resolution">The resolution of the image the grid covers</param>
+/// <param name="cell_size">Size of the cells in pixels</param>
+void build_segment_grid(SegmentGrid& grid, std::span<const Line> lines, glm::ivec2 resolution, float cell_size);
+
+/// <summary>
+/// Walks the cells along the ray with a 2D DDA and intersects the segments of every cell exactly, the same traversal as
+/// trace_grid in sample_shader.glsl
+/// </summary>
+/// <param name="grid">Grid built over lines</param>
+/// <param name="lines">The segments</param>
+/// <param name="origin">Start of the ray, inside the grid</param>
+/// <param name="direction">Direction of the ray</param>
+/// <returns>The closest hit in front of the origin</returns>
+SegmentHit trace_segment_grid(const SegmentGrid& grid, std::span<const Line> lines, glm::vec2 origin, glm::vec2 direction);
+
+/// <summary>
+/// Inserts every Bezier curve in the cells it can cross, found by splitting the curve until the bounding boxes of the pieces
+/// are about a cell large
+/// </summary>
+/// <param name="grid">Output grid</param>
+/// <param name="curves">The curves, in pixel coordinates</param>
+/// <param name="resolution">The resolution of the image the grid covers</param>
+/// <param name="cell_size">Size of the cells in pixels</param>
+void build_curve_grid(SegmentGrid& grid, std::span<const BezierCurve> curves, glm::ivec2 resolution, float cell_size);
+
+/// <summary>
+/// Same traversal as trace_segment_grid, but intersects the Bezier curves of every cell with intersect_bezier_curve
+/// </summary>
+/// <param name="grid">Grid built over curves with build_curve_grid</param>
+/// <param name="curves">The curves</param>
+/// <param name="origin">Start of the ray, inside the grid</param>
+/// <param name="direction">Direction of the ray</param>
+/// <returns>The closest hit in front of the origin, s is the curve parameter of the hit</returns>
+SegmentHit trace_curve_grid(const SegmentGrid& grid, std::span<const BezierCurve> curves, glm::vec2 origin, glm::vec2 direction);
+
+/// <summary>
+/// Intersects a ray with a cubic Bezier curve without linearizing it. Curves whose control points are all on one side of the ray
+/// or behind it are rejected first, otherwise the roots of the distance from the curve to the ray are found numerically.
+/// </summary>
+/// <param name="curve">The curve</param>
+/// <param name="origin">Start of the ray</param>
+/// <param name="direction">Direction of the ray</param>
+/// <param name="t">Output distance along the ray direction of the closest hit</param>
+/// <param name="u">Output curve parameter of the closest hit</param>
+/// <param name="left">Output if the ray origin is on the left side of the curve at the hit</param>
+/// <returns>True if the ray hits the curve in front of the origin</returns>
+bool intersect_bezier_curve(const BezierCurve& curve, glm::vec2 origin, glm::vec2 direction, float& t, float& u, bool& left);
@@ -4,6 +4,9 @@
 #include <algorithm> 
 
 #include <array>
+#include <numeric>
+
+#include "parallel.h"
 
 #include "rapidxml.hpp"
 #include "rapidxml_utils.hpp"
@@ -14,7 +17,8 @@
 
 //Forward declarations for helper functions
 void pushColor(rapidxml::xml_node<>* color_node, std::vector<glm::uvec2>& ind, std::vector<float>& color_u, std::vector<glm::vec3>& color);
-void linearize_bezier_curve_helper(BezierCurve curve, float tolerance, std::vector<Line>& lines, int max_depth);
+template <typename Emit>
+int linearize_bezier_curve(const BezierCurve& curve, float flatness, int max_depth, Emit emit);
 std::array<BezierCurve, 2> split_curve(BezierCurve curve, float alpha);
 bool is_curve_flat(BezierCurve curve, float tolerance);
 
@@ -246,33 +250,77 @@ void load_Bezier_curves(std::vector<BezierCurve>& curves, const char* path, glm:
 
 };
 
-std::vector<Line> linearize_bezier_curve(BezierCurve curve, float tolerance, int max_depth) {
-	std::vector<Line> lines;
+//Number of curves handled per work item, so small files do not pay for thread startup per curve
+constexpr int curves_per_work_item = 64;
 
-	linearize_bezier_curve_helper(curve, tolerance, lines, max_depth);
+void linearize_bezier_curves(std::vector<Line>& lines, std::span<const BezierCurve> curves, float tolerance, int max_depth, unsigned int n_threads,
+	std::vector<size_t>* curve_line_offsets) {
+	//is_curve_flat compares against 16 times the squared distance between the curve and the line
+	float flatness = 16.0f * tolerance * tolerance;
+	max_depth = std::clamp(max_depth, 0, max_linearize_depth);
 
-	return lines;
-};
+	int n_curves = (int)curves.size();
+	int n_work_items = (n_curves + curves_per_work_item - 1) / curves_per_work_item;
 
-//Helper function to handle the recusion of the approximation
-void linearize_bezier_curve_helper(BezierCurve curve, float tolerance, std::vector<Line>& lines, int max_depth) {
-	//If the curve is flat enough, it is well approximated by a line through the first and last control point
-	if (is_curve_flat(curve, tolerance) || max_depth == 0) {
-		lines.push_back({
-			curve.control_points[0],
-			curve.control_points[3],
-			{curve.color_left[0],curve.color_left[1]},
-			{curve.color_right[0],curve.color_right[1]},
-			}
-		);
-	}
-	//Otherwise split the curve in the middle and try again
-	else {
-		auto curves = split_curve(curve, 0.5f);
+	//First pass only counts the lines of every curve
+	std::vector<size_t> offsets(n_curves + 1, 0);
+	parallel_for(n_work_items, n_threads, [&](int item) {
+		int end = std::min((item + 1) * curves_per_work_item, n_curves);
+		for (int i = item * curves_per_work_item; i < end; i++) {
+			offsets[i + 1] = linearize_bezier_curve(curves[i], flatness, max_depth, [](const Line&) {});
+		}
+	});
+
+	//The prefix sum of the counts gives the place of the first line of each curve
+	std::inclusive_scan(offsets.begin(), offsets.end(), offsets.begin());
+	lines.resize(offsets[n_curves]);
+
+	//Second pass writes the lines in place, lines keeps its capacity between calls so this does not allocate on reloads
+	parallel_for(n_work_items, n_threads, [&](int item) {
+		int end = std::min((item + 1) * curves_per_work_item, n_curves);
+		for (int i = item * curves_per_work_item; i < end; i++) {
+			Line* out = lines.data() + offsets[i];
+			linearize_bezier_curve(curves[i], flatness, max_depth, [&](const Line& line) { *out++ = line; });
+		}
+	});
 
-		linearize_bezier_curve_helper(curves[0], tolerance, lines, max_depth - 1);
-		linearize_bezier_curve_helper(curves[1], tolerance, lines, max_depth - 1);
+	if (curve_line_offsets) *curve_line_offsets = std::move(offsets);
+}
+
+//Subdivides the curve until it is flat, calling emit for every line in order along the curve. Returns the number of lines.
+template <typename Emit>
+int linearize_bezier_curve(const BezierCurve& curve, float flatness, int max_depth, Emit emit) {
+	//Depth first traversal of the subdivision tree, the second half is pushed first so the first half comes out first
+	struct StackEntry {
+		BezierCurve curve;
+		int depth;
+	};
+	StackEntry stack[max_linearize_depth + 2];
+	int stack_size = 0;
+	stack[stack_size++] = { curve, 0 };
+
+	int n_lines = 0;
+	while (stack_size > 0) {
+		StackEntry entry = stack[--stack_size];
+
+		//If the curve is flat enough, it is well approximated by a line through the first and last control point
+		if (entry.depth >= max_depth || is_curve_flat(entry.curve, flatness)) {
+			emit(Line{
+				entry.curve.control_points[0],
+				entry.curve.control_points[3],
+				{entry.curve.color_left[0], entry.curve.color_left[1]},
+				{entry.curve.color_right[0], entry.curve.color_right[1]},
+				});
+			n_lines++;
+		}
+		//Otherwise split the curve in the middle and try again
+		else {
+			auto halves = split_curve(entry.curve, 0.5f);
+			stack[stack_size++] = { halves[1], entry.depth + 1 };
+			stack[stack_size++] = { halves[0], entry.depth + 1 };
+		}
 	}
+	return n_lines;
 }
 
 //Splits a bezierCurve into 2 smaller curves at the point where the curve parameter is equal to alpha
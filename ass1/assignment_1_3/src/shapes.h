@@ -1,5 +1,9 @@
+#pragma once
+
 #include <glm/glm.hpp>
 
+#include <climits>
+#include <span>
 #include <vector>
 
 // Shape enumerator
@@ -35,6 +39,10 @@ struct Line {
 	glm::vec4 color_right[2];
 };
 
+//Subdivision deeper than this would give segments far below a pixel, it also bounds the stack used per curve.
+//The tolerance decides how far a curve is subdivided, so this is also the default maximum.
+constexpr int max_linearize_depth = 30;
+
 /// <summary>
 /// Loads a set of diffusion curves from an diffusion curve XML file
 /// </summary>
@@ -43,11 +51,15 @@ struct Line {
 /// <param name="resolution">The resolution we intent to render the curves at</param>
 void load_Bezier_curves(std::vector<BezierCurve>& curves, const char* path, glm::ivec2 resolution);
 /// <summary>
-/// Creates a linear approximation for the given BezierCurve based on 
+/// Creates a linear approximation for all given BezierCurves based on
 /// Fischer, Kaspar. "Piecewise Linear Approximation of B'ezier Curves," n.d.
+/// Curves are subdivided with an explicit stack and processed in parallel, the lines are written straight into their final place.
 /// </summary>
-/// <param name="curve">The bezier curve to approximaate </param>
-/// <param name="tolerance">If the line version of the curve is closer than tolarance stop</param>
+/// <param name="lines">Output for the lines, resized to fit, the lines of each curve follow the order of the curves. Where lines overlap the one with the lowest index wins, so the order shows in the image</param>
+/// <param name="curves">The bezier curves to approximate, in pixel coordinates</param>
+/// <param name="tolerance">Stop subdividing when the lines are within tolerance pixels of the curve</param>
 /// <param name="max_depth">Stop after max_depth sub_divisions </param>
-/// <returns>The set of lines that approximate the curve</returns>
-std::vector<Line> linearize_bezier_curve(BezierCurve curve, float tolerance, int max_depth = INT_MAX);
+/// <param name="n_threads">Number of threads to use, 0 uses all hardware threads</param>
+/// <param name="curve_line_offsets">Optional output for the index of the first line of every curve, followed by the total number of lines</param>
+void linearize_bezier_curves(std::vector<Line>& lines, std::span<const BezierCurve> curves, float tolerance, int max_depth = INT_MAX, unsigned int n_threads = 0,
+	std::vector<size_t>* curve_line_offsets = nullptr);
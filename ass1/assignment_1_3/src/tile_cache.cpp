@@ -0,0 +1,89 @@
+#include "tile_cache.h"
+
+#include <algorithm>
+#include <cstdint>
+
+size_t TileKeyHash::operator()(const TileKey& key) const {
+	//Tile indices are small, so packing them gives a unique key per tile
+	return ((size_t)key.level << 48) ^ ((size_t)(uint32_t)key.index.y << 24) ^ (size_t)(uint32_t)key.index.x;
+}
+
+TileCache::TileCache(size_t capacity, glm::ivec2 tile_size)
+	: max_tiles(std::max(capacity, (size_t)1)), tile_size(tile_size) {
+}
+
+TileCache::~TileCache() {
+	clear();
+	for (Tile& tile : free_tiles) {
+		glDeleteFramebuffers(1, &tile.accumulator_buffer);
+		glDeleteTextures(1, &tile.texAccumulator);
+	}
+}
+
+Tile* TileCache::find(const TileKey& key) {
+	auto it = lookup.find(key);
+	if (it == lookup.end()) return nullptr;
+	tiles.splice(tiles.begin(), tiles, it->second);
+	return &it->second->second;
+}
+
+Tile& TileCache::get(const TileKey& key) {
+	if (Tile* tile = find(key)) return *tile;
+
+	//Reuse the textures of the least recently used tile, a cleared tile or make new ones
+	Tile tile;
+	if (tiles.size() >= max_tiles) {
+		lookup.erase(tiles.back().first);
+		tile = std::move(tiles.back().second);
+		tiles.pop_back();
+	} else if (!free_tiles.empty()) {
+		tile = std::move(free_tiles.back());
+		free_tiles.pop_back();
+	} else {
+		tile = create_tile();
+	}
+	reset_tile(tile);
+
+	tiles.emplace_front(key, std::move(tile));
+	lookup[key] = tiles.begin();
+	return tiles.front().second;
+}
+
+void TileCache::clear() {
+	for (auto& [key, tile] : tiles) {
+		free_tiles.push_back(std::move(tile));
+	}
+	tiles.clear();
+	lookup.clear();
+}
+
+//Creates the accumulator of a tile, the same format as the accumulator of the whole window
+Tile TileCache::create_tile() const {
+	Tile tile;
+
+	glGenTextures(1, &tile.texAccumulator);
+	glBindTexture(GL_TEXTURE_2D, tile.texAccumulator);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, tile_size.x, tile_size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &tile.accumulator_buffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, tile.accumulator_buffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tile.texAccumulator, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	return tile;
+}
+
+//Removes the samples of the previous owner of the textures
+void TileCache::reset_tile(Tile& tile) const {
+	tile.samples = 0;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, tile.accumulator_buffer);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <framework/opengl_includes.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Identifies a tile of the image. Level l is the image at 2^l times the base resolution, the index counts tiles from the bottom left.
+struct TileKey {
+	int level;
+	glm::ivec2 index;
+
+	bool operator==(const TileKey& other) const { return level == other.level && index == other.index; }
+};
+
+struct TileKeyHash {
+	size_t operator()(const TileKey& key) const;
+};
+
+// Accumulated samples of a tile. The rays are traced through the grid of the whole image, so a tile needs no shapes of its own.
+struct Tile {
+	GLuint texAccumulator = 0;
+	GLuint accumulator_buffer = 0;
+
+	// Samples taken per pixel so far
+	unsigned int samples = 0;
+};
+
+// Least recently used cache of tiles. A tile that is not cached takes the textures of the least recently used tile when the cache is full,
+// so the video memory used never grows beyond capacity tiles.
+class TileCache {
+public:
+	TileCache(size_t capacity, glm::ivec2 tile_size);
+	TileCache(const TileCache&) = delete;
+	TileCache& operator=(const TileCache&) = delete;
+	~TileCache();
+
+	/// <summary>
+	/// Looks up a tile and marks it as used
+	/// </summary>
+	/// <param name="key">The tile to find</param>
+	/// <returns>The tile, or nullptr if it is not cached</returns>
+	Tile* find(const TileKey& key);
+
+	/// <summary>
+	/// Looks up a tile and marks it as used, if it is not cached an empty tile is added for it
+	/// </summary>
+	/// <param name="key">The tile to get</param>
+	/// <returns>The tile, without samples if it was not cached</returns>
+	Tile& get(const TileKey& key);
+
+	// Drops all tiles, for when the shapes or the sample settings change. The textures are kept for new tiles.
+	void clear();
+
+	size_t size() const { return tiles.size(); }
+	size_t capacity() const { return max_tiles; }
+
+private:
+	Tile create_tile() const;
+	void reset_tile(Tile& tile) const;
+
+	size_t max_tiles;
+	glm::ivec2 tile_size;
+
+	// Most recently used tile first
+	std::list<std::pair<TileKey, Tile>> tiles;
+	std::unordered_map<TileKey, std::list<std::pair<TileKey, Tile>>::iterator, TileKeyHash> lookup;
+	// Textures of cleared tiles
+	std::vector<Tile> free_tiles;
+};
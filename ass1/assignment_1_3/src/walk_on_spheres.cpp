@@ -0,0 +1,82 @@
+#include "walk_on_spheres.h"
+
+#include "cpu_renderer.h"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+constexpr float M_PI_F = 3.14159265359f;
+//Pixels are processed in square tiles so the walks of one thread stay in the same part of the BVH
+constexpr int tile_size = 32;
+
+//Forward declarations for helper functions
+bool walk(glm::vec2 origin, std::span<const Line> lines, const SegmentBVH& bvh, glm::vec2 center, float escape_distance, const WalkSettings& settings, uint32_t& seed, glm::vec4& color);
+
+void sample_walk_on_spheres(std::vector<glm::vec4>& accumulator, std::span<const Line> lines, const SegmentBVH& bvh, glm::ivec2 resolution,
+	const WalkSettings& settings, unsigned int first_frame, unsigned int n_samples, unsigned int n_threads) {
+	sample_walk_on_spheres(accumulator, lines, bvh, resolution, glm::ivec2(0), resolution, settings, first_frame, n_samples, n_threads);
+}
+
+void sample_walk_on_spheres(std::vector<glm::vec4>& accumulator, std::span<const Line> lines, const SegmentBVH& bvh, glm::ivec2 resolution,
+	glm::ivec2 region_min, glm::ivec2 region_max, const WalkSettings& settings, unsigned int first_frame, unsigned int n_samples, unsigned int n_threads) {
+	glm::ivec2 region_size = region_max - region_min;
+	if (accumulator.size() != (size_t)region_size.x * region_size.y) {
+		accumulator.assign(region_size.x * region_size.y, glm::vec4(0));
+	}
+
+	//The walks escape relative to the whole image, not the region
+	glm::vec2 center = glm::vec2(resolution) * 0.5f;
+	float escape_distance = settings.escape_distance * (float)std::max(resolution.x, resolution.y);
+
+	glm::ivec2 n_tiles = (region_size + tile_size - 1) / tile_size;
+	parallel_for(n_tiles.x * n_tiles.y, n_threads, [&](int tile) {
+		glm::ivec2 tile_min = region_min + glm::ivec2(tile % n_tiles.x, tile / n_tiles.x) * tile_size;
+		glm::ivec2 tile_max = glm::min(tile_min + tile_size, region_max);
+
+		for (int y = tile_min.y; y < tile_max.y; y++) {
+			for (int x = tile_min.x; x < tile_max.x; x++) {
+				glm::vec4& pixel = accumulator[(y - region_min.y) * region_size.x + (x - region_min.x)];
+				for (unsigned int frame_nr = first_frame; frame_nr < first_frame + n_samples; frame_nr++) {
+					//Hash pixel and frame separately, a walk uses many random numbers so neighbouring seeds must not share sequences
+					uint32_t seed = ((uint32_t)y * (uint32_t)resolution.x + (uint32_t)x) * 747796405u + frame_nr * 2891336453u;
+					get_random_number(seed);
+
+					glm::vec4 color;
+					if (walk(glm::vec2(x, y) + 0.5f, lines, bvh, center, escape_distance, settings, seed, color)) {
+						pixel += glm::vec4(glm::vec3(color), 1);
+					}
+				}
+			}
+		}
+	});
+}
+
+//Walks from origin until it is within epsilon of a segment, returns false if the walk escaped or ran out of steps
+bool walk(glm::vec2 origin, std::span<const Line> lines, const SegmentBVH& bvh, glm::vec2 center, float escape_distance, const WalkSettings& settings, uint32_t& seed, glm::vec4& color) {
+	glm::vec2 position = origin;
+	for (unsigned int step = 0; step < settings.max_steps; step++) {
+		ClosestSegment closest = bvh.closest_segment(position, std::numeric_limits<float>::infinity());
+		if (closest.segment < 0) return false;
+
+		//Close enough to the boundary, take the color on the side of the segment the walk is on
+		if (closest.distance < settings.epsilon) {
+			const Line& line = lines[closest.segment];
+			glm::vec2 line_dir = line.end_point - line.start_point;
+			glm::vec2 to_position = position - line.start_point;
+			float cross_product = line_dir.x * to_position.y - line_dir.y * to_position.x;
+
+			color = cross_product > 0.0f ? glm::mix(line.color_left[0], line.color_left[1], closest.t) : glm::mix(line.color_right[0], line.color_right[1], closest.t);
+			return true;
+		}
+
+		//Jump to a uniformly random point on the largest circle that does not contain any boundary
+		float angle = 2.0f * M_PI_F * get_random_number(seed);
+		position += closest.distance * glm::vec2(std::cos(angle), std::sin(angle));
+
+		if (glm::length(position - center) > escape_distance) return false;
+	}
+	//Out of steps, the closest segment is not where the walk would have ended so taking its color would bias the estimate
+	return false;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "segment_bvh.h"
+#include "shapes.h"
+
+#include <glm/glm.hpp>
+
+#include <span>
+#include <vector>
+
+// Parameters of the walk on spheres estimator
+struct WalkSettings {
+	float epsilon = 0.01f;					//A walk that gets this close to a segment takes the color of that segment
+	unsigned int max_steps = 256;			//Walks that have not hit anything after this many steps are dropped
+	float escape_distance = 4.0f;			//Walks further than this many image sizes from the image center are dropped, like rays leaving the screen
+};
+
+/// <summary>
+/// Adds n_samples walk on spheres estimates per pixel to the accumulator. Walks that escape or run out of steps add nothing,
+/// every other walk adds its boundary color with a weight of 1, so the accumulator resolves the same way as the sample shader's.
+/// </summary>
+/// <param name="accumulator">Accumulated samples, resized to resolution if it has the wrong size</param>
+/// <param name="lines">The lines forming the boundary, in pixel coordinates</param>
+/// <param name="bvh">BVH built over lines</param>
+/// <param name="resolution">The resolution of the image</param>
+/// <param name="settings">Walk parameters</param>
+/// <param name="first_frame">Frame number of the first sample, used to seed the random numbers</param>
+/// <param name="n_samples">Number of walks per pixel</param>
+/// <param name="n_threads">Number of threads to use, 0 uses all hardware threads</param>
+void sample_walk_on_spheres(std::vector<glm::vec4>& accumulator, std::span<const Line> lines, const SegmentBVH& bvh, glm::ivec2 resolution,
+	const WalkSettings& settings, unsigned int first_frame, unsigned int n_samples, unsigned int n_threads = 0);
+
+/// <summary>
+/// Same as sample_walk_on_spheres for the pixels of a region of the image only. The walks start from the pixels of the whole image
+/// with their random numbers and see every line in the BVH, so rendering an image region by region gives exactly the image rendered at once.
+/// </summary>
+/// <param name="accumulator">Accumulated samples of the region, resized to the size of the region if it has the wrong size</param>
+/// <param name="lines">All lines of the image</param>
+/// <param name="bvh">BVH built over lines</param>
+/// <param name="resolution">The resolution of the whole image</param>
+/// <param name="region_min">First pixel of the region, inclusive</param>
+/// <param name="region_max">Last pixel of the region, exclusive</param>
+/// <param name="settings">Walk parameters</param>
+/// <param name="first_frame">Frame number of the first sample, used to seed the random numbers</param>
+/// <param name="n_samples">Number of walks per pixel</param>
+/// <param name="n_threads">Number of threads to use, 0 uses all hardware threads</param>
+void sample_walk_on_spheres(std::vector<glm::vec4>& accumulator, std::span<const Line> lines, const SegmentBVH& bvh, glm::ivec2 resolution,
+	glm::ivec2 region_min, glm::ivec2 region_max, const WalkSettings& settings, unsigned int first_frame, unsigned int n_samples, unsigned int n_threads = 0);
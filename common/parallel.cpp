@@ -0,0 +1,111 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+//One call of parallel_for, it lives on the stack of the calling thread
+struct Job {
+	int count;
+	const std::function<void(int)>* body;
+	std::atomic<int> next_index = 0;
+	//Number of workers that may still join, and that are working on the job
+	unsigned int helpers_wanted;
+	unsigned int helpers_active = 0;
+
+	//Every thread keeps taking the next unprocessed index until all are done
+	void work() {
+		for (int i = next_index++; i < count; i = next_index++) {
+			(*body)(i);
+		}
+	}
+};
+
+/// <summary>
+/// Threads that stay alive between calls of parallel_for and help with the queued jobs. The caller of
+/// parallel_for works on its own job as well and only waits for the workers that joined it, so a job never
+/// waits for a free worker and nested calls cannot deadlock.
+/// </summary>
+class ThreadPool {
+public:
+	~ThreadPool() {
+		{
+			std::lock_guard lock(mutex);
+			stopping = true;
+		}
+		work_available.notify_all();
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+	}
+
+	void run(Job& job) {
+		{
+			std::lock_guard lock(mutex);
+			//Workers are only added when a call wants more than ever before
+			while (threads.size() < job.helpers_wanted) {
+				threads.emplace_back([this]() { worker(); });
+			}
+			jobs.push_back(&job);
+		}
+		work_available.notify_all();
+
+		job.work();
+
+		//All indices are taken, workers that did not join yet must not find the job anymore
+		std::unique_lock lock(mutex);
+		auto queued = std::find(jobs.begin(), jobs.end(), &job);
+		if (queued != jobs.end()) jobs.erase(queued);
+		job_finished.wait(lock, [&]() { return job.helpers_active == 0; });
+	}
+
+private:
+	void worker() {
+		std::unique_lock lock(mutex);
+		while (true) {
+			work_available.wait(lock, [&]() { return stopping || !jobs.empty(); });
+			if (stopping) return;
+
+			Job* job = jobs.front();
+			job->helpers_active++;
+			if (--job->helpers_wanted == 0) jobs.pop_front();
+			lock.unlock();
+			job->work();
+			lock.lock();
+			if (--job->helpers_active == 0) job_finished.notify_all();
+		}
+	}
+
+	std::mutex mutex;
+	std::condition_variable work_available;
+	std::condition_variable job_finished;
+	std::deque<Job*> jobs;
+	std::vector<std::thread> threads;
+	bool stopping = false;
+};
+
+}
+
+void parallel_for(int count, unsigned int n_threads, const std::function<void(int)>& body) {
+	if (n_threads == 0) n_threads = std::max(std::thread::hardware_concurrency(), 1u);
+	n_threads = std::min(n_threads, (unsigned int)std::max(count, 1));
+
+	//A single thread does not need the pool
+	if (n_threads == 1) {
+		for (int i = 0; i < count; i++) {
+			body(i);
+		}
+		return;
+	}
+
+	static ThreadPool pool;
+	Job job{ count, &body };
+	job.helpers_wanted = n_threads - 1;
+	pool.run(job);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <functional>
+
+/// <summary>
+/// Calls body for every index in [0, count) using up to n_threads threads, indices are handed out dynamically.
+/// The calling thread takes part, the others come from a pool that is kept between calls. Calls may be nested.
+/// </summary>
+/// <param name="count">Number of work items</param>
+/// <param name="n_threads">Number of threads to use, 0 uses all hardware threads</param>
+/// <param name="body">Function to run for each work item</param>
+void parallel_for(int count, unsigned int n_threads, const std::function<void(int)>& body);
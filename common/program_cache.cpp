@@ -0,0 +1,237 @@
+#include "program_cache.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <random>
+#include <string>
+#include <system_error>
+#include <utility>
+
+namespace {
+constexpr uint32_t cacheMagic = 0x43475042; // "CGPB"
+
+// Written in front of every binary
+struct CacheHeader {
+    uint32_t magic;
+    uint32_t format;
+    uint64_t key;
+    uint64_t length;
+};
+
+// 64-bit FNV-1a
+void hashBytes(uint64_t& hash, const void* data, size_t size)
+{
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+}
+
+void hashString(uint64_t& hash, GLenum name)
+{
+    const GLubyte* string = glGetString(name);
+    const std::string value = string ? reinterpret_cast<const char*>(string) : "";
+    // Include the terminator so consecutive strings cannot run together
+    hashBytes(hash, value.c_str(), value.size() + 1);
+}
+
+std::optional<std::string> readFile(const std::filesystem::path& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return std::nullopt;
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+std::filesystem::path cacheFile(uint64_t key)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+    return CachedShaderBuilder::cacheDirectory() / name;
+}
+
+// Returns 0 when the file is not a valid binary of key or the driver rejects it
+GLuint loadProgram(uint64_t key)
+{
+    std::ifstream file(cacheFile(key), std::ios::binary);
+    CacheHeader header {};
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        return 0;
+    if (header.magic != cacheMagic || header.key != key || header.length > (1ull << 30))
+        return 0;
+    std::vector<char> binary(header.length);
+    if (!file.read(binary.data(), static_cast<std::streamsize>(binary.size())))
+        return 0;
+
+    const GLuint program = glCreateProgram();
+    glProgramBinary(program, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+void storeProgram(uint64_t key, GLuint program)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    std::vector<char> binary(static_cast<size_t>(length));
+    GLenum format = 0;
+    GLsizei written = 0;
+    glGetProgramBinary(program, length, &written, &format, binary.data());
+    if (written <= 0)
+        return;
+
+    std::error_code error;
+    std::filesystem::create_directories(CachedShaderBuilder::cacheDirectory(), error);
+    if (error)
+        return;
+
+    // Write to a temporary file first so another instance never reads a
+    // partial binary. Its name is unique, instances storing the same program
+    // at once each write their own file and the last rename wins.
+    const std::filesystem::path path = cacheFile(key);
+    std::random_device random;
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), ".%08x%08x.tmp", random(), random());
+    std::filesystem::path temporaryPath = path;
+    temporaryPath += suffix;
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        const CacheHeader header { cacheMagic, format, key, static_cast<uint64_t>(written) };
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(binary.data(), written);
+        file.close();
+        if (!file) {
+            std::filesystem::remove(temporaryPath, error);
+            return;
+        }
+    }
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error)
+        std::filesystem::remove(temporaryPath, error);
+}
+
+// Compiles one stage, throws ShaderLoadingException with the log of the
+// compiler when it fails
+GLuint compileStage(GLuint stage, const std::string& source, const std::filesystem::path& path)
+{
+    const GLuint shader = glCreateShader(stage);
+    const char* sourcePointer = source.c_str();
+    glShaderSource(shader, 1, &sourcePointer, nullptr);
+    glCompileShader(shader);
+
+    GLint compiled = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (compiled != GL_TRUE) {
+        GLint length = 0;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+        std::string log(static_cast<size_t>(std::max(length, 1)), '\0');
+        glGetShaderInfoLog(shader, length, nullptr, log.data());
+        glDeleteShader(shader);
+        throw ShaderLoadingException("Failed to compile " + path.string() + ":\n" + log.c_str());
+    }
+    return shader;
+}
+
+// Links the stages, throws ShaderLoadingException with the log of the linker
+// when it fails. Retrievable asks the driver to keep the binary of the program
+// so glGetProgramBinary can return it.
+GLuint linkProgram(const std::vector<GLuint>& shaders, bool retrievable)
+{
+    const GLuint program = glCreateProgram();
+    for (const GLuint shader : shaders)
+        glAttachShader(program, shader);
+    if (retrievable)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+    for (const GLuint shader : shaders) {
+        glDetachShader(program, shader);
+        glDeleteShader(shader);
+    }
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE) {
+        GLint length = 0;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+        std::string log(static_cast<size_t>(std::max(length, 1)), '\0');
+        glGetProgramInfoLog(program, length, nullptr, log.data());
+        glDeleteProgram(program);
+        throw ShaderLoadingException("Failed to link program:\n" + std::string(log.c_str()));
+    }
+    return program;
+}
+}
+
+CachedShaderBuilder& CachedShaderBuilder::addStage(GLuint shaderStage, std::filesystem::path shaderFile)
+{
+    m_stages.push_back(Stage { shaderStage, std::move(shaderFile), std::nullopt });
+    return *this;
+}
+
+CachedShaderBuilder& CachedShaderBuilder::addStageSource(GLuint shaderStage, std::string source, std::filesystem::path name)
+{
+    m_stages.push_back(Stage { shaderStage, std::move(name), std::move(source) });
+    return *this;
+}
+
+std::filesystem::path CachedShaderBuilder::cacheDirectory()
+{
+    return std::filesystem::temp_directory_path() / "cg_program_cache";
+}
+
+Shader CachedShaderBuilder::build()
+{
+    // Without binary formats the driver cannot load programs, compile as usual
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+    uint64_t key = 0xcbf29ce484222325ull;
+    hashString(key, GL_VENDOR);
+    hashString(key, GL_RENDERER);
+    hashString(key, GL_VERSION);
+    std::vector<std::string> sources;
+    for (const Stage& stage : m_stages) {
+        std::optional<std::string> source = stage.source ? stage.source : readFile(stage.path);
+        if (!source)
+            throw ShaderLoadingException("Could not open " + stage.path.string());
+        const uint64_t size = source->size();
+        hashBytes(key, &stage.type, sizeof(stage.type));
+        hashBytes(key, &size, sizeof(size));
+        hashBytes(key, source->data(), source->size());
+        sources.push_back(std::move(*source));
+    }
+    const bool cacheable = formats > 0;
+
+    if (cacheable) {
+        if (const GLuint program = loadProgram(key))
+            return Shader(program);
+    }
+
+    // Compile the sources that were hashed, so the stored binary always
+    // matches its key even when a file changes in between
+    std::vector<GLuint> shaders;
+    try {
+        for (size_t i = 0; i < m_stages.size(); i++)
+            shaders.push_back(compileStage(m_stages[i].type, sources[i], m_stages[i].path));
+    } catch (const ShaderLoadingException&) {
+        for (const GLuint shader : shaders)
+            glDeleteShader(shader);
+        throw;
+    }
+    const GLuint program = linkProgram(shaders, cacheable);
+
+    if (cacheable)
+        storeProgram(key, program);
+    return Shader(program);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <framework/opengl_includes.h>
+#include <filesystem>
+#include <framework/shader.h>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Drop-in replacement for ShaderBuilder that keeps linked programs on disk.
+// The binary of a program (glGetProgramBinary) is stored under a hash of its
+// stages and sources and of the vendor, renderer and version of the driver,
+// so editing a shader or updating the driver invalidates it. A binary that
+// is missing, truncated or rejected by the driver is compiled from source as
+// ShaderBuilder would, and stored again.
+class CachedShaderBuilder {
+public:
+    CachedShaderBuilder& addStage(GLuint shaderStage, std::filesystem::path shaderFile);
+    // Adds a stage whose source is already in memory, name only identifies
+    // the stage in compile errors
+    CachedShaderBuilder& addStageSource(GLuint shaderStage, std::string source, std::filesystem::path name);
+    Shader build();
+
+    // Directory of the cache, in the temporary directory of the system
+    static std::filesystem::path cacheDirectory();
+
+private:
+    struct Stage {
+        GLuint type;
+        std::filesystem::path path;
+        // Read from path when empty
+        std::optional<std::string> source;
+    };
+    std::vector<Stage> m_stages;
+};